@@ -1,3 +1,6 @@
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE         /* syscall */
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -5,15 +8,66 @@
 #include <string.h>
 #include <err.h>
 #include <time.h>
+#include <ctype.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include "hashchop.h"
+#include "hashchop_internal.h"
+#include "hashchop_pack.h"
+#include "hashchop_filter.h"
+#include "hashchop_delta.h"
+#include "hashchop_store.h"
+#include "hashchop_similar.h"
+#include "hashchop_tune.h"
+#include "hashchop_manifest.h"
+#include "hashchop_batch.h"
+#include "hashchop_router.h"
+
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define HAVE_PERF 1
+#else
+#define HAVE_PERF 0
+#endif
 
-#define CHUNK_SZ 1024
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
 
 static void usage(void) {
-    fprintf(stderr, "Usage: bench [BUFFER_SIZE_IN_KB] [SEED] [MASK_BITS]\n");
+    fprintf(stderr, "Usage: bench [-s SIZE_IN_KB] [-b BITS,...] [-z SINK_SIZE,...]\n"
+        "             [-p PROFILE,...] [-f FILE] [-w WARMUPS] [-n TRIALS]\n"
+        "             [-e ENGINE,...] [-r SEED] [-P] [-j]\n"
+        "       bench BUFFER_SIZE_IN_KB [SEED] [MASK_BITS]\n"
+        "       bench pack [CHUNK_COUNT] [PACK_PATH]\n"
+        "       bench filter [FINGERPRINT_COUNT]\n"
+        "       bench manifest [CHUNK_COUNT]\n"
+        "       bench delta [DATA_SIZE_IN_KB] [MASK_BITS]\n"
+        "       bench similar [PAGE_COUNT] [VERSIONS]\n"
+        "       bench levels [BUFFER_SIZE_IN_KB] [MASK_BITS] [LEVELS]\n"
+        "       bench records [LOG_SIZE_IN_KB] [MASK_BITS]\n"
+        "       bench tune [PAGE_COUNT] [INDEX_ENTRY_BYTES]\n"
+        "       bench stability [DATA_SIZE_IN_KB] [PROFILE]\n"
+        "       bench kernels [BUFFER_SIZE_IN_KB]\n"
+        "       bench batch [OBJECT_COUNT] [AVG_OBJECT_SIZE] [THREADS]\n"
+        "       bench router [DATA_SIZE_IN_KB] [SHARDS]\n");
     exit(0);
 }
 
+/* Report a failed benchmark run and exit with an error status. */
+static void die(const char *msg) {
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
+
 static void mkrandom(unsigned int seed, unsigned char *buf, size_t len) {
     srandom(seed);
     for (size_t i = 0; i < len; i++) buf[i] = random() % 256;
@@ -27,56 +81,1667 @@ static unsigned char *init(size_t sz, unsigned int seed) {
     return buf;
 }
 
-static void go(size_t sz, unsigned char *buf, int bits) {
-    int i = 0;
-#define BUF_SZ (64L * 1024L)
-    unsigned char out[BUF_SZ];
-    size_t rem = BUF_SZ;
+/* Wall-clock time in seconds. */
+static double now(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+        fprintf(stderr, "clock_gettime fail\n");
+        exit(1);
+    }
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Generate the I'th synthetic chunk (16 to 47 bytes) for the pack
+ * benchmark. Returns its length. */
+static size_t gen_chunk(uint64_t i, unsigned char *buf) {
+    uint64_t x = 0x9e3779b97f4a7c15ULL * (i + 1);
+    size_t len = 16 + (x >> 59);
+    for (size_t j = 0; j < len; j++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        buf[j] = x;
+    }
+    return len;
+}
+
+static size_t gcd(size_t a, size_t b) {
+    while (b != 0) { size_t t = a % b; a = b; b = t; }
+    return a;
+}
+
+/* Chunks appended to the pack between syncs. */
+#define PACK_SYNC_EVERY 100000
+
+/* Time appending COUNT unique chunks to a new pack, syncing every
+ * PACK_SYNC_EVERY chunks, then reopening it (mapping the index), and
+ * looking up hits and misses. */
+static void bench_pack(size_t count, const char *path) {
+    unsigned char buf[64];
+    char idx_path[1024], filter_path[1024];
+    hashchop_fp *fps = malloc(count * sizeof(*fps));
+    if (fps == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+    snprintf(filter_path, sizeof(filter_path), "%s.filter", path);
+    unlink(path);
+    unlink(idx_path);
+    unlink(filter_path);
+
+    size_t syncs = 0;
+    double sync_total = 0, sync_max = 0, sync_last = 0;
+    double pre = now();
+    hashchop_pack *p = hashchop_pack_open(path, 0);
+    if (p == NULL) { err(1, "hashchop_pack_open"); }
+    size_t bytes = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t id = 0;
+        size_t len = gen_chunk(i, buf);
+        fps[i] = hashchop_fingerprint(buf, len);
+        bytes += len;
+        if (HASHCHOP_OK != hashchop_pack_put(p, buf, len, &id)) {
+            fprintf(stderr, "hashchop_pack_put fail\n");
+            exit(1);
+        }
+        if ((i + 1) % PACK_SYNC_EVERY == 0) {
+            double spre = now();
+            if (HASHCHOP_OK != hashchop_pack_sync(p)) {
+                fprintf(stderr, "hashchop_pack_sync fail\n");
+                exit(1);
+            }
+            sync_last = now() - spre;
+            sync_total += sync_last;
+            if (sync_last > sync_max) sync_max = sync_last;
+            syncs++;
+        }
+    }
+    if (HASHCHOP_OK != hashchop_pack_close(p)) {
+        fprintf(stderr, "hashchop_pack_close fail\n");
+        exit(1);
+    }
+    double post = now();
+    printf("append: %zu chunks, %zu bytes -- %.3f sec -- %.0f chunks/sec\n",
+        count, bytes, post - pre, count / (post - pre));
+    if (syncs > 0) {
+        printf("sync: %zu syncs, one per %d chunks -- %.3f sec total, "
+            "%.3f msec mean, %.3f msec max, %.3f msec last\n",
+            syncs, PACK_SYNC_EVERY, sync_total, 1000.0 * sync_total / syncs,
+            1000.0 * sync_max, 1000.0 * sync_last);
+    }
+
+    pre = now();
+    p = hashchop_pack_open(path, 0);
+    post = now();
+    if (p == NULL) { err(1, "hashchop_pack_open"); }
+    printf("reopen: %.3f msec\n", 1000.0 * (post - pre));
+
+    /* Visit the chunks in a scattered order, so the index's pages
+     * aren't touched sequentially. */
+    size_t step = 2654435761UL % count;
+    while (step > 1 && gcd(step, count) != 1) step--;
+    if (step == 0) step = 1;
+    size_t found = 0, j = 0;
+    pre = now();
+    for (size_t i = 0; i < count; i++) {
+        uint64_t id = 0;
+        found += hashchop_pack_lookup(p, fps[j], &id);
+        j = (j + step) % count;
+    }
+    post = now();
+    if (found != count) {
+        fprintf(stderr, "lookup fail: %zu of %zu found\n", found, count);
+        exit(1);
+    }
+    printf("lookup hits: %.3f sec -- %.0f lookups/sec\n",
+        post - pre, count / (post - pre));
+
+    found = 0;
+    pre = now();
+    for (size_t i = 0; i < count; i++) {
+        uint64_t id = 0;
+        found += hashchop_pack_lookup(p, ~fps[i] * 0x9e3779b97f4a7c15ULL, &id);
+    }
+    post = now();
+    printf("lookup misses: %.3f sec -- %.0f lookups/sec (%zu false hits)\n",
+        post - pre, count / (post - pre), found);
+
+    hashchop_pack_close(p);
+    unlink(path);
+    unlink(idx_path);
+    unlink(filter_path);
+    free(fps);
+}
+
+/* Time filter checks for COUNT added fingerprints (hits) and COUNT
+ * others (misses), and measure the false positive rate, for several
+ * filter sizes. */
+static void bench_filter(size_t count) {
+    static const int bits[] = { 8, 10, 12, 16 };
+    hashchop_fp *fps = malloc(2 * count * sizeof(*fps));
+    if (fps == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+    for (size_t i = 0; i < 2 * count; i++) {
+        unsigned char buf[64];
+        size_t len = gen_chunk(i, buf);
+        fps[i] = hashchop_fingerprint(buf, len);
+    }
+
+    for (size_t b = 0; b < sizeof(bits) / sizeof(bits[0]); b++) {
+        hashchop_filter *f = hashchop_filter_new(count, bits[b]);
+        if (f == NULL) { fprintf(stderr, "hashchop_filter_new fail\n"); exit(1); }
+        for (size_t i = 0; i < count; i++) hashchop_filter_add(f, fps[i]);
+
+        size_t hits = 0, false_hits = 0;
+        double pre = now();
+        for (size_t i = 0; i < count; i++) hits += hashchop_filter_check(f, fps[i]);
+        double mid = now();
+        for (size_t i = count; i < 2 * count; i++) {
+            false_hits += hashchop_filter_check(f, fps[i]);
+        }
+        double post = now();
+        if (hits != count) { fprintf(stderr, "false negative\n"); exit(1); }
+        printf("filter %2d bits/entry: %.1f ns/hit -- %.1f ns/miss -- "
+            "false positive rate %.4f%% -- %zu KB\n",
+            bits[b], 1e9 * (mid - pre) / count, 1e9 * (post - mid) / count,
+            100.0 * false_hits / count, (count * bits[b] / 8) / 1024);
+        hashchop_filter_free(f);
+    }
+    free(fps);
+}
+
+/* Compare a text chunk list (one "offset length fingerprint" line per
+ * chunk), which has to be parsed before use, with a binary manifest used
+ * in place: time loading each, then finding the chunks holding COUNT
+ * random offsets. */
+static void bench_manifest(size_t count) {
+    uint64_t *offs = malloc(count * sizeof(uint64_t));
+    uint32_t *lens = malloc(count * sizeof(uint32_t));
+    hashchop_fp *fps = malloc(count * sizeof(hashchop_fp));
+    size_t text_sz = count * 48, text_len = 0;
+    char *text = malloc(text_sz);
+    hashchop_manifest_writer *w = hashchop_manifest_writer_new(14);
+    if (offs == NULL || lens == NULL || fps == NULL || text == NULL
+        || w == NULL) {
+        fprintf(stderr, "malloc fail\n");
+        exit(1);
+    }
+    uint64_t total = 0;
+    srandom(1);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t len = 4096 + random() % 61440;
+        unsigned char buf[8];
+        for (int j = 0; j < 8; j++) buf[j] = i >> (8 * j);
+        hashchop_fp fp = hashchop_fingerprint(buf, sizeof(buf));
+        text_len += snprintf(text + text_len, text_sz - text_len,
+            "%llu %u %016llx\n", (unsigned long long)total, len,
+            (unsigned long long)fp);
+        hashchop_manifest_add(w, len, fp);
+        total += len;
+    }
+    size_t bin_len = hashchop_manifest_size(w);
+    unsigned char *bin = malloc(bin_len);
+    hashchop_manifest_encode(w, bin, &bin_len);
+    uint64_t *probes = malloc(count * sizeof(uint64_t));
+    for (size_t i = 0; i < count; i++) {
+        probes[i] = (((uint64_t)random() << 31) ^ random()) % total;
+    }
+
+    /* Text: parse every line, then binary search the offsets. */
+    double pre = now();
+    char *p = text;
+    for (size_t i = 0; i < count; i++) {
+        offs[i] = strtoull(p, &p, 10);
+        lens[i] = strtoul(p, &p, 10);
+        fps[i] = strtoull(p, &p, 16);
+        if (*p++ != '\n') { fprintf(stderr, "parse fail\n"); exit(1); }
+    }
+    double mid = now();
+    size_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t lo = 0, hi = count;
+        while (hi - lo > 1) {
+            size_t m = lo + (hi - lo) / 2;
+            if (offs[m] <= probes[i]) { lo = m; } else { hi = m; }
+        }
+        sum += lo;
+    }
+    double post = now();
+    printf("text:     %zu KB, load %.3f sec, %.1f ns/find\n", text_len / 1024,
+        mid - pre, 1e9 * (post - mid) / count);
+
+    /* Binary: open in place, then find. */
+    pre = now();
+    hashchop_manifest *m = hashchop_manifest_open(bin, bin_len);
+    if (m == NULL) { fprintf(stderr, "hashchop_manifest_open fail\n"); exit(1); }
+    mid = now();
+    size_t bsum = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t ci = 0;
+        hashchop_manifest_find(m, probes[i], &ci, NULL);
+        bsum += ci;
+    }
+    post = now();
+    if (sum != bsum) { fprintf(stderr, "find mismatch\n"); exit(1); }
+    printf("manifest: %zu KB, load %.6f sec, %.1f ns/find\n", bin_len / 1024,
+        mid - pre, 1e9 * (post - mid) / count);
+
+    hashchop_manifest_free(m);
+    hashchop_manifest_writer_free(w);
+    free(offs); free(lens); free(fps); free(text); free(bin); free(probes);
+}
+
+static void write_all(int fd, const void *buf, size_t len) {
+    const unsigned char *p = buf;
+    while (len > 0) {
+        ssize_t wr = write(fd, p, len);
+        if (wr == -1) err(1, "write");
+        p += wr;
+        len -= wr;
+    }
+}
+
+static void read_all(int fd, void *buf, size_t len) {
+    unsigned char *p = buf;
+    while (len > 0) {
+        ssize_t rd = read(fd, p, len);
+        if (rd == -1) err(1, "read");
+        if (rd == 0) { fprintf(stderr, "unexpected EOF\n"); exit(1); }
+        p += rd;
+        len -= rd;
+    }
+}
+
+/* Messages are a 64-bit length, then that many bytes. */
+static void send_msg(int fd, const unsigned char *buf, size_t len) {
+    uint64_t hdr = len;
+    write_all(fd, &hdr, sizeof(hdr));
+    write_all(fd, buf, len);
+}
+
+static unsigned char *recv_msg(int fd, size_t *len) {
+    uint64_t hdr = 0;
+    read_all(fd, &hdr, sizeof(hdr));
+    unsigned char *buf = malloc(hdr ? hdr : 1);
+    if (buf == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+    read_all(fd, buf, hdr);
+    *len = hdr;
+    return buf;
+}
+
+/* The receiving end of a sync, which has OLD: send its signature (unless
+ * doing a FULL copy), get the delta (or the data), rebuild the new
+ * version, check it against EXPECT, and acknowledge it. */
+static void receiver(int fd, int full, int bits, const unsigned char *old,
+        size_t old_len, const unsigned char *expect, size_t expect_len) {
+    unsigned char *msg = NULL, *out = NULL;
+    size_t msg_len = 0, out_len = 0;
+    if (full) {
+        out = recv_msg(fd, &out_len);
+    } else {
+        hashchop_sig *s = hashchop_sig_build(bits, old, old_len);
+        if (s == NULL) { fprintf(stderr, "hashchop_sig_build fail\n"); exit(1); }
+        size_t sig_len = hashchop_sig_size(s);
+        unsigned char *sig_buf = malloc(sig_len);
+        if (sig_buf == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+        hashchop_sig_encode(s, sig_buf, &sig_len);
+        send_msg(fd, sig_buf, sig_len);
+        free(sig_buf);
+        hashchop_sig_free(s);
+
+        msg = recv_msg(fd, &msg_len);
+        if (HASHCHOP_OK != hashchop_delta_target_length(msg, msg_len, &out_len)) {
+            fprintf(stderr, "bad delta\n");
+            exit(1);
+        }
+        out = malloc(out_len ? out_len : 1);
+        if (out == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+        if (HASHCHOP_OK != hashchop_delta_apply(old, old_len, msg, msg_len,
+                out, &out_len)) {
+            fprintf(stderr, "hashchop_delta_apply fail\n");
+            exit(1);
+        }
+    }
+    if (out_len != expect_len || memcmp(out, expect, out_len) != 0) {
+        fprintf(stderr, "sync mismatch\n");
+        exit(1);
+    }
+    write_all(fd, "", 1);
+    free(msg);
+    free(out);
+}
+
+/* The sending end of a sync, which has NEW. Returns the number of bytes
+ * sent in either direction. */
+static size_t sender(int fd, int full, const unsigned char *new,
+        size_t new_len) {
+    size_t total = 0;
+    if (full) {
+        send_msg(fd, new, new_len);
+        total += 8 + new_len;
+    } else {
+        size_t sig_len = 0;
+        unsigned char *sig_buf = recv_msg(fd, &sig_len);
+        hashchop_sig *s = hashchop_sig_decode(sig_buf, sig_len);
+        if (s == NULL) { fprintf(stderr, "hashchop_sig_decode fail\n"); exit(1); }
+        size_t delta_len = hashchop_delta_bound(s, new_len);
+        unsigned char *delta = malloc(delta_len);
+        if (delta == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+        if (HASHCHOP_OK != hashchop_delta_encode(s, new, new_len,
+                delta, &delta_len, NULL)) {
+            fprintf(stderr, "hashchop_delta_encode fail\n");
+            exit(1);
+        }
+        send_msg(fd, delta, delta_len);
+        total += 8 + sig_len + 8 + delta_len;
+        free(delta);
+        free(sig_buf);
+        hashchop_sig_free(s);
+    }
+    char ack = 0;
+    read_all(fd, &ack, 1);
+    return total + 1;
+}
+
+/* Sync from OLD to NEW between two processes over a socket pair, with a
+ * delta or a FULL copy. Returns the elapsed time, and writes the bytes
+ * sent in (*BYTES). */
+static double sync_procs(int full, int bits, const unsigned char *old,
+        size_t old_len, const unsigned char *new, size_t new_len,
+        size_t *bytes) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) err(1, "socketpair");
+    double pre = now();
+    pid_t pid = fork();
+    if (pid == -1) err(1, "fork");
+    if (pid == 0) {
+        close(fds[0]);
+        receiver(fds[1], full, bits, old, old_len, new, new_len);
+        _exit(0);
+    }
+    close(fds[1]);
+    *bytes = sender(fds[0], full, new, new_len);
+    double post = now();
+    close(fds[0]);
+    int status = 0;
+    if (waitpid(pid, &status, 0) == -1) err(1, "waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "receiver failed\n");
+        exit(1);
+    }
+    return post - pre;
+}
+
+/* Make the new version of SZ bytes of OLD for an edit workload, and
+ * write its length in (*NEW_LEN). */
+static unsigned char *edit_workload(int kind, const unsigned char *old,
+        size_t sz, size_t *new_len) {
+    size_t cap = sz + 2 * 1024 * 1024;
+    unsigned char *new = malloc(cap);
+    if (new == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+    size_t o = 0, n = 0;
+    srandom(kind + 1);
+    /* Sixteen evenly spread edits, except for the append and rewrite. */
+    for (int e = 0; e < 16 && kind >= 1 && kind <= 3; e++) {
+        size_t at = (sz / 16) * e + (sz / 64);
+        size_t del = (kind == 1 ? 4096 : kind == 3 ? 1024 : 0);
+        size_t ins = (kind == 1 ? 4096 : kind == 2 ? 100 : 0);
+        memcpy(new + n, old + o, at - o);
+        n += at - o;
+        for (size_t i = 0; i < ins; i++) new[n++] = random();
+        o = at + del;
+    }
+    if (kind == 5) {            /* rewrite the middle 10% */
+        size_t at = sz / 2, len = sz / 10;
+        memcpy(new, old, at);
+        for (size_t i = 0; i < len; i++) new[at + i] = random();
+        n = o = at + len;
+    }
+    memcpy(new + n, old + o, sz - o);
+    n += sz - o;
+    if (kind == 4) {            /* append 1MB */
+        for (size_t i = 0; i < 1024 * 1024; i++) new[n++] = random();
+    }
+    *new_len = n;
+    return new;
+}
+
+/* Compare the bytes sent and time taken to sync edited versions of SZ
+ * bytes of data between two processes with deltas vs. full copies. */
+static void bench_delta(size_t sz, int bits) {
+    static const char *names[] = { "identical", "16 4KB writes",
+        "16 100B inserts", "16 1KB deletes", "1MB append",
+        "10% rewritten" };
+    unsigned char *old = init(sz, 12345);
+    if (bits < HASHCHOP_MIN_BITS || bits > HASHCHOP_MAX_BITS) {
+        die("bad bits argument");
+    }
+
+    for (int kind = 0; kind < 6; kind++) {
+        size_t new_len = 0, full_bytes = 0, delta_bytes = 0;
+        unsigned char *new = edit_workload(kind, old, sz, &new_len);
+        double full_t = sync_procs(1, bits, old, sz, new, new_len, &full_bytes);
+        double delta_t = sync_procs(0, bits, old, sz, new, new_len, &delta_bytes);
+        printf("%-16s full: %zu bytes, %.1f msec -- "
+            "delta: %zu bytes (%.2f%%), %.1f msec\n",
+            names[kind], full_bytes, 1000 * full_t, delta_bytes,
+            100.0 * delta_bytes / full_bytes, 1000 * delta_t);
+        free(new);
+    }
+    free(old);
+}
+
+#define PAGE_SZ 8192
+
+/* Make VERSIONS successive backups of a database of PAGES pages, one
+ * after another: each version rewrites the header (an LSN) and one
+ * 64-byte row of about 1/10 of the pages. Returns the data, and writes
+ * its length in (*LEN). */
+static unsigned char *page_backups(size_t pages, int versions, size_t *len) {
+    size_t db_sz = pages * PAGE_SZ;
+    unsigned char *buf = malloc(db_sz * versions);
+    if (buf == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+    mkrandom(1, buf, db_sz);
+    srandom(2);
+    for (int v = 1; v < versions; v++) {
+        unsigned char *db = buf + v * db_sz;
+        memcpy(db, db - db_sz, db_sz);
+        for (size_t i = 0; i < pages / 10; i++) {
+            unsigned char *page = db + (random() % pages) * PAGE_SZ;
+            uint64_t lsn = ((uint64_t)v << 32) | i;
+            memcpy(page, &lsn, sizeof(lsn));
+            unsigned char *row = page + 64 + 64 * (random() % (PAGE_SZ / 64 - 1));
+            for (int j = 0; j < 64; j++) row[j] = random();
+        }
+    }
+    *len = db_sz * versions;
+    return buf;
+}
+
+/* Store LEN bytes of DATA chopped into 2^13-byte chunks, deduplicating
+ * exactly, and (if SIMILAR) storing new chunks as deltas against similar
+ * stored ones when that saves at least half their size. Returns the
+ * bytes stored, and writes the number of delta chunks in (*DELTAS). */
+static size_t ingest(const unsigned char *data, size_t len, int similar,
+        size_t *deltas) {
+    hashchop *hc = hashchop_new(13);
+    hashchop_store *s = hashchop_store_new(0);
+    hashchop_simindex *x = hashchop_simindex_new(0);
+    unsigned char *delta = malloc(hashchop_xdelta_bound(hashchop_max_chunk(hc)));
+    if (hc == NULL || s == NULL || x == NULL || delta == NULL) {
+        fprintf(stderr, "alloc fail\n");
+        exit(1);
+    }
+    size_t pos = 0, stored = 0;
+    *deltas = 0;
+    while (pos < len) {
+        size_t sz = hashchop_seam(hc, data + pos, len - pos);
+        const unsigned char *chunk = data + pos;
+        hashchop_id id = 0;
+        pos += sz;
+        if (hashchop_store_find(s, chunk, sz, &id)) continue;
+
+        hashchop_sketch sk;
+        if (similar) {
+            uint32_t base_id = 0;
+            hashchop_sketch_chunk(chunk, sz, &sk);
+            if (hashchop_simindex_find(x, &sk, &base_id) > 0) {
+                size_t base_len = 0, delta_len = sz + 64;
+                const unsigned char *base = hashchop_store_get(s, base_id,
+                    &base_len);
+                if (HASHCHOP_OK == hashchop_xdelta_encode(base, base_len,
+                        chunk, sz, delta, &delta_len)
+                    && delta_len <= sz / 2) {
+                    stored += delta_len;
+                    (*deltas)++;
+                    continue;
+                }
+            }
+        }
+        if (HASHCHOP_OK != hashchop_store_put(s, chunk, sz, &id)) {
+            fprintf(stderr, "hashchop_store_put fail\n");
+            exit(1);
+        }
+        stored += sz;
+        if (similar && HASHCHOP_OK != hashchop_simindex_add(x, &sk, id)) {
+            fprintf(stderr, "hashchop_simindex_add fail\n");
+            exit(1);
+        }
+    }
+    free(delta);
+    hashchop_simindex_free(x);
+    hashchop_store_free(s);
+    hashchop_free(hc);
+    return stored;
+}
+
+/* Compare storage and ingest throughput for exact dedup alone vs. with
+ * delta compression of similar chunks, on database page backups. */
+static void bench_similar(size_t pages, int versions) {
+    size_t len = 0, deltas = 0;
+    unsigned char *data = page_backups(pages, versions, &len);
+    double mb = len / (1024.0 * 1024.0);
+
+    double pre = now();
+    size_t exact = ingest(data, len, 0, &deltas);
+    double mid = now();
+    size_t sim = ingest(data, len, 1, &deltas);
+    double post = now();
+    printf("input: %zu bytes (%d versions of %zu pages)\n",
+        len, versions, pages);
+    printf("exact dedup: %zu bytes stored (%.2fx) -- %.1f MB/sec\n",
+        exact, (double)len / exact, mb / (mid - pre));
+    printf("exact + similar: %zu bytes stored (%.2fx), %zu delta chunks "
+        "-- %.1f MB/sec\n", sim, (double)len / sim, deltas,
+        mb / (post - mid));
+    free(data);
+}
+
+/* Compare finding the boundaries for LEVELS chunk sizes in one
+ * multi-level pass over SZ bytes vs. one pass per size. */
+static void bench_levels(size_t sz, int bits, int levels) {
+    unsigned char *buf = init(sz, 12345);
+    size_t counts[HASHCHOP_MAX_LEVELS];
     hashchop *hc = hashchop_new(bits);
-    hashchop_res res = HASHCHOP_ERROR_UNDERFLOW;
-    if (hc == NULL) { fprintf(stderr, "bad bits argument\n"); exit(1); }
-
-    for (i = 0; i < sz / CHUNK_SZ; i++) {
-        do {
-            res = hashchop_poll(hc, out, &rem);
-            rem = BUF_SZ;
-            if (res == HASHCHOP_OK) {
-                ;               /* outgoing chunks not used */
-            } else {
-                assert(HASHCHOP_ERROR_UNDERFLOW == res);
+    if (hc == NULL || HASHCHOP_OK != hashchop_set_levels(hc, levels)) {
+        die("bad bits or levels argument");
+    }
+    memset(counts, 0, sizeof(counts));
+
+    double pre = now();
+    for (size_t pos = 0; pos < sz; ) {
+        uint8_t level = 0;
+        pos += hashchop_seam_level(hc, buf + pos, sz - pos, &level);
+        for (int l = 0; l <= level; l++) counts[l]++;
+    }
+    double mid = now();
+    for (int l = 0; l < levels; l++) {
+        hashchop *lhc = hashchop_new(bits + l);
+        if (lhc == NULL) die("bad bits argument");
+        for (size_t pos = 0; pos < sz; ) {
+            pos += hashchop_seam(lhc, buf + pos, sz - pos);
+        }
+        hashchop_free(lhc);
+    }
+    double post = now();
+
+    for (int l = 0; l < levels; l++) {
+        printf("level %d: %zu chunks, %zu bytes avg\n", l, counts[l],
+            sz / counts[l]);
+    }
+    printf("one multi-level pass: %.3f sec -- %d single-level passes: "
+        "%.3f sec\n", mid - pre, levels, post - mid);
+    hashchop_free(hc);
+    free(buf);
+}
+
+/* Time finding every seam in SZ bytes of random data with each bits
+ * value's scan kernel vs. the generic scan. Bits values without a
+ * kernel use the generic scan both ways. */
+static void bench_kernels(size_t sz) {
+    unsigned char *buf = init(sz, 12345);
+    for (int bits = HASHCHOP_MIN_BITS; bits <= 26; bits++) {
+        hashchop *hc = hashchop_new(bits);
+        if (hc == NULL) die("bad bits argument");
+        if (4 * hashchop_max_chunk(hc) > sz) {
+            hashchop_free(hc);
+            break;
+        }
+        double best[2] = { 0, 0 };
+        size_t chunks = 0;
+        for (int trial = 0; trial < 6; trial++) {
+            int generic = trial & 1;
+            hashchop_set_generic_scan(hc, generic);
+            chunks = 0;
+            double pre = now();
+            for (size_t pos = 0; pos < sz; chunks++) {
+                pos += hashchop_seam(hc, buf + pos, sz - pos);
+            }
+            double t = now() - pre;
+            if (best[generic] == 0 || t < best[generic]) best[generic] = t;
+        }
+        double mb = sz / (1024.0 * 1024.0);
+        printf("%2d bits: kernel %7.1f MB/sec, generic %7.1f MB/sec "
+            "-- %.2fx (%zu chunks)\n", bits, mb / best[0], mb / best[1],
+            best[1] / best[0], chunks);
+        hashchop_free(hc);
+    }
+    free(buf);
+}
+
+/* Chop COUNT OBJECTS in MODE (see bench_batch), and return the number
+ * of chunks. */
+static size_t batch_once(int mode, hashchop *hc,
+        const hashchop_object *objects, size_t count, int threads,
+        hashchop_batch_result *results, size_t *ends, size_t max_ends,
+        unsigned char *out) {
+    size_t chunks = 0, max = hashchop_max_chunk(hc);
+    if (mode == 0) {
+        for (size_t i = 0; i < count; i++) {
+            const hashchop_object *o = &objects[i];
+            size_t len = 0;
+            hashchop_reset(hc);
+            for (size_t off = 0; off < o->length; off += max) {
+                size_t step = (o->length - off < max ? o->length - off : max);
+                hashchop_sink(hc, o->data + off, step);
+                len = max;
+                while (HASHCHOP_OK == hashchop_poll(hc, out, &len)) {
+                    chunks++;
+                    len = max;
+                }
+            }
+            len = max;
+            hashchop_finish(hc, out, &len);
+            chunks += (len > 0);
+        }
+    } else if (mode == 1) {
+        for (size_t i = 0; i < count; i++) {
+            chunks += hashchop_seams(hc, objects[i].data, objects[i].length,
+                ends, max_ends);
+        }
+    } else {
+        hashchop_res res = hashchop_chop_batch(hc, objects, count, results,
+            ends, max_ends, mode == 2 ? 1 : threads);
+        if (res != HASHCHOP_OK) { fprintf(stderr, "batch fail\n"); exit(1); }
+        chunks = results[count - 1].first + results[count - 1].count;
+    }
+    return chunks;
+}
+
+/* Time chopping COUNT objects of about AVG bytes each: one at a time
+ * through a reset chopper (sink, poll, finish), one at a time in place
+ * with hashchop_seams, and with hashchop_chop_batch in one thread and in
+ * THREADS. */
+static void bench_batch(size_t count, size_t avg, int threads) {
+    static const char *names[] = {
+        "sink/poll/finish", "seams", "batch", "batch, threaded",
+    };
+    hashchop_object *objects = malloc(count * sizeof(*objects));
+    size_t *lens = malloc(count * sizeof(size_t)), total = 0;
+    if (objects == NULL || lens == NULL) die("malloc fail");
+    srandom(1);
+    for (size_t i = 0; i < count; i++) {
+        lens[i] = avg / 2 + random() % (avg + 1);
+        total += lens[i];
+    }
+    unsigned char *buf = init(total, 12345);
+    for (size_t i = 0, pos = 0; i < count; i++) {
+        objects[i].data = buf + pos;
+        objects[i].length = lens[i];
+        pos += lens[i];
+    }
+    hashchop *hc = hashchop_new(12);
+    hashchop_batch_result *results = malloc(count * sizeof(*results));
+    size_t max_ends = hashchop_batch_max_ends(hc, objects, count);
+    size_t *ends = malloc(max_ends * sizeof(size_t));
+    unsigned char *out = malloc(hashchop_max_chunk(hc));
+    if (results == NULL || ends == NULL || out == NULL) die("malloc fail");
+    double mb = total / (1024.0 * 1024.0);
+
+    for (int mode = 0; mode < 4; mode++) {
+        double best = 0;
+        size_t chunks = 0;
+        for (int trial = 0; trial < 3; trial++) {
+            double pre = now();
+            chunks = batch_once(mode, hc, objects, count, threads, results,
+                ends, max_ends, out);
+            double t = now() - pre;
+            if (best == 0 || t < best) best = t;
+        }
+        printf("%-17s %8.1f MB/sec -- %6.2f M objects/sec (%zu chunks)\n",
+            names[mode], mb / best, count / best / 1e6, chunks);
+    }
+    hashchop_free(hc);
+    free(objects); free(lens); free(buf); free(results); free(ends);
+    free(out);
+}
+
+/* Write all of IOV's CT buffers to FD, resuming after partial writes. */
+static void writev_all(int fd, struct iovec *iov, int ct) {
+    while (ct > 0) {
+        ssize_t wr = writev(fd, iov, ct);
+        if (wr == -1) err(1, "writev");
+        while (ct > 0 && (size_t)wr >= iov->iov_len) {
+            wr -= iov->iov_len;
+            iov++;
+            ct--;
+        }
+        if (ct > 0) {
+            iov->iov_base = (char *)iov->iov_base + wr;
+            iov->iov_len -= wr;
+        }
+    }
+}
+
+/* A stand-in storage shard: read chunks from IN until EOF, each a
+ * fingerprint and a length (8 bytes each) then the data, check each
+ * one's fingerprint, and write the chunk and byte totals to OUT. */
+static void shard_proc(int in, int out) {
+    uint64_t totals[2] = { 0, 0 }, hdr[2];
+    size_t limit = 1024 * 1024;
+    unsigned char *buf = malloc(limit);
+    for (;;) {
+        ssize_t rd = read(in, hdr, sizeof(hdr));
+        if (rd == -1) err(1, "read");
+        if (rd == 0) break;
+        if (rd != sizeof(hdr)) read_all(in, (char *)hdr + rd, sizeof(hdr) - rd);
+        if (hdr[1] > limit) { fprintf(stderr, "chunk too big\n"); exit(1); }
+        read_all(in, buf, hdr[1]);
+        if (hashchop_fingerprint(buf, hdr[1]) != hdr[0]) {
+            fprintf(stderr, "fingerprint mismatch\n");
+            exit(1);
+        }
+        totals[0]++;
+        totals[1] += hdr[1];
+    }
+    write_all(out, totals, sizeof(totals));
+    free(buf);
+}
+
+/* Chop SZ bytes of random data, route the chunks to SHARDS stand-in
+ * shard processes by fingerprint, and send each shard its chunks over a
+ * pipe (gathered from the data with writev, not copied). Reports the
+ * routing rate, the end-to-end rate, the balance, and how many chunks
+ * would move if another shard were added. */
+static void bench_router(size_t sz, uint32_t shards) {
+    unsigned char *buf = init(sz, 12345);
+    hashchop *hc = hashchop_new(12);
+    size_t *ends = malloc((sz / 1024 + 1) * sizeof(size_t));
+    size_t n = hashchop_seams(hc, buf, sz, ends, sz / 1024 + 1);
+    size_t *offs = malloc(n * sizeof(size_t));
+    size_t *lens = malloc(n * sizeof(size_t));
+    hashchop_fp *fps = malloc(n * sizeof(hashchop_fp));
+    for (size_t i = 0, pos = 0; i < n; i++) {
+        offs[i] = pos;
+        lens[i] = ends[i] - pos;
+        fps[i] = hashchop_fingerprint(buf + pos, lens[i]);
+        pos = ends[i];
+    }
+    hashchop_router *r = hashchop_router_new(shards);
+    if (r == NULL) die("hashchop_router_new fail");
+
+    double pre = now();
+    if (HASHCHOP_OK != hashchop_router_route(r, fps, lens, n)) {
+        fprintf(stderr, "hashchop_router_route fail\n");
+        exit(1);
+    }
+    double route_t = now() - pre;
+
+    int *to = malloc(shards * sizeof(int)), *from = malloc(shards * sizeof(int));
+    pid_t *pids = malloc(shards * sizeof(pid_t));
+    pre = now();
+    for (uint32_t s = 0; s < shards; s++) {
+        int down[2], up[2];
+        if (pipe(down) == -1 || pipe(up) == -1) err(1, "pipe");
+        pids[s] = fork();
+        if (pids[s] == -1) err(1, "fork");
+        if (pids[s] == 0) {
+            for (uint32_t o = 0; o < s; o++) { close(to[o]); close(from[o]); }
+            close(down[1]);
+            close(up[0]);
+            shard_proc(down[0], up[1]);
+            _exit(0);
+        }
+        close(down[0]);
+        close(up[1]);
+        to[s] = down[1];
+        from[s] = up[0];
+    }
+
+    /* Two iovecs per chunk: its header, then its data in place. */
+    enum { BATCH = IOV_MAX / 2 };
+    struct iovec iov[2 * BATCH];
+    uint64_t (*hdrs)[2] = malloc(BATCH * sizeof(*hdrs));
+    for (uint32_t s = 0; s < shards; s++) {
+        const size_t *idx = NULL;
+        size_t ct = hashchop_router_batch(r, s, &idx);
+        for (size_t j = 0; j < ct; j += BATCH) {
+            size_t k = 0;
+            for (; k < BATCH && j + k < ct; k++) {
+                size_t i = idx[j + k];
+                hdrs[k][0] = fps[i];
+                hdrs[k][1] = lens[i];
+                iov[2 * k].iov_base = hdrs[k];
+                iov[2 * k].iov_len = sizeof(hdrs[k]);
+                iov[2 * k + 1].iov_base = buf + offs[i];
+                iov[2 * k + 1].iov_len = lens[i];
+            }
+            writev_all(to[s], iov, 2 * k);
+        }
+        close(to[s]);
+    }
+
+    uint64_t min_bytes = UINT64_MAX, max_bytes = 0;
+    for (uint32_t s = 0; s < shards; s++) {
+        uint64_t totals[2];
+        hashchop_router_stats st;
+        read_all(from[s], totals, sizeof(totals));
+        hashchop_router_get_stats(r, s, &st);
+        if (totals[0] != st.chunks || totals[1] != st.bytes) {
+            fprintf(stderr, "shard %u totals differ\n", s);
+            exit(1);
+        }
+        if (st.bytes < min_bytes) min_bytes = st.bytes;
+        if (st.bytes > max_bytes) max_bytes = st.bytes;
+        close(from[s]);
+        int status = 0;
+        if (waitpid(pids[s], &status, 0) == -1) err(1, "waitpid");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "shard %u failed\n", s);
+            exit(1);
+        }
+    }
+    double send_t = now() - pre;
+
+    size_t moved = 0;
+    for (size_t i = 0; i < n; i++) {
+        moved += (hashchop_jump_hash(fps[i], shards)
+            != hashchop_jump_hash(fps[i], shards + 1));
+    }
+
+    double mb = sz / (1024.0 * 1024.0);
+    printf("%zu chunks over %u shards\n", n, shards);
+    printf("routing: %.1f M chunks/sec (%.0f MB/sec of chunks)\n",
+        n / route_t / 1e6, mb / route_t);
+    printf("end to end, over pipes: %.1f MB/sec\n", mb / send_t);
+    printf("balance: %.3f (max / mean bytes) -- %.1f to %.1f MB per shard\n",
+        hashchop_router_imbalance(r), min_bytes / (1024.0 * 1024.0),
+        max_bytes / (1024.0 * 1024.0));
+    printf("adding a shard moves %.2f%% of chunks (ideal %.2f%%)\n",
+        100.0 * moved / n, 100.0 / (shards + 1));
+
+    hashchop_router_free(r);
+    hashchop_free(hc);
+    free(buf); free(ends); free(offs); free(lens); free(fps);
+    free(to); free(from); free(pids); free(hdrs);
+}
+
+/* Write log lines into BUF until it has about SZ bytes, and return the
+ * length written. Every 2000th line of the old log, a random line is
+ * rewritten, and one or two new lines are inserted; if OLD is NULL,
+ * all lines are new. */
+static size_t gen_log(unsigned char *buf, size_t sz, const unsigned char *old,
+        size_t old_len) {
+    size_t len = 0, o = 0;
+    unsigned int line = 0;
+    while (len + 256 < sz) {
+        if (old && o < old_len) {
+            const unsigned char *nl = memchr(old + o, '\n', old_len - o);
+            size_t ll = nl ? nl - (old + o) + 1 : old_len - o;
+            if (++line % 2000 != 0) {
+                memcpy(buf + len, old + o, ll);
+                len += ll;
+                o += ll;
+                continue;
+            }
+            o += ll;            /* rewrite it, and maybe insert another */
+            if (random() % 2) continue;
+        } else if (old) {
+            break;
+        }
+        len += sprintf((char *)buf + len, "2026-10-19T%02ld:%02ld:%02ld.%03ld "
+            "host%02ld api[%ld]: GET /v1/items/%ld status=%d bytes=%ld "
+            "latency=%ldus\n", random() % 24, random() % 60, random() % 60,
+            random() % 1000, random() % 16, 1000 + random() % 9000,
+            random() % 100000, random() % 8 ? 200 : 404, random() % 65536,
+            random() % 100000);
+    }
+    return len;
+}
+
+/* Store LEN bytes of DATA with HC's chunking, deduplicating exactly into
+ * S. Returns the bytes newly stored. If REUSED is non-NULL, the number
+ * of chunks is written in (*CHUNKS), and the number already stored in
+ * (*REUSED). */
+static size_t store_chunks(hashchop *hc, hashchop_store *s,
+        const unsigned char *data, size_t len, size_t *chunks,
+        size_t *reused) {
+    size_t stored = 0, n = 0, found = 0;
+    for (size_t pos = 0; pos < len; ) {
+        size_t sz = hashchop_seam(hc, data + pos, len - pos);
+        hashchop_id id = 0;
+        if (!hashchop_store_find(s, data + pos, sz, &id)) {
+            if (HASHCHOP_OK != hashchop_store_put(s, data + pos, sz, &id)) {
+                fprintf(stderr, "hashchop_store_put fail\n");
+                exit(1);
+            }
+            stored += sz;
+        } else {
+            found++;
+        }
+        pos += sz;
+        n++;
+    }
+    if (reused) {
+        *chunks = n;
+        *reused = found;
+    }
+    return stored;
+}
+
+/* Compare chunking two versions of an SZ-byte log, a few lines apart,
+ * with and without aligning seams to the ends of lines. */
+static void bench_records(size_t sz, int bits) {
+    unsigned char *old = malloc(sz), *new = malloc(sz + sz / 8);
+    if (old == NULL || new == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+    srandom(1);
+    size_t old_len = gen_log(old, sz, NULL, 0);
+    size_t new_len = gen_log(new, sz + sz / 8, old, old_len);
+    double mb = (old_len + new_len) / (1024.0 * 1024.0);
+    printf("input: %zu + %zu bytes of log lines\n", old_len, new_len);
+
+    for (int aligned = 0; aligned < 2; aligned++) {
+        hashchop *hc = hashchop_new(bits);
+        hashchop_store *s = hashchop_store_new(0);
+        if (hc == NULL) die("bad bits argument");
+        if (s == NULL) { fprintf(stderr, "alloc fail\n"); exit(1); }
+        if (aligned) hashchop_set_delimiter(hc, '\n');
+        double pre = now();
+        size_t stored = store_chunks(hc, s, old, old_len, NULL, NULL);
+        size_t first = stored;
+        stored += store_chunks(hc, s, new, new_len, NULL, NULL);
+        double post = now();
+        printf("%s: %zu bytes stored, %zu for the new version (%.2fx) "
+            "-- %.1f MB/sec\n", aligned ? "line-aligned" : "unaligned",
+            stored, stored - first, (double)(old_len + new_len) / stored,
+            mb / (post - pre));
+        hashchop_store_free(s);
+        hashchop_free(hc);
+    }
+    free(old); free(new);
+}
+
+/* Tune the chunk size for database page backups, with ENTRY_BYTES per
+ * index entry, and compare the tuner's estimates with the real cost of
+ * storing them at each size. */
+static void bench_tune(size_t pages, double entry_bytes) {
+    size_t len = 0;
+    unsigned char *data = page_backups(pages, 8, &len);
+    hashchop_tuner *t = hashchop_tuner_new(HASHCHOP_MIN_BITS, 8);
+    if (t == NULL) { fprintf(stderr, "alloc fail\n"); exit(1); }
+    double pre = now();
+    if (HASHCHOP_OK != hashchop_tuner_add(t, data, len)) {
+        fprintf(stderr, "hashchop_tuner_add fail\n");
+        exit(1);
+    }
+    double post = now();
+    printf("input: %zu bytes -- tuned in %.3f sec (%.1f MB/sec)\n", len,
+        post - pre, len / (1024.0 * 1024.0) / (post - pre));
+
+    for (uint8_t i = 0; i < hashchop_tuner_levels(t); i++) {
+        hashchop_tune_level st;
+        hashchop_tuner_level(t, i, &st);
+        hashchop *hc = hashchop_new(st.bits);
+        hashchop_store *s = hashchop_store_new(0);
+        if (hc == NULL || s == NULL) { fprintf(stderr, "alloc fail\n"); exit(1); }
+        size_t stored = store_chunks(hc, s, data, len, NULL, NULL);
+        size_t entries = hashchop_store_count(s);
+        printf("%2u bits: est. %zu entries, %.1f%% dup, cost %.0f -- "
+            "real %zu entries, %.1f%% dup, cost %.0f\n", st.bits,
+            st.unique_chunks, 100.0 * st.dup_bytes / st.bytes,
+            hashchop_tuner_cost(t, i, entry_bytes), entries,
+            100.0 * (len - stored) / len, stored + entry_bytes * entries);
+        hashchop_store_free(s);
+        hashchop_free(hc);
+    }
+    printf("recommended: %u bits, at %.0f bytes per index entry\n",
+        hashchop_tuner_recommend(t, entry_bytes), entry_bytes);
+    hashchop_tuner_free(t);
+    free(data);
+}
+
+/* Data profiles for the chopping benchmark. */
+enum profile { PROF_RANDOM, PROF_ZEROS, PROF_TEXT, PROF_COMPRESSIBLE,
+               PROF_FILE, PROFILES };
+/* Engines for -e. */
+static const hashchop_engine *engines[] = {
+    &hashchop_engine_rsync, &hashchop_engine_rabin, &hashchop_engine_buzhash,
+};
+#define ENGINES (int)(sizeof(engines) / sizeof(engines[0]))
+
+static const char *profile_names[PROFILES] = {
+    "random", "zeros", "text", "compressible", "file",
+};
+
+/* Read the file at PATH, and write its length in (*LEN). */
+static unsigned char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) err(1, "%s", path);
+    if (fseek(f, 0, SEEK_END) == -1) err(1, "fseek");
+    long sz = ftell(f);
+    if (sz <= 0) { fprintf(stderr, "%s: empty or unseekable\n", path); exit(1); }
+    rewind(f);
+    unsigned char *buf = malloc(sz);
+    if (buf == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+    if (fread(buf, 1, sz, f) != (size_t)sz) err(1, "fread");
+    fclose(f);
+    *len = sz;
+    return buf;
+}
+
+/* Generate about SZ bytes of data for PROFILE (or read PATH, for the
+ * file profile), and write its length in (*LEN). Compressible data is
+ * runs of 1 to 16 bytes from a 16-byte alphabet, which gzip shrinks to
+ * about a third. */
+static unsigned char *gen_profile(int profile, size_t sz, unsigned int seed,
+        const char *path, size_t *len) {
+    if (profile == PROF_FILE) return read_file(path, len);
+    unsigned char *buf = malloc(sz);
+    if (buf == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+    *len = sz;
+    srandom(seed);
+    switch (profile) {
+    case PROF_RANDOM:
+        mkrandom(seed, buf, sz);
+        break;
+    case PROF_ZEROS:
+        memset(buf, 0, sz);
+        break;
+    case PROF_TEXT:
+        *len = gen_log(buf, sz, NULL, 0);
+        break;
+    case PROF_COMPRESSIBLE:
+        for (size_t i = 0; i < sz; ) {
+            long r = random();
+            size_t run = 1 + (r & 15);
+            if (run > sz - i) run = sz - i;
+            memset(buf + i, 'a' + ((r >> 4) & 15), run);
+            i += run;
+        }
+        break;
+    }
+    return buf;
+}
+
+static uint64_t tsc(void) {
+#if HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/* Chunk size statistics. */
+typedef struct {
+    size_t chunks;
+    double sum, sum_sq;
+    size_t min, max;
+} chunk_sizes;
+
+static void add_chunk(chunk_sizes *cs, size_t sz) {
+    if (cs->chunks == 0 || sz < cs->min) cs->min = sz;
+    if (sz > cs->max) cs->max = sz;
+    cs->chunks++;
+    cs->sum += sz;
+    cs->sum_sq += (double)sz * sz;
+}
+
+/* Chop LEN bytes of DATA with HC, sinking SINK_SZ bytes at a time and
+ * polling after each sink until UNDERFLOW, then finishing. OUT has room
+ * for the largest chunk. If CS is non-NULL, the chunk sizes are added
+ * to it. Returns the time taken, in seconds, and writes the TSC cycles
+ * taken in (*CYCLES). */
+static double chop_once(hashchop *hc, const unsigned char *data, size_t len,
+        size_t sink_sz, unsigned char *out, chunk_sizes *cs,
+        uint64_t *cycles) {
+    size_t max = hashchop_max_chunk(hc);
+    double pre = now();
+    uint64_t c_pre = tsc();
+    for (size_t pos = 0; pos < len; ) {
+        size_t sz = (len - pos < sink_sz ? len - pos : sink_sz);
+        if (HASHCHOP_OK != hashchop_sink(hc, data + pos, sz)) {
+            fprintf(stderr, "hashchop_sink fail\n");
+            exit(1);
+        }
+        pos += sz;
+        size_t rem = max;
+        while (HASHCHOP_OK == hashchop_poll(hc, out, &rem)) {
+            if (cs) add_chunk(cs, rem);
+            rem = max;
+        }
+    }
+    size_t rem = max;
+    if (HASHCHOP_OK != hashchop_finish(hc, out, &rem)) {
+        fprintf(stderr, "hashchop_finish fail\n");
+        exit(1);
+    }
+    if (cs && rem > 0) add_chunk(cs, rem);
+    *cycles = tsc() - c_pre;
+    return now() - pre;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile P of N sorted values. */
+static double percentile(const double *v, int n, double p) {
+    int i = (int)(p / 100.0 * n + 0.5) - 1;
+    if (i < 0) i = 0;
+    if (i >= n) i = n - 1;
+    return v[i];
+}
+
+/* Hardware counters, read as a group around a benchmark phase. */
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES, PERF_BRANCH_MISSES,
+       PERF_COUNTERS };
+
+typedef struct {
+    int fd;                     /* group leader, or -1 if unavailable */
+    uint64_t v[PERF_COUNTERS];
+} perf_group;
+
+/* Open the counters for this process, in user mode only (which most
+ * perf_event_paranoid settings allow). Returns 0 if perf events aren't
+ * supported or permitted. */
+static int perf_open(perf_group *g) {
+    g->fd = -1;
+#if HAVE_PERF
+    static const uint64_t configs[PERF_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES,
+    };
+    for (int i = 0; i < PERF_COUNTERS; i++) {
+        struct perf_event_attr pe;
+        memset(&pe, 0, sizeof(pe));
+        pe.type = PERF_TYPE_HARDWARE;
+        pe.size = sizeof(pe);
+        pe.config = configs[i];
+        pe.disabled = (i == 0);
+        pe.exclude_kernel = 1;
+        pe.exclude_hv = 1;
+        pe.read_format = PERF_FORMAT_GROUP;
+        int fd = syscall(SYS_perf_event_open, &pe, 0, -1, g->fd, 0);
+        if (fd == -1) {
+            if (g->fd != -1) close(g->fd);  /* closes the whole group */
+            g->fd = -1;
+            return 0;
+        }
+        if (i == 0) g->fd = fd;
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+static void perf_start(perf_group *g) {
+#if HAVE_PERF
+    ioctl(g->fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(g->fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+/* Stop the counters, and read them into G->V. Returns 0 on error. */
+static int perf_stop(perf_group *g) {
+#if HAVE_PERF
+    uint64_t buf[1 + PERF_COUNTERS];
+    ioctl(g->fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    if (read(g->fd, buf, sizeof(buf)) != sizeof(buf)) return 0;
+    memcpy(g->v, buf + 1, sizeof(g->v));    /* after the count */
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* Chopping benchmark configuration. */
+typedef struct {
+    size_t sz;
+    unsigned int seed;
+    int bits[32], bits_ct;
+    size_t sinks[32];
+    int sinks_ct;
+    int profiles[PROFILES], profiles_ct;
+    const hashchop_engine *engines[ENGINES];
+    int engines_ct;
+    const char *path;
+    int warmups, trials;
+    int json;
+    perf_group *perf;           /* or NULL */
+} chop_config;
+
+/* Run the trials for one profile, engine, bits and sink size, and print
+ * the results (as a JSON object, after SEP, if JSON is set). */
+static void chop_run(const chop_config *c, const char *profile,
+        const unsigned char *data, size_t len, const hashchop_engine *engine,
+        int bits, size_t sink_sz, const char *sep) {
+    hashchop *hc = hashchop_new_engine(bits, engine);
+    if (hc == NULL) die("bad bits argument");
+    unsigned char *out = malloc(hashchop_max_chunk(hc));
+    double *mbs = malloc(c->trials * sizeof(double));
+    double *cpb = malloc(c->trials * sizeof(double));
+    if (out == NULL || mbs == NULL || cpb == NULL) {
+        fprintf(stderr, "malloc fail\n");
+        exit(1);
+    }
+    double mb = len / (1024.0 * 1024.0);
+    uint64_t cycles = 0;
+    chunk_sizes cs;
+    hashchop_stats st;
+    memset(&cs, 0, sizeof(cs));
+
+    /* Count chunks (and forced cuts) in the first warmup, or in an extra
+     * run, so the timed runs don't pay for it. */
+    hashchop_set_stats(hc, 1);
+    chop_once(hc, data, len, sink_sz, out, &cs, &cycles);
+    hashchop_get_stats(hc, &st);
+    hashchop_set_stats(hc, 0);
+    for (int i = 1; i < c->warmups; i++) {
+        chop_once(hc, data, len, sink_sz, out, NULL, &cycles);
+    }
+    for (int i = 0; i < c->trials; i++) {
+        double sec = chop_once(hc, data, len, sink_sz, out, NULL, &cycles);
+        mbs[i] = mb / sec;
+        cpb[i] = (double)cycles / len;
+    }
+    qsort(mbs, c->trials, sizeof(double), cmp_double);
+    qsort(cpb, c->trials, sizeof(double), cmp_double);
+
+    /* One more run of each phase with hardware counters: the scan alone
+     * (hashchop_seam in place), and chopping with copies in and out. */
+    uint64_t pv[2][PERF_COUNTERS];
+    int have_perf = (c->perf != NULL);
+    if (have_perf) {
+        perf_start(c->perf);
+        for (size_t pos = 0; pos < len; ) {
+            pos += hashchop_seam(hc, data + pos, len - pos);
+        }
+        have_perf = perf_stop(c->perf);
+        memcpy(pv[0], c->perf->v, sizeof(pv[0]));
+        perf_start(c->perf);
+        chop_once(hc, data, len, sink_sz, out, NULL, &cycles);
+        have_perf = have_perf && perf_stop(c->perf);
+        memcpy(pv[1], c->perf->v, sizeof(pv[1]));
+    }
+
+    double mean = cs.sum / cs.chunks;
+    double var = cs.sum_sq / cs.chunks - mean * mean;
+    double sd = (var > 0 ? sqrt(var) : 0);
+    double forced = 100.0 * st.forced_cuts / cs.chunks;
+    if (c->json) {
+        printf("%s\n    {\"profile\": \"%s\", \"engine\": \"%s\", "
+            "\"bits\": %d, \"sink\": %zu, \"bytes\": %zu, \"trials\": %d,\n"
+            "     \"mb_per_sec\": {\"median\": %.1f, \"p10\": %.1f, "
+            "\"p90\": %.1f, \"min\": %.1f, \"max\": %.1f},\n"
+            "     \"cycles_per_byte\": ", sep, profile, engine->name, bits,
+            sink_sz, len,
+            c->trials, percentile(mbs, c->trials, 50),
+            percentile(mbs, c->trials, 10), percentile(mbs, c->trials, 90),
+            mbs[0], mbs[c->trials - 1]);
+        if (HAVE_TSC) {
+            printf("%.3f", percentile(cpb, c->trials, 50));
+        } else {
+            printf("null");
+        }
+        printf(",\n     \"chunks\": %zu, \"chunk_mean\": %.1f, "
+            "\"chunk_sd\": %.1f, \"chunk_min\": %zu, \"chunk_max\": %zu, "
+            "\"forced_pct\": %.2f", cs.chunks, mean, sd, cs.min, cs.max,
+            forced);
+        for (int ph = 0; have_perf && ph < 2; ph++) {
+            const uint64_t *v = pv[ph];
+            printf(",\n     \"%s\": {\"ipc\": %.3f, \"cycles_per_byte\": %.3f, "
+                "\"llc_misses_per_kb\": %.3f, \"branch_misses_per_kb\": %.3f}",
+                ph == 0 ? "perf_scan" : "perf_chop",
+                (double)v[PERF_INSTRUCTIONS] / v[PERF_CYCLES],
+                (double)v[PERF_CYCLES] / len,
+                1024.0 * v[PERF_LLC_MISSES] / len,
+                1024.0 * v[PERF_BRANCH_MISSES] / len);
+        }
+        printf("}");
+    } else {
+        printf("%-12s %-7s %2d bits, sink %6zu: %7.1f MB/sec "
+            "(p10 %.1f, p90 %.1f)", profile, engine->name, bits, sink_sz,
+            percentile(mbs, c->trials, 50),
+            percentile(mbs, c->trials, 10), percentile(mbs, c->trials, 90));
+        if (HAVE_TSC) {
+            printf(", %.2f cycles/byte", percentile(cpb, c->trials, 50));
+        }
+        printf(" -- %zu chunks, %.0f avg (sd %.0f), %.1f%% forced\n",
+            cs.chunks, mean, sd, forced);
+        for (int ph = 0; have_perf && ph < 2; ph++) {
+            const uint64_t *v = pv[ph];
+            printf("    %-5s %.2f IPC, %.2f cycles/byte, %.2f LLC misses/KB, "
+                "%.2f branch misses/KB\n", ph == 0 ? "scan" : "chop",
+                (double)v[PERF_INSTRUCTIONS] / v[PERF_CYCLES],
+                (double)v[PERF_CYCLES] / len,
+                1024.0 * v[PERF_LLC_MISSES] / len,
+                1024.0 * v[PERF_BRANCH_MISSES] / len);
+        }
+    }
+    free(out); free(mbs); free(cpb);
+    hashchop_free(hc);
+}
+
+/* Parse a comma-separated list of up to MAX numbers into V, and return
+ * how many there were. */
+static int parse_list(char *arg, size_t *v, int max) {
+    int n = 0;
+    for (char *tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        if (n == max || !isdigit((unsigned char)tok[0])) usage();
+        v[n++] = atol(tok);
+    }
+    return n;
+}
+
+/* Sweep every combination of profile, engine, bits and sink size. Sink sizes
+ * larger than the max chunk size are skipped, since hashchop_sink
+ * rejects them. */
+static void bench_chop(const chop_config *c) {
+    const char *sep = "";
+    if (c->json) {
+        printf("{\"version\": \"%d.%d\", \"tsc\": %s, \"warmups\": %d, "
+            "\"results\": [", hashchop_version_major, hashchop_version_minor,
+            HAVE_TSC ? "true" : "false", c->warmups);
+    }
+    for (int p = 0; p < c->profiles_ct; p++) {
+        int profile = c->profiles[p];
+        size_t len = 0;
+        unsigned char *data = gen_profile(profile, c->sz, c->seed, c->path,
+            &len);
+        for (int b = 0; b < c->bits_ct; b++) {
+            hashchop *hc = hashchop_new(c->bits[b]);
+            if (hc == NULL) die("bad bits argument");
+            size_t max = hashchop_max_chunk(hc);
+            hashchop_free(hc);
+            for (int e = 0; e < c->engines_ct; e++) {
+                for (int z = 0; z < c->sinks_ct; z++) {
+                    if (c->sinks[z] > max) continue;
+                    chop_run(c, profile_names[profile], data, len,
+                        c->engines[e], c->bits[b], c->sinks[z], sep);
+                    sep = ",";
+                }
             }
-        } while (res == HASHCHOP_OK);
-        res = hashchop_sink(hc, buf + (i * CHUNK_SZ), CHUNK_SZ);
-        assert(HASHCHOP_OK == res); 
+        }
+        free(data);
     }
+    if (c->json) printf("\n]}\n");
+}
+
+/* Edit workloads for the dedup stability benchmark. */
+static const char *stability_names[] = {
+    "64 small edits", "1MB insert", "1-byte shift", "16 1KB deletes",
+    "1MB append",
+};
+#define STABILITY_WORKLOADS (sizeof(stability_names) / sizeof(stability_names[0]))
+
+/* Make the new version of SZ bytes of OLD for stability workload KIND,
+ * and write its length in (*NEW_LEN). */
+static unsigned char *stability_edit(int kind, const unsigned char *old,
+        size_t sz, size_t *new_len) {
+    unsigned char *new = malloc(sz + 1024 * 1024);
+    if (new == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+    size_t o = 0, n = 0;
+    srandom(kind + 1);
+    switch (kind) {
+    case 0:                     /* overwrite 1 to 16 bytes, 64 times */
+        memcpy(new, old, sz);
+        n = o = sz;
+        for (int e = 0; e < 64; e++) {
+            size_t at = random() % (sz - 16), len = 1 + random() % 16;
+            for (size_t i = 0; i < len; i++) new[at + i] = random();
+        }
+        break;
+    case 1:                     /* insert 1MB in the middle */
+        memcpy(new, old, sz / 2);
+        n = o = sz / 2;
+        for (size_t i = 0; i < 1024 * 1024; i++) new[n++] = random();
+        break;
+    case 2:                     /* insert a byte at the start */
+        new[n++] = random();
+        break;
+    case 3:                     /* delete 1KB, 16 times, evenly spread */
+        for (int e = 0; e < 16; e++) {
+            size_t at = (sz / 16) * e + (sz / 64);
+            memcpy(new + n, old + o, at - o);
+            n += at - o;
+            o = at + 1024;
+        }
+        break;
+    }
+    memcpy(new + n, old + o, sz - o);
+    n += sz - o;
+    if (kind == 4) {            /* append 1MB */
+        for (size_t i = 0; i < 1024 * 1024; i++) new[n++] = random();
+    }
+    *new_len = n;
+    return new;
+}
+
+/* For each mask bits value (and, on text, with and without aligning to
+ * lines), report how many of the chunks of an edited version of SZ
+ * bytes of PROFILE data were already stored from the old version, how
+ * many bytes have to be stored again, and how fast the new version is
+ * chopped. */
+static void bench_stability(size_t sz, int profile) {
+    static const int bits[] = { 10, 12, 14 };
+    size_t old_len = 0;
+    unsigned char *old = gen_profile(profile, sz, 12345, NULL, &old_len);
+    unsigned char *news[STABILITY_WORKLOADS];
+    size_t new_lens[STABILITY_WORKLOADS];
+    for (size_t k = 0; k < STABILITY_WORKLOADS; k++) {
+        news[k] = stability_edit(k, old, old_len, &new_lens[k]);
+    }
+    printf("%s data, %zu bytes\n", profile_names[profile], old_len);
+
+    for (int aligned = 0; aligned < (profile == PROF_TEXT ? 2 : 1); aligned++) {
+        for (size_t b = 0; b < sizeof(bits) / sizeof(bits[0]); b++) {
+            hashchop *hc = hashchop_new(bits[b]);
+            if (hc == NULL) die("bad bits argument");
+            if (aligned) hashchop_set_delimiter(hc, '\n');
+            printf("rsync, %d bits%s:\n", bits[b], aligned ? ", line-aligned" : "");
+            for (size_t k = 0; k < STABILITY_WORKLOADS; k++) {
+                const unsigned char *new = news[k];
+                size_t len = new_lens[k], chunks = 0, reused = 0;
+                hashchop_store *s = hashchop_store_new(0);
+                if (s == NULL) { fprintf(stderr, "alloc fail\n"); exit(1); }
+                store_chunks(hc, s, old, old_len, NULL, NULL);
+                size_t stored = store_chunks(hc, s, new, len, &chunks, &reused);
+                hashchop_store_free(s);
+
+                double pre = now();
+                for (size_t pos = 0; pos < len; ) {
+                    pos += hashchop_seam(hc, new + pos, len - pos);
+                }
+                double post = now();
+                printf("  %-16s %5.1f%% of %zu chunks reused, %zu bytes "
+                    "stored again (%.2f%%) -- %.1f MB/sec\n",
+                    stability_names[k], 100.0 * reused / chunks, chunks,
+                    stored, 100.0 * stored / len,
+                    len / (1024.0 * 1024.0) / (post - pre));
+            }
+            hashchop_free(hc);
+        }
+    }
+    for (size_t k = 0; k < STABILITY_WORKLOADS; k++) free(news[k]);
+    free(old);
 }
 
 int main(int argc, char **argv) {
     size_t sz = 10L * 1024L * 1024L;
     unsigned int seed = 12345;
     int bits = 14;
-    clock_t pre = 0;
-    clock_t post = 0;
-    unsigned char *buf = NULL;
-    if (argc > 1) {
-        if (0 == strcmp(argv[1], "-h")) usage();
-        sz = atol(argv[1]) * 1024L;
-    }
-    if (argc > 2) seed = atoi(argv[2]);
-    if (argc > 2) bits = atoi(argv[3]);
-
-    buf = init(sz, seed);
-    pre = clock();
-    if ((int)pre == -1) { fprintf(stderr, "clock fail\n"); exit(1); }
-    go(sz, buf, bits);
-
-    post = clock();
-    if ((int)post == -1) { fprintf(stderr, "clock fail\n"); exit(1); }
-    {
-        unsigned long ticks = (unsigned long)post - pre;
-        double tdelta = (double)ticks / (1.0 * CLOCKS_PER_SEC);
-        printf("%lu bytes -- %lu ticks -- %.3f sec -- %.3f MB/sec\n",
-            sz, ticks, tdelta, (sz / (1024L*1024L)) / tdelta);
+    if (argc > 1 && 0 == strcmp(argv[1], "pack")) {
+        size_t count = 1000000;
+        if (argc > 2) count = atol(argv[2]);
+        if (count == 0) usage();
+        bench_pack(count, argc > 3 ? argv[3] : "/tmp/hashchop_bench.pack");
+        return 0;
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "filter")) {
+        size_t count = 1000000;
+        if (argc > 2) count = atol(argv[2]);
+        if (count == 0) usage();
+        bench_filter(count);
+        return 0;
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "manifest")) {
+        size_t count = 1000000;
+        if (argc > 2) count = atol(argv[2]);
+        if (count == 0) usage();
+        bench_manifest(count);
+        return 0;
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "delta")) {
+        size_t kb = 32 * 1024;
+        if (argc > 2) kb = atol(argv[2]);
+        if (argc > 3) bits = atoi(argv[3]);
+        if (kb == 0) usage();
+        bench_delta(kb * 1024, bits);
+        return 0;
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "similar")) {
+        size_t pages = 4096;
+        int versions = 8;
+        if (argc > 2) pages = atol(argv[2]);
+        if (argc > 3) versions = atoi(argv[3]);
+        if (pages == 0 || versions < 1) usage();
+        bench_similar(pages, versions);
+        return 0;
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "levels")) {
+        int levels = 4;
+        if (argc > 2) sz = atol(argv[2]) * 1024L;
+        if (argc > 3) bits = atoi(argv[3]);
+        if (argc > 4) levels = atoi(argv[4]);
+        if (sz == 0) usage();
+        bench_levels(sz, bits, levels);
+        return 0;
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "records")) {
+        size_t kb = 32 * 1024;
+        bits = 10;
+        if (argc > 2) kb = atol(argv[2]);
+        if (argc > 3) bits = atoi(argv[3]);
+        if (kb == 0) usage();
+        bench_records(kb * 1024, bits);
+        return 0;
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "tune")) {
+        size_t pages = 4096;
+        double entry_bytes = 64;
+        if (argc > 2) pages = atol(argv[2]);
+        if (argc > 3) entry_bytes = atof(argv[3]);
+        if (pages == 0 || entry_bytes < 0) usage();
+        bench_tune(pages, entry_bytes);
+        return 0;
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "kernels")) {
+        sz = 256L * 1024L * 1024L;
+        if (argc > 2) sz = atol(argv[2]) * 1024L;
+        if (sz == 0) usage();
+        bench_kernels(sz);
+        return 0;
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "batch")) {
+        size_t count = 100000, avg = 4096;
+        int threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (argc > 2) count = atol(argv[2]);
+        if (argc > 3) avg = atol(argv[3]);
+        if (argc > 4) threads = atoi(argv[4]);
+        if (count == 0 || avg == 0) usage();
+        bench_batch(count, avg, threads);
+        return 0;
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "router")) {
+        size_t kb = 256 * 1024;
+        int shards = 8;
+        if (argc > 2) kb = atol(argv[2]);
+        if (argc > 3) shards = atoi(argv[3]);
+        if (kb == 0 || shards < 1) usage();
+        bench_router(kb * 1024, shards);
+        return 0;
+    }
+    if (argc > 1 && 0 == strcmp(argv[1], "stability")) {
+        int profile = PROF_RANDOM;
+        sz = 16L * 1024L * 1024L;
+        if (argc > 2) sz = atol(argv[2]) * 1024L;
+        if (argc > 3) {
+            while (profile < PROF_FILE
+                && 0 != strcmp(argv[3], profile_names[profile])) profile++;
+        }
+        if (sz < 1024 * 1024 || profile == PROF_FILE) usage();
+        bench_stability(sz, profile);
+        return 0;
+    }
+
+    chop_config c;
+    memset(&c, 0, sizeof(c));
+    c.sz = 16L * 1024L * 1024L;
+    c.seed = seed;
+    c.warmups = 1;
+    c.trials = 5;
+    if (argc > 1 && isdigit((unsigned char)argv[1][0])) {
+        /* Old style: bench [KB] [SEED] [BITS], on random data. */
+        c.sz = atol(argv[1]) * 1024L;
+        if (argc > 2) c.seed = atoi(argv[2]);
+        if (argc > 3) bits = atoi(argv[3]);
+        c.bits[c.bits_ct++] = bits;
+        c.sinks[c.sinks_ct++] = 1024;
+        c.profiles[c.profiles_ct++] = PROF_RANDOM;
+        c.engines[c.engines_ct++] = &hashchop_engine_rsync;
+        if (c.sz == 0) usage();
+        bench_chop(&c);
+        return 0;
+    }
+
+    size_t v[32];
+    int fl, n;
+    perf_group perf;
+    while ((fl = getopt(argc, argv, "hs:b:z:p:e:f:w:n:r:Pj")) != -1) {
+        switch (fl) {
+        case 's': c.sz = atol(optarg) * 1024L; break;
+        case 'b':
+            n = parse_list(optarg, v, 32);
+            for (c.bits_ct = 0; c.bits_ct < n; c.bits_ct++) {
+                c.bits[c.bits_ct] = v[c.bits_ct];
+            }
+            break;
+        case 'z': c.sinks_ct = parse_list(optarg, c.sinks, 32); break;
+        case 'p':
+            c.profiles_ct = 0;
+            for (char *tok = strtok(optarg, ","); tok; tok = strtok(NULL, ",")) {
+                int p = 0;
+                while (p < PROFILES && 0 != strcmp(tok, profile_names[p])) p++;
+                if (p >= PROF_FILE || c.profiles_ct == PROF_FILE) usage();
+                c.profiles[c.profiles_ct++] = p;
+            }
+            break;
+        case 'e':
+            c.engines_ct = 0;
+            for (char *tok = strtok(optarg, ","); tok; tok = strtok(NULL, ",")) {
+                int e = 0;
+                while (e < ENGINES && 0 != strcmp(tok, engines[e]->name)) e++;
+                if (e == ENGINES || c.engines_ct == ENGINES) usage();
+                c.engines[c.engines_ct++] = engines[e];
+            }
+            break;
+        case 'f': c.path = optarg; break;
+        case 'w': c.warmups = atoi(optarg); break;
+        case 'n': c.trials = atoi(optarg); break;
+        case 'r': c.seed = atoi(optarg); break;
+        case 'P':
+            if (perf_open(&perf)) {
+                c.perf = &perf;
+            } else {
+                fprintf(stderr, "perf events unavailable (see "
+                    "/proc/sys/kernel/perf_event_paranoid), skipping -P\n");
+            }
+            break;
+        case 'j': c.json = 1; break;
+        default: usage();
+        }
+    }
+    if (c.sz == 0 || c.warmups < 1 || c.trials < 1) usage();
+    if (c.bits_ct == 0) {
+        c.bits[0] = 10; c.bits[1] = 12; c.bits[2] = 14;
+        c.bits_ct = 3;
+    }
+    if (c.sinks_ct == 0) {
+        c.sinks[0] = 1024; c.sinks[1] = 16384;
+        c.sinks_ct = 2;
+    }
+    if (c.engines_ct == 0) c.engines[c.engines_ct++] = &hashchop_engine_rsync;
+    if (c.profiles_ct == 0 && c.path == NULL) {
+        for (int p = 0; p < PROF_FILE; p++) c.profiles[c.profiles_ct++] = p;
     }
+    if (c.path) c.profiles[c.profiles_ct++] = PROF_FILE;
+    bench_chop(&c);
     return 0;
 }
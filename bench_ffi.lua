@@ -0,0 +1,73 @@
+-- Compare chopping through the LuaJIT FFI module with the hashchop.so
+-- binding. Build both (make lua lib), then run with LuaJIT:
+--
+--   LD_LIBRARY_PATH=. luajit bench_ffi.lua [MB] [BITS]
+
+local ffi = require "ffi"
+local hashchop = require "hashchop"
+local hffi = require "hashchop_ffi"
+
+local mb = tonumber(arg[1]) or 64
+local bits = tonumber(arg[2]) or 12
+local size = mb * 1024 * 1024
+
+-- Pseudo-random data (xorshift32), as cdata and as a string.
+local buf = ffi.new("uint8_t[?]", size)
+local x = ffi.new("uint32_t[1]", 2463534242)
+for i = 0, size - 1 do
+    x[0] = bit.bxor(x[0], bit.lshift(x[0], 13))
+    x[0] = bit.bxor(x[0], bit.rshift(x[0], 17))
+    x[0] = bit.bxor(x[0], bit.lshift(x[0], 5))
+    buf[i] = bit.band(x[0], 255)
+end
+local str = ffi.string(buf, size)
+
+-- Time F (which returns its chunk count), best of 3.
+local function run(name, f)
+    local t, chunks
+    for trial = 1, 3 do
+        collectgarbage()
+        local pre = os.clock()
+        chunks = f()
+        local tt = os.clock() - pre
+        if t == nil or tt < t then t = tt end
+    end
+    print(string.format("%-28s %6d chunks -- %.3f sec -- %.1f MB/sec",
+        name, chunks, t, mb / t))
+end
+
+run("hashchop.so push/finish", function()
+    local h = hashchop.new(bits)
+    local n = #h:push(str)
+    h:finish()
+    return n + 1
+end)
+
+run("hashchop.so seams", function()
+    return #hashchop.new(bits):seams(str)
+end)
+
+run("ffi sink/poll_view", function()
+    local h = hffi.new(bits)
+    local max, n, pos = h:max_chunk(), 0, 0
+    while pos < size do
+        local piece = math.min(max, size - pos)
+        assert(h:sink(buf + pos, piece) == hffi.OK)
+        pos = pos + piece
+        while h:poll_view() do n = n + 1 end
+    end
+    h:finish_view()
+    return n + 1
+end)
+
+run("ffi seams (caller-owned ends)", function()
+    local h = hffi.new(bits)
+    local ends = hffi.ends(4096)
+    local n, pos = 0, 0
+    repeat
+        local ct = h:seams(buf + pos, size - pos, ends, 4096)
+        n = n + ct
+        pos = pos + tonumber(ends[ct - 1])
+    until ct < 4096 or pos == size
+    return n
+end)
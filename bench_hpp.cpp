@@ -0,0 +1,92 @@
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+
+#include "hashchop.hpp"
+
+/* Time chopping a buffer of random data with hashchop.hpp's chunks(),
+ * whose scan has Config's sizes and mask as compile-time constants,
+ * against the C core's hashchop_seam, for each engine.
+ *
+ *     bench_hpp [BUFFER_SIZE_IN_KB] [TRIALS] */
+
+typedef unsigned char UC;
+
+static double now(void) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+        fprintf(stderr, "clock_gettime fail\n");
+        exit(1);
+    }
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Chop SZ bytes of BUF with the C++ range, or with hashchop_seam on a
+ * hashchopper with ENGINE's C engine, TRIALS times. Returns the best
+ * time in seconds, and writes the chunk count in (*COUNT). */
+template <class Engine, class Config>
+static double time_chop(const UC *buf, size_t sz, int trials, bool cpp,
+        size_t *count) {
+    hashchop_cpp::chopper<Engine, Config> ch;
+    hashchop_cpp::bytes data(reinterpret_cast<const std::byte *>(buf), sz);
+    double best = 0;
+    for (int t = 0; t < trials; t++) {
+        size_t n = 0;
+        double pre = now();
+        if (cpp) {
+            for (hashchop_cpp::bytes c : ch.chunks(data)) { (void)c; n++; }
+        } else {
+            for (size_t pos = 0; pos < sz; n++) {
+                pos += hashchop_seam(ch.get(), buf + pos, sz - pos);
+            }
+        }
+        double sec = now() - pre;
+        if (t == 0 || sec < best) best = sec;
+        *count = n;
+    }
+    return best;
+}
+
+template <class Engine, class Config>
+static void bench(const char *name, const UC *buf, size_t sz, int trials) {
+    size_t c_count = 0, cpp_count = 0;
+    double c = time_chop<Engine, Config>(buf, sz, trials, false, &c_count);
+    double cpp = time_chop<Engine, Config>(buf, sz, trials, true, &cpp_count);
+    if (c_count != cpp_count) {
+        fprintf(stderr, "%s: chunk counts differ (%zu vs %zu)\n",
+            name, c_count, cpp_count);
+        exit(1);
+    }
+    double mb = sz / (1024.0 * 1024.0);
+    printf("%-8s %2d bits: %zu chunks -- hashchop_seam %.1f MB/s, "
+        "chunks() %.1f MB/s -- %.2fx\n", name, Config::bits, c_count,
+        mb / c, mb / cpp, c / cpp);
+}
+
+int main(int argc, char **argv) {
+    size_t sz = 64 * 1024 * 1024;
+    int trials = 5;
+    if (argc > 1) sz = atol(argv[1]) * 1024L;
+    if (argc > 2) trials = atoi(argv[2]);
+    if (sz == 0 || trials < 1) {
+        fprintf(stderr, "Usage: bench_hpp [BUFFER_SIZE_IN_KB] [TRIALS]\n");
+        exit(1);
+    }
+    UC *buf = (UC *)malloc(sz);
+    if (buf == NULL) { fprintf(stderr, "malloc fail\n"); exit(1); }
+    unsigned int seed = 12345;
+    for (size_t i = 0; i < sz; i++) {
+        seed = 1103515245 * seed + 12345;
+        buf[i] = seed >> 16;
+    }
+
+    using namespace hashchop_cpp;
+    bench<rsync, config<12>>("rsync", buf, sz, trials);
+    bench<rsync, config<16>>("rsync", buf, sz, trials);
+    bench<rabin, config<12>>("rabin", buf, sz, trials);
+    bench<rabin, config<16>>("rabin", buf, sz, trials);
+    bench<buzhash, config<12>>("buzhash", buf, sz, trials);
+    bench<buzhash, config<16>>("buzhash", buf, sz, trials);
+    free(buf);
+    return 0;
+}
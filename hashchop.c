@@ -14,6 +14,12 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 
+#ifdef HASHCHOP_TRACE
+#define _POSIX_C_SOURCE 199309L /* clock_gettime */
+#define _DEFAULT_SOURCE         /* bzero */
+#include <time.h>
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/types.h>
@@ -22,12 +28,23 @@
 #include <strings.h>
 #include <assert.h>
 #include "hashchop.h"
+#include "hashchop_internal.h"
 
 /* Abbreviations. */
 typedef uint32_t UI;
 typedef uint8_t UC;
 #define T hashchop
 
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+/* Find the first break in BUF; see scan_body. */
+typedef UI (scan_fn)(const UC *buf, UI min, UI max, UI mask, UI *sum);
+static scan_fn *kernel_for(uint8_t bits);
+
 uint8_t hashchop_version_major = 0;
 uint8_t hashchop_version_minor = 8;
 
@@ -38,6 +55,22 @@ struct hashchop {
     UI max;                     /* max chunk size */
     UI limit;                   /* total buffer size */
     UI ct;                      /* current buffer use */
+    UI pending;                 /* viewed chunk still at the front */
+    uint64_t offset;            /* bytes sunk in the current stream */
+    uint8_t levels;             /* levels for multi-level chunking */
+    int delim;                  /* record delimiter byte, or -1 */
+    hashchop_delimiter_cb *delim_cb;    /* delimiter search callback */
+    void *delim_udata;
+    hashchop_stats *stats;      /* counters, or NULL when off */
+    const hashchop_engine *engine;  /* rolling hash engine */
+    scan_fn *scan;              /* rsync scan kernel for bits, or NULL */
+    uint8_t loop;               /* loop over the engine's roll, not scan */
+#ifdef HASHCHOP_TRACE
+    hashchop_trace trace;       /* per-phase totals */
+    struct trace_event *events; /* timeline, or NULL */
+    size_t event_ct;
+    size_t event_limit;
+#endif
     UC buf[];                   /* buffer */
 };
 
@@ -52,6 +85,49 @@ void hashchop_set_malloc(hashchop_malloc_cb *m, hashchop_free_cb *f) {
     HFREE = f;
 }
 
+/* Allocate/free memory via the functions set with hashchop_set_malloc. */
+void *hashchop_alloc(size_t sz) { return HMALLOC(sz); }
+void hashchop_dealloc(void *p, size_t sz) { HFREE(p, sz); }
+
+#ifdef HASHCHOP_TRACE
+/* One timed phase, for the timeline. */
+struct trace_event {
+    uint64_t start;             /* ns, CLOCK_MONOTONIC */
+    uint64_t ns;
+    UI bytes;
+    uint8_t phase;
+};
+
+static uint64_t trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Add a phase of BYTES bytes that started at START to HC's totals, and
+ * to its timeline while recording. */
+static void trace_phase(T *hc, hashchop_phase phase, uint64_t start,
+        size_t bytes) {
+    uint64_t ns = trace_now() - start;
+    hc->trace.calls[phase]++;
+    hc->trace.bytes[phase] += bytes;
+    hc->trace.ns[phase] += ns;
+    if (hc->event_ct < hc->event_limit) {
+        struct trace_event *ev = &hc->events[hc->event_ct++];
+        ev->start = start;
+        ev->ns = ns;
+        ev->bytes = bytes;
+        ev->phase = phase;
+    }
+}
+
+#define TRACE_START(VAR) uint64_t VAR = trace_now()
+#define TRACE_END(HC, PHASE, VAR, BYTES) trace_phase(HC, PHASE, VAR, BYTES)
+#else
+#define TRACE_START(VAR)
+#define TRACE_END(HC, PHASE, VAR, BYTES)
+#endif
+
 /* The buffer for accumulating data will be the average size * this.
  * TODO: Make this configurable? */
 #define LIMIT_BUFFER_MUL 4
@@ -61,12 +137,21 @@ void hashchop_set_malloc(hashchop_malloc_cb *m, hashchop_free_cb *f) {
 
 /* Create and return a new hashchopper. Returns NULL on error (bad BITS value). */
 T *hashchop_new(uint8_t bits) {
+    return hashchop_new_engine(bits, &hashchop_engine_rsync);
+}
+
+/* Like hashchop_new, but find boundaries with ENGINE. Returns NULL on
+ * error (bad BITS value, or an engine window larger than the min chunk
+ * size). */
+T *hashchop_new_engine(uint8_t bits, const hashchop_engine *engine) {
     if (bits < HASHCHOP_MIN_BITS || bits > HASHCHOP_MAX_BITS) return NULL;
 
     UI max = 1 << (bits + HASHCHOP_BIT_SKEW);
     UI mask = (1 << bits) - 1;
     UI min = 1 << (bits - HASHCHOP_BIT_SKEW);
     UI limit = LIMIT_BUFFER_MUL * max;
+    size_t window = engine->window(min);
+    if (window == 0 || window > min) return NULL;
     T *hc = HMALLOC(sizeof(*hc) + limit);
     if (hc == NULL) return NULL;   /* alloc failure */
     hc->bits = bits;
@@ -75,10 +160,38 @@ T *hashchop_new(uint8_t bits) {
     hc->max = max;
     hc->limit = limit;
     hc->ct = 0;
+    hc->pending = 0;
+    hc->offset = 0;
+    hc->levels = 1;
+    hc->delim = HASHCHOP_NO_DELIMITER;
+    hc->delim_cb = NULL;
+    hc->delim_udata = NULL;
+    hc->stats = NULL;
+    hc->engine = engine;
+    hc->scan = (engine == &hashchop_engine_rsync ? kernel_for(bits) : NULL);
+    hc->loop = 0;
+#ifdef HASHCHOP_TRACE
+    memset(&hc->trace, 0, sizeof(hc->trace));
+    hc->events = NULL;
+    hc->event_ct = hc->event_limit = 0;
+#endif
     bzero(hc->buf, 2*max);
     return hc;
 }
 
+/* Drop the chunk from the last hashchop_poll_view from the front of
+ * the buffer. */
+static void consume(T *hc) {
+    if (hc->pending == 0) return;
+    UI rem = hc->ct - hc->pending;
+    TRACE_START(t_move);
+    memmove(hc->buf, hc->buf + hc->pending, rem);
+    TRACE_END(hc, HASHCHOP_PHASE_MOVE, t_move, rem);
+    hc->ct = rem;
+    hc->pending = 0;
+    if (hc->stats) hc->stats->bytes_moved += rem;
+}
+
 /* Sink LENGTH bytes from DATA into the hashchopper.
  * 
  * Returns OVERFLOW if the data is too large to store (and should be added
@@ -86,9 +199,17 @@ T *hashchop_new(uint8_t bits) {
  * be flushed with hashchop_poll first), or OK on success. */
 hashchop_res hashchop_sink(T *hc, const unsigned char *data, size_t length) {
     if (length > hc->max) return HASHCHOP_ERROR_OVERFLOW;
-    if (hc->ct > hc->limit) return HASHCHOP_ERROR_FULL;
+    consume(hc);
+    if (hc->ct + length > hc->limit) {
+        if (hc->stats) hc->stats->full++;
+        return HASHCHOP_ERROR_FULL;
+    }
+    TRACE_START(t);
     memcpy(hc->buf + hc->ct, data, length);
+    TRACE_END(hc, HASHCHOP_PHASE_SINK, t, length);
     hc->ct += length;
+    hc->offset += length;
+    if (hc->stats) hc->stats->bytes_in += length;
     return HASHCHOP_OK;
 }
 
@@ -98,32 +219,293 @@ hashchop_res hashchop_sink(T *hc, const unsigned char *data, size_t length) {
  *
  * Essentially, this uses a simple checksum which is very cheap to step
  * through a byte array, looking for places (past the minimum length)
- * where the checksum AND'd with a bit mask is 0. */
-static UI find_seam(T *hc) {
-    UI a = 1, b = 0, len = hc->min, i = 0;
-    UI mask = hc->mask, max = hc->max;
-    assert(hc->ct >= hc->max);
+ * where the checksum AND'd with a bit mask is 0. BUF must have at
+ * least MAX bytes. The full checksum at the break is written in (*SUM).
+ * (It's only ever added, subtracted, and multiplied, so the bits under
+ * the mask don't depend on the ones above it, and it isn't masked while
+ * stepping.)
+ *
+ * The window is always MIN bytes, so the byte leaving it is weighted by
+ * MIN + 1. The loop steps 4 bytes at a time, since MAX - MIN is always a
+ * multiple of 4. This is inlined into a kernel per common BITS value
+ * below, so MIN, MAX and MASK are constants there. */
+static ALWAYS_INLINE UI scan_body(const UC *buf, UI min, UI max, UI mask,
+        UI *sum) {
+    UI a = 1, b = 0, i = 0;
 
-    for (i = 0; i < len; i++) {
-        UC v = hc->buf[i];
+    for (i = 0; i < min; i++) {
+        UC v = buf[i];
         a += v;
-        b += (len - i + 1) * v;
+        b += (min - i + 1) * v;
+    }
+
+#define STEP(J)                                                         \
+    do {                                                                \
+        UC nk = buf[i + J - min], nl = buf[i + J];                      \
+        a = a - nk + nl;                                                \
+        b = b - (min + 1) * nk + a;                                     \
+        if (((a + (b << 16)) & mask) == 0) {                            \
+            *sum = a + (b << 16);                                       \
+            return i + J;                                               \
+        }                                                               \
+    } while (0)
+
+    for (i = min; i < max; i += 4) {
+        STEP(0); STEP(1); STEP(2); STEP(3);
     }
-    a &= mask; b &= mask;
+#undef STEP
+    *sum = a + (b << 16);
+    return max;
+}
+
+/* Generic scan, for any BITS. */
+static UI scan(const UC *buf, UI min, UI max, UI mask, UI *sum) {
+    return scan_body(buf, min, max, mask, sum);
+}
+
+/* Scan kernel for BITS, with the sizes and mask baked in (the arguments
+ * are the same, and ignored). */
+#define SCAN_KERNEL(BITS)                                               \
+    static UI scan_##BITS(const UC *buf, UI min, UI max, UI mask,       \
+            UI *sum) {                                                  \
+        (void)min; (void)max; (void)mask;                               \
+        return scan_body(buf, 1U << (BITS - HASHCHOP_BIT_SKEW),         \
+            1U << (BITS + HASHCHOP_BIT_SKEW), (1U << BITS) - 1, sum);   \
+    }
+
+SCAN_KERNEL(10) SCAN_KERNEL(11) SCAN_KERNEL(12) SCAN_KERNEL(13)
+SCAN_KERNEL(14) SCAN_KERNEL(15) SCAN_KERNEL(16) SCAN_KERNEL(17)
+SCAN_KERNEL(18) SCAN_KERNEL(19) SCAN_KERNEL(20) SCAN_KERNEL(21)
+SCAN_KERNEL(22) SCAN_KERNEL(23) SCAN_KERNEL(24)
+#undef SCAN_KERNEL
+
+#define KERNEL_MIN_BITS 10
+#define KERNEL_MAX_BITS 24
+
+static scan_fn *kernels[] = {
+    scan_10, scan_11, scan_12, scan_13, scan_14, scan_15, scan_16,
+    scan_17, scan_18, scan_19, scan_20, scan_21, scan_22, scan_23, scan_24,
+};
+
+/* Get the scan kernel for BITS, or the generic scan. */
+static scan_fn *kernel_for(uint8_t bits) {
+    if (bits < KERNEL_MIN_BITS || bits > KERNEL_MAX_BITS) return scan;
+    return kernels[bits - KERNEL_MIN_BITS];
+}
+
+/* Use the generic scan instead of HC's kernel (or switch back), to
+ * compare them. For other engines, loop over the engine's roll instead
+ * of using its batch scan. */
+void hashchop_set_generic_scan(T *hc, int generic) {
+    if (hc->engine == &hashchop_engine_rsync) {
+        hc->scan = (generic ? scan : kernel_for(hc->bits));
+    } else {
+        hc->loop = (generic != 0);
+    }
+}
+
+/* The rsync engine, for hashchop_new_engine. Its rolling hash packs the
+ * checksum's two sums, A in the low 32 bits and B in the high 32, and
+ * its window is the min chunk size; the hashchopper uses the kernels
+ * above instead of these, though. Rolling doesn't keep B's weights the
+ * same as init's, so unlike the other engines' hashes, it also depends
+ * on where the chunk started (as it always has). */
+static size_t rsync_window(size_t min) { return min; }
+
+static uint64_t rsync_init(const UC *data, size_t window) {
+    UI a = 1, b = 0;
+    for (size_t i = 0; i < window; i++) {
+        a += data[i];
+        b += (UI)(window - i + 1) * data[i];
+    }
+    return a | ((uint64_t)b << 32);
+}
+
+static uint64_t rsync_roll(uint64_t hash, size_t window, UC out, UC in) {
+    UI a = (UI)hash, b = (UI)(hash >> 32);
+    a = a - out + in;
+    b = b - (UI)(window + 1) * out + a;
+    return a | ((uint64_t)b << 32);
+}
+
+static int rsync_is_boundary(uint64_t hash, uint64_t mask) {
+    UI a = (UI)hash, b = (UI)(hash >> 32);
+    return ((a + (b << 16)) & mask) == 0;
+}
 
-    for (i = len; i < max; i++) {
-        UI k = i - len, l = i;
-        UC nk = hc->buf[k], nl = hc->buf[l];
-        UI na = (a - nk + nl);
-        UI nb = (b - (l - k + 1) * nk + na);
-        UI checksum = (na + (nb << 16)) & mask;
-        if (checksum == 0) break;
-        a = na;
-        b = nb;
+static size_t rsync_scan(const UC *buf, size_t min, size_t max,
+        uint64_t mask, uint64_t *hash) {
+    UI sum = 0;
+    size_t cut = scan_body(buf, min, max, mask, &sum);
+    *hash = sum;
+    return cut;
+}
+
+const hashchop_engine hashchop_engine_rsync = {
+    "rsync", rsync_window, rsync_init, rsync_roll, rsync_is_boundary,
+    rsync_scan,
+};
+
+/* Find the first boundary in BUF (with at least max bytes) with HC's
+ * engine, by its batch scan if it has one, and write a hash of the
+ * window there in (*HASH). */
+static UI engine_scan(const T *hc, const UC *buf, uint64_t *hash) {
+    const hashchop_engine *e = hc->engine;
+    if (e->scan && !hc->loop) {
+        return e->scan(buf, hc->min, hc->max, hc->mask, hash);
+    }
+    size_t window = e->window(hc->min);
+    uint64_t h = e->init(buf + hc->min - window, window);
+    UI i = 0;
+    for (i = hc->min; i < hc->max; i++) {
+        h = e->roll(h, window, buf[i - window], buf[i]);
+        if (e->is_boundary(h, hc->mask)) break;
     }
+    *hash = h;
     return i;
 }
 
+/* Get the hashchopper's engine. */
+const hashchop_engine *hashchop_get_engine(const T *hc) {
+    return hc->engine;
+}
+
+/* Get the level of a break at CUT with checksum SUM. The checksum's
+ * bits above the mask aren't evenly distributed (several are often 0
+ * together), so the level is the number of leading zero bits in a hash
+ * of it, up to the top level. Breaks forced by the max chunk size are
+ * level 0. */
+static uint8_t cut_level(const T *hc, UI cut, UI sum) {
+    uint8_t level = 0;
+    if (cut == hc->max) return 0;
+    sum ^= sum >> 16;           /* MurmurHash3's finalizer */
+    sum *= 0x85ebca6b;
+    sum ^= sum >> 13;
+    sum *= 0xc2b2ae35;
+    sum ^= sum >> 16;
+    while (level + 1 < hc->levels && (sum & 0x80000000) == 0) {
+        level++;
+        sum <<= 1;
+    }
+    return level;
+}
+
+/* Find the offset of the first record end in LEN bytes at P, or LEN if
+ * there is none. memchr is vectorized in any serious libc, so searching
+ * for a delimiter byte costs far less than the scan. */
+static size_t next_end(const T *hc, const UC *p, size_t len) {
+    if (hc->delim_cb) return hc->delim_cb(p, len, hc->delim_udata);
+    const UC *end = memchr(p, hc->delim, len);
+    return (end ? (size_t)(end - p) : len);
+}
+
+/* Move a seam at CUT to just after a record end. A content-defined seam
+ * moves forward to the first record end at or after CUT - 1 (so a seam
+ * already after one stays put), and a seam forced by the max chunk size
+ * moves back to the last record end at or after the min. Either way, it
+ * only looks at the first max bytes, so it is the same whether the chunk
+ * is polled or found in place, and it stays put if there's no record end
+ * in range. */
+static UI align_cut(const T *hc, const UC *buf, UI cut) {
+    if (cut < hc->max) {
+        size_t len = hc->max - (cut - 1);
+        size_t off = next_end(hc, buf + cut - 1, len);
+        return (off < len ? cut + off : cut);
+    }
+
+    UI last = cut;
+    if (hc->delim_cb == NULL) {
+        for (UI i = hc->max; i-- > hc->min - 1; ) {
+            if (buf[i] == hc->delim) return i + 1;
+        }
+        return last;
+    }
+    for (UI i = hc->min - 1; i < hc->max; ) {
+        size_t off = next_end(hc, buf + i, hc->max - i);
+        if (off >= hc->max - i) break;
+        i += off + 1;
+        last = i;
+    }
+    return last;
+}
+
+/* Find the end of the first chunk in BUF, which has at least max bytes,
+ * and write its level in (*LEVEL), and whether the max size forced the
+ * cut in (*FORCED). */
+static UI find_cut(const T *hc, const UC *buf, uint8_t *level, int *forced) {
+    UI sum = 0, cut = 0;
+    if (hc->scan) {
+        cut = hc->scan(buf, hc->min, hc->max, hc->mask, &sum);
+    } else {
+        uint64_t hash = 0;
+        cut = engine_scan(hc, buf, &hash);
+        sum = (UI)(hash ^ (hash >> 32));
+    }
+    *level = cut_level(hc, cut, sum);
+    *forced = (cut == hc->max);
+    if (hc->delim_cb || hc->delim != HASHCHOP_NO_DELIMITER) {
+        cut = align_cut(hc, buf, cut);
+    }
+    return cut;
+}
+
+static UI find_seam(T *hc, uint8_t *level, int *forced) {
+    assert(hc->ct >= hc->max);
+    return find_cut(hc, hc->buf, level, forced);
+}
+
+/* Count a LENGTH-byte chunk. */
+static void count_chunk(hashchop_stats *st, size_t length) {
+    int bucket = 0;
+    while (bucket + 1 < HASHCHOP_STATS_BUCKETS && (length >> (bucket + 1))) {
+        bucket++;
+    }
+    st->chunks_out++;
+    st->sizes[bucket]++;
+}
+
+/* Find the next chunk in the buffer, and write its length in (*LENGTH),
+ * its level in (*LEVEL), and whether the max size forced it in (*FORCED). */
+static hashchop_res next_chunk(T *hc, UI *length, uint8_t *level,
+        int *forced) {
+    consume(hc);
+    if (hc->ct < hc->max) {
+        if (hc->stats) hc->stats->underflow++;
+        return HASHCHOP_ERROR_UNDERFLOW;
+    }
+    TRACE_START(t_scan);
+    *length = find_seam(hc, level, forced);
+    TRACE_END(hc, HASHCHOP_PHASE_SCAN, t_scan, *length);
+    return HASHCHOP_OK;
+}
+
+/* Count a LENGTH-byte chunk going out. */
+static void count_out(T *hc, size_t length, int forced) {
+    if (hc->stats) {
+        count_chunk(hc->stats, length);
+        hc->stats->forced_cuts += forced;
+    }
+}
+
+/* Copy the next chunk into DATA, and write its level in (*LEVEL). */
+static hashchop_res poll_chunk(T *hc, unsigned char *data, size_t *length,
+        uint8_t *level) {
+    UI offset = 0;
+    int forced = 0;
+    hashchop_res res = next_chunk(hc, &offset, level, &forced);
+    if (res != HASHCHOP_OK) return res;
+    if (*length < offset) return HASHCHOP_ERROR_OVERFLOW;
+    (*length) = offset;
+    /* printf("memcpy %p -> %p, %u bytes\n", hc->buf, data, offset); */
+    TRACE_START(t_copy);
+    memcpy(data, hc->buf, offset);
+    TRACE_END(hc, HASHCHOP_PHASE_COPY_OUT, t_copy, offset);
+    hc->pending = offset;
+    consume(hc);
+    count_out(hc, offset, forced);
+    return HASHCHOP_OK;
+}
+
 /* If available, copy the next chunk of chopped data into DATA, a buffer of
  * at least (*LENGTH) bytes, and write the chunk length in (*LENGTH).
  *
@@ -131,32 +513,346 @@ static UI find_seam(T *hc) {
  * data needs to be added with hashchop_sink first), OVERFLOW if the chunk
  * is too large to fit in DATA, or OK if the chunk has been copied. */
 hashchop_res hashchop_poll(T *hc, unsigned char *data, size_t *length) {
-    if (hc->ct < hc->max) return HASHCHOP_ERROR_UNDERFLOW;
-    UI offset = find_seam(hc);
-    UI rem = hc->ct - offset;
-    if (*length < offset) return HASHCHOP_ERROR_OVERFLOW;
-    (*length) = offset;
-    /* printf("memcpy %p -> %p, %u bytes\n", hc->buf, data, offset); */
-    memcpy(data, hc->buf, offset);
-    memmove(hc->buf, hc->buf + offset, rem);
-    hc->ct = rem;
+    uint8_t level = 0;
+    return poll_chunk(hc, data, length, &level);
+}
+
+/* If available, find the next chunk of chopped data, and point (*DATA)
+ * at it in the hashchopper's buffer, without copying it. */
+hashchop_res hashchop_poll_view(T *hc, const unsigned char **data,
+        size_t *length) {
+    UI offset = 0;
+    uint8_t level = 0;
+    int forced = 0;
+    hashchop_res res = next_chunk(hc, &offset, &level, &forced);
+    if (res != HASHCHOP_OK) return res;
+    *data = hc->buf;
+    *length = offset;
+    hc->pending = offset;
+    count_out(hc, offset, forced);
+    return HASHCHOP_OK;
+}
+
+/* Like hashchop_poll, but also write the chunk's level in (*LEVEL). */
+hashchop_res hashchop_poll_level(T *hc, unsigned char *data, size_t *length,
+        uint8_t *level) {
+    return poll_chunk(hc, data, length, level);
+}
+
+/* Set the number of chunk levels (1 to HASHCHOP_MAX_LEVELS). */
+hashchop_res hashchop_set_levels(T *hc, uint8_t levels) {
+    if (levels < 1 || levels > HASHCHOP_MAX_LEVELS) {
+        return HASHCHOP_ERROR_OVERFLOW;
+    }
+    hc->levels = levels;
+    return HASHCHOP_OK;
+}
+
+/* Move each content-defined seam to just after the next DELIMITER byte. */
+void hashchop_set_delimiter(T *hc, int delimiter) {
+    hc->delim = delimiter;
+    hc->delim_cb = NULL;
+}
+
+/* Move each content-defined seam to just after the next record end
+ * found by CB. */
+void hashchop_set_delimiter_cb(T *hc, hashchop_delimiter_cb *cb, void *udata) {
+    hc->delim = HASHCHOP_NO_DELIMITER;
+    hc->delim_cb = cb;
+    hc->delim_udata = udata;
+}
+
+/* Get the number of chunk levels. */
+uint8_t hashchop_levels(const T *hc) { return hc->levels; }
+
+/* Turn counting on (with all counters at 0) or off. */
+hashchop_res hashchop_set_stats(T *hc, int enabled) {
+    if (hc->stats) {
+        HFREE(hc->stats, sizeof(*hc->stats));
+        hc->stats = NULL;
+    }
+    if (enabled) {
+        hc->stats = HMALLOC(sizeof(*hc->stats));
+        if (hc->stats == NULL) return HASHCHOP_ERROR_MEMORY;
+        memset(hc->stats, 0, sizeof(*hc->stats));
+    }
     return HASHCHOP_OK;
 }
 
+/* Write the counters in (*STATS). */
+void hashchop_get_stats(const T *hc, hashchop_stats *stats) {
+    if (hc->stats) {
+        *stats = *hc->stats;
+    } else {
+        memset(stats, 0, sizeof(*stats));
+    }
+}
+
+/* Count the last chunk of a stream, if any. */
+static void count_finish(T *hc) {
+    if (hc->stats && hc->ct > 0) {
+        count_chunk(hc->stats, hc->ct);
+        hc->stats->finish_cuts++;
+    }
+}
+
 /* The end of the data stream has been reached, so write the remaining
  * buffered data into DATA, save its length in (*LENGTH), and
  * reset the hashchopper. Returns OK on success, or OVERFLOW if
  * (*LENGTH) says that DATA is too small to contain the data. */
 hashchop_res hashchop_finish(T *hc, unsigned char *data, size_t *length) {
+    consume(hc);
     if (*length < hc->ct) return HASHCHOP_ERROR_OVERFLOW;
+    TRACE_START(t);
     memcpy(data, hc->buf, hc->ct);
+    TRACE_END(hc, HASHCHOP_PHASE_COPY_OUT, t, hc->ct);
     (*length) = hc->ct;
+    count_finish(hc);
     hashchop_reset(hc);
     return HASHCHOP_OK;
 }
 
+/* Like hashchop_finish, but point (*DATA) at the remaining data in the
+ * hashchopper's buffer, without copying it. */
+void hashchop_finish_view(T *hc, const unsigned char **data, size_t *length) {
+    consume(hc);
+    *data = hc->buf;
+    *length = hc->ct;
+    count_finish(hc);
+    hashchop_reset(hc);
+}
+
+/* Find the end of the first chunk in LENGTH bytes of DATA, without
+ * copying it. If LENGTH is less than the max chunk size, DATA is the end
+ * of the stream, and LENGTH is returned. */
+size_t hashchop_seam(const T *hc, const unsigned char *data, size_t length) {
+    uint8_t level = 0;
+    int forced = 0;
+    if (length < hc->max) return length;
+    return find_cut(hc, data, &level, &forced);
+}
+
+/* Like hashchop_seam, but also write the chunk's level in (*LEVEL). The
+ * last chunk in the stream is on the top level. */
+size_t hashchop_seam_level(const T *hc, const unsigned char *data,
+        size_t length, uint8_t *level) {
+    if (length < hc->max) {
+        *level = hc->levels - 1;
+        return length;
+    }
+    int forced = 0;
+    return find_cut(hc, data, level, &forced);
+}
+
+/* Find the ends of up to MAX_ENDS successive chunks in LENGTH bytes of
+ * DATA, and write them in ENDS. */
+size_t hashchop_seams(const T *hc, const unsigned char *data, size_t length,
+        size_t *ends, size_t max_ends) {
+    size_t pos = 0, n = 0;
+    while (n < max_ends && pos < length) {
+        pos += hashchop_seam(hc, data + pos, length - pos);
+        ends[n++] = pos;
+    }
+    return n;
+}
+
+/* Get the largest chunk size the hashchopper will produce. */
+size_t hashchop_max_chunk(const T *hc) { return hc->max; }
+
+#ifdef HASHCHOP_TRACE
+/* Write the per-phase totals in (*TRACE). */
+void hashchop_get_trace(const T *hc, hashchop_trace *trace) {
+    *trace = hc->trace;
+}
+
+/* Start recording a timeline of the next COUNT phases. */
+hashchop_res hashchop_trace_window(T *hc, size_t count) {
+    if (hc->events) {
+        HFREE(hc->events, hc->event_limit * sizeof(*hc->events));
+    }
+    hc->events = NULL;
+    hc->event_ct = hc->event_limit = 0;
+    if (count == 0) return HASHCHOP_OK;
+    hc->events = HMALLOC(count * sizeof(*hc->events));
+    if (hc->events == NULL) return HASHCHOP_ERROR_MEMORY;
+    hc->event_limit = count;
+    return HASHCHOP_OK;
+}
+
+/* Write the recorded timeline to F, as Chrome trace event JSON. Times
+ * are in microseconds from the first event. */
+hashchop_res hashchop_trace_dump(const T *hc, FILE *f) {
+    static const char *names[HASHCHOP_PHASES] = {
+        "sink", "scan", "move", "copy_out",
+    };
+    uint64_t base = (hc->event_ct > 0 ? hc->events[0].start : 0);
+    if (fprintf(f, "{\"traceEvents\":[") < 0) return HASHCHOP_ERROR_IO;
+    for (size_t i = 0; i < hc->event_ct; i++) {
+        const struct trace_event *ev = &hc->events[i];
+        if (fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,"
+                "\"dur\":%.3f,\"pid\":1,\"tid\":1,"
+                "\"args\":{\"bytes\":%u}}", i > 0 ? "," : "",
+                names[ev->phase], (ev->start - base) / 1000.0,
+                ev->ns / 1000.0, ev->bytes) < 0) {
+            return HASHCHOP_ERROR_IO;
+        }
+    }
+    if (fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n") < 0) {
+        return HASHCHOP_ERROR_IO;
+    }
+    return HASHCHOP_OK;
+}
+#endif
+
+/* Get the number of bytes sunk into the current stream. */
+uint64_t hashchop_stream_offset(const T *hc) { return hc->offset; }
+
+/* Saved state encoding:
+ *     0  "hcst"
+ *     4  version (1 byte), bits (1 byte), levels (1 byte), flags (1 byte)
+ *     8  delimiter byte (1 byte), engine name length (1 byte), 2 unused
+ *    12  buffered length (4 bytes)
+ *    16  stream offset (8 bytes)
+ *    24  engine name, then the buffered data
+ * then the fingerprint of everything before it (8 bytes). */
+#define STATE_MAGIC "hcst"
+#define STATE_VERSION 1
+#define STATE_HDR_SZ 24
+#define STATE_DELIM 0x01        /* flag: delimiter byte is set */
+#define STATE_DELIM_CB 0x02     /* flag: a delimiter callback was set */
+
+/* Built-in engines, for restoring by name. */
+static const hashchop_engine *builtin_engines[] = {
+    &hashchop_engine_rsync, &hashchop_engine_rabin, &hashchop_engine_buzhash,
+};
+
+/* Get the size of HC's saved state. */
+size_t hashchop_state_size(const T *hc) {
+    return STATE_HDR_SZ + strlen(hc->engine->name) + (hc->ct - hc->pending)
+        + sizeof(hashchop_fp);
+}
+
+/* Save HC's state into BUF. */
+hashchop_res hashchop_save_state(const T *hc, unsigned char *buf,
+        size_t *length) {
+    size_t name_len = strlen(hc->engine->name);
+    size_t sz = hashchop_state_size(hc);
+    UI buffered = hc->ct - hc->pending;
+    if (name_len > UINT8_MAX) return HASHCHOP_ERROR_FORMAT;
+    if (*length < sz) return HASHCHOP_ERROR_OVERFLOW;
+    memset(buf, 0, STATE_HDR_SZ);
+    memcpy(buf, STATE_MAGIC, 4);
+    buf[4] = STATE_VERSION;
+    buf[5] = hc->bits;
+    buf[6] = hc->levels;
+    if (hc->delim_cb) {
+        buf[7] = STATE_DELIM_CB;
+    } else if (hc->delim != HASHCHOP_NO_DELIMITER) {
+        buf[7] = STATE_DELIM;
+        buf[8] = (UC)hc->delim;
+    }
+    buf[9] = name_len;
+    hashchop_put_le32(buf + 12, buffered);
+    hashchop_put_le64(buf + 16, hc->offset);
+    UC *p = buf + STATE_HDR_SZ;
+    memcpy(p, hc->engine->name, name_len);
+    memcpy(p + name_len, hc->buf + hc->pending, buffered);
+    p += name_len + buffered;
+    hashchop_put_le64(p, hashchop_fingerprint(buf, p - buf));
+    *length = sz;
+    return HASHCHOP_OK;
+}
+
+/* Create a hashchopper from LENGTH bytes of saved state in BUF. */
+T *hashchop_restore_state(const unsigned char *buf, size_t length,
+        const hashchop_engine *engine) {
+    if (length < STATE_HDR_SZ + sizeof(hashchop_fp)
+        || memcmp(buf, STATE_MAGIC, 4) != 0
+        || buf[4] != STATE_VERSION) return NULL;
+    size_t name_len = buf[9];
+    UI buffered = hashchop_get_le32(buf + 12);
+    size_t body = length - sizeof(hashchop_fp);
+    if (body != STATE_HDR_SZ + name_len + (uint64_t)buffered) return NULL;
+    if (hashchop_get_le64(buf + body) != hashchop_fingerprint(buf, body)) {
+        return NULL;
+    }
+
+    const char *name = (const char *)buf + STATE_HDR_SZ;
+    if (engine == NULL) {
+        size_t n = sizeof(builtin_engines) / sizeof(builtin_engines[0]);
+        for (size_t i = 0; i < n && engine == NULL; i++) {
+            if (strlen(builtin_engines[i]->name) == name_len
+                && 0 == memcmp(builtin_engines[i]->name, name, name_len)) {
+                engine = builtin_engines[i];
+            }
+        }
+    }
+    if (engine == NULL || strlen(engine->name) != name_len
+        || 0 != memcmp(engine->name, name, name_len)) return NULL;
+
+    T *hc = hashchop_new_engine(buf[5], engine);
+    if (hc == NULL) return NULL;
+    if (buffered > hc->limit
+        || hashchop_set_levels(hc, buf[6]) != HASHCHOP_OK) {
+        hashchop_free(hc);
+        return NULL;
+    }
+    if (buf[7] & STATE_DELIM) hashchop_set_delimiter(hc, buf[8]);
+    memcpy(hc->buf, buf + STATE_HDR_SZ + name_len, buffered);
+    hc->ct = buffered;
+    hc->offset = hashchop_get_le64(buf + 16);
+    return hc;
+}
+
 /* Reset a hashchopper, so it can be used to chop a new data stream. */
-void hashchop_reset(T *hc) { hc->ct = 0; }
+void hashchop_reset(T *hc) {
+    hc->ct = 0;
+    hc->pending = 0;
+    hc->offset = 0;
+}
 
 /* Free a hashchopper. */
-void hashchop_free(T *hc) { HFREE(hc, sizeof(*hc) + hc->limit); }
+void hashchop_free(T *hc) {
+    if (hc->stats) HFREE(hc->stats, sizeof(*hc->stats));
+#ifdef HASHCHOP_TRACE
+    if (hc->events) {
+        HFREE(hc->events, hc->event_limit * sizeof(*hc->events));
+    }
+#endif
+    HFREE(hc, sizeof(*hc) + hc->limit);
+}
+
+/* Get a fingerprint for LENGTH bytes of DATA.
+ * This is MurmurHash64A (by Austin Appleby, public domain), reading
+ * words as little-endian so fingerprints don't depend on byte order. */
+hashchop_fp hashchop_fingerprint(const unsigned char *data, size_t length) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = 0x5bd1e9955bd1e995ULL ^ (length * m);
+    size_t i = 0;
+
+    for (i = 0; i + 8 <= length; i += 8) {
+        uint64_t k = hashchop_get_le64(data + i);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (length & 7) {
+    case 7: h ^= (uint64_t)data[i + 6] << 48;
+    case 6: h ^= (uint64_t)data[i + 5] << 40;
+    case 5: h ^= (uint64_t)data[i + 4] << 32;
+    case 4: h ^= (uint64_t)data[i + 3] << 24;
+    case 3: h ^= (uint64_t)data[i + 2] << 16;
+    case 2: h ^= (uint64_t)data[i + 1] << 8;
+    case 1: h ^= (uint64_t)data[i];
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
@@ -2,6 +2,11 @@
 #define HASHCHOP_H
 
 #include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /* Malloc/free-like functions, to replace malloc and free. */
 typedef void *(hashchop_malloc_cb)(size_t sz);
@@ -20,16 +25,89 @@ typedef enum HASHCHOP_RES {
     HASHCHOP_ERROR_UNDERFLOW = -1,
     HASHCHOP_ERROR_OVERFLOW = -2,
     HASHCHOP_ERROR_FULL = -3,
+    HASHCHOP_ERROR_MEMORY = -4,
+    HASHCHOP_ERROR_IO = -5,
+    HASHCHOP_ERROR_FORMAT = -6,
 } hashchop_res;
 
 #define HASHCHOP_MIN_BITS 8
 #define HASHCHOP_MAX_BITS 30
+#define HASHCHOP_MAX_LEVELS 8
 
 #define T hashchop
 
 /* Create and return a new hashchopper. Returns NULL on error (bad BITS value). */
 T *hashchop_new(uint8_t bits);
 
+/* Rolling hash engine, for finding content-defined boundaries. The
+ * window slides over the data, and there's a boundary at offset I when
+ * the hash of the window ending at I (that is, of its last WINDOW
+ * bytes, up to and including I) passes is_boundary. The chunk ends just
+ * before I, so a chunk is at least the min chunk size, and the window
+ * can't start before the chunk does.
+ *
+ * Chunks found with different engines don't line up, so an engine
+ * should be chosen once for a data set. hashchop_engine_rsync is the
+ * default, and there are table-driven Rabin and Buzhash engines, to
+ * match chunks made by other tools. Other engines can be defined the
+ * same way. */
+typedef struct hashchop_engine {
+    const char *name;
+
+    /* Get the window size for a min chunk size of MIN (at most MIN). */
+    size_t (*window)(size_t min);
+
+    /* Get the hash of the WINDOW bytes at DATA. */
+    uint64_t (*init)(const unsigned char *data, size_t window);
+
+    /* Slide the window one byte: drop OUT, add IN, and get the new hash. */
+    uint64_t (*roll)(uint64_t hash, size_t window, unsigned char out,
+        unsigned char in);
+
+    /* Is HASH a boundary, for MASK (with the low BITS bits set)? */
+    int (*is_boundary)(uint64_t hash, uint64_t mask);
+
+    /* Batch scan: find the first boundary in BUF, which has at least MAX
+     * bytes, at an offset from MIN to MAX - 1, the same as init, roll
+     * and is_boundary would, and write a hash of the window there in
+     * (*HASH), for levels. Returns the offset, or MAX if there's none.
+     * If NULL, the hashchopper loops over the other functions instead,
+     * and takes levels from roll's hash. */
+    size_t (*scan)(const unsigned char *buf, size_t min, size_t max,
+        uint64_t mask, uint64_t *hash);
+} hashchop_engine;
+
+/* The rsync-style checksum from the original hashchop (the default).
+ * Its sums are rolled from the start of each chunk, so they also depend
+ * on where that was, not just on the window. */
+extern const hashchop_engine hashchop_engine_rsync;
+
+/* Rabin fingerprints over a 64-byte window, with the degree 53
+ * polynomial 0x3DA3358B4DC173 (restic's example polynomial). */
+extern const hashchop_engine hashchop_engine_rabin;
+
+/* Buzhash (cyclic polynomial) over a 48-byte window, with 32-bit hashes
+ * from a fixed table. */
+extern const hashchop_engine hashchop_engine_buzhash;
+
+/* The Rabin and Buzhash engines' windows and tables (see
+ * hashchop_engine.c), for wrappers that inline their scans, such as
+ * hashchop.hpp. */
+#define HASHCHOP_RABIN_WINDOW 64
+#define HASHCHOP_RABIN_SHIFT (53 - 8)
+extern const uint64_t hashchop_rabin_out[256];
+extern const uint64_t hashchop_rabin_mod[256];
+#define HASHCHOP_BUZHASH_WINDOW 48
+extern const uint32_t hashchop_buzhash[256];
+
+/* Like hashchop_new, but find boundaries with ENGINE. Returns NULL on
+ * error (bad BITS value, or an engine window larger than the min chunk
+ * size). */
+T *hashchop_new_engine(uint8_t bits, const hashchop_engine *engine);
+
+/* Get the hashchopper's engine. */
+const hashchop_engine *hashchop_get_engine(const T *hc);
+
 /* Sink LENGTH bytes from DATA into the hashchopper.
  * 
  * Returns OVERFLOW if the data is too large to store (and should be added
@@ -45,17 +123,203 @@ hashchop_res hashchop_sink(T *hc, const unsigned char *data, size_t length);
  * is too large to fit in DATA, or OK if the chunk has been copied. */
 hashchop_res hashchop_poll(T *hc, unsigned char *data, size_t *length);
 
+/* Like hashchop_poll, but instead of copying the chunk out, point (*DATA)
+ * at it in the hashchopper's buffer, and write its length in (*LENGTH).
+ * The chunk stays valid until the next call on HC (other than the
+ * getters). Returns UNDERFLOW or OK, as for hashchop_poll. */
+hashchop_res hashchop_poll_view(T *hc, const unsigned char **data,
+    size_t *length);
+
 /* The end of the data stream has been reached, so write the remaining
  * buffered data into DATA, save its length in (*LENGTH), and
  * reset the hashchopper. Returns OK on success, or OVERFLOW if
  * (*LENGTH) says that DATA is too small to contain the data. */
 hashchop_res hashchop_finish(T *hc, unsigned char *data, size_t *length);
 
+/* Like hashchop_finish, but point (*DATA) at the remaining data in the
+ * hashchopper's buffer (valid until the next call on HC, as for
+ * hashchop_poll_view) instead of copying it. */
+void hashchop_finish_view(T *hc, const unsigned char **data, size_t *length);
+
+/* Find the end of the first chunk in LENGTH bytes of DATA, which start at
+ * a chunk boundary, without copying it. This gives the same chunks as
+ * sinking DATA into HC and polling until UNDERFLOW, then finishing: if
+ * LENGTH is less than the max chunk size, DATA is taken to be the end of
+ * the stream, and LENGTH is returned. HC's buffered data is not used or
+ * changed. To chop a whole buffer in place, call this repeatedly,
+ * advancing DATA by the returned length. */
+size_t hashchop_seam(const T *hc, const unsigned char *data, size_t length);
+
+/* Like calling hashchop_seam repeatedly: find the ends of up to
+ * MAX_ENDS successive chunks in LENGTH bytes of DATA (as offsets from
+ * DATA), and write them in ENDS. Returns the number found; if it's less
+ * than MAX_ENDS, the last end is LENGTH. */
+size_t hashchop_seams(const T *hc, const unsigned char *data, size_t length,
+    size_t *ends, size_t max_ends);
+
+/* Get the largest chunk size the hashchopper will produce. (Chunks
+ * returned by hashchop_finish can be larger if the stream was not
+ * polled until UNDERFLOW first.) */
+size_t hashchop_max_chunk(const T *hc);
+
+/* Multi-level chunking: with LEVELS levels, each chunk boundary also
+ * gets a level, from 0 to LEVELS - 1, as if it had matched a mask of
+ * BITS + level bits (extra bits, from a hash of the checksum, that are
+ * also 0 there). Each boundary at level L is also a boundary for every
+ * level below, and the boundaries at level L or above chop the stream
+ * into chunks about 2^L times as large -- so a hierarchy of chunk sizes
+ * costs one pass. Boundaries forced by the max chunk size are level 0.
+ * The chunks are the same as without levels.
+ *
+ * Set the number of levels, 1 (the default) to HASHCHOP_MAX_LEVELS.
+ * Returns OK, or OVERFLOW if LEVELS is out of range. */
+hashchop_res hashchop_set_levels(T *hc, uint8_t levels);
+
+/* Get the number of levels. */
+uint8_t hashchop_levels(const T *hc);
+
+/* Like hashchop_poll, but also write the chunk's level in (*LEVEL).
+ * The chunk from hashchop_finish ends every level. */
+hashchop_res hashchop_poll_level(T *hc, unsigned char *data, size_t *length,
+    uint8_t *level);
+
+/* Like hashchop_seam, but also write the chunk's level in (*LEVEL).
+ * The last chunk (when LENGTH is less than the max) is on the top level. */
+size_t hashchop_seam_level(const T *hc, const unsigned char *data,
+    size_t length, uint8_t *level);
+
+/* Record-aligned chunking: each content-defined seam is moved forward to
+ * just after the next record delimiter, unless there isn't one before
+ * the max chunk size, and each seam forced by the max chunk size is moved
+ * back to just after the last delimiter past the min chunk size, if any.
+ * This keeps records whole, and chunks line up on the same records when
+ * records are inserted or removed.
+ *
+ * Use DELIMITER (a byte value, such as '\n') to end records, or
+ * HASHCHOP_NO_DELIMITER (the default) to turn record alignment off. */
+#define HASHCHOP_NO_DELIMITER (-1)
+void hashchop_set_delimiter(T *hc, int delimiter);
+
+/* Callback to find the end of the first record in LENGTH bytes of DATA.
+ * Returns the offset of the record's last byte, or LENGTH if there is
+ * none. It should only look at DATA[0] to DATA[LENGTH - 1]. */
+typedef size_t (hashchop_delimiter_cb)(const unsigned char *data,
+    size_t length, void *udata);
+
+/* Use CB (called with UDATA) to find record ends, for records that don't
+ * end with a single byte. Replaces any delimiter byte; NULL turns record
+ * alignment off. */
+void hashchop_set_delimiter_cb(T *hc, hashchop_delimiter_cb *cb, void *udata);
+
+/* Number of chunk size histogram buckets: bucket N counts the chunks of
+ * 2^N to 2^(N+1) - 1 bytes (and bucket 0, empty chunks too). */
+#define HASHCHOP_STATS_BUCKETS 32
+
+/* Counters for the data that has passed through a hashchopper. */
+typedef struct hashchop_stats {
+    uint64_t bytes_in;          /* bytes sunk */
+    uint64_t chunks_out;        /* chunks polled or finished */
+    uint64_t forced_cuts;       /* chunks cut at the max size */
+    uint64_t finish_cuts;       /* non-empty chunks from hashchop_finish */
+    uint64_t full;              /* sinks that returned FULL */
+    uint64_t underflow;         /* polls that returned UNDERFLOW */
+    uint64_t bytes_moved;       /* bytes moved within the buffer */
+    uint64_t sizes[HASHCHOP_STATS_BUCKETS];   /* log2 size histogram */
+} hashchop_stats;
+
+/* Turn counting on (with all counters at 0) or off. It's off by default,
+ * and costs a branch per sink or poll call when off; it never touches
+ * the scanning loop. Only hashchop_sink, hashchop_poll (and
+ * hashchop_poll_level) and hashchop_finish are counted, not
+ * hashchop_seam. Returns OK, or MEMORY on alloc failure. */
+hashchop_res hashchop_set_stats(T *hc, int enabled);
+
+/* Write the counters in (*STATS); all 0 if counting is off. The counters
+ * are kept across hashchop_reset. */
+void hashchop_get_stats(const T *hc, hashchop_stats *stats);
+
+#ifdef HASHCHOP_TRACE
+#include <stdio.h>
+
+/* Per-phase timing, only when compiled with -DHASHCHOP_TRACE (otherwise
+ * none of this exists, and the phases aren't timed at all). */
+typedef enum hashchop_phase {
+    HASHCHOP_PHASE_SINK,        /* copying into the buffer, in sink */
+    HASHCHOP_PHASE_SCAN,        /* finding the next seam, in poll */
+    HASHCHOP_PHASE_MOVE,        /* moving the rest of the buffer down */
+    HASHCHOP_PHASE_COPY_OUT,    /* copying a chunk out, in poll/finish */
+    HASHCHOP_PHASES,
+} hashchop_phase;
+
+/* Totals per phase, since the hashchopper was created. */
+typedef struct hashchop_trace {
+    uint64_t calls[HASHCHOP_PHASES];
+    uint64_t bytes[HASHCHOP_PHASES];
+    uint64_t ns[HASHCHOP_PHASES];
+} hashchop_trace;
+
+/* Write the per-phase totals in (*TRACE). */
+void hashchop_get_trace(const T *hc, hashchop_trace *trace);
+
+/* Start recording a timeline of the next COUNT phases (replacing any
+ * earlier one), for hashchop_trace_dump. 0 stops recording.
+ * Returns OK, or MEMORY on alloc failure. */
+hashchop_res hashchop_trace_window(T *hc, size_t count);
+
+/* Write the recorded timeline to F, as Chrome trace event JSON (for
+ * chrome://tracing or Perfetto). Returns OK, or IO on write error. */
+hashchop_res hashchop_trace_dump(const T *hc, FILE *f);
+#endif
+
+/* Get the number of bytes sunk into the current stream (since the
+ * hashchopper was created, reset, or finished). The data still buffered
+ * is the end of it. */
+uint64_t hashchop_stream_offset(const T *hc);
+
+/* Checkpoints: save a hashchopper's state mid-stream, and restore it
+ * later (in another process, or on another platform), to resume the
+ * stream where it left off. The state is the config (bits, levels,
+ * engine and delimiter), the stream offset, and the buffered data that
+ * hasn't been polled yet; no rolling hash state survives between chunks,
+ * so the restored hashchopper finds the same boundaries as the original
+ * would have. Keep reading the stream from hashchop_stream_offset.
+ * Counters and traces aren't saved, and a delimiter callback has to be
+ * set again after restoring. */
+
+/* Get the size of HC's saved state. */
+size_t hashchop_state_size(const T *hc);
+
+/* Save HC's state into BUF, a buffer of at least (*LENGTH) bytes, and
+ * write its size in (*LENGTH). HC is unchanged. Returns OK, OVERFLOW if
+ * BUF is too small (see hashchop_state_size), or FORMAT if the engine's
+ * name is over 255 bytes. */
+hashchop_res hashchop_save_state(const T *hc, unsigned char *buf,
+    size_t *length);
+
+/* Create a hashchopper from LENGTH bytes of saved state in BUF. ENGINE
+ * is the engine to use, which must have the saved engine's name, or
+ * NULL to find the built-in engine by that name. Returns NULL if the
+ * state is malformed or corrupt, is from a newer version, or names an
+ * engine that can't be found, or on alloc failure. */
+T *hashchop_restore_state(const unsigned char *buf, size_t length,
+    const hashchop_engine *engine);
+
 /* Reset a hashchopper, so it can be used to chop a new data stream. */
 void hashchop_reset(T *hc);
 
 /* Free a hashchopper. */
 void hashchop_free(T *hc);
 
+/* 64-bit chunk fingerprint, used to identify chunks by content. */
+typedef uint64_t hashchop_fp;
+
+/* Get a fingerprint for LENGTH bytes of DATA. This is a fast, well-mixed
+ * non-cryptographic hash, and gives the same result on every platform. */
+hashchop_fp hashchop_fingerprint(const unsigned char *data, size_t length);
+
 #undef T
+
+#ifdef __cplusplus
+}
+#endif
 #endif
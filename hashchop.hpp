@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HASHCHOP_HPP
+#define HASHCHOP_HPP
+
+/* Header-only C++20 wrapper.
+ *
+ * chopper<Engine, Config> owns a hashchopper (freed on destruction), and
+ * takes std::span<const std::byte> input. Streaming goes through the C
+ * core's sink and poll_view; chopping a whole buffer in place (seam and
+ * chunks) runs ENGINE's scan with CONFIG's sizes and mask as compile-time
+ * constants. Either way, the chunks are the same as the C core's for
+ * the same bits. chunks() is a lazy range of views into the input, and
+ * nothing allocates after construction.
+ *
+ *     hashchop_cpp::chopper<> hc;              // rsync engine, 12 bits
+ *     for (std::span<const std::byte> c : hc.chunks(data)) { ... }
+ *
+ * Engine is a tag naming the rolling hash: rsync (the default), rabin or
+ * buzhash. Each gives its C engine (c_engine(), which the chopper is
+ * created with) and a cut<Config> for finding seams in place, so both
+ * paths find the same boundaries for any engine. Those three inline
+ * their scans here; c_engine_tag wraps any other hashchop_engine, but
+ * calls its scan through a pointer, without compile-time constants.
+ *
+ * It's in namespace hashchop_cpp, since the C handle type already has
+ * the name hashchop. Record alignment and levels aren't exposed here;
+ * use the C API. */
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <span>
+#include <utility>
+
+#include "hashchop.h"
+
+namespace hashchop_cpp {
+
+using bytes = std::span<const std::byte>;
+
+/* Chunk sizes for BITS mask bits, as hashchop_new sets them. */
+template <uint8_t BITS>
+struct config {
+    static_assert(BITS >= HASHCHOP_MIN_BITS && BITS <= HASHCHOP_MAX_BITS,
+        "bits out of range");
+    static constexpr uint8_t bits = BITS;
+    static constexpr uint32_t mask = (uint32_t(1) << BITS) - 1;
+    static constexpr uint32_t min = uint32_t(1) << (BITS - 2);
+    static constexpr uint32_t max = uint32_t(1) << (BITS + 2);
+};
+
+/* The C core's rolling checksum (see scan in hashchop.c). cut<Config>
+ * returns the end of the first chunk in BUF, which has at least
+ * Config::max bytes. */
+struct rsync {
+    static const hashchop_engine *c_engine() { return &hashchop_engine_rsync; }
+
+    template <class Config>
+    static uint32_t cut(const unsigned char *buf) {
+        constexpr uint32_t len = Config::min;
+        uint32_t a = 1, b = 0, i = 0;
+
+        for (i = 0; i < len; i++) {
+            unsigned char v = buf[i];
+            a += v;
+            b += (len - i + 1) * v;
+        }
+
+        for (i = len; i < Config::max; i++) {
+            unsigned char nk = buf[i - len], nl = buf[i];
+            uint32_t na = a - nk + nl;
+            uint32_t nb = b - (len + 1) * nk + na;
+            if (((na + (nb << 16)) & Config::mask) == 0) break;
+            a = na;
+            b = nb;
+        }
+        return i;
+    }
+};
+
+/* Rabin fingerprints, as hashchop_engine_rabin's scan, with its tables
+ * from hashchop.h. */
+struct rabin {
+    static const hashchop_engine *c_engine() { return &hashchop_engine_rabin; }
+
+    template <class Config>
+    static uint32_t cut(const unsigned char *buf) {
+        constexpr uint32_t window = HASHCHOP_RABIN_WINDOW;
+        static_assert(window <= Config::min, "window exceeds min chunk");
+        uint64_t h = 0;
+        for (uint32_t i = Config::min - window; i < Config::min; i++) {
+            h = ((h << 8) | buf[i])
+                ^ hashchop_rabin_mod[h >> HASHCHOP_RABIN_SHIFT];
+        }
+
+        uint32_t i = Config::min;
+        for (; i < Config::max; i++) {
+            h ^= hashchop_rabin_out[buf[i - window]];
+            h = ((h << 8) | buf[i])
+                ^ hashchop_rabin_mod[h >> HASHCHOP_RABIN_SHIFT];
+            if ((h & Config::mask) == 0) break;
+        }
+        return i;
+    }
+};
+
+/* Buzhash, as hashchop_engine_buzhash's scan, with its table from
+ * hashchop.h. */
+struct buzhash {
+    static const hashchop_engine *c_engine() {
+        return &hashchop_engine_buzhash;
+    }
+
+    template <class Config>
+    static uint32_t cut(const unsigned char *buf) {
+        constexpr uint32_t window = HASHCHOP_BUZHASH_WINDOW;
+        static_assert(window <= Config::min, "window exceeds min chunk");
+        uint32_t h = 0;
+        for (uint32_t i = Config::min - window; i < Config::min; i++) {
+            h = rotl(h, 1) ^ hashchop_buzhash[buf[i]];
+        }
+
+        uint32_t i = Config::min;
+        for (; i < Config::max; i++) {
+            uint32_t o = hashchop_buzhash[buf[i - window]];
+            h = rotl(h, 1) ^ rotl(o, window % 32) ^ hashchop_buzhash[buf[i]];
+            if ((h & Config::mask) == 0) break;
+        }
+        return i;
+    }
+
+private:
+    static constexpr uint32_t rotl(uint32_t x, unsigned n) {
+        return (x << n) | (x >> ((32 - n) & 31));
+    }
+};
+
+/* Any other C engine, found with its batch scan (or by rolling its
+ * hash, if it has none), as the C core does. Its functions are called
+ * through pointers, so Config's sizes and mask are only runtime
+ * arguments to them, not constants in the loop as for the engines
+ * above. */
+template <const hashchop_engine *E>
+struct c_engine_tag {
+    static const hashchop_engine *c_engine() { return E; }
+
+    template <class Config>
+    static uint32_t cut(const unsigned char *buf) {
+        uint64_t h = 0;
+        if (E->scan) {
+            return E->scan(buf, Config::min, Config::max, Config::mask, &h);
+        }
+        size_t window = E->window(Config::min);
+        h = E->init(buf + Config::min - window, window);
+        uint32_t i = Config::min;
+        for (; i < Config::max; i++) {
+            h = E->roll(h, window, buf[i - window], buf[i]);
+            if (E->is_boundary(h, Config::mask)) break;
+        }
+        return i;
+    }
+};
+
+/* A lazy range over the chunks of a buffer, as views into it. */
+template <class Engine, class Config>
+class chunk_range {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = bytes;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = bytes;
+
+        iterator() = default;
+        iterator(bytes rest) : rest_(rest) { len_ = seam(rest_); }
+
+        bytes operator*() const { return rest_.first(len_); }
+        iterator &operator++() {
+            rest_ = rest_.subspan(len_);
+            len_ = seam(rest_);
+            return *this;
+        }
+        iterator operator++(int) { iterator t = *this; ++*this; return t; }
+        bool operator==(std::default_sentinel_t) const { return rest_.empty(); }
+        bool operator==(const iterator &o) const {
+            return rest_.data() == o.rest_.data()
+                && rest_.size() == o.rest_.size();
+        }
+
+    private:
+        bytes rest_;
+        size_t len_ = 0;
+    };
+
+    chunk_range(bytes data) : data_(data) {}
+    iterator begin() const { return iterator(data_); }
+    std::default_sentinel_t end() const { return {}; }
+
+    /* Get the length of the first chunk in DATA, as hashchop_seam. */
+    static size_t seam(bytes data) {
+        if (data.size() < Config::max) return data.size();
+        return Engine::template cut<Config>(
+            reinterpret_cast<const unsigned char *>(data.data()));
+    }
+
+private:
+    bytes data_;
+};
+
+/* A hashchopper, with ENGINE's C engine. Throws std::invalid_argument
+ * if the engine's window is larger than Config's min chunk size, or
+ * std::bad_alloc if it can't be allocated. */
+template <class Engine = rsync, class Config = config<12>>
+class chopper {
+public:
+    using range = chunk_range<Engine, Config>;
+
+    chopper() : hc_(nullptr) {
+        const hashchop_engine *e = Engine::c_engine();
+        if (e->window(Config::min) > Config::min) {
+            throw std::invalid_argument("engine window exceeds min chunk");
+        }
+        hc_ = hashchop_new_engine(Config::bits, e);
+        if (hc_ == nullptr) throw std::bad_alloc();
+    }
+    ~chopper() { if (hc_) hashchop_free(hc_); }
+    chopper(chopper &&o) noexcept : hc_(std::exchange(o.hc_, nullptr)) {}
+    chopper &operator=(chopper &&o) noexcept {
+        std::swap(hc_, o.hc_);
+        return *this;
+    }
+    chopper(const chopper &) = delete;
+    chopper &operator=(const chopper &) = delete;
+
+    static constexpr size_t max_chunk() { return Config::max; }
+
+    /* Sink DATA, as hashchop_sink: OK, OVERFLOW or FULL. */
+    hashchop_res sink(bytes data) {
+        return hashchop_sink(hc_,
+            reinterpret_cast<const unsigned char *>(data.data()), data.size());
+    }
+
+    /* Point CHUNK at the next chunk in the buffer, as hashchop_poll_view
+     * (valid until the next call). Returns false on UNDERFLOW. */
+    bool poll(bytes &chunk) {
+        const unsigned char *p = nullptr;
+        size_t len = 0;
+        if (hashchop_poll_view(hc_, &p, &len) != HASHCHOP_OK) return false;
+        chunk = bytes(reinterpret_cast<const std::byte *>(p), len);
+        return true;
+    }
+
+    /* Get the rest of the stream, as hashchop_finish_view, and reset. */
+    bytes finish() {
+        const unsigned char *p = nullptr;
+        size_t len = 0;
+        hashchop_finish_view(hc_, &p, &len);
+        return bytes(reinterpret_cast<const std::byte *>(p), len);
+    }
+
+    void reset() { hashchop_reset(hc_); }
+
+    /* Get the length of the first chunk in DATA, which starts at a chunk
+     * boundary, as hashchop_seam. The buffered stream isn't touched. */
+    static size_t seam(bytes data) { return range::seam(data); }
+
+    /* Get a lazy range of DATA's chunks, as views into it. */
+    static range chunks(bytes data) { return range(data); }
+
+    /* The C handle, for the rest of the C API. */
+    hashchop *get() const { return hc_; }
+
+private:
+    hashchop *hc_;
+};
+
+}  /* namespace hashchop_cpp */
+
+#endif
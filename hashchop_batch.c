@@ -0,0 +1,173 @@
+/* 
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *  
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "hashchop.h"
+#include "hashchop_batch.h"
+
+/* Don't start a thread for less than this much data. */
+#define MIN_THREAD_BYTES (4L * 1024L * 1024L)
+#define MAX_THREADS 64
+
+/* One thread's share of a batch: OBJECTS[first, last), with ends
+ * written from ENDS[ends_first] on. */
+typedef struct {
+    const hashchop *hc;
+    const hashchop_object *objects;
+    hashchop_batch_result *results;
+    size_t *ends;
+    size_t first;
+    size_t last;
+    size_t ends_first;
+    size_t ends_limit;
+    size_t ends_used;           /* out */
+    hashchop_res res;           /* out */
+} part;
+
+/* Get the number of chunk ends an object of LENGTH bytes could have. */
+static size_t max_ends_for(size_t min, size_t length) {
+    return (length == 0 ? 0 : length / min + 1);
+}
+
+/* Get the number of chunk ends that N OBJECTS could have. */
+size_t hashchop_batch_max_ends(const hashchop *hc,
+        const hashchop_object *objects, size_t n) {
+    size_t min = hashchop_max_chunk(hc) / 16, total = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += max_ends_for(min, objects[i].length);
+    }
+    return total;
+}
+
+/* Chop one part's objects, in order. */
+static void chop_part(part *p) {
+    size_t max = hashchop_max_chunk(p->hc);
+    size_t e = p->ends_first;
+    p->res = HASHCHOP_OK;
+    for (size_t i = p->first; i < p->last; i++) {
+        const hashchop_object *o = &p->objects[i];
+        hashchop_batch_result *r = &p->results[i];
+        r->first = e;
+        if (o->length < max) {  /* one chunk, or none */
+            if (o->length > 0) {
+                if (e == p->ends_limit) {
+                    p->res = HASHCHOP_ERROR_OVERFLOW;
+                    break;
+                }
+                p->ends[e++] = o->length;
+            }
+            r->count = e - r->first;
+            continue;
+        }
+        size_t room = p->ends_limit - e;
+        size_t ct = hashchop_seams(p->hc, o->data, o->length, p->ends + e,
+            room);
+        if (ct == room && (ct == 0 || p->ends[e + ct - 1] != o->length)) {
+            p->res = HASHCHOP_ERROR_OVERFLOW;
+            break;
+        }
+        r->count = ct;
+        e += ct;
+    }
+    p->ends_used = e - p->ends_first;
+}
+
+static void *run_part(void *udata) {
+    chop_part(udata);
+    return NULL;
+}
+
+/* Chop N objects, possibly across threads. Each thread gets a run of
+ * objects with about the same number of bytes, and room for as many
+ * ends as they could have; afterward, the runs of ends are moved down
+ * to be contiguous. */
+hashchop_res hashchop_chop_batch(const hashchop *hc,
+        const hashchop_object *objects, size_t n, hashchop_batch_result *results,
+        size_t *ends, size_t max_ends, int threads) {
+    part parts[MAX_THREADS];
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++) total += objects[i].length;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    if (threads > 1 && total / MIN_THREAD_BYTES < (uint64_t)threads) {
+        threads = total / MIN_THREAD_BYTES;
+    }
+    if (threads > 1 && hashchop_batch_max_ends(hc, objects, n) > max_ends) {
+        threads = 1;
+    }
+
+    if (threads <= 1) {
+        part p = { hc, objects, results, ends, 0, n, 0, max_ends, 0, 0 };
+        chop_part(&p);
+        return p.res;
+    }
+
+    size_t min = hashchop_max_chunk(hc) / 16;
+    size_t i = 0, e = 0;
+    uint64_t done = 0;
+    for (int t = 0; t < threads; t++) {
+        part *p = &parts[t];
+        uint64_t goal = total * (t + 1) / threads;
+        p->hc = hc;
+        p->objects = objects;
+        p->results = results;
+        p->ends = ends;
+        p->first = i;
+        p->ends_first = e;
+        while (i < n && (done < goal || t == threads - 1)) {
+            done += objects[i].length;
+            e += max_ends_for(min, objects[i].length);
+            i++;
+        }
+        p->last = i;
+        p->ends_limit = e;
+    }
+
+    pthread_t tids[MAX_THREADS];
+    int started = 0;
+    hashchop_res res = HASHCHOP_OK;
+    for (; started < threads - 1; started++) {
+        if (pthread_create(&tids[started], NULL, run_part,
+                &parts[started + 1]) != 0) {
+            res = HASHCHOP_ERROR_MEMORY;
+            break;
+        }
+    }
+    if (res == HASHCHOP_OK) chop_part(&parts[0]);
+    for (int t = 0; t < started; t++) pthread_join(tids[t], NULL);
+    if (res != HASHCHOP_OK) return res;
+
+    size_t used = parts[0].ends_used;
+    for (int t = 1; t < threads; t++) {
+        part *p = &parts[t];
+        if (p->first == p->last) continue;
+        size_t shift = p->ends_first - used;
+        if (shift > 0) {
+            memmove(ends + used, ends + p->ends_first,
+                p->ends_used * sizeof(size_t));
+            for (size_t j = p->first; j < p->last; j++) {
+                results[j].first -= shift;
+            }
+        }
+        used += p->ends_used;
+    }
+    return HASHCHOP_OK;
+}
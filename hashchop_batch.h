@@ -0,0 +1,51 @@
+#ifndef HASHCHOP_BATCH_H
+#define HASHCHOP_BATCH_H
+
+#include "hashchop.h"
+
+/* Chopping many independent objects in one call.
+ *
+ * For small objects (a few KB), resetting a chopper and sinking, polling
+ * and finishing each one costs more than finding its seams: every call
+ * copies the object through the chopper's buffer. A batch chops each
+ * object in place, as hashchop_seams, with one chopper's settings
+ * (bits, engine, levels and record alignment), and writes all of their
+ * chunk ends into one flat array. Objects under the max chunk size are
+ * one chunk each, without scanning. Large batches can be split across
+ * threads, since chopping in place doesn't change the chopper. */
+
+/* One object to chop. */
+typedef struct hashchop_object {
+    const unsigned char *data;
+    size_t length;
+} hashchop_object;
+
+/* Where an object's chunk ends are in the flat array: ENDS[FIRST] to
+ * ENDS[FIRST + COUNT - 1], as offsets from the object's start. An empty
+ * object has no chunks. */
+typedef struct hashchop_batch_result {
+    size_t first;
+    size_t count;
+} hashchop_batch_result;
+
+/* Get the number of chunk ends that N OBJECTS could have when chopped
+ * by HC, at most. (Every chunk but an object's last is at least the min
+ * chunk size, a 16th of the max.) */
+size_t hashchop_batch_max_ends(const hashchop *hc,
+    const hashchop_object *objects, size_t n);
+
+/* Chop N OBJECTS with HC's settings, write the ends of each one's chunks
+ * in ENDS (with room for MAX_ENDS) in order, and where they are in
+ * RESULTS (with room for N). HC's buffered data is not used or changed.
+ *
+ * THREADS is the most threads to use (1 or less: chop in this thread).
+ * Threads are only used when ENDS has room for hashchop_batch_max_ends,
+ * and each gets at least a few MB of data.
+ *
+ * Returns OK, OVERFLOW if ENDS runs out of room (RESULTS is only filled
+ * in for the objects before it), or MEMORY if threads can't be started. */
+hashchop_res hashchop_chop_batch(const hashchop *hc,
+    const hashchop_object *objects, size_t n, hashchop_batch_result *results,
+    size_t *ends, size_t max_ends, int threads);
+
+#endif
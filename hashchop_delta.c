@@ -0,0 +1,339 @@
+/*
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "hashchop.h"
+#include "hashchop_internal.h"
+#include "hashchop_delta.h"
+
+/* Abbreviations. */
+typedef uint32_t UI;
+typedef uint8_t UC;
+#define S hashchop_sig
+
+/* Signature encoding: a header, then a record per chunk.
+ *     0  "hcsg"
+ *     4  version (1 byte), bits (1 byte), 2 bytes unused
+ *     8  chunk count (8 bytes)
+ *    16  basis length (8 bytes)
+ * Records are a fingerprint (8 bytes) and a length (4 bytes). */
+#define SIG_MAGIC "hcsg"
+#define SIG_VERSION 1
+#define SIG_HDR_SZ 24
+#define SIG_REC_SZ 12
+
+/* Delta encoding: a header, then ops until the end.
+ *     0  "hcdl"
+ *     4  version (1 byte), 3 bytes unused
+ *     8  target length (8 bytes)
+ *    16  target fingerprint (8 bytes)
+ * A copy op is 'C', a basis offset (8 bytes), and a length (4 bytes).
+ * A literal op is 'L', a length (4 bytes), and that many bytes. */
+#define DELTA_MAGIC "hcdl"
+#define DELTA_VERSION 1
+#define DELTA_HDR_SZ 24
+#define OP_COPY 'C'
+#define OP_LITERAL 'L'
+#define COPY_SZ 13
+#define LITERAL_HDR_SZ 5
+#define OP_MAX_LEN UINT32_MAX
+
+struct hashchop_sig {
+    uint8_t bits;
+    size_t count;               /* chunks */
+    size_t limit;               /* room for chunks */
+    uint64_t length;            /* basis length */
+    hashchop_fp *fps;
+    UI *lens;
+    uint64_t *offsets;          /* offset of each chunk in the basis */
+    UI *table;                  /* open-addressing index, chunk index + 1 */
+    size_t table_sz;            /* power of 2, at least 2 * count */
+};
+
+/* Allocate a signature with room for COUNT chunks. */
+static S *sig_alloc(uint8_t bits, size_t count) {
+    S *s = hashchop_alloc(sizeof(*s));
+    if (s == NULL) return NULL;
+    memset(s, 0, sizeof(*s));
+    s->bits = bits;
+    s->count = count;
+    s->limit = (count ? count : 1);
+    s->table_sz = 16;
+    while (s->table_sz < 2 * count) s->table_sz *= 2;
+    size_t n = s->limit;
+    s->fps = hashchop_alloc(n * sizeof(hashchop_fp));
+    s->lens = hashchop_alloc(n * sizeof(UI));
+    s->offsets = hashchop_alloc(n * sizeof(uint64_t));
+    s->table = hashchop_alloc(s->table_sz * sizeof(UI));
+    if (s->fps == NULL || s->lens == NULL || s->offsets == NULL
+        || s->table == NULL) {
+        hashchop_sig_free(s);
+        return NULL;
+    }
+    memset(s->table, 0, s->table_sz * sizeof(UI));
+    return s;
+}
+
+/* Fill in the offsets and index, once the fingerprints and lengths are
+ * set. If a fingerprint appears more than once, the first is indexed. */
+static void sig_index(S *s) {
+    uint64_t off = 0;
+    size_t mask = s->table_sz - 1;
+    for (size_t i = 0; i < s->count; i++) {
+        s->offsets[i] = off;
+        off += s->lens[i];
+        size_t b = s->fps[i] & mask;
+        while (s->table[b] != 0) {
+            if (s->fps[s->table[b] - 1] == s->fps[i]) break;
+            b = (b + 1) & mask;
+        }
+        if (s->table[b] == 0) s->table[b] = i + 1;
+    }
+    s->length = off;
+}
+
+/* Find the chunk with fingerprint FP. Returns its index + 1, or 0. */
+static size_t sig_lookup(const S *s, hashchop_fp fp) {
+    size_t mask = s->table_sz - 1;
+    for (size_t b = fp & mask; s->table[b] != 0; b = (b + 1) & mask) {
+        if (s->fps[s->table[b] - 1] == fp) return s->table[b];
+    }
+    return 0;
+}
+
+/* Chop LENGTH bytes of DATA with 2^BITS-byte average chunks, and return
+ * its signature. */
+S *hashchop_sig_build(uint8_t bits, const unsigned char *data, size_t length) {
+    hashchop *hc = hashchop_new(bits);
+    if (hc == NULL) return NULL;
+
+    /* Chunks other than the last are at least 1/4 the average size. */
+    size_t max_count = length / (1 << (bits - 2)) + 1;
+    S *s = sig_alloc(bits, max_count);
+    if (s == NULL) { hashchop_free(hc); return NULL; }
+
+    size_t pos = 0, n = 0;
+    while (pos < length) {
+        size_t sz = hashchop_seam(hc, data + pos, length - pos);
+        s->fps[n] = hashchop_fingerprint(data + pos, sz);
+        s->lens[n] = sz;
+        n++;
+        pos += sz;
+    }
+    s->count = n;
+    sig_index(s);
+    hashchop_free(hc);
+    return s;
+}
+
+/* Get the number of chunks in a signature. */
+size_t hashchop_sig_count(const S *s) { return s->count; }
+
+/* Get the size of a signature's encoding. */
+size_t hashchop_sig_size(const S *s) {
+    return SIG_HDR_SZ + s->count * SIG_REC_SZ;
+}
+
+/* Encode a signature into BUF. */
+hashchop_res hashchop_sig_encode(const S *s, unsigned char *buf,
+        size_t *length) {
+    size_t sz = hashchop_sig_size(s);
+    if (*length < sz) return HASHCHOP_ERROR_OVERFLOW;
+    memset(buf, 0, SIG_HDR_SZ);
+    memcpy(buf, SIG_MAGIC, 4);
+    buf[4] = SIG_VERSION;
+    buf[5] = s->bits;
+    hashchop_put_le64(buf + 8, s->count);
+    hashchop_put_le64(buf + 16, s->length);
+    UC *p = buf + SIG_HDR_SZ;
+    for (size_t i = 0; i < s->count; i++) {
+        hashchop_put_le64(p, s->fps[i]);
+        hashchop_put_le32(p + 8, s->lens[i]);
+        p += SIG_REC_SZ;
+    }
+    *length = sz;
+    return HASHCHOP_OK;
+}
+
+/* Decode a signature from LENGTH bytes of BUF. */
+S *hashchop_sig_decode(const unsigned char *buf, size_t length) {
+    if (length < SIG_HDR_SZ || memcmp(buf, SIG_MAGIC, 4) != 0
+        || buf[4] != SIG_VERSION) return NULL;
+    uint8_t bits = buf[5];
+    uint64_t count = hashchop_get_le64(buf + 8);
+    if (bits < HASHCHOP_MIN_BITS || bits > HASHCHOP_MAX_BITS) return NULL;
+    if (count != (length - SIG_HDR_SZ) / SIG_REC_SZ
+        || (length - SIG_HDR_SZ) % SIG_REC_SZ != 0) return NULL;
+
+    S *s = sig_alloc(bits, count);
+    if (s == NULL) return NULL;
+    const UC *p = buf + SIG_HDR_SZ;
+    for (size_t i = 0; i < count; i++) {
+        s->fps[i] = hashchop_get_le64(p);
+        s->lens[i] = hashchop_get_le32(p + 8);
+        p += SIG_REC_SZ;
+    }
+    sig_index(s);
+    if (s->length != hashchop_get_le64(buf + 16)) {
+        hashchop_sig_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+/* Free a signature. */
+void hashchop_sig_free(S *s) {
+    size_t n = s->limit;
+    if (s->fps) hashchop_dealloc(s->fps, n * sizeof(hashchop_fp));
+    if (s->lens) hashchop_dealloc(s->lens, n * sizeof(UI));
+    if (s->offsets) hashchop_dealloc(s->offsets, n * sizeof(uint64_t));
+    if (s->table) hashchop_dealloc(s->table, s->table_sz * sizeof(UI));
+    hashchop_dealloc(s, sizeof(*s));
+}
+
+/* Get an upper bound on the size of the delta to LENGTH bytes of new
+ * data: at worst, one op per chunk, and every byte sent as a literal. */
+size_t hashchop_delta_bound(const S *sig, size_t length) {
+    size_t max_count = length / (1 << (sig->bits - 2)) + 1;
+    return DELTA_HDR_SZ + max_count * COPY_SZ + length;
+}
+
+/* Encode the delta from the basis with signature SIG to LENGTH bytes of
+ * DATA into DELTA. */
+hashchop_res hashchop_delta_encode(const S *sig,
+        const unsigned char *data, size_t length,
+        unsigned char *delta, size_t *delta_length,
+        hashchop_delta_stats *stats) {
+    hashchop_delta_stats st;
+    memset(&st, 0, sizeof(st));
+    if (*delta_length < DELTA_HDR_SZ) return HASHCHOP_ERROR_OVERFLOW;
+    hashchop *hc = hashchop_new(sig->bits);
+    if (hc == NULL) return HASHCHOP_ERROR_MEMORY;
+
+    size_t limit = *delta_length, o = DELTA_HDR_SZ, pos = 0;
+    UC *last_op = NULL;         /* last op, for merging */
+    uint64_t copy_end = 0;      /* basis offset after the last copy op */
+    hashchop_res res = HASHCHOP_OK;
+
+    while (pos < length) {
+        size_t sz = hashchop_seam(hc, data + pos, length - pos);
+        size_t idx = sig_lookup(sig, hashchop_fingerprint(data + pos, sz));
+        if (idx != 0 && sig->lens[idx - 1] == sz) {
+            uint64_t off = sig->offsets[idx - 1];
+            if (last_op && last_op[0] == OP_COPY && copy_end == off
+                && hashchop_get_le32(last_op + 9) + sz <= OP_MAX_LEN) {
+                hashchop_put_le32(last_op + 9,
+                    hashchop_get_le32(last_op + 9) + sz);
+            } else {
+                if (o + COPY_SZ > limit) { res = HASHCHOP_ERROR_OVERFLOW; break; }
+                last_op = delta + o;
+                last_op[0] = OP_COPY;
+                hashchop_put_le64(last_op + 1, off);
+                hashchop_put_le32(last_op + 9, sz);
+                o += COPY_SZ;
+                st.copy_ops++;
+            }
+            copy_end = off + sz;
+            st.copy_bytes += sz;
+        } else {
+            if (last_op && last_op[0] == OP_LITERAL
+                && hashchop_get_le32(last_op + 1) + sz <= OP_MAX_LEN) {
+                if (o + sz > limit) { res = HASHCHOP_ERROR_OVERFLOW; break; }
+                hashchop_put_le32(last_op + 1,
+                    hashchop_get_le32(last_op + 1) + sz);
+            } else {
+                if (o + LITERAL_HDR_SZ + sz > limit) {
+                    res = HASHCHOP_ERROR_OVERFLOW;
+                    break;
+                }
+                last_op = delta + o;
+                last_op[0] = OP_LITERAL;
+                hashchop_put_le32(last_op + 1, sz);
+                o += LITERAL_HDR_SZ;
+                st.literal_ops++;
+            }
+            memcpy(delta + o, data + pos, sz);
+            o += sz;
+            st.literal_bytes += sz;
+        }
+        pos += sz;
+    }
+    hashchop_free(hc);
+    if (res != HASHCHOP_OK) return res;
+
+    memset(delta, 0, DELTA_HDR_SZ);
+    memcpy(delta, DELTA_MAGIC, 4);
+    delta[4] = DELTA_VERSION;
+    hashchop_put_le64(delta + 8, length);
+    hashchop_put_le64(delta + 16, hashchop_fingerprint(data, length));
+    *delta_length = o;
+    if (stats) *stats = st;
+    return HASHCHOP_OK;
+}
+
+/* Get the length of the data a delta rebuilds. */
+hashchop_res hashchop_delta_target_length(const unsigned char *delta,
+        size_t delta_length, size_t *length) {
+    if (delta_length < DELTA_HDR_SZ || memcmp(delta, DELTA_MAGIC, 4) != 0
+        || delta[4] != DELTA_VERSION) return HASHCHOP_ERROR_FORMAT;
+    uint64_t len = hashchop_get_le64(delta + 8);
+    if (len > SIZE_MAX) return HASHCHOP_ERROR_FORMAT;
+    *length = len;
+    return HASHCHOP_OK;
+}
+
+/* Apply DELTA_LENGTH bytes of DELTA to BASIS_LENGTH bytes of BASIS. */
+hashchop_res hashchop_delta_apply(const unsigned char *basis,
+        size_t basis_length, const unsigned char *delta, size_t delta_length,
+        unsigned char *out, size_t *out_length) {
+    size_t target = 0;
+    hashchop_res res = hashchop_delta_target_length(delta, delta_length,
+        &target);
+    if (res != HASHCHOP_OK) return res;
+    if (*out_length < target) return HASHCHOP_ERROR_OVERFLOW;
+
+    size_t i = DELTA_HDR_SZ, o = 0;
+    while (i < delta_length) {
+        const UC *op = delta + i;
+        if (op[0] == OP_COPY && delta_length - i >= COPY_SZ) {
+            uint64_t off = hashchop_get_le64(op + 1);
+            size_t len = hashchop_get_le32(op + 9);
+            if (off > basis_length || len > basis_length - off
+                || len > target - o) return HASHCHOP_ERROR_FORMAT;
+            memcpy(out + o, basis + off, len);
+            i += COPY_SZ;
+            o += len;
+        } else if (op[0] == OP_LITERAL && delta_length - i >= LITERAL_HDR_SZ) {
+            size_t len = hashchop_get_le32(op + 1);
+            i += LITERAL_HDR_SZ;
+            if (len > delta_length - i || len > target - o) {
+                return HASHCHOP_ERROR_FORMAT;
+            }
+            memcpy(out + o, delta + i, len);
+            i += len;
+            o += len;
+        } else {
+            return HASHCHOP_ERROR_FORMAT;
+        }
+    }
+    if (o != target || hashchop_fingerprint(out, o) != hashchop_get_le64(delta + 16)) {
+        return HASHCHOP_ERROR_FORMAT;
+    }
+    *out_length = o;
+    return HASHCHOP_OK;
+}
@@ -0,0 +1,88 @@
+#ifndef HASHCHOP_DELTA_H
+#define HASHCHOP_DELTA_H
+
+#include "hashchop.h"
+
+/* Chunk-based delta sync.
+ *
+ * The receiver, which has an old version of some data (the basis), sends
+ * its signature: the fingerprint and length of each of its chunks. The
+ * sender chops its new version with the same settings, and sends a delta:
+ * a copy op for each chunk the receiver already has (adjacent copies are
+ * merged), and a literal op with the bytes of each chunk it doesn't.
+ * The receiver applies the delta to its basis to rebuild the new version.
+ *
+ * Both are plain byte strings, so they can go over any transport.
+ * Chunks are matched by fingerprint alone; the delta also carries the
+ * length and fingerprint of the whole new version, which are checked after
+ * applying it. All integers are little-endian. */
+
+/* Opaque signature handle. */
+typedef struct hashchop_sig hashchop_sig;
+
+/* Counters for the ops in a delta. */
+typedef struct hashchop_delta_stats {
+    size_t copy_ops;            /* copy ops, after merging */
+    size_t copy_bytes;          /* bytes copied from the basis */
+    size_t literal_ops;         /* literal ops, after merging */
+    size_t literal_bytes;       /* bytes sent in the delta */
+} hashchop_delta_stats;
+
+#define S hashchop_sig
+
+/* Chop LENGTH bytes of DATA with 2^BITS-byte average chunks, and return
+ * its signature. Returns NULL on error (bad BITS value, or alloc
+ * failure). */
+S *hashchop_sig_build(uint8_t bits, const unsigned char *data, size_t length);
+
+/* Get the number of chunks in a signature. */
+size_t hashchop_sig_count(const S *s);
+
+/* Get the size of a signature's encoding. */
+size_t hashchop_sig_size(const S *s);
+
+/* Encode a signature into BUF, a buffer of at least (*LENGTH) bytes, and
+ * write the encoded size in (*LENGTH). Returns OK, or OVERFLOW if BUF
+ * is too small. */
+hashchop_res hashchop_sig_encode(const S *s, unsigned char *buf,
+    size_t *length);
+
+/* Decode a signature from LENGTH bytes of BUF. Returns NULL if it is
+ * malformed, or on alloc failure. */
+S *hashchop_sig_decode(const unsigned char *buf, size_t length);
+
+/* Free a signature. */
+void hashchop_sig_free(S *s);
+
+/* Get an upper bound on the size of the delta from the basis with
+ * signature SIG to LENGTH bytes of new data. */
+size_t hashchop_delta_bound(const S *sig, size_t length);
+
+/* Encode the delta from the basis with signature SIG to LENGTH bytes of
+ * DATA into DELTA, a buffer of at least (*DELTA_LENGTH) bytes, and write
+ * the delta's size in (*DELTA_LENGTH). DATA is chopped with the same
+ * settings as the basis. If STATS is non-NULL, the delta's op counts
+ * are written there. Returns OK, OVERFLOW if DELTA is too small (see
+ * hashchop_delta_bound), or MEMORY on alloc failure. */
+hashchop_res hashchop_delta_encode(const S *sig,
+    const unsigned char *data, size_t length,
+    unsigned char *delta, size_t *delta_length,
+    hashchop_delta_stats *stats);
+
+/* Get the length of the data a delta rebuilds, and write it in (*LENGTH).
+ * Returns OK, or FORMAT if the delta header is malformed. */
+hashchop_res hashchop_delta_target_length(const unsigned char *delta,
+    size_t delta_length, size_t *length);
+
+/* Apply DELTA_LENGTH bytes of DELTA to BASIS_LENGTH bytes of BASIS, writing
+ * the new data into OUT, a buffer of at least (*OUT_LENGTH) bytes, and
+ * write its length in (*OUT_LENGTH). Returns OK, OVERFLOW if OUT is too
+ * small (see hashchop_delta_target_length), or FORMAT if the delta is
+ * malformed or the result doesn't match it (e.g. it was made for a
+ * different basis). */
+hashchop_res hashchop_delta_apply(const unsigned char *basis,
+    size_t basis_length, const unsigned char *delta, size_t delta_length,
+    unsigned char *out, size_t *out_length);
+
+#undef S
+#endif
@@ -0,0 +1,349 @@
+/* 
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *  
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include "hashchop.h"
+
+/* Rolling hash engines other than the default rsync checksum: Rabin
+ * fingerprints and Buzhash. Each has a fixed window, and a batch scan
+ * that inlines its roll. */
+
+typedef uint8_t UC;
+
+/* Rabin fingerprints: the window's bytes, as a polynomial over GF(2),
+ * mod an irreducible polynomial P of degree 53, as in LBFS and restic.
+ * Appending a byte shifts the hash up 8 bits, and RABIN_MOD[top 8 bits]
+ * both clears them and adds their remainder mod P. Dropping the byte
+ * leaving the window subtracts (XORs) RABIN_OUT[byte], which is the
+ * hash of that byte followed by RABIN_WINDOW - 1 zero bytes.
+ *
+ * Tables for P = 0x3DA3358B4DC173. They're declared in hashchop.h, so
+ * hashchop.hpp can inline the scan. */
+#define RABIN_WINDOW HASHCHOP_RABIN_WINDOW
+#define RABIN_SHIFT HASHCHOP_RABIN_SHIFT
+#define RABIN_OUT hashchop_rabin_out
+#define RABIN_MOD hashchop_rabin_mod
+
+const uint64_t hashchop_rabin_out[256] = {
+    0x00000000000000ULL, 0x17eb4232e19216ULL, 0x1275b1ee8ee55fULL,
+    0x059ef3dc6f7749ULL, 0x19485656500bcdULL, 0x0ea31464b199dbULL,
+    0x0b3de7b8deee92ULL, 0x1cd6a58a3f7c84ULL, 0x0f339927edd6e9ULL,
+    0x18d8db150c44ffULL, 0x1d4628c96333b6ULL, 0x0aad6afb82a1a0ULL,
+    0x167bcf71bddd24ULL, 0x01908d435c4f32ULL, 0x040e7e9f33387bULL,
+    0x13e53cadd2aa6dULL, 0x1e67324fdbadd2ULL, 0x098c707d3a3fc4ULL,
+    0x0c1283a155488dULL, 0x1bf9c193b4da9bULL, 0x072f64198ba61fULL,
+    0x10c4262b6a3409ULL, 0x155ad5f7054340ULL, 0x02b197c5e4d156ULL,
+    0x1154ab68367b3bULL, 0x06bfe95ad7e92dULL, 0x03211a86b89e64ULL,
+    0x14ca58b4590c72ULL, 0x081cfd3e6670f6ULL, 0x1ff7bf0c87e2e0ULL,
+    0x1a694cd0e895a9ULL, 0x0d820ee20907bfULL, 0x016d5114fa9ad7ULL,
+    0x168613261b08c1ULL, 0x1318e0fa747f88ULL, 0x04f3a2c895ed9eULL,
+    0x18250742aa911aULL, 0x0fce45704b030cULL, 0x0a50b6ac247445ULL,
+    0x1dbbf49ec5e653ULL, 0x0e5ec833174c3eULL, 0x19b58a01f6de28ULL,
+    0x1c2b79dd99a961ULL, 0x0bc03bef783b77ULL, 0x17169e654747f3ULL,
+    0x00fddc57a6d5e5ULL, 0x05632f8bc9a2acULL, 0x12886db92830baULL,
+    0x1f0a635b213705ULL, 0x08e12169c0a513ULL, 0x0d7fd2b5afd25aULL,
+    0x1a9490874e404cULL, 0x0642350d713cc8ULL, 0x11a9773f90aedeULL,
+    0x143784e3ffd997ULL, 0x03dcc6d11e4b81ULL, 0x1039fa7ccce1ecULL,
+    0x07d2b84e2d73faULL, 0x024c4b924204b3ULL, 0x15a709a0a396a5ULL,
+    0x0971ac2a9cea21ULL, 0x1e9aee187d7837ULL, 0x1b041dc4120f7eULL,
+    0x0cef5ff6f39d68ULL, 0x02daa229f535aeULL, 0x1531e01b14a7b8ULL,
+    0x10af13c77bd0f1ULL, 0x074451f59a42e7ULL, 0x1b92f47fa53e63ULL,
+    0x0c79b64d44ac75ULL, 0x09e745912bdb3cULL, 0x1e0c07a3ca492aULL,
+    0x0de93b0e18e347ULL, 0x1a02793cf97151ULL, 0x1f9c8ae0960618ULL,
+    0x0877c8d277940eULL, 0x14a16d5848e88aULL, 0x034a2f6aa97a9cULL,
+    0x06d4dcb6c60dd5ULL, 0x113f9e84279fc3ULL, 0x1cbd90662e987cULL,
+    0x0b56d254cf0a6aULL, 0x0ec82188a07d23ULL, 0x192363ba41ef35ULL,
+    0x05f5c6307e93b1ULL, 0x121e84029f01a7ULL, 0x178077def076eeULL,
+    0x006b35ec11e4f8ULL, 0x138e0941c34e95ULL, 0x04654b7322dc83ULL,
+    0x01fbb8af4dabcaULL, 0x1610fa9dac39dcULL, 0x0ac65f17934558ULL,
+    0x1d2d1d2572d74eULL, 0x18b3eef91da007ULL, 0x0f58accbfc3211ULL,
+    0x03b7f33d0faf79ULL, 0x145cb10fee3d6fULL, 0x11c242d3814a26ULL,
+    0x062900e160d830ULL, 0x1affa56b5fa4b4ULL, 0x0d14e759be36a2ULL,
+    0x088a1485d141ebULL, 0x1f6156b730d3fdULL, 0x0c846a1ae27990ULL,
+    0x1b6f282803eb86ULL, 0x1ef1dbf46c9ccfULL, 0x091a99c68d0ed9ULL,
+    0x15cc3c4cb2725dULL, 0x02277e7e53e04bULL, 0x07b98da23c9702ULL,
+    0x1052cf90dd0514ULL, 0x1dd0c172d402abULL, 0x0a3b83403590bdULL,
+    0x0fa5709c5ae7f4ULL, 0x184e32aebb75e2ULL, 0x04989724840966ULL,
+    0x1373d516659b70ULL, 0x16ed26ca0aec39ULL, 0x010664f8eb7e2fULL,
+    0x12e3585539d442ULL, 0x05081a67d84654ULL, 0x0096e9bbb7311dULL,
+    0x177dab8956a30bULL, 0x0bab0e0369df8fULL, 0x1c404c31884d99ULL,
+    0x19debfede73ad0ULL, 0x0e35fddf06a8c6ULL, 0x05b54453ea6b5cULL,
+    0x125e06610bf94aULL, 0x17c0f5bd648e03ULL, 0x002bb78f851c15ULL,
+    0x1cfd1205ba6091ULL, 0x0b1650375bf287ULL, 0x0e88a3eb3485ceULL,
+    0x1963e1d9d517d8ULL, 0x0a86dd7407bdb5ULL, 0x1d6d9f46e62fa3ULL,
+    0x18f36c9a8958eaULL, 0x0f182ea868cafcULL, 0x13ce8b2257b678ULL,
+    0x0425c910b6246eULL, 0x01bb3accd95327ULL, 0x165078fe38c131ULL,
+    0x1bd2761c31c68eULL, 0x0c39342ed05498ULL, 0x09a7c7f2bf23d1ULL,
+    0x1e4c85c05eb1c7ULL, 0x029a204a61cd43ULL, 0x15716278805f55ULL,
+    0x10ef91a4ef281cULL, 0x0704d3960eba0aULL, 0x14e1ef3bdc1067ULL,
+    0x030aad093d8271ULL, 0x06945ed552f538ULL, 0x117f1ce7b3672eULL,
+    0x0da9b96d8c1baaULL, 0x1a42fb5f6d89bcULL, 0x1fdc088302fef5ULL,
+    0x08374ab1e36ce3ULL, 0x04d8154710f18bULL, 0x13335775f1639dULL,
+    0x16ada4a99e14d4ULL, 0x0146e69b7f86c2ULL, 0x1d90431140fa46ULL,
+    0x0a7b0123a16850ULL, 0x0fe5f2ffce1f19ULL, 0x180eb0cd2f8d0fULL,
+    0x0beb8c60fd2762ULL, 0x1c00ce521cb574ULL, 0x199e3d8e73c23dULL,
+    0x0e757fbc92502bULL, 0x12a3da36ad2cafULL, 0x054898044cbeb9ULL,
+    0x00d66bd823c9f0ULL, 0x173d29eac25be6ULL, 0x1abf2708cb5c59ULL,
+    0x0d54653a2ace4fULL, 0x08ca96e645b906ULL, 0x1f21d4d4a42b10ULL,
+    0x03f7715e9b5794ULL, 0x141c336c7ac582ULL, 0x1182c0b015b2cbULL,
+    0x06698282f420ddULL, 0x158cbe2f268ab0ULL, 0x0267fc1dc718a6ULL,
+    0x07f90fc1a86fefULL, 0x10124df349fdf9ULL, 0x0cc4e87976817dULL,
+    0x1b2faa4b97136bULL, 0x1eb15997f86422ULL, 0x095a1ba519f634ULL,
+    0x076fe67a1f5ef2ULL, 0x1084a448fecce4ULL, 0x151a579491bbadULL,
+    0x02f115a67029bbULL, 0x1e27b02c4f553fULL, 0x09ccf21eaec729ULL,
+    0x0c5201c2c1b060ULL, 0x1bb943f0202276ULL, 0x085c7f5df2881bULL,
+    0x1fb73d6f131a0dULL, 0x1a29ceb37c6d44ULL, 0x0dc28c819dff52ULL,
+    0x1114290ba283d6ULL, 0x06ff6b394311c0ULL, 0x036198e52c6689ULL,
+    0x148adad7cdf49fULL, 0x1908d435c4f320ULL, 0x0ee39607256136ULL,
+    0x0b7d65db4a167fULL, 0x1c9627e9ab8469ULL, 0x0040826394f8edULL,
+    0x17abc051756afbULL, 0x1235338d1a1db2ULL, 0x05de71bffb8fa4ULL,
+    0x163b4d122925c9ULL, 0x01d00f20c8b7dfULL, 0x044efcfca7c096ULL,
+    0x13a5bece465280ULL, 0x0f731b44792e04ULL, 0x1898597698bc12ULL,
+    0x1d06aaaaf7cb5bULL, 0x0aede89816594dULL, 0x0602b76ee5c425ULL,
+    0x11e9f55c045633ULL, 0x147706806b217aULL, 0x039c44b28ab36cULL,
+    0x1f4ae138b5cfe8ULL, 0x08a1a30a545dfeULL, 0x0d3f50d63b2ab7ULL,
+    0x1ad412e4dab8a1ULL, 0x09312e490812ccULL, 0x1eda6c7be980daULL,
+    0x1b449fa786f793ULL, 0x0cafdd95676585ULL, 0x1079781f581901ULL,
+    0x07923a2db98b17ULL, 0x020cc9f1d6fc5eULL, 0x15e78bc3376e48ULL,
+    0x186585213e69f7ULL, 0x0f8ec713dffbe1ULL, 0x0a1034cfb08ca8ULL,
+    0x1dfb76fd511ebeULL, 0x012dd3776e623aULL, 0x16c691458ff02cULL,
+    0x13586299e08765ULL, 0x04b320ab011573ULL, 0x17561c06d3bf1eULL,
+    0x00bd5e34322d08ULL, 0x0523ade85d5a41ULL, 0x12c8efdabcc857ULL,
+    0x0e1e4a5083b4d3ULL, 0x19f508626226c5ULL, 0x1c6bfbbe0d518cULL,
+    0x0b80b98cecc39aULL,
+};
+
+const uint64_t hashchop_rabin_mod[256] = {
+    0x0000000000000000ULL, 0x003da3358b4dc173ULL, 0x0046e55e9dd64395ULL,
+    0x007b466b169b82e6ULL, 0x008dcabd3bac872aULL, 0x00b06988b0e14659ULL,
+    0x00cb2fe3a67ac4bfULL, 0x00f68cd62d3705ccULL, 0x011b957a77590e54ULL,
+    0x0126364ffc14cf27ULL, 0x015d7024ea8f4dc1ULL, 0x0160d31161c28cb2ULL,
+    0x01965fc74cf5897eULL, 0x01abfcf2c7b8480dULL, 0x01d0ba99d123caebULL,
+    0x01ed19ac5a6e0b98ULL, 0x020a89c165ffdddbULL, 0x02372af4eeb21ca8ULL,
+    0x024c6c9ff8299e4eULL, 0x0271cfaa73645f3dULL, 0x0287437c5e535af1ULL,
+    0x02bae049d51e9b82ULL, 0x02c1a622c3851964ULL, 0x02fc051748c8d817ULL,
+    0x03111cbb12a6d38fULL, 0x032cbf8e99eb12fcULL, 0x0357f9e58f70901aULL,
+    0x036a5ad0043d5169ULL, 0x039cd606290a54a5ULL, 0x03a17533a24795d6ULL,
+    0x03da3358b4dc1730ULL, 0x03e7906d3f91d643ULL, 0x04151382cbffbbb6ULL,
+    0x0428b0b740b27ac5ULL, 0x0453f6dc5629f823ULL, 0x046e55e9dd643950ULL,
+    0x0498d93ff0533c9cULL, 0x04a57a0a7b1efdefULL, 0x04de3c616d857f09ULL,
+    0x04e39f54e6c8be7aULL, 0x050e86f8bca6b5e2ULL, 0x053325cd37eb7491ULL,
+    0x054863a62170f677ULL, 0x0575c093aa3d3704ULL, 0x05834c45870a32c8ULL,
+    0x05beef700c47f3bbULL, 0x05c5a91b1adc715dULL, 0x05f80a2e9191b02eULL,
+    0x061f9a43ae00666dULL, 0x06223976254da71eULL, 0x06597f1d33d625f8ULL,
+    0x0664dc28b89be48bULL, 0x069250fe95ace147ULL, 0x06aff3cb1ee12034ULL,
+    0x06d4b5a0087aa2d2ULL, 0x06e91695833763a1ULL, 0x07040f39d9596839ULL,
+    0x0739ac0c5214a94aULL, 0x0742ea67448f2bacULL, 0x077f4952cfc2eadfULL,
+    0x0789c584e2f5ef13ULL, 0x07b466b169b82e60ULL, 0x07cf20da7f23ac86ULL,
+    0x07f283eff46e6df5ULL, 0x081784301cb2b61fULL, 0x082a270597ff776cULL,
+    0x0851616e8164f58aULL, 0x086cc25b0a2934f9ULL, 0x089a4e8d271e3135ULL,
+    0x08a7edb8ac53f046ULL, 0x08dcabd3bac872a0ULL, 0x08e108e63185b3d3ULL,
+    0x090c114a6bebb84bULL, 0x0931b27fe0a67938ULL, 0x094af414f63dfbdeULL,
+    0x097757217d703aadULL, 0x0981dbf750473f61ULL, 0x09bc78c2db0afe12ULL,
+    0x09c73ea9cd917cf4ULL, 0x09fa9d9c46dcbd87ULL, 0x0a1d0df1794d6bc4ULL,
+    0x0a20aec4f200aab7ULL, 0x0a5be8afe49b2851ULL, 0x0a664b9a6fd6e922ULL,
+    0x0a90c74c42e1eceeULL, 0x0aad6479c9ac2d9dULL, 0x0ad62212df37af7bULL,
+    0x0aeb8127547a6e08ULL, 0x0b06988b0e146590ULL, 0x0b3b3bbe8559a4e3ULL,
+    0x0b407dd593c22605ULL, 0x0b7ddee0188fe776ULL, 0x0b8b523635b8e2baULL,
+    0x0bb6f103bef523c9ULL, 0x0bcdb768a86ea12fULL, 0x0bf0145d2323605cULL,
+    0x0c0297b2d74d0da9ULL, 0x0c3f34875c00ccdaULL, 0x0c4472ec4a9b4e3cULL,
+    0x0c79d1d9c1d68f4fULL, 0x0c8f5d0fece18a83ULL, 0x0cb2fe3a67ac4bf0ULL,
+    0x0cc9b8517137c916ULL, 0x0cf41b64fa7a0865ULL, 0x0d1902c8a01403fdULL,
+    0x0d24a1fd2b59c28eULL, 0x0d5fe7963dc24068ULL, 0x0d6244a3b68f811bULL,
+    0x0d94c8759bb884d7ULL, 0x0da96b4010f545a4ULL, 0x0dd22d2b066ec742ULL,
+    0x0def8e1e8d230631ULL, 0x0e081e73b2b2d072ULL, 0x0e35bd4639ff1101ULL,
+    0x0e4efb2d2f6493e7ULL, 0x0e735818a4295294ULL, 0x0e85d4ce891e5758ULL,
+    0x0eb877fb0253962bULL, 0x0ec3319014c814cdULL, 0x0efe92a59f85d5beULL,
+    0x0f138b09c5ebde26ULL, 0x0f2e283c4ea61f55ULL, 0x0f556e57583d9db3ULL,
+    0x0f68cd62d3705cc0ULL, 0x0f9e41b4fe47590cULL, 0x0fa3e281750a987fULL,
+    0x0fd8a4ea63911a99ULL, 0x0fe507dfe8dcdbeaULL, 0x1012ab55b228ad4dULL,
+    0x102f086039656c3eULL, 0x10544e0b2ffeeed8ULL, 0x1069ed3ea4b32fabULL,
+    0x109f61e889842a67ULL, 0x10a2c2dd02c9eb14ULL, 0x10d984b6145269f2ULL,
+    0x10e427839f1fa881ULL, 0x11093e2fc571a319ULL, 0x11349d1a4e3c626aULL,
+    0x114fdb7158a7e08cULL, 0x11727844d3ea21ffULL, 0x1184f492fedd2433ULL,
+    0x11b957a77590e540ULL, 0x11c211cc630b67a6ULL, 0x11ffb2f9e846a6d5ULL,
+    0x12182294d7d77096ULL, 0x122581a15c9ab1e5ULL, 0x125ec7ca4a013303ULL,
+    0x126364ffc14cf270ULL, 0x1295e829ec7bf7bcULL, 0x12a84b1c673636cfULL,
+    0x12d30d7771adb429ULL, 0x12eeae42fae0755aULL, 0x1303b7eea08e7ec2ULL,
+    0x133e14db2bc3bfb1ULL, 0x134552b03d583d57ULL, 0x1378f185b615fc24ULL,
+    0x138e7d539b22f9e8ULL, 0x13b3de66106f389bULL, 0x13c8980d06f4ba7dULL,
+    0x13f53b388db97b0eULL, 0x1407b8d779d716fbULL, 0x143a1be2f29ad788ULL,
+    0x14415d89e401556eULL, 0x147cfebc6f4c941dULL, 0x148a726a427b91d1ULL,
+    0x14b7d15fc93650a2ULL, 0x14cc9734dfadd244ULL, 0x14f1340154e01337ULL,
+    0x151c2dad0e8e18afULL, 0x15218e9885c3d9dcULL, 0x155ac8f393585b3aULL,
+    0x15676bc618159a49ULL, 0x1591e71035229f85ULL, 0x15ac4425be6f5ef6ULL,
+    0x15d7024ea8f4dc10ULL, 0x15eaa17b23b91d63ULL, 0x160d31161c28cb20ULL,
+    0x1630922397650a53ULL, 0x164bd44881fe88b5ULL, 0x1676777d0ab349c6ULL,
+    0x1680fbab27844c0aULL, 0x16bd589eacc98d79ULL, 0x16c61ef5ba520f9fULL,
+    0x16fbbdc0311fceecULL, 0x1716a46c6b71c574ULL, 0x172b0759e03c0407ULL,
+    0x17504132f6a786e1ULL, 0x176de2077dea4792ULL, 0x179b6ed150dd425eULL,
+    0x17a6cde4db90832dULL, 0x17dd8b8fcd0b01cbULL, 0x17e028ba4646c0b8ULL,
+    0x18052f65ae9a1b52ULL, 0x18388c5025d7da21ULL, 0x1843ca3b334c58c7ULL,
+    0x187e690eb80199b4ULL, 0x1888e5d895369c78ULL, 0x18b546ed1e7b5d0bULL,
+    0x18ce008608e0dfedULL, 0x18f3a3b383ad1e9eULL, 0x191eba1fd9c31506ULL,
+    0x1923192a528ed475ULL, 0x19585f4144155693ULL, 0x1965fc74cf5897e0ULL,
+    0x199370a2e26f922cULL, 0x19aed3976922535fULL, 0x19d595fc7fb9d1b9ULL,
+    0x19e836c9f4f410caULL, 0x1a0fa6a4cb65c689ULL, 0x1a320591402807faULL,
+    0x1a4943fa56b3851cULL, 0x1a74e0cfddfe446fULL, 0x1a826c19f0c941a3ULL,
+    0x1abfcf2c7b8480d0ULL, 0x1ac489476d1f0236ULL, 0x1af92a72e652c345ULL,
+    0x1b1433debc3cc8ddULL, 0x1b2990eb377109aeULL, 0x1b52d68021ea8b48ULL,
+    0x1b6f75b5aaa74a3bULL, 0x1b99f96387904ff7ULL, 0x1ba45a560cdd8e84ULL,
+    0x1bdf1c3d1a460c62ULL, 0x1be2bf08910bcd11ULL, 0x1c103ce76565a0e4ULL,
+    0x1c2d9fd2ee286197ULL, 0x1c56d9b9f8b3e371ULL, 0x1c6b7a8c73fe2202ULL,
+    0x1c9df65a5ec927ceULL, 0x1ca0556fd584e6bdULL, 0x1cdb1304c31f645bULL,
+    0x1ce6b0314852a528ULL, 0x1d0ba99d123caeb0ULL, 0x1d360aa899716fc3ULL,
+    0x1d4d4cc38feaed25ULL, 0x1d70eff604a72c56ULL, 0x1d8663202990299aULL,
+    0x1dbbc015a2dde8e9ULL, 0x1dc0867eb4466a0fULL, 0x1dfd254b3f0bab7cULL,
+    0x1e1ab526009a7d3fULL, 0x1e2716138bd7bc4cULL, 0x1e5c50789d4c3eaaULL,
+    0x1e61f34d1601ffd9ULL, 0x1e977f9b3b36fa15ULL, 0x1eaadcaeb07b3b66ULL,
+    0x1ed19ac5a6e0b980ULL, 0x1eec39f02dad78f3ULL, 0x1f01205c77c3736bULL,
+    0x1f3c8369fc8eb218ULL, 0x1f47c502ea1530feULL, 0x1f7a66376158f18dULL,
+    0x1f8ceae14c6ff441ULL, 0x1fb149d4c7223532ULL, 0x1fca0fbfd1b9b7d4ULL,
+    0x1ff7ac8a5af476a7ULL,
+};
+
+static size_t rabin_window(size_t min) { return RABIN_WINDOW; }
+
+#define RABIN_APPEND(H, IN)                                             \
+    ((((H) << 8) | (IN)) ^ RABIN_MOD[(H) >> RABIN_SHIFT])
+
+static uint64_t rabin_init(const UC *data, size_t window) {
+    uint64_t h = 0;
+    for (size_t i = 0; i < window; i++) h = RABIN_APPEND(h, data[i]);
+    return h;
+}
+
+static uint64_t rabin_roll(uint64_t hash, size_t window, UC out, UC in) {
+    hash ^= RABIN_OUT[out];
+    return RABIN_APPEND(hash, in);
+}
+
+static int rabin_is_boundary(uint64_t hash, uint64_t mask) {
+    return (hash & mask) == 0;
+}
+
+static size_t rabin_scan(const UC *buf, size_t min, size_t max,
+        uint64_t mask, uint64_t *hash) {
+    uint64_t h = rabin_init(buf + min - RABIN_WINDOW, RABIN_WINDOW);
+    size_t i = 0;
+    for (i = min; i < max; i++) {
+        h ^= RABIN_OUT[buf[i - RABIN_WINDOW]];
+        h = RABIN_APPEND(h, buf[i]);
+        if ((h & mask) == 0) break;
+    }
+    *hash = h;
+    return i;
+}
+
+const hashchop_engine hashchop_engine_rabin = {
+    "rabin", rabin_window, rabin_init, rabin_roll, rabin_is_boundary,
+    rabin_scan,
+};
+
+/* Buzhash: each byte maps to a random 32-bit value, and the hash is the
+ * XOR of the window's values, each rotated by its distance from the end
+ * of the window. Rolling rotates everything by 1, then drops the old
+ * byte's value (rotated by the window size) and adds the new one's.
+ *
+ * Table: the low 32 bits of splitmix64's outputs, seeded with
+ * 0x6275687a. */
+#define BUZHASH_WINDOW HASHCHOP_BUZHASH_WINDOW
+#define BUZHASH hashchop_buzhash
+
+const uint32_t hashchop_buzhash[256] = {
+    0xcdecdf8d, 0xfd686634, 0xa6d43e88, 0xf9eb43b7, 0xcf500b20, 0x5ec2569e,
+    0x040de2da, 0x93492c09, 0x54ff173f, 0x0650a12b, 0xc7839dbd, 0x0402bea3,
+    0xceeb5b9a, 0xd2761692, 0x95072253, 0x274bd9e2, 0x150750ce, 0x62a8fa28,
+    0x9554ea6e, 0x085b590e, 0x7b9e5644, 0xcce32cb9, 0x2d50ab7f, 0x1cc1d6d3,
+    0x73132999, 0x01d1625f, 0x985d85f1, 0xd1178d46, 0x9396d061, 0x71b125fb,
+    0x33d20fa1, 0xc965de2c, 0x11534588, 0xf055c5fe, 0xec1d3c19, 0x7b8808ed,
+    0xe35480ae, 0x933e060a, 0x17bdf1f8, 0x3669bca2, 0xa15376a9, 0x3528c97a,
+    0x5ae80366, 0xb8ff64a8, 0x722f4c4a, 0x360148cb, 0x03312d9d, 0xcee35a34,
+    0xe892dc26, 0x513507a4, 0xcd8313db, 0x0666db02, 0x1788e320, 0x9ee4bcae,
+    0xa9c546b3, 0x034a8339, 0xdc889da4, 0x7b4a1e29, 0x4f194297, 0x6d949e05,
+    0x7a648135, 0x057181ee, 0x14b4cfbf, 0xdddabca0, 0x0b80d256, 0x10c25195,
+    0xd62383ff, 0x40e3e9e6, 0x77c68957, 0xf8eeee20, 0x6207ed6d, 0xed7f40da,
+    0xd979adff, 0x5dbb3ef8, 0x85427bb6, 0xc0a726ea, 0x15b15b6f, 0x8f060293,
+    0x42d37a7a, 0x24504561, 0xb9dde621, 0xef878909, 0x0cd0d839, 0x5ead8c52,
+    0xc89db66e, 0x0931973b, 0xa63f2285, 0x2db84f30, 0x631e6f00, 0x5da59cc9,
+    0x624f9a0e, 0xcac7301d, 0x288db1f1, 0x5a1dc1ae, 0xf0c25335, 0xc4b5be01,
+    0x2b4eeb15, 0x3d73952b, 0xfae33293, 0xa4c18a5d, 0x4875ea62, 0x9dcfd488,
+    0x5fca93ec, 0x43cc1021, 0x0d472ccb, 0xd2d191e8, 0x51a07619, 0x84c26001,
+    0x74ce1211, 0x28467dc7, 0x6473901a, 0x8779f96d, 0x1408fada, 0x41512d17,
+    0x9698b294, 0x1eb34270, 0xc60627c3, 0x26deda5c, 0x001b5eb7, 0xa90397bc,
+    0x93b0f7fe, 0x67958e53, 0xe7183b51, 0xd3042015, 0xa74895bc, 0xc2941d0b,
+    0x4be4d528, 0xa30efff9, 0x051cc890, 0x96afa159, 0x77c006f8, 0x8076c1c3,
+    0x1302e572, 0x37fcfd21, 0x004be355, 0x475163f9, 0x510bc09e, 0x6119106b,
+    0xaa624f25, 0xb9458ab7, 0x281b95b0, 0x3d4110fb, 0x06991c59, 0xe9e6443e,
+    0x91ae06fe, 0x520d4e42, 0x0a02e778, 0x891a228f, 0x7f1d20ab, 0xff48d4a5,
+    0x7373df56, 0xa450912b, 0x19f2f9ec, 0xd225863c, 0xcc9dd6c2, 0xad9197f0,
+    0x612ebd49, 0xfafee913, 0x9ecad328, 0x62b7e94b, 0x257c73ff, 0x2f46a98a,
+    0x57a26700, 0xc0e6bb19, 0xcb074c33, 0x788a9c31, 0x028b6f12, 0xbe09c461,
+    0xa7b91cc3, 0xc8a837b0, 0x1fa6af47, 0x093154e4, 0x57df81c9, 0x66f38d53,
+    0x49556560, 0xd29b8fc4, 0xec2abbe0, 0x7cf50181, 0xe27b1cc4, 0x311a0e88,
+    0x8f80a088, 0x0c118e7c, 0x7853f600, 0x1b705510, 0xd9585665, 0x310ee9fc,
+    0xc611a0e9, 0x3ffb33be, 0x03091fef, 0x1d738984, 0x04107906, 0x4d2c3c32,
+    0xa458e56a, 0xfd12a83f, 0xd0f54be8, 0x983cb42d, 0x1c9b2020, 0x70d4e103,
+    0xc3f68edd, 0x20340039, 0x996b22e7, 0xc3fb83cb, 0xe68698bb, 0x944ea581,
+    0xc7344aad, 0xdaf4dc06, 0x47ecdb9a, 0xc026abf1, 0x1ed70ac1, 0x2fc3de63,
+    0x9be91f0b, 0x9eab1a52, 0x61b2c75b, 0x397ac899, 0x948fc9b0, 0x04032283,
+    0xa2afcac8, 0x2c0d5253, 0xf19d34ee, 0xa6cc5c69, 0xa43cf150, 0x06f1a8b5,
+    0x858b06ff, 0xbe90faf4, 0x8b16c4ac, 0x2294d28b, 0x109ef9f5, 0x4f6d16bb,
+    0xc40ad18a, 0xb7badfd9, 0xf65cd1af, 0xd9f19032, 0xf08605b0, 0x0e790b2a,
+    0xd94785eb, 0x830750e8, 0x1fa2187e, 0x3228c8f8, 0xbc9f68b2, 0x5d6ae4ec,
+    0x41d4e54f, 0xfd2bce11, 0x252eda8e, 0xccf83351, 0x3f867cd2, 0xfa7c9bea,
+    0xd6ac4082, 0x463b39a2, 0x18f3a071, 0xc9104359, 0xff43c076, 0x5822004f,
+    0x39b6dfa0, 0x0933da53, 0x2d17f5ff, 0xb9f3563e,
+};
+
+#define ROTL32(X, N) (((X) << (N)) | ((X) >> ((32 - (N)) & 31)))
+
+static size_t buzhash_window(size_t min) { return BUZHASH_WINDOW; }
+
+static uint64_t buzhash_init(const UC *data, size_t window) {
+    uint32_t h = 0;
+    for (size_t i = 0; i < window; i++) h = ROTL32(h, 1) ^ BUZHASH[data[i]];
+    return h;
+}
+
+static uint64_t buzhash_roll(uint64_t hash, size_t window, UC out, UC in) {
+    uint32_t h = (uint32_t)hash, o = BUZHASH[out];
+    return ROTL32(h, 1) ^ ROTL32(o, window % 32) ^ BUZHASH[in];
+}
+
+static int buzhash_is_boundary(uint64_t hash, uint64_t mask) {
+    return (hash & mask) == 0;
+}
+
+static size_t buzhash_scan(const UC *buf, size_t min, size_t max,
+        uint64_t mask, uint64_t *hash) {
+    uint32_t h = (uint32_t)buzhash_init(buf + min - BUZHASH_WINDOW,
+        BUZHASH_WINDOW);
+    size_t i = 0;
+    for (i = min; i < max; i++) {
+        uint32_t o = BUZHASH[buf[i - BUZHASH_WINDOW]];
+        h = ROTL32(h, 1) ^ ROTL32(o, BUZHASH_WINDOW % 32) ^ BUZHASH[buf[i]];
+        if ((h & mask) == 0) break;
+    }
+    *hash = h;
+    return i;
+}
+
+const hashchop_engine hashchop_engine_buzhash = {
+    "buzhash", buzhash_window, buzhash_init, buzhash_roll,
+    buzhash_is_boundary, buzhash_scan,
+};
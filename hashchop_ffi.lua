@@ -0,0 +1,118 @@
+-- LuaJIT FFI interface for hashchop, using libhashchop.so (make lib).
+--
+-- Unlike the hashchop.so binding, data is passed as cdata pointers (or
+-- strings) and chunks come back as pointers into the chopper's buffer,
+-- or as offsets into the caller's data, so nothing is interned and the
+-- JIT can compile straight through the calls.
+--
+--   local hashchop = require "hashchop_ffi"
+--   local h = hashchop.new(12)
+--   local ends = hashchop.ends(1024)          -- caller-owned size_t[1024]
+--   local n = h:seams(buf, len, ends, 1024)   -- chunk i ends at ends[i-1]
+--
+-- Set HASHCHOP_LIB to load the library from a specific path.
+
+local ffi = require "ffi"
+
+ffi.cdef[[
+typedef struct hashchop hashchop;
+typedef uint64_t hashchop_fp;
+
+hashchop *hashchop_new(uint8_t bits);
+int hashchop_sink(hashchop *hc, const uint8_t *data, size_t length);
+int hashchop_poll(hashchop *hc, uint8_t *data, size_t *length);
+int hashchop_poll_view(hashchop *hc, const uint8_t **data, size_t *length);
+int hashchop_finish(hashchop *hc, uint8_t *data, size_t *length);
+void hashchop_finish_view(hashchop *hc, const uint8_t **data, size_t *length);
+size_t hashchop_seam(const hashchop *hc, const uint8_t *data, size_t length);
+size_t hashchop_seams(const hashchop *hc, const uint8_t *data, size_t length,
+    size_t *ends, size_t max_ends);
+size_t hashchop_max_chunk(const hashchop *hc);
+void hashchop_reset(hashchop *hc);
+void hashchop_free(hashchop *hc);
+hashchop_fp hashchop_fingerprint(const uint8_t *data, size_t length);
+]]
+
+local C = ffi.load(os.getenv("HASHCHOP_LIB") or "hashchop")
+
+local M = {
+    OK = 0, UNDERFLOW = -1, OVERFLOW = -2, FULL = -3,
+    MEMORY = -4, IO = -5, FORMAT = -6,
+    MIN_BITS = 8, MAX_BITS = 30,        -- HASHCHOP_MIN_BITS, _MAX_BITS
+}
+
+-- Out-parameters, shared so polling doesn't allocate.
+local view = ffi.new("const uint8_t *[1]")
+local len = ffi.new("size_t[1]")
+
+local methods = {}
+
+-- Sink LENGTH bytes at DATA. Returns a result code (M.OK, etc.).
+function methods:sink(data, length)
+    return C.hashchop_sink(self, data, length)
+end
+
+-- Copy the next chunk into BUF, a caller-owned buffer of CAP bytes.
+-- Returns its length, or (nil, result code).
+function methods:poll(buf, cap)
+    len[0] = cap
+    local res = C.hashchop_poll(self, buf, len)
+    if res ~= 0 then return nil, res end
+    return tonumber(len[0])
+end
+
+-- Get the next chunk as (pointer, length), valid until the next call on
+-- the chopper, or (nil, result code).
+function methods:poll_view()
+    local res = C.hashchop_poll_view(self, view, len)
+    if res ~= 0 then return nil, res end
+    return view[0], tonumber(len[0])
+end
+
+-- Get the rest of the stream as (pointer, length), and reset.
+function methods:finish_view()
+    C.hashchop_finish_view(self, view, len)
+    return view[0], tonumber(len[0])
+end
+
+-- Get the length of the first chunk in LENGTH bytes at DATA.
+function methods:seam(data, length)
+    return tonumber(C.hashchop_seam(self, data, length))
+end
+
+-- Write the ends of up to MAX_ENDS chunks in LENGTH bytes at DATA in
+-- ENDS (a size_t array, from M.ends). Returns the number found.
+function methods:seams(data, length, ends, max_ends)
+    return tonumber(C.hashchop_seams(self, data, length, ends, max_ends))
+end
+
+function methods:max_chunk() return tonumber(C.hashchop_max_chunk(self)) end
+function methods:reset() C.hashchop_reset(self) end
+
+ffi.metatype("hashchop", { __index = methods })
+
+-- Create a chopper, or return (nil, error message).
+function M.new(bits)
+    local n = tonumber(bits)
+    if n == nil then
+        error(("bad argument #1 to 'new' (number expected, got %s)")
+            :format(type(bits)), 2)
+    end
+    -- hashchop_new takes a uint8_t, which would wrap N.
+    if n < M.MIN_BITS or n > M.MAX_BITS then
+        return nil, "Bad bits argument."
+    end
+    local hc = C.hashchop_new(n)
+    if hc == nil then return nil, "Bad bits argument." end
+    return ffi.gc(hc, C.hashchop_free)
+end
+
+-- Allocate a size_t array of N chunk ends, for seams.
+function M.ends(n) return ffi.new("size_t[?]", n) end
+
+-- Get the 64-bit fingerprint (a uint64_t cdata) of LENGTH bytes at DATA.
+function M.fingerprint(data, length)
+    return C.hashchop_fingerprint(data, length)
+end
+
+return M
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "hashchop.h"
+#include "hashchop_internal.h"
+#include "hashchop_filter.h"
+
+/* Abbreviations. */
+typedef uint32_t UI;
+typedef uint8_t UC;
+#define F hashchop_filter
+
+/* File header: magic, version, hash count, (pad), block count,
+ * entry count, capacity, then padding to one block. */
+static const UC MAGIC[4] = { 'h', 'c', 'b', 'f' };
+#define VERSION 1
+#define HEADER_SZ 64
+
+/* Each block is a 512-bit Bloom filter, one cache line wide. */
+#define BLOCK_SZ 64
+#define BLOCK_BITS (8 * BLOCK_SZ)
+
+struct hashchop_filter {
+    UC *blocks;                 /* block array */
+    uint64_t block_ct;
+    UI k;                       /* bits set per fingerprint */
+    uint64_t count;             /* fingerprints added */
+    uint64_t capacity;          /* entries the filter was sized for */
+    void *alloc;                /* allocation or mapping, for freeing */
+    size_t alloc_sz;
+    int mapped;
+};
+
+/* Create and return a new, empty filter, sized for CAPACITY entries. */
+F *hashchop_filter_new(size_t capacity, uint8_t bits_per_entry) {
+    if (bits_per_entry == 0) bits_per_entry = HASHCHOP_FILTER_DEF_BITS;
+    if (capacity == 0) capacity = 1;
+    uint64_t block_ct = (capacity * bits_per_entry + BLOCK_BITS - 1) / BLOCK_BITS;
+
+    F *f = hashchop_alloc(sizeof(*f));
+    if (f == NULL) return NULL;
+    f->alloc_sz = block_ct * BLOCK_SZ + BLOCK_SZ - 1;
+    f->alloc = hashchop_alloc(f->alloc_sz);
+    if (f->alloc == NULL) {
+        hashchop_dealloc(f, sizeof(*f));
+        return NULL;
+    }
+    memset(f->alloc, 0, f->alloc_sz);
+    f->blocks = (UC *)(((uintptr_t)f->alloc + BLOCK_SZ - 1)
+        & ~(uintptr_t)(BLOCK_SZ - 1));
+    f->block_ct = block_ct;
+    f->k = (bits_per_entry * 69 + 50) / 100;    /* ~ln(2) * bits */
+    if (f->k == 0) f->k = 1;
+    f->count = 0;
+    f->capacity = capacity;
+    f->mapped = 0;
+    return f;
+}
+
+/* Pick FP's block. The high half of FP chooses the block, and the low
+ * half (and a remix of the whole) chooses bits within it. */
+static UC *get_block(const F *f, hashchop_fp fp) {
+    return f->blocks + BLOCK_SZ * (((fp >> 32) * f->block_ct) >> 32);
+}
+
+#define BIT_POS(H1, H2, I) (((H1) + (I) * (H2)) >> (32 - 9))
+
+/* Add a fingerprint to the filter. */
+void hashchop_filter_add(F *f, hashchop_fp fp) {
+    UC *b = get_block(f, fp);
+    UI h1 = (UI)fp, h2 = (UI)((fp * 0x9e3779b97f4a7c15ULL) >> 32) | 1;
+    for (UI i = 0; i < f->k; i++) {
+        UI pos = BIT_POS(h1, h2, i);
+        b[pos >> 3] |= 1 << (pos & 7);
+    }
+    f->count++;
+}
+
+/* Check for a fingerprint. */
+int hashchop_filter_check(const F *f, hashchop_fp fp) {
+    const UC *b = get_block(f, fp);
+    UI h1 = (UI)fp, h2 = (UI)((fp * 0x9e3779b97f4a7c15ULL) >> 32) | 1;
+    for (UI i = 0; i < f->k; i++) {
+        UI pos = BIT_POS(h1, h2, i);
+        if ((b[pos >> 3] & (1 << (pos & 7))) == 0) return 0;
+    }
+    return 1;
+}
+
+/* Get the number of fingerprints added. */
+size_t hashchop_filter_count(const F *f) { return f->count; }
+
+/* Get the number of entries the filter was sized for. */
+size_t hashchop_filter_capacity(const F *f) { return f->capacity; }
+
+/* Save the filter to the file at PATH (via a temp file and rename). */
+hashchop_res hashchop_filter_save(const F *f, const char *path) {
+    UC hdr[HEADER_SZ];
+    memset(hdr, 0, sizeof(hdr));
+    memcpy(hdr, MAGIC, 4);
+    hashchop_put_le32(hdr + 4, VERSION);
+    hashchop_put_le32(hdr + 8, f->k);
+    hashchop_put_le64(hdr + 16, f->block_ct);
+    hashchop_put_le64(hdr + 24, f->count);
+    hashchop_put_le64(hdr + 32, f->capacity);
+
+    size_t tmp_sz = strlen(path) + sizeof(".tmp");
+    char *tmp_path = hashchop_alloc(tmp_sz);
+    if (tmp_path == NULL) return HASHCHOP_ERROR_MEMORY;
+    snprintf(tmp_path, tmp_sz, "%s.tmp", path);
+
+    hashchop_res res = HASHCHOP_ERROR_IO;
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL) goto cleanup;
+    int ok = (fwrite(hdr, HEADER_SZ, 1, out) == 1
+        && fwrite(f->blocks, BLOCK_SZ, f->block_ct, out) == f->block_ct
+        && fflush(out) == 0
+        && fsync(fileno(out)) == 0);
+    if (fclose(out) != 0) ok = 0;
+    if (ok && rename(tmp_path, path) == 0) res = HASHCHOP_OK;
+    if (res != HASHCHOP_OK) unlink(tmp_path);
+
+cleanup:
+    hashchop_dealloc(tmp_path, tmp_sz);
+    return res;
+}
+
+/* Map a filter saved with hashchop_filter_save. */
+F *hashchop_filter_map(const char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+    if (fstat(fd, &st) == -1 || st.st_size < HEADER_SZ) {
+        close(fd);
+        return NULL;
+    }
+    /* Private and writable, so adds don't change the file. */
+    UC *m = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (m == MAP_FAILED) return NULL;
+
+    uint64_t block_ct = hashchop_get_le64(m + 16);
+    UI k = hashchop_get_le32(m + 8);
+    if (memcmp(m, MAGIC, 4) != 0 || hashchop_get_le32(m + 4) != VERSION
+        || k == 0 || k > 64 || block_ct == 0
+        || (uint64_t)st.st_size != HEADER_SZ + block_ct * BLOCK_SZ) {
+        munmap(m, st.st_size);
+        return NULL;
+    }
+
+    F *f = hashchop_alloc(sizeof(*f));
+    if (f == NULL) {
+        munmap(m, st.st_size);
+        return NULL;
+    }
+    f->blocks = m + HEADER_SZ;
+    f->block_ct = block_ct;
+    f->k = k;
+    f->count = hashchop_get_le64(m + 24);
+    f->capacity = hashchop_get_le64(m + 32);
+    f->alloc = m;
+    f->alloc_sz = st.st_size;
+    f->mapped = 1;
+    return f;
+}
+
+/* Free (or unmap) a filter. */
+void hashchop_filter_free(F *f) {
+    if (f->mapped) {
+        munmap(f->alloc, f->alloc_sz);
+    } else {
+        hashchop_dealloc(f->alloc, f->alloc_sz);
+    }
+    hashchop_dealloc(f, sizeof(*f));
+}
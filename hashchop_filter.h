@@ -0,0 +1,57 @@
+#ifndef HASHCHOP_FILTER_H
+#define HASHCHOP_FILTER_H
+
+#include "hashchop.h"
+
+/* Blocked Bloom filter over chunk fingerprints.
+ *
+ * This answers "is this chunk definitely new?" without probing a chunk
+ * index: if hashchop_filter_check returns 0, the fingerprint was never
+ * added. Each fingerprint's bits all fall in one 64-byte block, so a
+ * check touches a single cache line.
+ *
+ * A filter can be saved to a file and mapped back in. The file is a
+ * 64-byte header followed by the blocks; bits are addressed by byte,
+ * so the format doesn't depend on the host's byte order. */
+
+/* Opaque filter handle. */
+typedef struct hashchop_filter hashchop_filter;
+
+#define F hashchop_filter
+
+/* Default bits of filter per expected entry, giving a false
+ * positive rate around 1%. */
+#define HASHCHOP_FILTER_DEF_BITS 10
+
+/* Create and return a new, empty filter, sized for CAPACITY entries at
+ * BITS_PER_ENTRY bits each (0 for the default). Returns NULL on alloc
+ * failure. */
+F *hashchop_filter_new(size_t capacity, uint8_t bits_per_entry);
+
+/* Add a fingerprint to the filter. */
+void hashchop_filter_add(F *f, hashchop_fp fp);
+
+/* Check for a fingerprint. Returns 0 if it was definitely never added,
+ * or 1 if it probably was. */
+int hashchop_filter_check(const F *f, hashchop_fp fp);
+
+/* Get the number of fingerprints added. */
+size_t hashchop_filter_count(const F *f);
+
+/* Get the number of entries the filter was sized for. */
+size_t hashchop_filter_capacity(const F *f);
+
+/* Save the filter to the file at PATH (via a temp file and rename).
+ * Returns OK, IO on error, or MEMORY on alloc failure. */
+hashchop_res hashchop_filter_save(const F *f, const char *path);
+
+/* Map a filter saved with hashchop_filter_save. Fingerprints can still
+ * be added, but only change the in-memory copy until it is saved again.
+ * Returns NULL if the file is missing or invalid. */
+F *hashchop_filter_map(const char *path);
+
+/* Free (or unmap) a filter. */
+void hashchop_filter_free(F *f);
+
+#undef F
+#endif
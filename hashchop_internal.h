@@ -0,0 +1,38 @@
+#ifndef HASHCHOP_INTERNAL_H
+#define HASHCHOP_INTERNAL_H
+
+/* Declarations shared between the hashchop modules, but not part of
+ * the public interface. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Allocate/free memory via the functions set with hashchop_set_malloc. */
+void *hashchop_alloc(size_t sz);
+void hashchop_dealloc(void *p, size_t sz);
+
+/* Use the generic scan instead of the hashchopper's kernel for its bits
+ * (or switch back), for tests and benchmarks. */
+struct hashchop;
+void hashchop_set_generic_scan(struct hashchop *hc, int generic);
+
+/* Little-endian encoding, for file formats and fingerprints. */
+static inline uint32_t hashchop_get_le32(const unsigned char *p) {
+    return ((uint32_t)p[0]) | ((uint32_t)p[1] << 8)
+        | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t hashchop_get_le64(const unsigned char *p) {
+    return hashchop_get_le32(p) | ((uint64_t)hashchop_get_le32(p + 4) << 32);
+}
+
+static inline void hashchop_put_le32(unsigned char *p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static inline void hashchop_put_le64(unsigned char *p, uint64_t v) {
+    hashchop_put_le32(p, (uint32_t)v);
+    hashchop_put_le32(p + 4, (uint32_t)(v >> 32));
+}
+
+#endif
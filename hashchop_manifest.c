@@ -0,0 +1,362 @@
+/*
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "hashchop.h"
+#include "hashchop_internal.h"
+#include "hashchop_manifest.h"
+
+/* Abbreviations. */
+typedef uint32_t UI;
+typedef uint8_t UC;
+#define W hashchop_manifest_writer
+#define M hashchop_manifest
+
+/* Manifest encoding:
+ *     0  "hcmf"
+ *     4  version (1 byte), bits (1 byte), 2 bytes unused
+ *     8  chunk count (8 bytes)
+ *    16  total length (8 bytes)
+ *    24  a record per chunk: length (4 bytes), fingerprint (8 bytes)
+ * then the index: the offset (8 bytes) of every INDEX_STEP'th chunk,
+ * starting with chunk 0. */
+#define MF_MAGIC "hcmf"
+#define MF_VERSION 1
+#define MF_HDR_SZ 24
+#define MF_REC_SZ 12
+#define INDEX_STEP 64
+
+#define DEF_CHUNKS 1024
+
+struct hashchop_manifest_writer {
+    uint8_t bits;
+    size_t count;               /* chunks */
+    size_t limit;               /* room for chunks */
+    uint64_t length;            /* total length */
+    UI *lens;
+    hashchop_fp *fps;
+    uint64_t *index;            /* offset of every INDEX_STEP'th chunk */
+};
+
+struct hashchop_manifest {
+    const UC *recs;             /* records */
+    const UC *index;            /* sparse offset index */
+    size_t count;
+    size_t index_ct;
+    uint64_t length;
+    uint8_t bits;
+    void *map;                  /* mapping, or NULL */
+    size_t map_sz;
+};
+
+/* Get the number of index entries for COUNT chunks. */
+static size_t index_count(size_t count) {
+    return (count + INDEX_STEP - 1) / INDEX_STEP;
+}
+
+/* Create and return a new manifest writer. */
+W *hashchop_manifest_writer_new(uint8_t bits) {
+    W *w = hashchop_alloc(sizeof(*w));
+    if (w == NULL) return NULL;
+    w->bits = bits;
+    w->count = 0;
+    w->limit = DEF_CHUNKS;
+    w->length = 0;
+    w->lens = hashchop_alloc(DEF_CHUNKS * sizeof(UI));
+    w->fps = hashchop_alloc(DEF_CHUNKS * sizeof(hashchop_fp));
+    w->index = hashchop_alloc(index_count(DEF_CHUNKS) * sizeof(uint64_t));
+    if (w->lens == NULL || w->fps == NULL || w->index == NULL) {
+        hashchop_manifest_writer_free(w);
+        return NULL;
+    }
+    return w;
+}
+
+/* Resize one of the writer's arrays from OLD_SZ to NEW_SZ bytes.
+ * Returns 0 on alloc failure, leaving it unchanged. */
+static int resize(void **p, size_t old_sz, size_t new_sz) {
+    void *np = hashchop_alloc(new_sz);
+    if (np == NULL) return 0;
+    memcpy(np, *p, old_sz);
+    hashchop_dealloc(*p, old_sz);
+    *p = np;
+    return 1;
+}
+
+/* Double the writer's room for chunks. */
+static int grow(W *w) {
+    size_t nl = 2 * w->limit;
+    if (!resize((void **)&w->lens, w->limit * sizeof(UI), nl * sizeof(UI))
+        || !resize((void **)&w->fps, w->limit * sizeof(hashchop_fp),
+            nl * sizeof(hashchop_fp))
+        || !resize((void **)&w->index,
+            index_count(w->limit) * sizeof(uint64_t),
+            index_count(nl) * sizeof(uint64_t))) return 0;
+    w->limit = nl;
+    return 1;
+}
+
+/* Add the next chunk, of LENGTH bytes with fingerprint FP. */
+hashchop_res hashchop_manifest_add(W *w, size_t length, hashchop_fp fp) {
+    if (length > UINT32_MAX) return HASHCHOP_ERROR_OVERFLOW;
+    if (w->count == w->limit && !grow(w)) return HASHCHOP_ERROR_MEMORY;
+    if (w->count % INDEX_STEP == 0) w->index[w->count / INDEX_STEP] = w->length;
+    w->lens[w->count] = length;
+    w->fps[w->count] = fp;
+    w->count++;
+    w->length += length;
+    return HASHCHOP_OK;
+}
+
+/* Get the size of the manifest's encoding. */
+size_t hashchop_manifest_size(const W *w) {
+    return MF_HDR_SZ + w->count * MF_REC_SZ
+        + index_count(w->count) * sizeof(uint64_t);
+}
+
+/* Encode the manifest into BUF. */
+hashchop_res hashchop_manifest_encode(const W *w, unsigned char *buf,
+        size_t *length) {
+    size_t sz = hashchop_manifest_size(w);
+    if (*length < sz) return HASHCHOP_ERROR_OVERFLOW;
+    memset(buf, 0, MF_HDR_SZ);
+    memcpy(buf, MF_MAGIC, 4);
+    buf[4] = MF_VERSION;
+    buf[5] = w->bits;
+    hashchop_put_le64(buf + 8, w->count);
+    hashchop_put_le64(buf + 16, w->length);
+    UC *p = buf + MF_HDR_SZ;
+    for (size_t i = 0; i < w->count; i++) {
+        hashchop_put_le32(p, w->lens[i]);
+        hashchop_put_le64(p + 4, w->fps[i]);
+        p += MF_REC_SZ;
+    }
+    for (size_t i = 0; i < index_count(w->count); i++) {
+        hashchop_put_le64(p, w->index[i]);
+        p += sizeof(uint64_t);
+    }
+    *length = sz;
+    return HASHCHOP_OK;
+}
+
+/* Save the manifest to the file at PATH (via a temp file and rename). */
+hashchop_res hashchop_manifest_save(const W *w, const char *path) {
+    size_t sz = hashchop_manifest_size(w);
+    UC *buf = hashchop_alloc(sz);
+    if (buf == NULL) return HASHCHOP_ERROR_MEMORY;
+    hashchop_manifest_encode(w, buf, &sz);
+
+    size_t tmp_sz = strlen(path) + sizeof(".tmp");
+    char *tmp_path = hashchop_alloc(tmp_sz);
+    hashchop_res res = HASHCHOP_ERROR_MEMORY;
+    if (tmp_path == NULL) goto cleanup;
+    snprintf(tmp_path, tmp_sz, "%s.tmp", path);
+
+    res = HASHCHOP_ERROR_IO;
+    FILE *out = fopen(tmp_path, "wb");
+    if (out == NULL) goto cleanup;
+    int ok = (fwrite(buf, 1, sz, out) == sz
+        && fflush(out) == 0
+        && fsync(fileno(out)) == 0);
+    if (fclose(out) != 0) ok = 0;
+    if (ok && rename(tmp_path, path) == 0) res = HASHCHOP_OK;
+    if (res != HASHCHOP_OK) unlink(tmp_path);
+
+cleanup:
+    if (tmp_path) hashchop_dealloc(tmp_path, tmp_sz);
+    hashchop_dealloc(buf, sz);
+    return res;
+}
+
+/* Free a manifest writer. */
+void hashchop_manifest_writer_free(W *w) {
+    if (w->lens) hashchop_dealloc(w->lens, w->limit * sizeof(UI));
+    if (w->fps) hashchop_dealloc(w->fps, w->limit * sizeof(hashchop_fp));
+    if (w->index) {
+        hashchop_dealloc(w->index, index_count(w->limit) * sizeof(uint64_t));
+    }
+    hashchop_dealloc(w, sizeof(*w));
+}
+
+/* Read a manifest in place from LENGTH bytes of BUF. */
+M *hashchop_manifest_open(const unsigned char *buf, size_t length) {
+    if (length < MF_HDR_SZ || memcmp(buf, MF_MAGIC, 4) != 0
+        || buf[4] != MF_VERSION) return NULL;
+    uint64_t count = hashchop_get_le64(buf + 8);
+    size_t max_count = (length - MF_HDR_SZ) / MF_REC_SZ;
+    if (count > max_count || length != MF_HDR_SZ + count * MF_REC_SZ
+        + index_count(count) * sizeof(uint64_t)) return NULL;
+
+    M *m = hashchop_alloc(sizeof(*m));
+    if (m == NULL) return NULL;
+    m->recs = buf + MF_HDR_SZ;
+    m->index = m->recs + count * MF_REC_SZ;
+    m->count = count;
+    m->index_ct = index_count(count);
+    m->length = hashchop_get_le64(buf + 16);
+    m->bits = buf[5];
+    m->map = NULL;
+    m->map_sz = 0;
+    return m;
+}
+
+/* Map the manifest saved at PATH, read-only. */
+M *hashchop_manifest_map(const char *path) {
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+    if (fstat(fd, &st) == -1 || st.st_size < MF_HDR_SZ) {
+        close(fd);
+        return NULL;
+    }
+    UC *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+    M *m = hashchop_manifest_open(p, st.st_size);
+    if (m == NULL) {
+        munmap(p, st.st_size);
+        return NULL;
+    }
+    m->map = p;
+    m->map_sz = st.st_size;
+    return m;
+}
+
+/* Get the number of chunks, the total length, and the recorded bits. */
+size_t hashchop_manifest_count(const M *m) { return m->count; }
+uint64_t hashchop_manifest_length(const M *m) { return m->length; }
+uint8_t hashchop_manifest_bits(const M *m) { return m->bits; }
+
+static UI rec_length(const M *m, size_t i) {
+    return hashchop_get_le32(m->recs + i * MF_REC_SZ);
+}
+
+static void rec_entry(const M *m, size_t i, uint64_t offset,
+        hashchop_manifest_entry *entry) {
+    entry->offset = offset;
+    entry->length = rec_length(m, i);
+    entry->fp = hashchop_get_le64(m->recs + i * MF_REC_SZ + 4);
+}
+
+static uint64_t index_offset(const M *m, size_t i) {
+    return hashchop_get_le64(m->index + i * sizeof(uint64_t));
+}
+
+/* Get the I'th chunk: its offset is the indexed offset before it, plus
+ * the lengths of the (at most INDEX_STEP - 1) chunks between. */
+hashchop_res hashchop_manifest_get(const M *m, size_t i,
+        hashchop_manifest_entry *entry) {
+    if (i >= m->count) return HASHCHOP_ERROR_OVERFLOW;
+    size_t j = i - i % INDEX_STEP;
+    uint64_t offset = index_offset(m, j / INDEX_STEP);
+    for (; j < i; j++) offset += rec_length(m, j);
+    rec_entry(m, i, offset, entry);
+    return HASHCHOP_OK;
+}
+
+/* Find the chunk holding byte OFFSET: binary search the index for the
+ * last indexed chunk starting at or before it, then step through the
+ * run of chunks after that. */
+hashchop_res hashchop_manifest_find(const M *m, uint64_t offset, size_t *i,
+        hashchop_manifest_entry *entry) {
+    if (offset >= m->length || m->count == 0) return HASHCHOP_ERROR_OVERFLOW;
+    size_t lo = 0, hi = m->index_ct;   /* index_offset(lo) <= offset */
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index_offset(m, mid) <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t j = lo * INDEX_STEP;
+    uint64_t start = index_offset(m, lo);
+    for (; j < m->count; j++) {
+        UI len = rec_length(m, j);
+        if (offset < start + len) break;
+        start += len;
+    }
+    if (j == m->count) return HASHCHOP_ERROR_OVERFLOW;    /* bad lengths */
+    *i = j;
+    if (entry) rec_entry(m, j, start, entry);
+    return HASHCHOP_OK;
+}
+
+/* Find FP's slot in TABLE (of SZ slots, a power of 2, with 0 marking an
+ * empty slot): either the one holding it, or the empty slot where it
+ * would go. */
+static uint64_t *find_slot(uint64_t *table, size_t sz, uint64_t fp) {
+    size_t mask = sz - 1;
+    size_t b = (fp ^ (fp >> 32)) & mask;
+    while (table[b] != 0 && table[b] != fp) b = (b + 1) & mask;
+    return &table[b];
+}
+
+/* Diff two manifests, by the fingerprints in OLD. */
+hashchop_res hashchop_manifest_diff(const M *old, const M *new,
+        hashchop_manifest_diff_cb *cb, void *udata,
+        hashchop_manifest_diff_stats *stats) {
+    size_t sz = 16;
+    while (sz < 2 * old->count) sz *= 2;
+    uint64_t *table = hashchop_alloc(sz * sizeof(uint64_t));
+    if (table == NULL) return HASHCHOP_ERROR_MEMORY;
+    memset(table, 0, sz * sizeof(uint64_t));
+    int has_zero = 0;           /* 0 marks empty slots, so track it apart */
+    for (size_t i = 0; i < old->count; i++) {
+        uint64_t fp = hashchop_get_le64(old->recs + i * MF_REC_SZ + 4);
+        if (fp == 0) {
+            has_zero = 1;
+        } else {
+            *find_slot(table, sz, fp) = fp;
+        }
+    }
+
+    hashchop_manifest_diff_stats st;
+    memset(&st, 0, sizeof(st));
+    uint64_t offset = 0;
+    for (size_t i = 0; i < new->count; i++) {
+        hashchop_manifest_entry e;
+        rec_entry(new, i, offset, &e);
+        offset += e.length;
+        if (e.fp == 0 ? has_zero : *find_slot(table, sz, e.fp) == e.fp) {
+            st.shared_chunks++;
+            st.shared_bytes += e.length;
+        } else {
+            st.new_chunks++;
+            st.new_bytes += e.length;
+            if (cb) cb(i, &e, udata);
+        }
+    }
+    hashchop_dealloc(table, sz * sizeof(uint64_t));
+    if (stats) *stats = st;
+    return HASHCHOP_OK;
+}
+
+/* Free (or unmap) a manifest. */
+void hashchop_manifest_free(M *m) {
+    if (m->map) munmap(m->map, m->map_sz);
+    hashchop_dealloc(m, sizeof(*m));
+}
@@ -0,0 +1,105 @@
+#ifndef HASHCHOP_MANIFEST_H
+#define HASHCHOP_MANIFEST_H
+
+#include "hashchop.h"
+
+/* Binary chunk manifests: the list of a file's chunks (offset, length
+ * and fingerprint), in a compact format that can be read in place.
+ *
+ * Records are fixed-width (a length and a fingerprint), and offsets are
+ * implied by the lengths before them, with a sparse index of the offset
+ * of every 64th chunk. Finding a chunk's offset, or the chunk holding a
+ * given file offset, only reads the index and one run of 64 records, so
+ * a manifest can be used straight from a file mapping (or any buffer)
+ * without parsing it. All fields are little-endian. */
+
+/* One chunk in a manifest. */
+typedef struct hashchop_manifest_entry {
+    uint64_t offset;
+    uint32_t length;
+    hashchop_fp fp;
+} hashchop_manifest_entry;
+
+/* Opaque manifest writer and reader handles. */
+typedef struct hashchop_manifest_writer hashchop_manifest_writer;
+typedef struct hashchop_manifest hashchop_manifest;
+
+#define W hashchop_manifest_writer
+#define M hashchop_manifest
+
+/* Create and return a new manifest writer, for chunks chopped with BITS
+ * (which is only recorded). Returns NULL on alloc failure. */
+W *hashchop_manifest_writer_new(uint8_t bits);
+
+/* Add the next chunk, of LENGTH bytes with fingerprint FP.
+ * Returns OK, OVERFLOW if LENGTH doesn't fit in 32 bits, or MEMORY on
+ * alloc failure. */
+hashchop_res hashchop_manifest_add(W *w, size_t length, hashchop_fp fp);
+
+/* Get the size of the manifest's encoding. */
+size_t hashchop_manifest_size(const W *w);
+
+/* Encode the manifest into BUF, a buffer of at least (*LENGTH) bytes, and
+ * write the encoded size in (*LENGTH). Returns OK, or OVERFLOW if BUF is
+ * too small. */
+hashchop_res hashchop_manifest_encode(const W *w, unsigned char *buf,
+    size_t *length);
+
+/* Save the manifest to the file at PATH (via a temp file and rename).
+ * Returns OK, MEMORY on alloc failure, or IO on write error. */
+hashchop_res hashchop_manifest_save(const W *w, const char *path);
+
+/* Free a manifest writer. */
+void hashchop_manifest_writer_free(W *w);
+
+/* Read a manifest in place from LENGTH bytes of BUF, which must stay
+ * valid (and unchanged) until the manifest is freed. Returns NULL if it
+ * is malformed, or on alloc failure. */
+M *hashchop_manifest_open(const unsigned char *buf, size_t length);
+
+/* Map the manifest saved at PATH, read-only. Returns NULL if it can't
+ * be opened or mapped, or is malformed. */
+M *hashchop_manifest_map(const char *path);
+
+/* Get the number of chunks, the total length, and the recorded bits. */
+size_t hashchop_manifest_count(const M *m);
+uint64_t hashchop_manifest_length(const M *m);
+uint8_t hashchop_manifest_bits(const M *m);
+
+/* Get the I'th chunk, and write it in (*ENTRY).
+ * Returns OK, or OVERFLOW if I is out of range. */
+hashchop_res hashchop_manifest_get(const M *m, size_t i,
+    hashchop_manifest_entry *entry);
+
+/* Find the chunk holding byte OFFSET of the file, write its index in
+ * (*I), and write it in (*ENTRY) (if non-NULL). Returns OK, or OVERFLOW
+ * if OFFSET is past the end. */
+hashchop_res hashchop_manifest_find(const M *m, uint64_t offset, size_t *i,
+    hashchop_manifest_entry *entry);
+
+/* Totals from hashchop_manifest_diff. */
+typedef struct hashchop_manifest_diff_stats {
+    size_t shared_chunks;       /* NEW's chunks also in OLD */
+    uint64_t shared_bytes;
+    size_t new_chunks;          /* NEW's chunks not in OLD */
+    uint64_t new_bytes;
+} hashchop_manifest_diff_stats;
+
+/* Callback for each of NEW's chunks that isn't in OLD, with its index. */
+typedef void (hashchop_manifest_diff_cb)(size_t i,
+    const hashchop_manifest_entry *entry, void *udata);
+
+/* Diff two manifests: call CB (if non-NULL, with UDATA) for each chunk
+ * of NEW whose fingerprint isn't in OLD, in order, and write the totals
+ * in (*STATS) (if non-NULL). These are the chunks a sync from OLD to NEW
+ * has to send. Returns OK, or MEMORY on alloc failure. */
+hashchop_res hashchop_manifest_diff(const M *old, const M *new,
+    hashchop_manifest_diff_cb *cb, void *udata,
+    hashchop_manifest_diff_stats *stats);
+
+/* Free (or unmap) a manifest. */
+void hashchop_manifest_free(M *m);
+
+#undef W
+#undef M
+#endif
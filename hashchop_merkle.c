@@ -0,0 +1,358 @@
+/*
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "hashchop.h"
+#include "hashchop_internal.h"
+#include "hashchop_merkle.h"
+
+/* Abbreviations. */
+typedef uint32_t UI;
+typedef uint8_t UC;
+#define M hashchop_merkle
+
+/* Max fanout is the average * this, like the chopper's max chunk size. */
+#define FANOUT_MUL 4
+
+typedef struct {
+    hashchop_fp fp;
+    size_t nchild;              /* number of children, 0 for leaves */
+} node;
+
+typedef struct {
+    node *n;
+    size_t ct;                  /* nodes on the level */
+    size_t limit;               /* array size */
+    size_t open;                /* trailing nodes without a parent yet */
+} level;
+
+struct hashchop_merkle {
+    UI mask;                    /* bitmask for node cuts */
+    size_t max_fanout;
+    level *levels;
+    size_t level_ct;
+    size_t level_limit;
+    int finished;
+    UC *scratch;                /* buffer for hashing a node's children */
+    size_t scratch_sz;
+    size_t hashed;              /* nodes hashed, for update's count */
+};
+
+#define DEF_LEVELS 8
+#define DEF_NODES 64
+
+/* A node ends after a child whose fingerprint matches the mask. These
+ * bits are independent of the ones used by the chunk store and filter. */
+#define IS_CUT(M, FP) ((((FP) >> 40) & (M)->mask) == 0)
+
+/* Create and return a new, empty tree with an average fanout of
+ * 2^FANOUT_BITS. */
+M *hashchop_merkle_new(uint8_t fanout_bits) {
+    if (fanout_bits < HASHCHOP_MERKLE_MIN_BITS
+        || fanout_bits > HASHCHOP_MERKLE_MAX_BITS) return NULL;
+    M *m = hashchop_alloc(sizeof(*m));
+    if (m == NULL) return NULL;
+    memset(m, 0, sizeof(*m));
+    m->mask = (1 << fanout_bits) - 1;
+    m->max_fanout = FANOUT_MUL << fanout_bits;
+    m->scratch_sz = 1 + 8 * m->max_fanout;
+    m->scratch = hashchop_alloc(m->scratch_sz);
+    m->level_limit = DEF_LEVELS;
+    m->levels = hashchop_alloc(m->level_limit * sizeof(level));
+    if (m->scratch == NULL || m->levels == NULL) {
+        if (m->scratch) hashchop_dealloc(m->scratch, m->scratch_sz);
+        if (m->levels) hashchop_dealloc(m->levels, m->level_limit * sizeof(level));
+        hashchop_dealloc(m, sizeof(*m));
+        return NULL;
+    }
+    memset(m->levels, 0, m->level_limit * sizeof(level));
+    m->level_ct = 1;
+    return m;
+}
+
+/* Get level L, adding empty levels up to it if necessary. */
+static level *get_level(M *m, size_t l) {
+    if (l >= m->level_limit) {
+        size_t nlimit = 2 * m->level_limit;
+        level *nl = hashchop_alloc(nlimit * sizeof(level));
+        if (nl == NULL) return NULL;
+        memset(nl, 0, nlimit * sizeof(level));
+        memcpy(nl, m->levels, m->level_ct * sizeof(level));
+        hashchop_dealloc(m->levels, m->level_limit * sizeof(level));
+        m->levels = nl;
+        m->level_limit = nlimit;
+    }
+    while (m->level_ct <= l) {
+        level *lv = &m->levels[m->level_ct++];
+        lv->ct = 0;
+        lv->open = 0;
+    }
+    return &m->levels[l];
+}
+
+/* Make sure LV has room for SZ nodes. */
+static int reserve(level *lv, size_t sz) {
+    if (sz <= lv->limit) return 1;
+    size_t nlimit = (lv->limit ? lv->limit : DEF_NODES);
+    while (nlimit < sz) nlimit *= 2;
+    node *nn = hashchop_alloc(nlimit * sizeof(node));
+    if (nn == NULL) return 0;
+    if (lv->n) {
+        memcpy(nn, lv->n, lv->ct * sizeof(node));
+        hashchop_dealloc(lv->n, lv->limit * sizeof(node));
+    }
+    lv->n = nn;
+    lv->limit = nlimit;
+    return 1;
+}
+
+/* Get the fingerprint of a node on level L with N CHILDREN. */
+static hashchop_fp hash_node(M *m, size_t l, const node *children, size_t n) {
+    UC *buf = m->scratch;
+    buf[0] = (UC)l;
+    for (size_t i = 0; i < n; i++) {
+        hashchop_put_le64(buf + 1 + 8 * i, children[i].fp);
+    }
+    m->hashed++;
+    return hashchop_fingerprint(buf, 1 + 8 * n);
+}
+
+static hashchop_res add_node(M *m, size_t l, hashchop_fp fp, size_t nchild);
+
+/* Give the open nodes at the end of level L a parent. */
+static hashchop_res close_node(M *m, size_t l) {
+    level *lv = &m->levels[l];
+    size_t n = lv->open;
+    hashchop_fp fp = hash_node(m, l + 1, lv->n + lv->ct - n, n);
+    lv->open = 0;
+    return add_node(m, l + 1, fp, n);
+}
+
+/* Append a node to level L, closing its parent if it's a cut. */
+static hashchop_res add_node(M *m, size_t l, hashchop_fp fp, size_t nchild) {
+    level *lv = get_level(m, l);
+    if (lv == NULL || !reserve(lv, lv->ct + 1)) return HASHCHOP_ERROR_MEMORY;
+    node *nd = &lv->n[lv->ct++];
+    nd->fp = fp;
+    nd->nchild = nchild;
+    lv->open++;
+    if (IS_CUT(m, fp) || lv->open == m->max_fanout) return close_node(m, l);
+    return HASHCHOP_OK;
+}
+
+/* Add a leaf, the fingerprint of the next chunk in the stream. */
+hashchop_res hashchop_merkle_add(M *m, hashchop_fp leaf) {
+    if (m->finished) return HASHCHOP_ERROR_FULL;
+    return add_node(m, 0, leaf, 0);
+}
+
+/* Add a leaf for LENGTH bytes of DATA, the next chunk in the stream. */
+hashchop_res hashchop_merkle_add_chunk(M *m, const unsigned char *data,
+        size_t length) {
+    return hashchop_merkle_add(m, hashchop_fingerprint(data, length));
+}
+
+/* The top level is the lowest one with only one node. Drop any levels
+ * above it (chains of single-child nodes), so the tree only depends on
+ * its leaves, not on the order it was built in. */
+static void trim(M *m) {
+    for (size_t l = 0; l < m->level_ct; l++) {
+        if (m->levels[l].ct == 1) {
+            m->level_ct = l + 1;
+            break;
+        }
+    }
+}
+
+/* Close the last node on each level, and write the root fingerprint. */
+hashchop_res hashchop_merkle_finish(M *m, hashchop_fp *root) {
+    if (m->levels[0].ct == 0) return HASHCHOP_ERROR_UNDERFLOW;
+    if (!m->finished) {
+        for (size_t l = 0; m->levels[l].ct > 1; l++) {
+            if (m->levels[l].open > 0) {
+                hashchop_res res = close_node(m, l);
+                if (res != HASHCHOP_OK) return res;
+            }
+        }
+        trim(m);
+        for (size_t l = 0; l < m->level_ct; l++) m->levels[l].open = 0;
+        m->finished = 1;
+    }
+    *root = m->levels[m->level_ct - 1].n[0].fp;
+    return HASHCHOP_OK;
+}
+
+/* Replace the R nodes at A on level LV with N new ones. */
+static int level_splice(level *lv, size_t a, size_t r, const node *ins, size_t n) {
+    if (!reserve(lv, lv->ct - r + n)) return 0;
+    memmove(lv->n + a + n, lv->n + a + r, (lv->ct - a - r) * sizeof(node));
+    memcpy(lv->n + a, ins, n * sizeof(node));
+    lv->ct = lv->ct - r + n;
+    return 1;
+}
+
+/* Cut level L into parent nodes, starting at child FROM (the first child
+ * of old parent J), and append them to (*OUT). Stop early once a parent
+ * ends at or after child SYNC_FROM and lines up with the end of an old
+ * parent, where old offsets are new offsets - ADDED + REMOVED. The index
+ * after the last old parent replaced is written in (*END). Returns 0 on
+ * alloc failure. */
+static int recut(M *m, size_t l, size_t from, size_t sync_from,
+        size_t added, size_t removed, size_t j,
+        node **out, size_t *out_ct, size_t *out_limit, size_t *end) {
+    level *lv = &m->levels[l];
+    level *pl = (l + 1 < m->level_ct ? &m->levels[l + 1] : NULL);
+    size_t k = j, old_end = (pl && j < pl->ct ? from + pl->n[j].nchild : 0);
+    size_t open = 0;
+
+    for (size_t i = from; i < lv->ct; i++) {
+        open++;
+        if (!(IS_CUT(m, lv->n[i].fp) || open == m->max_fanout
+                || i == lv->ct - 1)) continue;
+
+        size_t e = i + 1;
+        if (*out_ct == *out_limit) {
+            size_t nlimit = 2 * *out_limit;
+            node *nn = hashchop_alloc(nlimit * sizeof(node));
+            if (nn == NULL) return 0;
+            memcpy(nn, *out, *out_ct * sizeof(node));
+            hashchop_dealloc(*out, *out_limit * sizeof(node));
+            *out = nn;
+            *out_limit = nlimit;
+        }
+        node *nd = &(*out)[(*out_ct)++];
+        nd->fp = hash_node(m, l + 1, lv->n + e - open, open);
+        nd->nchild = open;
+        open = 0;
+
+        if (pl && e >= sync_from && e < lv->ct) {
+            size_t oe = e - added + removed;
+            while (k + 1 < pl->ct && old_end < oe) {
+                k++;
+                old_end += pl->n[k].nchild;
+            }
+            if (old_end == oe) {        /* back in sync */
+                *end = k + 1;
+                return 1;
+            }
+        }
+    }
+    *end = (pl ? pl->ct : 0);
+    return 1;
+}
+
+/* Replace the R nodes at A on level L with N new ones, and update the
+ * levels above. */
+static hashchop_res splice(M *m, size_t l, size_t a, size_t r,
+        const node *ins, size_t n) {
+    level *lv = &m->levels[l];
+    size_t top = m->level_ct - 1;
+    size_t j = 0, from = 0;
+
+    if (l < top) {
+        /* Find the parent of the first changed child (or of the
+         * last child, when appending), and start from its first child. */
+        level *pl = &m->levels[l + 1];
+        size_t idx = (a < lv->ct ? a : lv->ct - 1);
+        while (from + pl->n[j].nchild <= idx) from += pl->n[j++].nchild;
+    }
+    if (!level_splice(lv, a, r, ins, n)) return HASHCHOP_ERROR_MEMORY;
+    if (l == top && lv->ct <= 1) return HASHCHOP_OK;
+
+    size_t out_ct = 0, out_limit = DEF_NODES;
+    node *out = hashchop_alloc(out_limit * sizeof(node));
+    if (out == NULL) return HASHCHOP_ERROR_MEMORY;
+    size_t end = 0;
+    hashchop_res res = HASHCHOP_ERROR_MEMORY;
+    if (recut(m, l, from, a + n, n, r, j, &out, &out_ct, &out_limit, &end)) {
+        if (l == top) {         /* a new top level */
+            if (get_level(m, l + 1) == NULL) goto cleanup;
+            res = splice(m, l + 1, 0, 0, out, out_ct);
+        } else {
+            res = splice(m, l + 1, j, end - j, out, out_ct);
+        }
+    }
+cleanup:
+    hashchop_dealloc(out, out_limit * sizeof(node));
+    return res;
+}
+
+/* In a finished tree, replace the REMOVED leaves starting at FIRST with
+ * ADDED new LEAVES, re-hashing only the nodes whose children changed. */
+hashchop_res hashchop_merkle_update(M *m, size_t first, size_t removed,
+        const hashchop_fp *leaves, size_t added, hashchop_fp *root,
+        size_t *rehashed) {
+    hashchop_fp r = 0;
+    if (!m->finished) {
+        hashchop_res res = hashchop_merkle_finish(m, &r);
+        if (res != HASHCHOP_OK && res != HASHCHOP_ERROR_UNDERFLOW) return res;
+        m->finished = 1;
+    }
+    level *leaf_level = &m->levels[0];
+    if (first + removed > leaf_level->ct) return HASHCHOP_ERROR_OVERFLOW;
+    if (leaf_level->ct - removed + added == 0) {
+        leaf_level->ct = 0;
+        m->level_ct = 1;
+        return HASHCHOP_ERROR_UNDERFLOW;
+    }
+
+    node *ins = hashchop_alloc((added ? added : 1) * sizeof(node));
+    if (ins == NULL) return HASHCHOP_ERROR_MEMORY;
+    for (size_t i = 0; i < added; i++) {
+        ins[i].fp = leaves[i];
+        ins[i].nchild = 0;
+    }
+    m->hashed = 0;
+    if (leaf_level->ct == 0) m->level_ct = 1;
+    hashchop_res res = splice(m, 0, first, removed, ins, added);
+    hashchop_dealloc(ins, (added ? added : 1) * sizeof(node));
+    if (res != HASHCHOP_OK) return res;
+
+    trim(m);
+    *root = m->levels[m->level_ct - 1].n[0].fp;
+    if (rehashed) *rehashed = m->hashed;
+    return HASHCHOP_OK;
+}
+
+/* Get the number of levels, including the leaves. */
+size_t hashchop_merkle_levels(const M *m) { return m->level_ct; }
+
+/* Get the number of nodes on a level. */
+size_t hashchop_merkle_count(const M *m, size_t level) {
+    return (level < m->level_ct ? m->levels[level].ct : 0);
+}
+
+/* Get the fingerprint of the INDEX'th node on LEVEL. */
+hashchop_fp hashchop_merkle_node(const M *m, size_t level, size_t index,
+        size_t *children) {
+    if (level >= m->level_ct || index >= m->levels[level].ct) return 0;
+    const node *nd = &m->levels[level].n[index];
+    if (children) *children = nd->nchild;
+    return nd->fp;
+}
+
+/* Free a tree. */
+void hashchop_merkle_free(M *m) {
+    for (size_t l = 0; l < m->level_limit; l++) {
+        level *lv = &m->levels[l];
+        if (lv->n) hashchop_dealloc(lv->n, lv->limit * sizeof(node));
+    }
+    hashchop_dealloc(m->levels, m->level_limit * sizeof(level));
+    hashchop_dealloc(m->scratch, m->scratch_sz);
+    hashchop_dealloc(m, sizeof(*m));
+}
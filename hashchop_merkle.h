@@ -0,0 +1,77 @@
+#ifndef HASHCHOP_MERKLE_H
+#define HASHCHOP_MERKLE_H
+
+#include "hashchop.h"
+
+/* Content-defined Merkle tree over a chunk stream.
+ *
+ * The leaves are chunk fingerprints, in stream order. Interior nodes are
+ * cut content-defined too: a node ends after a child whose fingerprint
+ * matches a bit mask (much like the chopper's seams), or after a max
+ * number of children, so trees for edited data share most of their
+ * nodes. A node's fingerprint is the fingerprint of its level and its
+ * children's fingerprints. Levels are numbered from 0 (the leaves), and
+ * the root is the only node on the top level.
+ *
+ * The tree is built while streaming: each completed node is hashed as
+ * soon as its last child arrives, so hashchop_merkle_finish only has to
+ * close the last node on each level. After finishing, leaves can be
+ * replaced with hashchop_merkle_update, which only re-hashes the nodes
+ * on the changed paths. */
+
+/* Opaque Merkle tree handle. */
+typedef struct hashchop_merkle hashchop_merkle;
+
+#define M hashchop_merkle
+
+#define HASHCHOP_MERKLE_MIN_BITS 1
+#define HASHCHOP_MERKLE_MAX_BITS 8
+
+/* Create and return a new, empty tree with an average fanout of
+ * 2^FANOUT_BITS (and a max of four times that). Returns NULL on error
+ * (bad FANOUT_BITS value, or alloc failure). */
+M *hashchop_merkle_new(uint8_t fanout_bits);
+
+/* Add a leaf, the fingerprint of the next chunk in the stream.
+ * Returns OK, MEMORY on alloc failure, or FULL if the tree has
+ * been finished. */
+hashchop_res hashchop_merkle_add(M *m, hashchop_fp leaf);
+
+/* Add a leaf for LENGTH bytes of DATA, the next chunk in the stream. */
+hashchop_res hashchop_merkle_add_chunk(M *m, const unsigned char *data,
+    size_t length);
+
+/* Close the last node on each level, and write the root fingerprint in
+ * (*ROOT). Returns OK, UNDERFLOW if there are no leaves, or MEMORY on
+ * alloc failure. Finishing a finished tree just gets the root. */
+hashchop_res hashchop_merkle_finish(M *m, hashchop_fp *root);
+
+/* In a finished tree, replace the REMOVED leaves starting at FIRST with
+ * ADDED new LEAVES (for example, the chunks between the old and new
+ * boundaries found by hashchop_rechunk), re-hashing only the nodes whose
+ * children changed, and write the new root in (*ROOT). If REHASHED is
+ * non-NULL, the number of nodes hashed is written there. The tree is the
+ * same as one built from scratch from the new leaves. Returns OK,
+ * UNDERFLOW if no leaves are left, OVERFLOW if FIRST + REMOVED is past the
+ * last leaf, or MEMORY on alloc failure. */
+hashchop_res hashchop_merkle_update(M *m, size_t first, size_t removed,
+    const hashchop_fp *leaves, size_t added, hashchop_fp *root,
+    size_t *rehashed);
+
+/* Get the number of levels, including the leaves. */
+size_t hashchop_merkle_levels(const M *m);
+
+/* Get the number of nodes on a level. */
+size_t hashchop_merkle_count(const M *m, size_t level);
+
+/* Get the fingerprint of the INDEX'th node on LEVEL, and write its number
+ * of children in (*CHILDREN) if CHILDREN is non-NULL (0 for leaves).
+ * Returns 0 for an invalid level or index. */
+hashchop_fp hashchop_merkle_node(const M *m, size_t level, size_t index,
+    size_t *children);
+
+/* Free a tree. */
+void hashchop_merkle_free(M *m);
+
+#undef M
+#endif
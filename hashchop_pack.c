@@ -0,0 +1,626 @@
+/*
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "hashchop.h"
+#include "hashchop_internal.h"
+#include "hashchop_pack.h"
+#include "hashchop_filter.h"
+
+/* Abbreviations. */
+typedef uint32_t UI;
+typedef uint8_t UC;
+#define P hashchop_pack
+
+/* Pack file header: magic, version, reserved. */
+static const UC PACK_MAGIC[4] = { 'h', 'c', 'p', 'k' };
+#define PACK_VERSION 1
+#define PACK_HEADER_SZ 16
+
+/* Record header: fingerprint, length, check. The check is a function of
+ * the other two fields, to detect a torn header at the end of the pack. */
+#define REC_HEADER_SZ 16
+#define REC_CHECK(FP, LEN) ((UI)((FP) ^ ((FP) >> 32) ^ (LEN) ^ 0x9e3779b9))
+
+/* Index file header: magic, version, slot count, entry count, pack
+ * length covered (0 while the slots are being changed). Slots follow:
+ * fingerprint, pack offset + 1 (0 = empty). */
+static const UC IDX_MAGIC[4] = { 'h', 'c', 'i', 'x' };
+#define IDX_VERSION 1
+#define IDX_HEADER_SZ 32
+#define IDX_SLOT_SZ 16
+
+/* In-memory slot, for entries not in the mapped index yet. */
+typedef struct {
+    hashchop_fp fp;
+    uint64_t off1;              /* pack offset + 1, 0 = empty */
+} slot;
+
+#define DEF_WBUF (1024 * 1024)
+#define DEF_PENDING 1024
+#define MAX_PENDING (64 * 1024)
+#define DEF_FILTER (64 * 1024)
+
+struct hashchop_pack {
+    int fd;                     /* pack file */
+    char *idx_path;             /* index path */
+    size_t idx_path_sz;
+    char *filter_path;          /* prefilter path */
+    size_t filter_path_sz;
+    hashchop_filter *filter;    /* prefilter for all entries */
+    int filter_stale;           /* prefilter differs from its file */
+    uint64_t pack_len;          /* pack length, including write buffer */
+    UC *wbuf;                   /* buffered appends */
+    size_t wbuf_used;
+    size_t wbuf_size;
+    UC *idx;                    /* mapped index, or NULL */
+    size_t idx_len;             /* mapping length */
+    uint64_t idx_slot_ct;       /* index slots, a power of 2 */
+    uint64_t idx_count;         /* entries in index */
+    int idx_dirty;              /* index changed since it was committed */
+    slot *pend;                 /* entries not in the index yet */
+    size_t pend_slot_ct;        /* a power of 2 */
+    size_t pend_count;
+};
+
+/* Get the number of chunks in the pack. */
+size_t hashchop_pack_count(const P *p) { return p->idx_count + p->pend_count; }
+
+/* Look up FP in the mapped index. Returns offset + 1, or 0. */
+static uint64_t idx_lookup(const P *p, hashchop_fp fp) {
+    if (p->idx == NULL) return 0;
+    uint64_t mask = p->idx_slot_ct - 1;
+    const UC *slots = p->idx + IDX_HEADER_SZ;
+    for (uint64_t b = fp & mask; ; b = (b + 1) & mask) {
+        const UC *s = slots + b * IDX_SLOT_SZ;
+        uint64_t off1 = hashchop_get_le64(s + 8);
+        if (off1 == 0) return 0;
+        if (hashchop_get_le64(s) == fp) return off1;
+    }
+}
+
+/* Find FP's pending slot, or the empty slot where it belongs. */
+static slot *pend_lookup(const P *p, hashchop_fp fp) {
+    size_t mask = p->pend_slot_ct - 1;
+    for (size_t b = fp & mask; ; b = (b + 1) & mask) {
+        slot *s = &p->pend[b];
+        if (s->off1 == 0 || s->fp == fp) return s;
+    }
+}
+
+static int pend_alloc(P *p, size_t slot_ct) {
+    p->pend = hashchop_alloc(slot_ct * sizeof(slot));
+    if (p->pend == NULL) return 0;
+    memset(p->pend, 0, slot_ct * sizeof(slot));
+    p->pend_slot_ct = slot_ct;
+    p->pend_count = 0;
+    return 1;
+}
+
+static hashchop_res idx_merge(P *p);
+
+/* Add a pending entry for a chunk known not to be in the pack yet.
+ * Once there are MAX_PENDING, they are moved into the index first. */
+static hashchop_res pend_add(P *p, hashchop_fp fp, uint64_t offset) {
+    if (p->pend_count >= MAX_PENDING) {
+        hashchop_res res = idx_merge(p);
+        if (res != HASHCHOP_OK) return res;
+    }
+    hashchop_filter_add(p->filter, fp);
+    p->filter_stale = 1;
+    if (4 * (p->pend_count + 1) > 3 * p->pend_slot_ct) {
+        slot *old = p->pend;
+        size_t old_ct = p->pend_slot_ct, count = p->pend_count;
+        if (!pend_alloc(p, 2 * old_ct)) {
+            p->pend = old;
+            return HASHCHOP_ERROR_MEMORY;
+        }
+        for (size_t i = 0; i < old_ct; i++) {
+            if (old[i].off1 != 0) *pend_lookup(p, old[i].fp) = old[i];
+        }
+        p->pend_count = count;
+        hashchop_dealloc(old, old_ct * sizeof(slot));
+    }
+    slot *s = pend_lookup(p, fp);
+    s->fp = fp;
+    s->off1 = offset + 1;
+    p->pend_count++;
+    return HASHCHOP_OK;
+}
+
+/* Look up a chunk by fingerprint. */
+int hashchop_pack_lookup(const P *p, hashchop_fp fp, uint64_t *id) {
+    /* Most new chunks can skip probing the index. */
+    if (!hashchop_filter_check(p->filter, fp)) return 0;
+    uint64_t off1 = idx_lookup(p, fp);
+    if (off1 == 0) off1 = pend_lookup(p, fp)->off1;
+    if (off1 == 0) return 0;
+    *id = off1 - 1;
+    return 1;
+}
+
+static int write_all(int fd, const UC *buf, size_t sz) {
+    while (sz > 0) {
+        ssize_t wr = write(fd, buf, sz);
+        if (wr < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        buf += wr;
+        sz -= wr;
+    }
+    return 1;
+}
+
+static int read_all(int fd, UC *buf, size_t sz, uint64_t offset) {
+    while (sz > 0) {
+        ssize_t rd = pread(fd, buf, sz, offset);
+        if (rd < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        } else if (rd == 0) {
+            return 0;           /* unexpected EOF */
+        }
+        buf += rd;
+        sz -= rd;
+        offset += rd;
+    }
+    return 1;
+}
+
+static int flush(P *p) {
+    if (!write_all(p->fd, p->wbuf, p->wbuf_used)) return 0;
+    p->wbuf_used = 0;
+    return 1;
+}
+
+/* Make room for a record with SZ bytes of data in the write buffer. */
+static hashchop_res reserve(P *p, size_t sz) {
+    sz += REC_HEADER_SZ;
+    if (p->wbuf_size - p->wbuf_used >= sz) return HASHCHOP_OK;
+    if (!flush(p)) return HASHCHOP_ERROR_IO;
+    if (p->wbuf_size < sz) {
+        UC *nbuf = hashchop_alloc(sz);
+        if (nbuf == NULL) return HASHCHOP_ERROR_MEMORY;
+        hashchop_dealloc(p->wbuf, p->wbuf_size);
+        p->wbuf = nbuf;
+        p->wbuf_size = sz;
+    }
+    return HASHCHOP_OK;
+}
+
+/* Add the chunk in the write buffer (after space for its record header)
+ * to the pack, unless it's already there. */
+static hashchop_res append(P *p, size_t length, uint64_t *id) {
+    UC *rec = p->wbuf + p->wbuf_used;
+    hashchop_fp fp = hashchop_fingerprint(rec + REC_HEADER_SZ, length);
+    if (hashchop_pack_lookup(p, fp, id)) return HASHCHOP_OK;
+    hashchop_res res = pend_add(p, fp, p->pack_len);
+    if (res != HASHCHOP_OK) return res;
+
+    hashchop_put_le64(rec, fp);
+    hashchop_put_le32(rec + 8, length);
+    hashchop_put_le32(rec + 12, REC_CHECK(fp, (UI)length));
+    *id = p->pack_len;
+    p->wbuf_used += REC_HEADER_SZ + length;
+    p->pack_len += REC_HEADER_SZ + length;
+    return HASHCHOP_OK;
+}
+
+/* Append LENGTH bytes of DATA to the pack as a chunk, unless a chunk with
+ * the same fingerprint is already there, and write its ID in (*ID). */
+hashchop_res hashchop_pack_put(P *p, const unsigned char *data,
+        size_t length, uint64_t *id) {
+    hashchop_fp fp = hashchop_fingerprint(data, length);
+    if (hashchop_pack_lookup(p, fp, id)) return HASHCHOP_OK;
+    hashchop_res res = reserve(p, length);
+    if (res != HASHCHOP_OK) return res;
+    memcpy(p->wbuf + p->wbuf_used + REC_HEADER_SZ, data, length);
+    return append(p, length, id);
+}
+
+/* Poll the next chunk from HC directly into the pack's write buffer. */
+hashchop_res hashchop_pack_poll(P *p, hashchop *hc, uint64_t *id) {
+    size_t len = hashchop_max_chunk(hc);
+    hashchop_res res = reserve(p, len);
+    if (res != HASHCHOP_OK) return res;
+    res = hashchop_poll(hc, p->wbuf + p->wbuf_used + REC_HEADER_SZ, &len);
+    if (res != HASHCHOP_OK) return res;
+    return append(p, len, id);
+}
+
+/* Finish HC's data stream, appending its last chunk to the pack. */
+hashchop_res hashchop_pack_finish(P *p, hashchop *hc, uint64_t *id) {
+    size_t len = hashchop_max_chunk(hc);
+    hashchop_res res = reserve(p, len);
+    if (res != HASHCHOP_OK) return res;
+    res = hashchop_finish(hc, p->wbuf + p->wbuf_used + REC_HEADER_SZ, &len);
+    if (res != HASHCHOP_OK) return res;
+    if (len == 0) return HASHCHOP_ERROR_UNDERFLOW;
+    return append(p, len, id);
+}
+
+/* Read the chunk with a given ID into DATA. */
+hashchop_res hashchop_pack_read(P *p, uint64_t id, unsigned char *data,
+        size_t *length) {
+    UC hdr[REC_HEADER_SZ];
+    if (p->wbuf_used > 0 && !flush(p)) return HASHCHOP_ERROR_IO;
+    if (id < PACK_HEADER_SZ || id + REC_HEADER_SZ > p->pack_len)
+        return HASHCHOP_ERROR_IO;
+    if (!read_all(p->fd, hdr, REC_HEADER_SZ, id)) return HASHCHOP_ERROR_IO;
+    hashchop_fp fp = hashchop_get_le64(hdr);
+    UI len = hashchop_get_le32(hdr + 8);
+    if (hashchop_get_le32(hdr + 12) != REC_CHECK(fp, len))
+        return HASHCHOP_ERROR_IO;
+    if (*length < len) return HASHCHOP_ERROR_OVERFLOW;
+    if (!read_all(p->fd, data, len, id + REC_HEADER_SZ))
+        return HASHCHOP_ERROR_IO;
+    *length = len;
+    return HASHCHOP_OK;
+}
+
+static void unmap_index(P *p) {
+    if (p->idx) munmap((void *)p->idx, p->idx_len);
+    p->idx = NULL;
+    p->idx_len = 0;
+    p->idx_slot_ct = 0;
+    p->idx_count = 0;
+    p->idx_dirty = 0;
+}
+
+/* Map the index read-write, if it exists and is valid. Returns the pack
+ * length it covers, or 0 if there is no usable index (including one
+ * left mid-update by a crash). */
+static uint64_t map_index(P *p, uint64_t pack_len) {
+    struct stat st;
+    int fd = open(p->idx_path, O_RDWR);
+    if (fd == -1) return 0;
+    if (fstat(fd, &st) == -1 || st.st_size < IDX_HEADER_SZ) goto fail;
+    void *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        fd, 0);
+    if (map == MAP_FAILED) goto fail;
+    close(fd);
+
+    UC *m = map;
+    uint64_t slot_ct = hashchop_get_le64(m + 8);
+    uint64_t count = hashchop_get_le64(m + 16);
+    uint64_t covered = hashchop_get_le64(m + 24);
+    if (memcmp(m, IDX_MAGIC, 4) != 0
+        || hashchop_get_le32(m + 4) != IDX_VERSION
+        || slot_ct == 0 || (slot_ct & (slot_ct - 1)) != 0
+        || (uint64_t)st.st_size != IDX_HEADER_SZ + slot_ct * IDX_SLOT_SZ
+        || count >= slot_ct
+        || covered < PACK_HEADER_SZ || covered > pack_len) {
+        munmap(map, st.st_size);
+        return 0;
+    }
+    p->idx = m;
+    p->idx_len = st.st_size;
+    p->idx_slot_ct = slot_ct;
+    p->idx_count = count;
+    return covered;
+
+fail:
+    close(fd);
+    return 0;
+}
+
+/* Replace the prefilter with a new one, sized for at least twice the
+ * current entries, and add all of them. */
+static int build_filter(P *p) {
+    size_t capacity = 2 * (p->idx_count + p->pend_count);
+    if (capacity < DEF_FILTER) capacity = DEF_FILTER;
+    hashchop_filter *f = hashchop_filter_new(capacity, 0);
+    if (f == NULL) return 0;
+    for (uint64_t i = 0; i < p->idx_slot_ct; i++) {
+        const UC *s = p->idx + IDX_HEADER_SZ + i * IDX_SLOT_SZ;
+        if (hashchop_get_le64(s + 8) != 0)
+            hashchop_filter_add(f, hashchop_get_le64(s));
+    }
+    for (size_t i = 0; i < p->pend_slot_ct; i++) {
+        if (p->pend[i].off1 != 0) hashchop_filter_add(f, p->pend[i].fp);
+    }
+    if (p->filter) hashchop_filter_free(p->filter);
+    p->filter = f;
+    p->filter_stale = 1;
+    return 1;
+}
+
+/* Map the saved prefilter, if it matches the index; otherwise build it
+ * from the index. */
+static int load_filter(P *p, int rebuild) {
+    if (!rebuild) p->filter = hashchop_filter_map(p->filter_path);
+    if (p->filter && hashchop_filter_count(p->filter) != p->idx_count) {
+        hashchop_filter_free(p->filter);
+        p->filter = NULL;
+    }
+    return p->filter != NULL || build_filter(p);
+}
+
+/* Index the records from OFFSET to the end of the pack, truncating any
+ * torn or corrupt record at the end. */
+static hashchop_res scan_pack(P *p, uint64_t offset, uint64_t pack_len) {
+    UC hdr[REC_HEADER_SZ];
+    UC *buf = NULL;
+    size_t buf_sz = 0;
+    hashchop_res res = HASHCHOP_OK;
+
+    while (offset + REC_HEADER_SZ <= pack_len) {
+        if (!read_all(p->fd, hdr, REC_HEADER_SZ, offset)) break;
+        hashchop_fp fp = hashchop_get_le64(hdr);
+        UI len = hashchop_get_le32(hdr + 8);
+        if (hashchop_get_le32(hdr + 12) != REC_CHECK(fp, len)) break;
+        if (offset + REC_HEADER_SZ + len > pack_len) break;
+        if (len > buf_sz) {
+            if (buf) hashchop_dealloc(buf, buf_sz);
+            buf_sz = len;
+            buf = hashchop_alloc(buf_sz);
+            if (buf == NULL) return HASHCHOP_ERROR_MEMORY;
+        }
+        if (!read_all(p->fd, buf, len, offset + REC_HEADER_SZ)) break;
+        if (hashchop_fingerprint(buf, len) != fp) break;
+        uint64_t id = 0;
+        if (!hashchop_pack_lookup(p, fp, &id)) {
+            res = pend_add(p, fp, offset);
+            if (res != HASHCHOP_OK) break;
+        }
+        offset += REC_HEADER_SZ + len;
+    }
+    if (buf) hashchop_dealloc(buf, buf_sz);
+    if (res == HASHCHOP_OK && offset < pack_len) {
+        if (ftruncate(p->fd, offset) == -1) return HASHCHOP_ERROR_IO;
+    }
+    p->pack_len = offset;
+    return res;
+}
+
+/* Open the pack file at PATH (creating it if necessary) and map its index. */
+P *hashchop_pack_open(const char *path, int flags) {
+    struct stat st;
+    P *p = hashchop_alloc(sizeof(*p));
+    if (p == NULL) { errno = ENOMEM; return NULL; }
+    memset(p, 0, sizeof(*p));
+    p->fd = -1;
+
+    p->idx_path_sz = strlen(path) + sizeof(".idx");
+    p->idx_path = hashchop_alloc(p->idx_path_sz);
+    p->filter_path_sz = strlen(path) + sizeof(".filter");
+    p->filter_path = hashchop_alloc(p->filter_path_sz);
+    p->wbuf_size = DEF_WBUF;
+    p->wbuf = hashchop_alloc(p->wbuf_size);
+    if (p->idx_path == NULL || p->filter_path == NULL || p->wbuf == NULL
+        || !pend_alloc(p, DEF_PENDING)) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    snprintf(p->idx_path, p->idx_path_sz, "%s.idx", path);
+    snprintf(p->filter_path, p->filter_path_sz, "%s.filter", path);
+
+    p->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (p->fd == -1) goto fail;
+    if (fstat(p->fd, &st) == -1) goto fail;
+
+    uint64_t pack_len = st.st_size;
+    UC hdr[PACK_HEADER_SZ];
+    if (pack_len < PACK_HEADER_SZ) {  /* new pack */
+        memset(hdr, 0, sizeof(hdr));
+        memcpy(hdr, PACK_MAGIC, 4);
+        hashchop_put_le32(hdr + 4, PACK_VERSION);
+        if (ftruncate(p->fd, 0) == -1) goto fail;
+        if (!write_all(p->fd, hdr, sizeof(hdr))) goto fail;
+        pack_len = PACK_HEADER_SZ;
+    } else {
+        if (!read_all(p->fd, hdr, sizeof(hdr), 0)) goto fail;
+        if (memcmp(hdr, PACK_MAGIC, 4) != 0
+            || hashchop_get_le32(hdr + 4) != PACK_VERSION) {
+            errno = EINVAL;
+            goto fail;
+        }
+    }
+
+    uint64_t covered = 0;
+    if (!(flags & HASHCHOP_PACK_REBUILD)) covered = map_index(p, pack_len);
+    if (covered == 0) covered = PACK_HEADER_SZ;
+    if (!load_filter(p, flags & HASHCHOP_PACK_REBUILD)) {
+        errno = ENOMEM;
+        goto fail;
+    }
+    hashchop_res res = scan_pack(p, covered, pack_len);
+    if (res != HASHCHOP_OK) {
+        errno = (res == HASHCHOP_ERROR_MEMORY ? ENOMEM : EIO);
+        goto fail;
+    }
+    if (lseek(p->fd, p->pack_len, SEEK_SET) == -1) goto fail;
+    return p;
+
+fail:
+    {
+        int e = errno;
+        if (p->fd != -1) close(p->fd);
+        unmap_index(p);
+        if (p->filter) hashchop_filter_free(p->filter);
+        if (p->pend) hashchop_dealloc(p->pend, p->pend_slot_ct * sizeof(slot));
+        if (p->wbuf) hashchop_dealloc(p->wbuf, p->wbuf_size);
+        if (p->idx_path) hashchop_dealloc(p->idx_path, p->idx_path_sz);
+        if (p->filter_path) {
+            hashchop_dealloc(p->filter_path, p->filter_path_sz);
+        }
+        hashchop_dealloc(p, sizeof(*p));
+        errno = e;
+    }
+    return NULL;
+}
+
+/* Insert an entry, known not to be there yet, into an index's slots. */
+static void idx_insert(UC *slots, uint64_t slot_ct, hashchop_fp fp,
+        uint64_t off1) {
+    uint64_t mask = slot_ct - 1;
+    for (uint64_t b = fp & mask; ; b = (b + 1) & mask) {
+        UC *s = slots + b * IDX_SLOT_SZ;
+        if (hashchop_get_le64(s + 8) == 0) {
+            hashchop_put_le64(s, fp);
+            hashchop_put_le64(s + 8, off1);
+            return;
+        }
+    }
+}
+
+/* Write every entry into a new index, with at least twice as many slots
+ * as entries, and map it in place of the old one. It is written to a
+ * temp file, renamed into place, and left uncommitted. */
+static hashchop_res grow_index(P *p) {
+    uint64_t count = p->idx_count + p->pend_count;
+    uint64_t slot_ct = 1024;
+    while (slot_ct < 2 * count) slot_ct <<= 1;
+    size_t len = IDX_HEADER_SZ + slot_ct * IDX_SLOT_SZ;
+
+    size_t tmp_sz = p->idx_path_sz + sizeof(".tmp");
+    char *tmp_path = hashchop_alloc(tmp_sz);
+    if (tmp_path == NULL) return HASHCHOP_ERROR_MEMORY;
+    snprintf(tmp_path, tmp_sz, "%s.tmp", p->idx_path);
+
+    UC *m = MAP_FAILED;
+    int fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd != -1) {
+        if (ftruncate(fd, len) == 0) {
+            m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+    }
+    if (m == MAP_FAILED) goto fail;
+
+    memcpy(m, IDX_MAGIC, 4);
+    hashchop_put_le32(m + 4, IDX_VERSION);
+    hashchop_put_le64(m + 8, slot_ct);
+    hashchop_put_le64(m + 16, count);
+    UC *slots = m + IDX_HEADER_SZ;
+
+    for (uint64_t i = 0; i < p->idx_slot_ct; i++) {
+        const UC *s = p->idx + IDX_HEADER_SZ + i * IDX_SLOT_SZ;
+        uint64_t off1 = hashchop_get_le64(s + 8);
+        if (off1 != 0) idx_insert(slots, slot_ct, hashchop_get_le64(s), off1);
+    }
+    for (size_t i = 0; i < p->pend_slot_ct; i++) {
+        const slot *s = &p->pend[i];
+        if (s->off1 != 0) idx_insert(slots, slot_ct, s->fp, s->off1);
+    }
+
+    if (rename(tmp_path, p->idx_path) == -1) {
+        munmap(m, len);
+        goto fail;
+    }
+    hashchop_dealloc(tmp_path, tmp_sz);
+    unmap_index(p);
+    p->idx = m;
+    p->idx_len = len;
+    p->idx_slot_ct = slot_ct;
+    p->idx_count = count;
+    p->idx_dirty = 1;
+    return HASHCHOP_OK;
+
+fail:
+    unlink(tmp_path);
+    hashchop_dealloc(tmp_path, tmp_sz);
+    return HASHCHOP_ERROR_IO;
+}
+
+/* Move the pending entries into the index: in place while it stays at
+ * most half full, or else by growing it. A crash leaves the covered
+ * pack length at 0 until the index is committed, so a half-updated
+ * index is rebuilt on open rather than trusted. */
+static hashchop_res idx_merge(P *p) {
+    if (p->idx == NULL
+        || 2 * (p->idx_count + p->pend_count) > p->idx_slot_ct) {
+        hashchop_res res = grow_index(p);
+        if (res != HASHCHOP_OK) return res;
+    } else {
+        if (!p->idx_dirty) {
+            hashchop_put_le64(p->idx + 24, 0);
+            if (msync(p->idx, IDX_HEADER_SZ, MS_SYNC) == -1) {
+                return HASHCHOP_ERROR_IO;
+            }
+            p->idx_dirty = 1;
+        }
+        for (size_t i = 0; i < p->pend_slot_ct; i++) {
+            const slot *s = &p->pend[i];
+            if (s->off1 == 0) continue;
+            idx_insert(p->idx + IDX_HEADER_SZ, p->idx_slot_ct, s->fp, s->off1);
+        }
+        p->idx_count += p->pend_count;
+    }
+    memset(p->pend, 0, p->pend_slot_ct * sizeof(slot));
+    p->pend_count = 0;
+    return HASHCHOP_OK;
+}
+
+/* Flush appended chunks to disk, then move pending entries into the
+ * index and commit it. The prefilter is only saved if SAVE_FILTER. */
+static hashchop_res sync_pack(P *p, int save_filter) {
+    if (!flush(p) || fsync(p->fd) == -1) return HASHCHOP_ERROR_IO;
+    if (hashchop_filter_count(p->filter) > hashchop_filter_capacity(p->filter)) {
+        if (!build_filter(p)) return HASHCHOP_ERROR_MEMORY;
+    }
+    if (p->pend_count > 0 || p->idx == NULL) {
+        hashchop_res res = idx_merge(p);
+        if (res != HASHCHOP_OK) return res;
+    }
+
+    /* The prefilter is saved first; if the index isn't committed after
+     * it, their counts won't match, and the prefilter is rebuilt on open. */
+    if (save_filter && p->filter_stale) {
+        hashchop_res res = hashchop_filter_save(p->filter, p->filter_path);
+        if (res != HASHCHOP_OK) return res;
+        p->filter_stale = 0;
+    }
+    if (!p->idx_dirty) return HASHCHOP_OK;
+
+    /* Write back the slots, then record the pack length they cover. */
+    if (msync(p->idx, p->idx_len, MS_SYNC) == -1) return HASHCHOP_ERROR_IO;
+    hashchop_put_le64(p->idx + 16, p->idx_count);
+    hashchop_put_le64(p->idx + 24, p->pack_len);
+    if (msync(p->idx, IDX_HEADER_SZ, MS_SYNC) == -1) return HASHCHOP_ERROR_IO;
+    p->idx_dirty = 0;
+    return HASHCHOP_OK;
+}
+
+/* Flush appended chunks to disk, then update and commit the index. */
+hashchop_res hashchop_pack_sync(P *p) { return sync_pack(p, 0); }
+
+/* Sync and close a pack. */
+hashchop_res hashchop_pack_close(P *p) {
+    hashchop_res res = sync_pack(p, 1);
+    close(p->fd);
+    unmap_index(p);
+    hashchop_filter_free(p->filter);
+    hashchop_dealloc(p->pend, p->pend_slot_ct * sizeof(slot));
+    hashchop_dealloc(p->wbuf, p->wbuf_size);
+    hashchop_dealloc(p->idx_path, p->idx_path_sz);
+    hashchop_dealloc(p->filter_path, p->filter_path_sz);
+    hashchop_dealloc(p, sizeof(*p));
+    return res;
+}
@@ -0,0 +1,90 @@
+#ifndef HASHCHOP_PACK_H
+#define HASHCHOP_PACK_H
+
+#include "hashchop.h"
+
+/* Persistent chunk storage: an append-only pack file of chunks, plus a
+ * fingerprint index that is mmap'd rather than loaded into the heap.
+ *
+ * The pack file (PATH) holds a header, then one record per unique chunk:
+ * a 16-byte record header (fingerprint, length, header check) followed
+ * by the chunk's bytes. A chunk's ID is its record's offset in the pack.
+ *
+ * The index (PATH.idx) is an on-disk open-addressing hash table mapping
+ * fingerprints to pack offsets, mapped read-write. New entries are kept
+ * in memory until there are 64K of them or the pack is synced, then
+ * inserted into the mapped table in place. When the table would be over
+ * half full, it is rewritten with twice the slots instead (to a temp
+ * file, then renamed into place), so each entry costs amortized O(1).
+ *
+ * The index is only a cache of the pack: hashchop_pack_sync commits it
+ * by recording the pack length it covers, and that length is cleared
+ * while its slots are being changed. When a pack is opened, records
+ * appended after the last sync are re-indexed from the pack, and a torn
+ * record at the end (from a crash mid-write) is truncated. If the index
+ * is missing, invalid, or was left mid-update, it is rebuilt.
+ *
+ * A Bloom filter of every fingerprint (PATH.filter, see hashchop_filter.h)
+ * is checked before the index, so most lookups for new chunks don't
+ * probe the index at all. It is saved when the pack is closed, and
+ * rebuilt from the index on open if it is missing or out of date.
+ *
+ * Chunks are deduplicated by fingerprint alone, without comparing bytes;
+ * with 64-bit fingerprints, a collision among 100M chunks has a
+ * probability around 1 in 3,700. All integers on disk are little-endian. */
+
+/* Opaque pack handle. */
+typedef struct hashchop_pack hashchop_pack;
+
+/* Flags for hashchop_pack_open. */
+#define HASHCHOP_PACK_REBUILD 0x01   /* ignore and rebuild the index */
+
+#define P hashchop_pack
+
+/* Open the pack file at PATH (creating it if necessary) and map its index.
+ * Returns NULL on error, with errno set. */
+P *hashchop_pack_open(const char *path, int flags);
+
+/* Append LENGTH bytes of DATA to the pack as a chunk, unless a chunk with
+ * the same fingerprint is already there, and write its ID in (*ID).
+ * Returns OK, IO on write error, or MEMORY on alloc failure. */
+hashchop_res hashchop_pack_put(P *p, const unsigned char *data,
+    size_t length, uint64_t *id);
+
+/* Poll the next chunk from HC directly into the pack's write buffer, and
+ * write its ID in (*ID). Returns OK, UNDERFLOW if HC doesn't have a
+ * complete chunk yet, IO on write error, or MEMORY on alloc failure. */
+hashchop_res hashchop_pack_poll(P *p, hashchop *hc, uint64_t *id);
+
+/* Finish HC's data stream, appending its last chunk to the pack and
+ * writing its ID in (*ID). HC should have been polled until UNDERFLOW
+ * first. Returns OK, UNDERFLOW if there was no remaining data, or
+ * OVERFLOW, IO, or MEMORY on error. */
+hashchop_res hashchop_pack_finish(P *p, hashchop *hc, uint64_t *id);
+
+/* Look up a chunk by fingerprint. Returns 1 and writes its ID in (*ID)
+ * if found, or 0 if not. */
+int hashchop_pack_lookup(const P *p, hashchop_fp fp, uint64_t *id);
+
+/* Read the chunk with a given ID into DATA, a buffer of at least
+ * (*LENGTH) bytes, and write the chunk length in (*LENGTH).
+ * Returns OK, OVERFLOW if DATA is too small, or IO on a read error
+ * or bad ID. */
+hashchop_res hashchop_pack_read(P *p, uint64_t id, unsigned char *data,
+    size_t *length);
+
+/* Get the number of chunks in the pack. */
+size_t hashchop_pack_count(const P *p);
+
+/* Flush appended chunks to disk, then add new entries to the index and
+ * commit it. This costs time in proportion to the chunks added since the
+ * last sync (plus the occasional growth of the index), not to the size
+ * of the pack. Returns OK, IO on error, or MEMORY on alloc failure. */
+hashchop_res hashchop_pack_sync(P *p);
+
+/* Sync and close a pack, saving its prefilter. Returns the result of
+ * the sync; the pack is closed either way. */
+hashchop_res hashchop_pack_close(P *p);
+
+#undef P
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "hashchop.h"
+#include "hashchop_rechunk.h"
+
+/* A chunk starting at s only depends on the bytes [s, s + max) -- the
+ * scan never looks further, and neither does moving its seam to a record
+ * delimiter -- and on whether there are at least max bytes from s to the
+ * end of the stream; otherwise, it's the last chunk. An old chunk can be
+ * reused (shifted by the length change of the edits before it) if it
+ * starts at a boundary, none of those bytes were edited, and it's still
+ * either the last chunk or not.
+ *
+ * Offsets in the new data are "pos", and old offsets are pos - delta,
+ * where delta is the total length change of the edits passed so far.
+ * (It's unsigned, but wraps consistently.) */
+
+/* Re-chunk LENGTH bytes of DATA (the new version) with HC's settings. */
+hashchop_res hashchop_rechunk(const hashchop *hc,
+        const unsigned char *data, size_t length,
+        const size_t *old_cuts, size_t old_count,
+        const hashchop_edit *edits, size_t edit_count,
+        size_t *new_cuts, size_t *new_count, size_t *scanned) {
+    size_t max = hashchop_max_chunk(hc);
+    size_t limit = *new_count;
+    size_t pos = 0, delta = 0, oi = 0, ei = 0, ni = 0, rescanned = 0;
+
+    for (;;) {
+        /* Reuse old chunks, until one might be changed by the next edit. */
+        while (oi < old_count) {
+            size_t t = old_cuts[oi];
+            if (ei < edit_count) {
+                if (pos - delta + max > edits[ei].offset) break;
+                if (pos + max > length) break;
+            }
+            if (ni == limit) return HASHCHOP_ERROR_OVERFLOW;
+            pos = t + delta;
+            new_cuts[ni++] = pos;
+            oi++;
+        }
+
+        /* Re-scan, until a new boundary past the edit lines up with an
+         * old one. */
+        while (pos < length) {
+            size_t sz = hashchop_seam(hc, data + pos, length - pos);
+            if (ni == limit) return HASHCHOP_ERROR_OVERFLOW;
+            pos += sz;
+            rescanned += sz;
+            new_cuts[ni++] = pos;
+
+            while (ei < edit_count
+                && edits[ei].offset + delta + edits[ei].new_length <= pos) {
+                delta += edits[ei].new_length - edits[ei].old_length;
+                ei++;
+            }
+            if (ei < edit_count && edits[ei].offset + delta < pos) {
+                continue;       /* still inside an edit */
+            }
+
+            size_t opos = pos - delta;
+            while (oi < old_count && old_cuts[oi] < opos) oi++;
+            if (oi < old_count && old_cuts[oi] == opos) {
+                oi++;
+                break;          /* back in sync */
+            }
+        }
+        if (pos >= length) break;
+    }
+
+    *new_count = ni;
+    if (scanned) *scanned = rescanned;
+    return HASHCHOP_OK;
+}
@@ -0,0 +1,41 @@
+#ifndef HASHCHOP_RECHUNK_H
+#define HASHCHOP_RECHUNK_H
+
+#include "hashchop.h"
+
+/* Incremental re-chunking of modified data.
+ *
+ * Given the chunk boundaries of the old version of some data and a list of
+ * the edits made to it, this finds the new version's chunk boundaries by
+ * only scanning from the last boundary before each edit until the new
+ * boundaries fall back in sync with the old ones. The result is the same
+ * as chopping the whole new version from the start. */
+
+/* An edit: OLD_LENGTH bytes at OFFSET (in the old data) were replaced by
+ * NEW_LENGTH bytes. An in-place write has OLD_LENGTH == NEW_LENGTH, an
+ * insertion has OLD_LENGTH == 0, and a deletion has NEW_LENGTH == 0. */
+typedef struct hashchop_edit {
+    size_t offset;
+    size_t old_length;
+    size_t new_length;
+} hashchop_edit;
+
+/* Re-chunk LENGTH bytes of DATA (the new version) with HC's settings.
+ *
+ * OLD_CUTS holds the OLD_COUNT chunk end offsets of the old version, in
+ * order (so the last one is the old length), as chopped by a hashchopper
+ * with the same settings. EDITS holds EDIT_COUNT edits, in order of offset
+ * and not overlapping.
+ *
+ * The new version's chunk end offsets are written to NEW_CUTS, which has
+ * room for (*NEW_COUNT) of them, and (*NEW_COUNT) is set to how many there
+ * are. If SCANNED is non-NULL, the number of bytes that had to be
+ * re-scanned is written there. Returns OK, or OVERFLOW if NEW_CUTS is
+ * too small. */
+hashchop_res hashchop_rechunk(const hashchop *hc,
+    const unsigned char *data, size_t length,
+    const size_t *old_cuts, size_t old_count,
+    const hashchop_edit *edits, size_t edit_count,
+    size_t *new_cuts, size_t *new_count, size_t *scanned);
+
+#endif
@@ -0,0 +1,162 @@
+/* 
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *  
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *  
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "hashchop.h"
+#include "hashchop_internal.h"
+#include "hashchop_router.h"
+
+/* Abbreviations. */
+#define R hashchop_router
+
+#define DEF_CHUNKS 1024
+
+struct hashchop_router {
+    uint32_t shards;
+    size_t limit;               /* room for chunks in a batch */
+    uint32_t *shard_of;         /* each chunk's shard */
+    size_t *indices;            /* chunk indices, grouped by shard */
+    size_t *starts;             /* start of each shard's group, and end */
+    hashchop_router_stats *stats;
+};
+
+/* Get the shard for fingerprint FP: jump consistent hash, from "A Fast,
+ * Minimal Memory, Consistent Hash Algorithm" (Lamping and Veach). Each
+ * step jumps to the next number of buckets at which the key would move,
+ * so it takes about ln(SHARDS) steps. */
+uint32_t hashchop_jump_hash(hashchop_fp fp, uint32_t shards) {
+    int64_t b = -1, j = 0;
+    uint64_t key = fp;
+    while (j < (int64_t)shards) {
+        b = j;
+        key = key * 2862933555777941757ULL + 1;
+        j = (b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1));
+    }
+    return (uint32_t)b;
+}
+
+/* Create and return a new router over SHARDS shards. */
+R *hashchop_router_new(uint32_t shards) {
+    if (shards == 0) return NULL;
+    R *r = hashchop_alloc(sizeof(*r));
+    if (r == NULL) return NULL;
+    memset(r, 0, sizeof(*r));
+    r->shards = shards;
+    r->limit = DEF_CHUNKS;
+    r->shard_of = hashchop_alloc(DEF_CHUNKS * sizeof(uint32_t));
+    r->indices = hashchop_alloc(DEF_CHUNKS * sizeof(size_t));
+    r->starts = hashchop_alloc((shards + 1) * sizeof(size_t));
+    r->stats = hashchop_alloc(shards * sizeof(hashchop_router_stats));
+    if (r->shard_of == NULL || r->indices == NULL || r->starts == NULL
+        || r->stats == NULL) {
+        hashchop_router_free(r);
+        return NULL;
+    }
+    memset(r->starts, 0, (shards + 1) * sizeof(size_t));
+    memset(r->stats, 0, shards * sizeof(hashchop_router_stats));
+    return r;
+}
+
+/* Get the number of shards. */
+uint32_t hashchop_router_shards(const R *r) { return r->shards; }
+
+/* Make room for a batch of N chunks. */
+static int grow(R *r, size_t n) {
+    size_t nl = r->limit;
+    while (nl < n) nl *= 2;
+    uint32_t *so = hashchop_alloc(nl * sizeof(uint32_t));
+    size_t *idx = hashchop_alloc(nl * sizeof(size_t));
+    if (so == NULL || idx == NULL) {
+        if (so) hashchop_dealloc(so, nl * sizeof(uint32_t));
+        if (idx) hashchop_dealloc(idx, nl * sizeof(size_t));
+        return 0;
+    }
+    hashchop_dealloc(r->shard_of, r->limit * sizeof(uint32_t));
+    hashchop_dealloc(r->indices, r->limit * sizeof(size_t));
+    r->shard_of = so;
+    r->indices = idx;
+    r->limit = nl;
+    return 1;
+}
+
+/* Route a batch of N chunks. This is a counting sort by shard: hash and
+ * count every chunk, then place each index after the earlier ones in
+ * its shard's group, so every group keeps the batch's order. */
+hashchop_res hashchop_router_route(R *r, const hashchop_fp *fps,
+        const size_t *lengths, size_t n) {
+    if (n > r->limit && !grow(r, n)) return HASHCHOP_ERROR_MEMORY;
+    size_t *starts = r->starts;
+    memset(starts, 0, (r->shards + 1) * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) {
+        uint32_t s = hashchop_jump_hash(fps[i], r->shards);
+        r->shard_of[i] = s;
+        starts[s + 1]++;
+        r->stats[s].chunks++;
+        if (lengths) r->stats[s].bytes += lengths[i];
+    }
+    for (uint32_t s = 0; s < r->shards; s++) starts[s + 1] += starts[s];
+
+    /* Place each index, using starts[s] as shard s's fill point; after
+     * this, starts[s] is where shard s + 1's group starts, so shift. */
+    for (size_t i = 0; i < n; i++) {
+        r->indices[starts[r->shard_of[i]]++] = i;
+    }
+    memmove(starts + 1, starts, r->shards * sizeof(size_t));
+    starts[0] = 0;
+    return HASHCHOP_OK;
+}
+
+/* Get the indices of SHARD's chunks in the last batch. */
+size_t hashchop_router_batch(const R *r, uint32_t shard,
+        const size_t **indices) {
+    *indices = r->indices + r->starts[shard];
+    return r->starts[shard + 1] - r->starts[shard];
+}
+
+/* Write SHARD's running totals in (*STATS). */
+void hashchop_router_get_stats(const R *r, uint32_t shard,
+        hashchop_router_stats *stats) {
+    *stats = r->stats[shard];
+}
+
+/* Get the balance of the running totals. */
+double hashchop_router_imbalance(const R *r) {
+    uint64_t total = 0, most = 0, bytes = 0;
+    for (uint32_t s = 0; s < r->shards; s++) bytes += r->stats[s].bytes;
+    for (uint32_t s = 0; s < r->shards; s++) {
+        uint64_t v = (bytes > 0 ? r->stats[s].bytes : r->stats[s].chunks);
+        total += v;
+        if (v > most) most = v;
+    }
+    if (total == 0) return 0;
+    return most / ((double)total / r->shards);
+}
+
+/* Free a router. */
+void hashchop_router_free(R *r) {
+    if (r->shard_of) hashchop_dealloc(r->shard_of, r->limit * sizeof(uint32_t));
+    if (r->indices) hashchop_dealloc(r->indices, r->limit * sizeof(size_t));
+    if (r->starts) {
+        hashchop_dealloc(r->starts, (r->shards + 1) * sizeof(size_t));
+    }
+    if (r->stats) {
+        hashchop_dealloc(r->stats, r->shards * sizeof(hashchop_router_stats));
+    }
+    hashchop_dealloc(r, sizeof(*r));
+}
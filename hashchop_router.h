@@ -0,0 +1,65 @@
+#ifndef HASHCHOP_ROUTER_H
+#define HASHCHOP_ROUTER_H
+
+#include "hashchop.h"
+
+/* Routing chunks to storage shards by fingerprint.
+ *
+ * Each chunk goes to the shard picked by a jump consistent hash of its
+ * fingerprint (Lamping and Veach), so routing needs no table, every
+ * shard gets about the same share, and going from N to N + 1 shards
+ * only moves about 1 / (N + 1) of the chunks, all to the new shard.
+ *
+ * A router takes a batch of chunks (fingerprints, and optionally their
+ * lengths) and groups their indices by shard, without copying the
+ * chunks: each shard's batch is a run of indices into the caller's
+ * arrays, in the order given. It also keeps running totals per shard,
+ * for checking the balance. */
+
+/* Opaque router handle. */
+typedef struct hashchop_router hashchop_router;
+
+/* Running totals for one shard. */
+typedef struct hashchop_router_stats {
+    uint64_t chunks;
+    uint64_t bytes;             /* if lengths were given */
+} hashchop_router_stats;
+
+#define R hashchop_router
+
+/* Get the shard for fingerprint FP, from 0 to SHARDS - 1 (which must be
+ * at least 1). */
+uint32_t hashchop_jump_hash(hashchop_fp fp, uint32_t shards);
+
+/* Create and return a new router over SHARDS shards. Returns NULL if
+ * SHARDS is 0, or on alloc failure. */
+R *hashchop_router_new(uint32_t shards);
+
+/* Get the number of shards. */
+uint32_t hashchop_router_shards(const R *r);
+
+/* Route a batch of N chunks, with fingerprints FPS and lengths LENGTHS
+ * (or NULL, to not count bytes), replacing the last batch.
+ * Returns OK, or MEMORY on alloc failure. */
+hashchop_res hashchop_router_route(R *r, const hashchop_fp *fps,
+    const size_t *lengths, size_t n);
+
+/* Get the indices of SHARD's chunks in the last batch: point (*INDICES)
+ * at them (valid until the next route) and return how many. */
+size_t hashchop_router_batch(const R *r, uint32_t shard,
+    const size_t **indices);
+
+/* Write SHARD's running totals in (*STATS). */
+void hashchop_router_get_stats(const R *r, uint32_t shard,
+    hashchop_router_stats *stats);
+
+/* Get the balance of the running totals: the most bytes on any shard
+ * over the mean (or chunks, if no bytes were counted). 1.0 is even, and
+ * it's 0 if nothing has been routed. */
+double hashchop_router_imbalance(const R *r);
+
+/* Free a router. */
+void hashchop_router_free(R *r);
+
+#undef R
+#endif
@@ -0,0 +1,372 @@
+/*
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "hashchop.h"
+#include "hashchop_internal.h"
+#include "hashchop_similar.h"
+
+/* Abbreviations. */
+typedef uint32_t UI;
+typedef uint8_t UC;
+#define X hashchop_simindex
+
+#define FEATURES (HASHCHOP_SKETCH_SF * HASHCHOP_SKETCH_FEATURES_PER_SF)
+
+/* Random values for the gear hash, from splitmix64 (seed 0), low bits. */
+static const UI gear[256] = {
+    0x7b1dcdaf, 0xa1b965f4, 0x8009454f, 0x724c81ec, 0x51a8749b, 0x747ea2ea,
+    0x1f4532e1, 0xc916ab3c, 0x41c98ac3, 0x368cb0a6, 0x3cb13d09, 0x055bdef6,
+    0xe0bbdb7b, 0x983aa92f, 0x00cc4d19, 0x971d80ab, 0x75521255, 0x2b7f7f86,
+    0x83914f64, 0x5a4485ac, 0x100b9ed7, 0x1825f10d, 0x0dca2f6a, 0x7bd2634c,
+    0xf5407269, 0xdb4c4f7b, 0x92233300, 0x7de1d510, 0xb45c6316, 0x0f4d3872,
+    0x72f3454f, 0xa8e40225, 0x4963bab0, 0x111ac529, 0x599dc6f7, 0x93d108c3,
+    0x81daa383, 0xb43343a1, 0xcbe531df, 0x24851729, 0xa792922a, 0x918175ce,
+    0x302278a8, 0x7019e937, 0x52ebf438, 0x0a691e37, 0x763e79ad, 0x743aae49,
+    0xb1a1f2e1, 0x4f4f52da, 0xa71a5eb1, 0xb6513356, 0xd4367d77, 0x23ce3c71,
+    0x0043c714, 0x844f1705, 0xdd9e0ec1, 0x82bb9698, 0xcbc87656, 0xa17b3c8f,
+    0x1d5c5d7b, 0x1cbbf170, 0x29a88f1d, 0xb8bb18fb, 0x6c6ad50e, 0x3e46f143,
+    0x99a4fc72, 0x8a8bb259, 0xaed5bdfc, 0x8d8553c0, 0x8c4064c0, 0x1d86a66f,
+    0x03c367a8, 0x1ec11786, 0xee954551, 0x0555c6df, 0x72403c08, 0x1bfa1137,
+    0xb5c554e1, 0x7441bcd2, 0xb48216e8, 0x40bf0048, 0xa0ee15b4, 0x96a7eea1,
+    0x98f8a0fd, 0x0e3335a7, 0xebcb1cca, 0x7453424e, 0x05234c6d, 0xa6f2b568,
+    0x39ac2c65, 0x14d23c6f, 0x57e00235, 0xc6589373, 0x6dd3aee7, 0xc376cc66,
+    0x897b2307, 0x6343e5c3, 0x9eba2304, 0x6bd1a506, 0x00a05f50, 0x0385cdbc,
+    0xd78101da, 0x6ca266ac, 0xbb2dc749, 0x8493cd8c, 0x336bd182, 0x3741519b,
+    0xb109ac94, 0x813cb177, 0x0f7c9370, 0xcde95015, 0xfb354461, 0x64ed82f2,
+    0x41ce6808, 0xc9643c37, 0xa70fa9c0, 0xa4005729, 0x927b52d8, 0x42f6791f,
+    0xcab4adae, 0xc5ab61d6, 0x79d452d9, 0x0085641c, 0x157c85d0, 0x4e08f3a3,
+    0x06c41fc2, 0x45a39c19, 0xd20f0841, 0x57e774b8, 0xaf5b0cc3, 0xa23864a4,
+    0xa1d0f7bd, 0x3349f8e4, 0x86039fe8, 0xd953eff2, 0x650d04e1, 0x46980cad,
+    0x5299106c, 0x1adea7cd, 0xf04895b4, 0x3f62c0e0, 0xf4ecf37f, 0xa352437f,
+    0xc34d6363, 0x0786cf50, 0x0e6c9d8a, 0x776e37e1, 0x6ba7eee8, 0xe9660c62,
+    0x116b5e0b, 0x0f6a3645, 0xbd82131b, 0xd319aec0, 0x553d320b, 0x47612dcf,
+    0x7c0a77f5, 0x381ec437, 0xa24494ae, 0xcdc895a9, 0x586d7a91, 0xc2f49745,
+    0x2acbd1f0, 0x47c1c8e1, 0x7d015bf6, 0x7511b6a9, 0x2e89a193, 0x498d8347,
+    0x123d6faa, 0x102301eb, 0x17a43c52, 0x1355ef2d, 0xfdee7cfc, 0x86e29eed,
+    0x64517f89, 0xe8a6849d, 0x2e8f9cb0, 0xef54f7c3, 0xaac3a919, 0xacf748a0,
+    0x3b1e1b78, 0x0df9faee, 0x796893ba, 0x2070e652, 0x97a12dcc, 0x75704f28,
+    0x70a924fb, 0x1bfc419c, 0x52b85c1f, 0x6211cc67, 0x1db57ff0, 0xa1a8e901,
+    0x5ada36da, 0xb42e37d4, 0x91d6a7d1, 0xa357f38e, 0x09e447f0, 0x25215be0,
+    0x1e33c095, 0x533e80ac, 0xe8301d95, 0x83d9ba21, 0x3b0e7d2e, 0x3a8a8d6c,
+    0xa7cbf6bd, 0xc4e2a6a7, 0xd50577a9, 0xb539087d, 0x552b4f57, 0x0a8a8898,
+    0x7fb54b19, 0xe50ef3ef, 0xe2efd65c, 0x9785f572, 0xf2b0f37a, 0x3b343439,
+    0x212e37e8, 0xd4fc75ed, 0x9697108e, 0x5db69bee, 0x41daf445, 0x1e81a5fc,
+    0xe77de273, 0x5e06513a, 0x02987cab, 0x6a4e55a8, 0xf39acdd4, 0x8170cde1,
+    0x7e1854c9, 0xd55df899, 0xf1067032, 0xce60fab0, 0x286d18b1, 0xb85ed6d8,
+    0xe3acc5a3, 0x42cea639, 0x1d904827, 0xbd9cdee5, 0x7ffbb613, 0x79963d1b,
+    0x6cc24920, 0xc57169fb, 0xfeb62d07, 0xc88469f4, 0xe68dfee4, 0x2a105536,
+    0x3aefc159, 0x9df63ee2, 0x76cc6044, 0x226c6ab6, 0x07bdfdab, 0x8e0d2933,
+    0xba00b9cc, 0xf0003ee8, 0xa75fb9be, 0x47bcf19e,
+};
+
+/* Multipliers (odd) and addends for each feature's transform. */
+static const UI feature_mul[FEATURES] = {
+    0x9e3779b1, 0x85ebca6b, 0xc2b2ae35, 0x27d4eb2f, 0x165667b1, 0xd3a2646d,
+    0xfd7046c5, 0xb55a4f09, 0x8d2a4c8b, 0x6c8e9cf5, 0x7feb352d, 0x846ca68b,
+};
+static const UI feature_add[FEATURES] = {
+    0x7f4a7c15, 0xf39cc060, 0x5ced1c24, 0x1b873593, 0xe6546b64, 0x4cf5ad43,
+    0x2545f491, 0x4f6cdd1d, 0x94d049bb, 0x133111eb, 0xbf58476d, 0x1ce4e5b9,
+};
+
+/* A position is sampled if the top SAMPLE_BITS bits of its rolling hash
+ * are 0. The gear hash's top bits depend on the last 32 bytes. */
+#define SAMPLE_BITS 3
+
+/* Get the sketch of LENGTH bytes of DATA. */
+void hashchop_sketch_chunk(const unsigned char *data, size_t length,
+        hashchop_sketch *sk) {
+    UI feat[FEATURES];
+    UI h = 0;
+    int sampled = 0;
+    memset(feat, 0, sizeof(feat));
+    for (size_t i = 0; i < length; i++) {
+        h = (h << 1) + gear[data[i]];
+        if ((h >> (32 - SAMPLE_BITS)) != 0) continue;
+        sampled = 1;
+        for (int f = 0; f < FEATURES; f++) {
+            UI v = feature_mul[f] * h + feature_add[f];
+            if (v > feat[f]) feat[f] = v;
+        }
+    }
+
+    for (int s = 0; s < HASHCHOP_SKETCH_SF; s++) {
+        if (!sampled) { sk->sf[s] = 0; continue; }
+        UC buf[4 * HASHCHOP_SKETCH_FEATURES_PER_SF + 1];
+        buf[0] = s;
+        for (int f = 0; f < HASHCHOP_SKETCH_FEATURES_PER_SF; f++) {
+            hashchop_put_le32(buf + 1 + 4 * f,
+                feat[s * HASHCHOP_SKETCH_FEATURES_PER_SF + f]);
+        }
+        uint64_t sf = hashchop_fingerprint(buf, sizeof(buf));
+        sk->sf[s] = (sf == 0 ? 1 : sf);     /* 0 means empty */
+    }
+}
+
+typedef struct {
+    uint64_t sf;
+    UI id1;                     /* ID + 1, or 0 for an empty slot */
+} slot;
+
+struct hashchop_simindex {
+    slot *tables[HASHCHOP_SKETCH_SF];   /* one per super-feature */
+    size_t table_sz;                    /* power of 2 */
+    size_t used[HASHCHOP_SKETCH_SF];
+    size_t count;
+};
+
+#define DEF_SLOTS 1024
+
+static int alloc_tables(slot **tables, size_t sz) {
+    for (int s = 0; s < HASHCHOP_SKETCH_SF; s++) {
+        tables[s] = hashchop_alloc(sz * sizeof(slot));
+        if (tables[s] == NULL) {
+            while (s-- > 0) hashchop_dealloc(tables[s], sz * sizeof(slot));
+            return 0;
+        }
+        memset(tables[s], 0, sz * sizeof(slot));
+    }
+    return 1;
+}
+
+/* Create and return a new similarity index. */
+X *hashchop_simindex_new(size_t size_hint) {
+    X *x = hashchop_alloc(sizeof(*x));
+    if (x == NULL) return NULL;
+    memset(x, 0, sizeof(*x));
+    x->table_sz = DEF_SLOTS;
+    while (x->table_sz < 2 * size_hint) x->table_sz *= 2;
+    if (!alloc_tables(x->tables, x->table_sz)) {
+        hashchop_dealloc(x, sizeof(*x));
+        return NULL;
+    }
+    return x;
+}
+
+/* Find SF's slot in TABLE: either the one holding it, or the empty
+ * slot where it would go. */
+static slot *find_slot(slot *table, size_t sz, uint64_t sf) {
+    size_t mask = sz - 1;
+    size_t b = (sf ^ (sf >> 32)) & mask;
+    while (table[b].id1 != 0 && table[b].sf != sf) b = (b + 1) & mask;
+    return &table[b];
+}
+
+/* Double the tables' size, if any is at least half full. */
+static int grow(X *x) {
+    size_t nsz = 2 * x->table_sz;
+    slot *nt[HASHCHOP_SKETCH_SF];
+    if (!alloc_tables(nt, nsz)) return 0;
+    for (int s = 0; s < HASHCHOP_SKETCH_SF; s++) {
+        for (size_t i = 0; i < x->table_sz; i++) {
+            const slot *o = &x->tables[s][i];
+            if (o->id1 != 0) *find_slot(nt[s], nsz, o->sf) = *o;
+        }
+        hashchop_dealloc(x->tables[s], x->table_sz * sizeof(slot));
+        x->tables[s] = nt[s];
+    }
+    x->table_sz = nsz;
+    return 1;
+}
+
+/* Add the chunk with ID and sketch SK to the index. */
+hashchop_res hashchop_simindex_add(X *x, const hashchop_sketch *sk,
+        uint32_t id) {
+    for (int s = 0; s < HASHCHOP_SKETCH_SF; s++) {
+        if (2 * (x->used[s] + 1) > x->table_sz && !grow(x)) {
+            return HASHCHOP_ERROR_MEMORY;
+        }
+    }
+    for (int s = 0; s < HASHCHOP_SKETCH_SF; s++) {
+        if (sk->sf[s] == 0) continue;
+        slot *sl = find_slot(x->tables[s], x->table_sz, sk->sf[s]);
+        if (sl->id1 != 0) continue;
+        sl->sf = sk->sf[s];
+        sl->id1 = id + 1;
+        x->used[s]++;
+    }
+    x->count++;
+    return HASHCHOP_OK;
+}
+
+/* Find the indexed chunk that shares the most super-features with SK. */
+int hashchop_simindex_find(const X *x, const hashchop_sketch *sk,
+        uint32_t *id) {
+    UI ids[HASHCHOP_SKETCH_SF];
+    int best = 0, best_ct = 0;
+    for (int s = 0; s < HASHCHOP_SKETCH_SF; s++) {
+        ids[s] = 0;
+        if (sk->sf[s] == 0) continue;
+        const slot *sl = find_slot(x->tables[s], x->table_sz, sk->sf[s]);
+        ids[s] = sl->id1;
+    }
+    for (int s = 0; s < HASHCHOP_SKETCH_SF; s++) {
+        if (ids[s] == 0) continue;
+        int ct = 0;
+        for (int t = 0; t < HASHCHOP_SKETCH_SF; t++) ct += (ids[t] == ids[s]);
+        if (ct > best_ct) { best = s; best_ct = ct; }
+    }
+    if (best_ct > 0) *id = ids[best] - 1;
+    return best_ct;
+}
+
+/* Get the number of chunks added to the index. */
+size_t hashchop_simindex_count(const X *x) { return x->count; }
+
+/* Free a similarity index. */
+void hashchop_simindex_free(X *x) {
+    for (int s = 0; s < HASHCHOP_SKETCH_SF; s++) {
+        hashchop_dealloc(x->tables[s], x->table_sz * sizeof(slot));
+    }
+    hashchop_dealloc(x, sizeof(*x));
+}
+
+/* Delta encoding: the target length, then ops until the end. Every
+ * number is a LEB128 varint. An op starts with (length << 1 | is_copy);
+ * a copy is followed by a base offset, and a literal by its bytes.
+ *
+ * Matches are found by hashing every MATCH_HASH_LEN-byte window of the
+ * base into a table (later positions overwrite earlier ones), then
+ * looking up each target position and extending the match both ways.
+ * A copy is only used if it saves at least the cost of the literal op
+ * header that may follow it, so a delta is never more than a few bytes
+ * longer than the target. */
+#define MATCH_HASH_LEN 8
+#define MIN_MATCH 16
+#define VARINT_MAX 10
+#define LITERAL_HDR_MAX 5           /* literal lengths fit in 32 bits */
+#define TABLE_MAX_BITS 16
+
+static size_t varint_len(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) { v >>= 7; n++; }
+    return n;
+}
+
+static UC *put_varint(UC *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (UC)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (UC)v;
+    return p;
+}
+
+/* Read a varint from [*P, END) into (*V). Returns 0 if it's truncated
+ * or too long. */
+static int get_varint(const UC **p, const UC *end, uint64_t *v) {
+    uint64_t r = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        UC b = *(*p)++;
+        r |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) { *v = r; return 1; }
+    }
+    return 0;
+}
+
+static UI window_hash(const UC *p, int bits) {
+    return (UI)((hashchop_get_le64(p) * 0x9e3779b97f4a7c15ULL) >> (64 - bits));
+}
+
+/* Get an upper bound on the size of the delta for a LENGTH-byte chunk. */
+size_t hashchop_xdelta_bound(size_t length) {
+    return VARINT_MAX + LITERAL_HDR_MAX + length;
+}
+
+/* Write the literal op for LEN bytes at DATA to P. */
+static UC *put_literal(UC *p, const UC *data, size_t len) {
+    p = put_varint(p, (uint64_t)len << 1);
+    memcpy(p, data, len);
+    return p + len;
+}
+
+/* Encode TARGET_LENGTH bytes of TARGET as a delta against BASE. */
+hashchop_res hashchop_xdelta_encode(const unsigned char *base,
+        size_t base_length, const unsigned char *target, size_t target_length,
+        unsigned char *out, size_t *out_length) {
+    if (*out_length < hashchop_xdelta_bound(target_length)) {
+        return HASHCHOP_ERROR_OVERFLOW;
+    }
+    int bits = 4;
+    while (bits < TABLE_MAX_BITS && ((size_t)1 << bits) < base_length) bits++;
+    size_t table_sz = (size_t)1 << bits;
+    UI *table = hashchop_alloc(table_sz * sizeof(UI));
+    if (table == NULL) return HASHCHOP_ERROR_MEMORY;
+    memset(table, 0, table_sz * sizeof(UI));
+    for (size_t i = 0; i + MATCH_HASH_LEN <= base_length; i++) {
+        table[window_hash(base + i, bits)] = i + 1;
+    }
+
+    UC *p = put_varint(out, target_length);
+    size_t i = 0, lit = 0;
+    while (i + MATCH_HASH_LEN <= target_length) {
+        UI cand1 = table[window_hash(target + i, bits)];
+        if (cand1 == 0) { i++; continue; }
+        size_t c = cand1 - 1;
+        if (memcmp(base + c, target + i, MATCH_HASH_LEN) != 0) { i++; continue; }
+
+        size_t f = MATCH_HASH_LEN, b = 0;
+        while (i + f < target_length && c + f < base_length
+            && base[c + f] == target[i + f]) f++;
+        while (b < i - lit && b < c && base[c - b - 1] == target[i - b - 1]) b++;
+        size_t len = f + b, start = i - b, off = c - b;
+        size_t cost = varint_len((uint64_t)len << 1 | 1) + varint_len(off);
+        if (len < MIN_MATCH || len < cost + LITERAL_HDR_MAX) { i++; continue; }
+
+        if (start > lit) p = put_literal(p, target + lit, start - lit);
+        p = put_varint(p, (uint64_t)len << 1 | 1);
+        p = put_varint(p, off);
+        i = lit = start + len;
+    }
+    if (target_length > lit) p = put_literal(p, target + lit, target_length - lit);
+
+    hashchop_dealloc(table, table_sz * sizeof(UI));
+    *out_length = p - out;
+    return HASHCHOP_OK;
+}
+
+/* Decode DELTA_LENGTH bytes of DELTA against BASE_LENGTH bytes of BASE. */
+hashchop_res hashchop_xdelta_decode(const unsigned char *base,
+        size_t base_length, const unsigned char *delta, size_t delta_length,
+        unsigned char *out, size_t *out_length) {
+    const UC *p = delta, *end = delta + delta_length;
+    uint64_t target = 0, op = 0, off = 0;
+    if (!get_varint(&p, end, &target)) return HASHCHOP_ERROR_FORMAT;
+    if (target > *out_length) return HASHCHOP_ERROR_OVERFLOW;
+
+    size_t o = 0;
+    while (p < end) {
+        if (!get_varint(&p, end, &op)) return HASHCHOP_ERROR_FORMAT;
+        uint64_t len = op >> 1;
+        if (len > target - o) return HASHCHOP_ERROR_FORMAT;
+        if (op & 1) {
+            if (!get_varint(&p, end, &off) || off > base_length
+                || len > base_length - off) return HASHCHOP_ERROR_FORMAT;
+            memcpy(out + o, base + off, len);
+        } else {
+            if (len > (size_t)(end - p)) return HASHCHOP_ERROR_FORMAT;
+            memcpy(out + o, p, len);
+            p += len;
+        }
+        o += len;
+    }
+    if (o != target) return HASHCHOP_ERROR_FORMAT;
+    *out_length = o;
+    return HASHCHOP_OK;
+}
@@ -0,0 +1,82 @@
+#ifndef HASHCHOP_SIMILAR_H
+#define HASHCHOP_SIMILAR_H
+
+#include "hashchop.h"
+
+/* Similarity detection and delta compression for near-duplicate chunks.
+ *
+ * Exact dedup can't help with a chunk that differs from a stored one by
+ * a few bytes. A chunk's sketch has a few super-features: each feature is
+ * the max of a different linear transform of a rolling hash, taken over
+ * positions sampled by content, and each super-feature is a hash of a
+ * group of features. Small edits rarely change every feature in a group,
+ * so chunks that share a super-feature are very likely to be similar.
+ *
+ * The similarity index maps super-features to chunk IDs, and finds the
+ * stored chunk sharing the most super-features with a new one. The new
+ * chunk can then be stored as a byte-level delta against it (copies of
+ * base ranges, plus literal bytes). */
+
+/* Number of super-features per sketch, and features per super-feature. */
+#define HASHCHOP_SKETCH_SF 3
+#define HASHCHOP_SKETCH_FEATURES_PER_SF 4
+
+/* A chunk's sketch. Chunks too small to have any sampled positions get
+ * an empty sketch (all zero), which never matches. */
+typedef struct hashchop_sketch {
+    uint64_t sf[HASHCHOP_SKETCH_SF];
+} hashchop_sketch;
+
+/* Opaque similarity index handle. */
+typedef struct hashchop_simindex hashchop_simindex;
+
+#define X hashchop_simindex
+
+/* Get the sketch of LENGTH bytes of DATA, and write it in (*SK). */
+void hashchop_sketch_chunk(const unsigned char *data, size_t length,
+    hashchop_sketch *sk);
+
+/* Create and return a new similarity index, sized for about SIZE_HINT
+ * chunks (0 for a small default; it grows as necessary).
+ * Returns NULL on alloc failure. */
+X *hashchop_simindex_new(size_t size_hint);
+
+/* Add the chunk with ID and sketch SK to the index. For each
+ * super-feature, the first chunk added with it is kept.
+ * Returns OK, or MEMORY on alloc failure. */
+hashchop_res hashchop_simindex_add(X *x, const hashchop_sketch *sk,
+    uint32_t id);
+
+/* Find the indexed chunk that shares the most super-features with SK
+ * (on a tie, the one matching the earliest super-feature), and write its
+ * ID in (*ID). Returns the number of shared super-features, 0 if none. */
+int hashchop_simindex_find(const X *x, const hashchop_sketch *sk,
+    uint32_t *id);
+
+/* Get the number of chunks added to the index. */
+size_t hashchop_simindex_count(const X *x);
+
+/* Free a similarity index. */
+void hashchop_simindex_free(X *x);
+
+/* Get an upper bound on the size of the delta for a LENGTH-byte chunk. */
+size_t hashchop_xdelta_bound(size_t length);
+
+/* Encode TARGET_LENGTH bytes of TARGET as a delta against BASE_LENGTH
+ * bytes of BASE, into OUT, a buffer of at least (*OUT_LENGTH) bytes, and
+ * write the delta's size in (*OUT_LENGTH). Returns OK, OVERFLOW if OUT is
+ * too small (see hashchop_xdelta_bound), or MEMORY on alloc failure. */
+hashchop_res hashchop_xdelta_encode(const unsigned char *base,
+    size_t base_length, const unsigned char *target, size_t target_length,
+    unsigned char *out, size_t *out_length);
+
+/* Decode DELTA_LENGTH bytes of DELTA against BASE_LENGTH bytes of BASE,
+ * into OUT, a buffer of at least (*OUT_LENGTH) bytes, and write the
+ * decoded length in (*OUT_LENGTH). Returns OK, OVERFLOW if OUT is too
+ * small, or FORMAT if the delta is malformed. */
+hashchop_res hashchop_xdelta_decode(const unsigned char *base,
+    size_t base_length, const unsigned char *delta, size_t delta_length,
+    unsigned char *out, size_t *out_length);
+
+#undef X
+#endif
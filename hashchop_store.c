@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "hashchop.h"
+#include "hashchop_internal.h"
+#include "hashchop_store.h"
+
+/* Abbreviations. */
+typedef uint32_t UI;
+typedef uint8_t UC;
+#define S hashchop_store
+
+/* Hash table entry. ID1 is the chunk's ID + 1, so 0 marks an empty slot. */
+typedef struct {
+    hashchop_fp fp;
+    UI id1;
+    UI len;
+} entry;
+
+/* Entries per bucket -- one 64-byte cache line. */
+#define BUCKET_ENTRIES 4
+#define CACHE_LINE 64
+
+typedef struct {
+    entry e[BUCKET_ENTRIES];
+} bucket;
+
+/* Where a chunk lives in the arena. */
+typedef struct {
+    size_t offset;
+    UI len;
+} chunk;
+
+struct hashchop_store {
+    bucket *buckets;            /* cache-line-aligned bucket array */
+    void *buckets_raw;          /* unaligned allocation, for freeing */
+    size_t bucket_ct;           /* number of buckets, a power of 2 */
+    chunk *chunks;              /* chunks, by ID */
+    size_t chunk_ct;            /* unique chunks stored */
+    size_t chunk_limit;         /* chunk array size */
+    UC *arena;                  /* chunk data */
+    size_t arena_used;          /* bytes of arena used */
+    size_t arena_size;          /* arena size */
+    hashchop_store_stats stats; /* dedup counters */
+};
+
+#define DEF_BUCKETS 64
+#define DEF_ARENA (64 * 1024)
+
+/* Grow the table once it is more than 3/4 full. */
+#define FULL(ct, buckets) ((ct) + 1 > (3 * (buckets) * BUCKET_ENTRIES) / 4)
+
+static int alloc_buckets(S *s, size_t bucket_ct) {
+    size_t sz = bucket_ct * sizeof(bucket) + CACHE_LINE - 1;
+    void *raw = hashchop_alloc(sz);
+    if (raw == NULL) return 0;
+    memset(raw, 0, sz);
+    s->buckets_raw = raw;
+    s->buckets = (bucket *)(((uintptr_t)raw + CACHE_LINE - 1)
+        & ~(uintptr_t)(CACHE_LINE - 1));
+    s->bucket_ct = bucket_ct;
+    return 1;
+}
+
+static void free_buckets(void *raw, size_t bucket_ct) {
+    hashchop_dealloc(raw, bucket_ct * sizeof(bucket) + CACHE_LINE - 1);
+}
+
+/* Create and return a new chunk store, sized for about SIZE_HINT unique
+ * chunks (0 for a small default). Returns NULL on alloc failure. */
+S *hashchop_store_new(size_t size_hint) {
+    size_t bucket_ct = DEF_BUCKETS;
+    while (FULL(size_hint, bucket_ct)) bucket_ct <<= 1;
+
+    S *s = hashchop_alloc(sizeof(*s));
+    if (s == NULL) return NULL;
+    memset(s, 0, sizeof(*s));
+    if (!alloc_buckets(s, bucket_ct)) goto cleanup;
+    s->chunk_limit = BUCKET_ENTRIES * bucket_ct;
+    s->chunks = hashchop_alloc(s->chunk_limit * sizeof(chunk));
+    if (s->chunks == NULL) goto cleanup;
+    s->arena_size = DEF_ARENA;
+    s->arena = hashchop_alloc(s->arena_size);
+    if (s->arena == NULL) goto cleanup;
+    return s;
+
+cleanup:
+    if (s->buckets_raw) free_buckets(s->buckets_raw, s->bucket_ct);
+    if (s->chunks) hashchop_dealloc(s->chunks, s->chunk_limit * sizeof(chunk));
+    hashchop_dealloc(s, sizeof(*s));
+    return NULL;
+}
+
+/* Find the entry for a chunk, or the empty entry where it belongs. */
+static entry *lookup(const S *s, hashchop_fp fp, const UC *data, UI len) {
+    size_t mask = s->bucket_ct - 1;
+    size_t b = fp & mask;
+    for (;;) {
+        bucket *bk = &s->buckets[b];
+        for (int i = 0; i < BUCKET_ENTRIES; i++) {
+            entry *e = &bk->e[i];
+            if (e->id1 == 0) return e;
+            if (e->fp == fp && e->len == len) {
+                const chunk *c = &s->chunks[e->id1 - 1];
+                if (0 == memcmp(s->arena + c->offset, data, len)) return e;
+            }
+        }
+        b = (b + 1) & mask;
+    }
+}
+
+/* Double the bucket array, and re-insert all entries. */
+static int grow_table(S *s) {
+    void *old_raw = s->buckets_raw;
+    bucket *old = s->buckets;
+    size_t old_ct = s->bucket_ct;
+    if (!alloc_buckets(s, 2 * old_ct)) return 0;
+
+    size_t mask = s->bucket_ct - 1;
+    for (size_t ob = 0; ob < old_ct; ob++) {
+        for (int i = 0; i < BUCKET_ENTRIES; i++) {
+            entry *oe = &old[ob].e[i];
+            if (oe->id1 == 0) continue;
+            size_t b = oe->fp & mask;
+            for (;;) {
+                bucket *bk = &s->buckets[b];
+                int j = 0;
+                while (j < BUCKET_ENTRIES && bk->e[j].id1 != 0) j++;
+                if (j < BUCKET_ENTRIES) { bk->e[j] = *oe; break; }
+                b = (b + 1) & mask;
+            }
+        }
+    }
+    free_buckets(old_raw, old_ct);
+    return 1;
+}
+
+/* Make sure there is room for another chunk record and SZ more bytes. */
+static int reserve(S *s, size_t sz) {
+    if (s->chunk_ct == s->chunk_limit) {
+        size_t nlimit = 2 * s->chunk_limit;
+        chunk *nc = hashchop_alloc(nlimit * sizeof(chunk));
+        if (nc == NULL) return 0;
+        memcpy(nc, s->chunks, s->chunk_ct * sizeof(chunk));
+        hashchop_dealloc(s->chunks, s->chunk_limit * sizeof(chunk));
+        s->chunks = nc;
+        s->chunk_limit = nlimit;
+    }
+    if (s->arena_size - s->arena_used < sz) {
+        size_t nsize = 2 * s->arena_size;
+        while (nsize - s->arena_used < sz) nsize *= 2;
+        UC *na = hashchop_alloc(nsize);
+        if (na == NULL) return 0;
+        memcpy(na, s->arena, s->arena_used);
+        hashchop_dealloc(s->arena, s->arena_size);
+        s->arena = na;
+        s->arena_size = nsize;
+    }
+    return 1;
+}
+
+/* Count a chunk as added, once it has been found or stored (so a
+ * failed add that's retried is only counted once). */
+static void count_in(S *s, UI len) {
+    s->stats.chunks_in++;
+    s->stats.bytes_in += len;
+}
+
+/* Index the new chunk at the end of the arena's used space. E is the
+ * empty entry returned by lookup. */
+static hashchop_res insert(S *s, hashchop_fp fp, entry *e, UI len,
+        hashchop_id *id) {
+    if (FULL(s->chunk_ct, s->bucket_ct)) {
+        if (!grow_table(s)) return HASHCHOP_ERROR_MEMORY;
+        e = lookup(s, fp, s->arena + s->arena_used, len);
+    }
+    chunk *c = &s->chunks[s->chunk_ct];
+    c->offset = s->arena_used;
+    c->len = len;
+    e->fp = fp;
+    e->len = len;
+    e->id1 = s->chunk_ct + 1;
+    *id = s->chunk_ct;
+    s->chunk_ct++;
+    s->arena_used += len;
+    s->stats.chunks_stored++;
+    s->stats.bytes_stored += len;
+    count_in(s, len);
+    return HASHCHOP_OK;
+}
+
+/* Add LENGTH bytes of DATA to the store as a chunk, and write its ID
+ * in (*ID). If an identical chunk is already stored, its ID is reused. */
+hashchop_res hashchop_store_put(S *s, const unsigned char *data,
+        size_t length, hashchop_id *id) {
+    if (length > UINT32_MAX) return HASHCHOP_ERROR_OVERFLOW;
+    hashchop_fp fp = hashchop_fingerprint(data, length);
+    entry *e = lookup(s, fp, data, length);
+    if (e->id1 != 0) {
+        count_in(s, length);
+        *id = e->id1 - 1;
+        return HASHCHOP_OK;
+    }
+    if (!reserve(s, length)) return HASHCHOP_ERROR_MEMORY;
+    memcpy(s->arena + s->arena_used, data, length);
+    return insert(s, fp, e, length, id);
+}
+
+/* Index a chunk that was copied to the end of the arena's used space.
+ * If it's a duplicate, the space is reused by the next chunk. */
+static hashchop_res add_in_place(S *s, UI len, hashchop_id *id) {
+    const UC *data = s->arena + s->arena_used;
+    hashchop_fp fp = hashchop_fingerprint(data, len);
+    entry *e = lookup(s, fp, data, len);
+    if (e->id1 != 0) {
+        count_in(s, len);
+        *id = e->id1 - 1;
+        return HASHCHOP_OK;
+    }
+    return insert(s, fp, e, len, id);
+}
+
+/* Poll the next chunk from HC directly into the store, and write its
+ * ID in (*ID). */
+hashchop_res hashchop_store_poll(S *s, hashchop *hc, hashchop_id *id) {
+    size_t len = hashchop_max_chunk(hc);
+    if (!reserve(s, len)) return HASHCHOP_ERROR_MEMORY;
+    hashchop_res res = hashchop_poll(hc, s->arena + s->arena_used, &len);
+    if (res != HASHCHOP_OK) return res;
+    return add_in_place(s, len, id);
+}
+
+/* Finish HC's data stream, adding its last chunk to the store and
+ * writing its ID in (*ID). */
+hashchop_res hashchop_store_finish(S *s, hashchop *hc, hashchop_id *id) {
+    size_t len = hashchop_max_chunk(hc);
+    if (!reserve(s, len)) return HASHCHOP_ERROR_MEMORY;
+    hashchop_res res = hashchop_finish(hc, s->arena + s->arena_used, &len);
+    if (res != HASHCHOP_OK) return res;
+    if (len == 0) return HASHCHOP_ERROR_UNDERFLOW;
+    return add_in_place(s, len, id);
+}
+
+/* Look for a chunk with the same content as LENGTH bytes of DATA. */
+int hashchop_store_find(const S *s, const unsigned char *data,
+        size_t length, hashchop_id *id) {
+    if (length > UINT32_MAX) return 0;
+    entry *e = lookup(s, hashchop_fingerprint(data, length), data, length);
+    if (e->id1 == 0) return 0;
+    *id = e->id1 - 1;
+    return 1;
+}
+
+/* Get the chunk with a given ID, and write its length in (*LENGTH). */
+const unsigned char *hashchop_store_get(const S *s, hashchop_id id,
+        size_t *length) {
+    if (id >= s->chunk_ct) return NULL;
+    const chunk *c = &s->chunks[id];
+    *length = c->len;
+    return s->arena + c->offset;
+}
+
+/* Get the number of unique chunks in the store. */
+size_t hashchop_store_count(const S *s) { return s->chunk_ct; }
+
+/* Get the store's dedup counters. */
+void hashchop_store_get_stats(const S *s, hashchop_store_stats *stats) {
+    *stats = s->stats;
+}
+
+/* Free a chunk store. */
+void hashchop_store_free(S *s) {
+    free_buckets(s->buckets_raw, s->bucket_ct);
+    hashchop_dealloc(s->chunks, s->chunk_limit * sizeof(chunk));
+    hashchop_dealloc(s->arena, s->arena_size);
+    hashchop_dealloc(s, sizeof(*s));
+}
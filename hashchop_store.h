@@ -0,0 +1,75 @@
+#ifndef HASHCHOP_STORE_H
+#define HASHCHOP_STORE_H
+
+#include "hashchop.h"
+
+/* In-memory deduplicating chunk store.
+ *
+ * Each unique chunk is stored once, in an arena, and is identified by a
+ * small integer ID (assigned sequentially, from 0). Chunks are indexed by
+ * fingerprint in an open-addressing hash table whose buckets are one
+ * cache line wide, so a lookup usually touches a single cache line. */
+
+/* Opaque chunk store handle. */
+typedef struct hashchop_store hashchop_store;
+
+/* Chunk ID. */
+typedef uint32_t hashchop_id;
+
+/* Counters for the data that has passed through a store.
+ * The dedup ratio is bytes_in / bytes_stored. */
+typedef struct hashchop_store_stats {
+    uint64_t chunks_in;         /* chunks added */
+    uint64_t bytes_in;          /* bytes added */
+    uint64_t chunks_stored;     /* unique chunks stored */
+    uint64_t bytes_stored;      /* unique bytes stored */
+} hashchop_store_stats;
+
+#define S hashchop_store
+
+/* Create and return a new chunk store, sized for about SIZE_HINT unique
+ * chunks (0 for a small default; it grows as necessary).
+ * Returns NULL on alloc failure. */
+S *hashchop_store_new(size_t size_hint);
+
+/* Add LENGTH bytes of DATA to the store as a chunk, and write its ID
+ * in (*ID). If an identical chunk is already stored, its ID is reused.
+ * Returns OK, OVERFLOW if LENGTH doesn't fit in 32 bits, or MEMORY on
+ * alloc failure (in which case nothing is counted in the stats). */
+hashchop_res hashchop_store_put(S *s, const unsigned char *data,
+    size_t length, hashchop_id *id);
+
+/* Poll the next chunk from HC directly into the store (without copying
+ * through an intermediate buffer), and write its ID in (*ID).
+ * Returns OK, UNDERFLOW if HC doesn't have a complete chunk yet,
+ * or MEMORY on alloc failure. */
+hashchop_res hashchop_store_poll(S *s, hashchop *hc, hashchop_id *id);
+
+/* Finish HC's data stream, adding its last chunk to the store and
+ * writing its ID in (*ID). HC should have been polled until UNDERFLOW
+ * first. Returns OK, UNDERFLOW if there was no remaining data, OVERFLOW
+ * if HC had not been polled until UNDERFLOW, or MEMORY on alloc failure. */
+hashchop_res hashchop_store_finish(S *s, hashchop *hc, hashchop_id *id);
+
+/* Look for a chunk with the same content as LENGTH bytes of DATA.
+ * Returns 1 and writes its ID in (*ID) if found, or 0 if not. */
+int hashchop_store_find(const S *s, const unsigned char *data,
+    size_t length, hashchop_id *id);
+
+/* Get the chunk with a given ID, and write its length in (*LENGTH).
+ * Returns NULL for an unknown ID. The pointer is only valid until
+ * the next chunk is added to the store. */
+const unsigned char *hashchop_store_get(const S *s, hashchop_id id,
+    size_t *length);
+
+/* Get the number of unique chunks in the store. */
+size_t hashchop_store_count(const S *s);
+
+/* Get the store's dedup counters. */
+void hashchop_store_get_stats(const S *s, hashchop_store_stats *stats);
+
+/* Free a chunk store. */
+void hashchop_store_free(S *s);
+
+#undef S
+#endif
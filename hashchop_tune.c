@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2011-2012 Scott Vokes <vokes.s@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "hashchop.h"
+#include "hashchop_internal.h"
+#include "hashchop_tune.h"
+
+/* Abbreviations. */
+typedef uint8_t UC;
+#define T hashchop_tuner
+
+#define DEF_SLOTS 1024
+
+/* The distinct chunk fingerprints seen at one level, in an
+ * open-addressing table, with 0 marking an empty slot. */
+typedef struct {
+    uint64_t *fps;
+    size_t table_sz;            /* power of 2 */
+    hashchop_tune_level stats;
+} level;
+
+struct hashchop_tuner {
+    hashchop *hc;
+    uint8_t levels;
+    level l[HASHCHOP_MAX_LEVELS];
+};
+
+/* Create and return a new tuner. */
+T *hashchop_tuner_new(uint8_t min_bits, uint8_t levels) {
+    if (levels < 1 || levels > HASHCHOP_MAX_LEVELS) return NULL;
+    if (min_bits < HASHCHOP_MIN_BITS
+        || min_bits + levels - 1 > HASHCHOP_MAX_BITS) return NULL;
+    T *t = hashchop_alloc(sizeof(*t));
+    if (t == NULL) return NULL;
+    memset(t, 0, sizeof(*t));
+    t->levels = levels;
+    t->hc = hashchop_new(min_bits);
+    if (t->hc == NULL || HASHCHOP_OK != hashchop_set_levels(t->hc, levels)) {
+        hashchop_tuner_free(t);
+        return NULL;
+    }
+    for (int i = 0; i < levels; i++) {
+        level *l = &t->l[i];
+        l->table_sz = DEF_SLOTS;
+        l->fps = hashchop_alloc(DEF_SLOTS * sizeof(uint64_t));
+        if (l->fps == NULL) {
+            hashchop_tuner_free(t);
+            return NULL;
+        }
+        memset(l->fps, 0, DEF_SLOTS * sizeof(uint64_t));
+        l->stats.bits = min_bits + i;
+    }
+    return t;
+}
+
+/* Find FP's slot in TABLE: either the one holding it, or the empty
+ * slot where it would go. */
+static uint64_t *find_slot(uint64_t *table, size_t sz, uint64_t fp) {
+    size_t mask = sz - 1;
+    size_t b = (fp ^ (fp >> 32)) & mask;
+    while (table[b] != 0 && table[b] != fp) b = (b + 1) & mask;
+    return &table[b];
+}
+
+/* Double L's table size. */
+static int grow(level *l) {
+    size_t nsz = 2 * l->table_sz;
+    uint64_t *nt = hashchop_alloc(nsz * sizeof(uint64_t));
+    if (nt == NULL) return 0;
+    memset(nt, 0, nsz * sizeof(uint64_t));
+    for (size_t i = 0; i < l->table_sz; i++) {
+        if (l->fps[i] != 0) *find_slot(nt, nsz, l->fps[i]) = l->fps[i];
+    }
+    hashchop_dealloc(l->fps, l->table_sz * sizeof(uint64_t));
+    l->fps = nt;
+    l->table_sz = nsz;
+    return 1;
+}
+
+/* Count a SZ-byte chunk with fingerprint FP at level L. */
+static int count_chunk(level *l, uint64_t fp, size_t sz) {
+    if (2 * (l->stats.unique_chunks + 1) > l->table_sz && !grow(l)) return 0;
+    if (fp == 0) fp = 1;
+    uint64_t *slot = find_slot(l->fps, l->table_sz, fp);
+    l->stats.chunks++;
+    l->stats.bytes += sz;
+    if (*slot == fp) {
+        l->stats.dup_bytes += sz;
+    } else {
+        *slot = fp;
+        l->stats.unique_chunks++;
+    }
+    return 1;
+}
+
+/* Fold a level 0 chunk's fingerprint into the fingerprint of the chunk
+ * containing it at a higher level. */
+static uint64_t combine(uint64_t h, uint64_t fp) {
+    h = (h ^ fp) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 29);
+}
+
+/* Chop a sample at every chunk size, and count its chunks. */
+hashchop_res hashchop_tuner_add(T *t, const unsigned char *data,
+        size_t length) {
+    uint64_t h[HASHCHOP_MAX_LEVELS];
+    size_t start[HASHCHOP_MAX_LEVELS];
+    memset(h, 0, sizeof(h));
+    memset(start, 0, sizeof(start));
+    size_t pos = 0;
+    while (pos < length) {
+        uint8_t lv = 0;
+        size_t sz = hashchop_seam_level(t->hc, data + pos, length - pos, &lv);
+        hashchop_fp fp = hashchop_fingerprint(data + pos, sz);
+        pos += sz;
+        for (int i = 0; i < t->levels; i++) {
+            h[i] = combine(h[i], fp);
+            if (i > lv) continue;
+            if (!count_chunk(&t->l[i], h[i], pos - start[i])) {
+                return HASHCHOP_ERROR_MEMORY;
+            }
+            h[i] = 0;
+            start[i] = pos;
+        }
+    }
+    return HASHCHOP_OK;
+}
+
+/* Get the number of chunk sizes. */
+uint8_t hashchop_tuner_levels(const T *t) { return t->levels; }
+
+/* Get the counts for the LEVEL'th chunk size. */
+hashchop_res hashchop_tuner_level(const T *t, uint8_t level,
+        hashchop_tune_level *stats) {
+    if (level >= t->levels) return HASHCHOP_ERROR_OVERFLOW;
+    *stats = t->l[level].stats;
+    return HASHCHOP_OK;
+}
+
+/* Get the cost of storing the samples with the LEVEL'th chunk size. */
+double hashchop_tuner_cost(const T *t, uint8_t level, double entry_bytes) {
+    if (level >= t->levels) return 0;
+    const hashchop_tune_level *s = &t->l[level].stats;
+    return (double)(s->bytes - s->dup_bytes) + entry_bytes * s->unique_chunks;
+}
+
+/* Get the mask bits that store the samples most cheaply. */
+uint8_t hashchop_tuner_recommend(const T *t, double entry_bytes) {
+    uint8_t best = 0;
+    double best_cost = hashchop_tuner_cost(t, 0, entry_bytes);
+    for (uint8_t i = 1; i < t->levels; i++) {
+        double cost = hashchop_tuner_cost(t, i, entry_bytes);
+        if (cost <= best_cost) { best = i; best_cost = cost; }
+    }
+    return t->l[best].stats.bits;
+}
+
+/* Free a tuner. */
+void hashchop_tuner_free(T *t) {
+    for (int i = 0; i < HASHCHOP_MAX_LEVELS; i++) {
+        level *l = &t->l[i];
+        if (l->fps) hashchop_dealloc(l->fps, l->table_sz * sizeof(uint64_t));
+    }
+    if (t->hc) hashchop_free(t->hc);
+    hashchop_dealloc(t, sizeof(*t));
+}
@@ -0,0 +1,68 @@
+#ifndef HASHCHOP_TUNE_H
+#define HASHCHOP_TUNE_H
+
+#include "hashchop.h"
+
+/* Picking the chunk size (mask bits) from sample data.
+ *
+ * Smaller chunks find more duplicate data, but every chunk costs an index
+ * entry. A tuner chops sample data (a set of files, or blocks of a
+ * stream) at several chunk sizes in one multi-level pass, counts the
+ * distinct chunks and the duplicate bytes at each size, and recommends the
+ * size that stores the sample most cheaply, given how many bytes an index
+ * entry costs compared to a byte of stored data.
+ *
+ * Level L's chunks are cut at the boundaries of level L or above of a
+ * chopper with the smallest number of bits, so they are close to, but
+ * not quite, the chunks a chopper with L more bits would make: they have
+ * its smaller min and no max size. */
+
+/* Opaque tuner handle. */
+typedef struct hashchop_tuner hashchop_tuner;
+
+/* What one chunk size did with the samples. */
+typedef struct hashchop_tune_level {
+    uint8_t bits;               /* mask bits of this chunk size */
+    size_t chunks;              /* chunks cut */
+    size_t unique_chunks;       /* distinct chunks among them */
+    uint64_t bytes;             /* bytes chopped */
+    uint64_t dup_bytes;         /* bytes in chunks already seen */
+} hashchop_tune_level;
+
+#define T hashchop_tuner
+
+/* Create and return a new tuner for LEVELS chunk sizes (1 to
+ * HASHCHOP_MAX_LEVELS), with from MIN_BITS to MIN_BITS + LEVELS - 1 mask
+ * bits (all from HASHCHOP_MIN_BITS to HASHCHOP_MAX_BITS).
+ * Returns NULL on bad arguments or alloc failure. */
+T *hashchop_tuner_new(uint8_t min_bits, uint8_t levels);
+
+/* Chop LENGTH bytes of DATA, one sample file or stream block, at every
+ * chunk size, and count its chunks and duplicates (within it, and against
+ * all samples added before). Returns OK, or MEMORY on alloc failure. */
+hashchop_res hashchop_tuner_add(T *t, const unsigned char *data,
+    size_t length);
+
+/* Get the number of chunk sizes. */
+uint8_t hashchop_tuner_levels(const T *t);
+
+/* Write the counts for the LEVEL'th chunk size (0 is the smallest) in
+ * (*STATS). Returns OK, or OVERFLOW if there is no such level. */
+hashchop_res hashchop_tuner_level(const T *t, uint8_t level,
+    hashchop_tune_level *stats);
+
+/* Get the cost of storing the samples with the LEVEL'th chunk size, in
+ * bytes: the bytes of the distinct chunks, plus ENTRY_BYTES per distinct
+ * chunk. Returns 0 if there is no such level. */
+double hashchop_tuner_cost(const T *t, uint8_t level, double entry_bytes);
+
+/* Get the mask bits that store the samples most cheaply, with
+ * ENTRY_BYTES per index entry (on a tie, the larger chunks), for passing
+ * to hashchop_new. */
+uint8_t hashchop_tuner_recommend(const T *t, double entry_bytes);
+
+/* Free a tuner. */
+void hashchop_tuner_free(T *t);
+
+#undef T
+#endif
@@ -1,21 +1,29 @@
 /* Lua wrapper for hashchop. */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <lua.h>
 #include <lauxlib.h>
+#include <lualib.h>
 #include "hashchop.h"
 
 static const char OK[] = "ok";
 static const char UNDERFLOW[] = "underflow";
 static const char OVERFLOW[] = "overflow";
 static const char FULL[] = "full";
+static const char MEMORY[] = "memory";
+static const char IO[] = "io";
+static const char FORMAT[] = "format";
 
-static const char *res_msgs[] = {FULL, OVERFLOW, UNDERFLOW, OK};
-#define GET_STATUS(RES) (res_msgs[RES+3])
+static const char *res_msgs[] = {FORMAT, IO, MEMORY, FULL, OVERFLOW, UNDERFLOW, OK};
+#define GET_STATUS(RES) (res_msgs[RES+6])
 
+/* Chunks are pushed to Lua straight from the chopper's buffer, with
+ * hashchop_poll_view, so there's no buffer here. */
 typedef struct {
     hashchop *h;
-    size_t buf_sz;
-    unsigned char buf[1];
 } LHashchop;
 
 #define CHECK_HC(N)                                                     \
@@ -26,8 +34,13 @@ typedef struct {
  * Returns a hashchopper or (nil, "Bad bits argument.").*/
 static int lhashchop_new(lua_State *L) {
     int bits = luaL_checkint(L, 1);
-    size_t buf_sz = 1 << (bits + 2);
-    LHashchop *lh = lua_newuserdata(L, sizeof(*lh) + buf_sz);
+    if (bits < HASHCHOP_MIN_BITS || bits > HASHCHOP_MAX_BITS) {
+        /* hashchop_new takes a uint8_t, which would wrap it. */
+        lua_pushnil(L);
+        lua_pushstring(L, "Bad bits argument.");
+        return 2;
+    }
+    LHashchop *lh = lua_newuserdata(L, sizeof(*lh));
     if (lh == NULL) {
         /* FIXME If lua_newuserdata's alloc fails, does lua longjmp
          * into its normal error handling, or just return null? */
@@ -43,7 +56,6 @@ static int lhashchop_new(lua_State *L) {
         return 2;
     } else {
         lh->h = hc;
-        lh->buf_sz = buf_sz;
         luaL_getmetatable(L, "Hashchop");
         lua_setmetatable(L, -2);
         return 1;
@@ -66,10 +78,11 @@ static int lhashchop_sink(lua_State *L) {
  * Returns the chunk string, or (nil, error code). */
 static int lhashchop_poll(lua_State *L) {
     CHECK_HC(1);
-    size_t sz = lh->buf_sz;
-    hashchop_res res = hashchop_poll(hc, lh->buf, &sz);
+    const unsigned char *chunk = NULL;
+    size_t sz = 0;
+    hashchop_res res = hashchop_poll_view(hc, &chunk, &sz);
     if (res == HASHCHOP_OK) {
-        lua_pushlstring(L, (char *)lh->buf, sz);
+        lua_pushlstring(L, (const char *)chunk, sz);
         return 1;
     } else {
         lua_pushnil(L);
@@ -79,19 +92,74 @@ static int lhashchop_poll(lua_State *L) {
 }
 
 /* Get the remaining data from the hashchopper and reset it.
- * Returns the last chunk or (nil, error code). */
+ * Returns the last chunk (possibly empty). */
 static int lhashchop_finish(lua_State *L) {
     CHECK_HC(1);
-    size_t sz = lh->buf_sz;
-    hashchop_res res = hashchop_finish(hc, lh->buf, &sz);
-    if (res == HASHCHOP_OK) {
-        lua_pushlstring(L, (char *)lh->buf, sz);
-        return 1;
-    } else {
-        lua_pushnil(L);
-        lua_pushstring(L, GET_STATUS(res));
-        return 2;
+    const unsigned char *chunk = NULL;
+    size_t sz = 0;
+    hashchop_finish_view(hc, &chunk, &sz);
+    lua_pushlstring(L, (const char *)chunk, sz);
+    return 1;
+}
+
+/* Append every chunk that's ready to the table on top of the stack,
+ * after its first N entries. Returns the new count. */
+static int push_ready(lua_State *L, hashchop *hc, int n) {
+    const unsigned char *chunk = NULL;
+    size_t sz = 0;
+    while (hashchop_poll_view(hc, &chunk, &sz) == HASHCHOP_OK) {
+        lua_pushlstring(L, (const char *)chunk, sz);
+        lua_rawseti(L, -2, ++n);
     }
+    return n;
+}
+
+/* Poll for every complete chunk at once.
+ * Returns a table of chunk strings (empty if none are ready). */
+static int lhashchop_poll_all(lua_State *L) {
+    CHECK_HC(1);
+    lua_newtable(L);
+    push_ready(L, hc, 0);
+    return 1;
+}
+
+/* Sink a binary string of any length, polling as necessary.
+ * Returns a table of the chunks completed; the rest of the data stays
+ * buffered, for later calls or finish. */
+static int lhashchop_push(lua_State *L) {
+    CHECK_HC(1);
+    size_t sz = 0, pos = 0, max = hashchop_max_chunk(hc);
+    const unsigned char *str = (const unsigned char *)luaL_checklstring(L, 2, &sz);
+    int n = 0;
+    lua_newtable(L);
+    n = push_ready(L, hc, n);
+    while (pos < sz) {
+        size_t piece = (sz - pos < max ? sz - pos : max);
+        /* After polling until underflow, there's always room for max. */
+        if (hashchop_sink(hc, str + pos, piece) != HASHCHOP_OK) {
+            return luaL_error(L, "hashchop sink failed");
+        }
+        pos += piece;
+        n = push_ready(L, hc, n);
+    }
+    return 1;
+}
+
+/* Find the chunk boundaries of a whole string, without copying it (or
+ * using the hashchopper's buffered data). Returns a table of the end
+ * offset of each chunk, so chunk I is str:sub(ends[I-1] + 1, ends[I]). */
+static int lhashchop_seams(lua_State *L) {
+    CHECK_HC(1);
+    size_t sz = 0, pos = 0;
+    const unsigned char *str = (const unsigned char *)luaL_checklstring(L, 2, &sz);
+    int n = 0;
+    lua_newtable(L);
+    while (pos < sz) {
+        pos += hashchop_seam(hc, str + pos, sz - pos);
+        lua_pushinteger(L, pos);
+        lua_rawseti(L, -2, ++n);
+    }
+    return 1;
 }
 
 /* Reset the hashchopper. */
@@ -108,10 +176,9 @@ static int lhashchop_gc(lua_State *L) {
 }
 
 static int lhashchop_tostring(lua_State *L) {
-    #define BUF_SZ 24
-    char buf[BUF_SZ];
+    char buf[64];
     LHashchop *lh = luaL_checkudata(L, 1, "Hashchop");
-    if (BUF_SZ < snprintf(buf, BUF_SZ - 1, "hashchop: %p", lh)) {
+    if (snprintf(buf, sizeof(buf), "hashchop: %p", lh) >= (int)sizeof(buf)) {
         lua_pushstring(L, "(snprintf error in tostring)");
     } else {
         lua_pushstring(L, buf);
@@ -119,9 +186,153 @@ static int lhashchop_tostring(lua_State *L) {
     return 1;
 }
 
-/* Library's table, containing only hashchop.new. */
+/* State for a hashchop.chunks iterator. Chunks are found in place in
+ * the read buffer with hashchop_seam, so data is only copied when it's
+ * read (and when a chunk string is made). */
+typedef struct {
+    hashchop *hc;
+    FILE *f;
+    int owns_f;                 /* opened from a path, so close it */
+    int mode;
+    unsigned char *buf;
+    size_t buf_sz;
+    size_t start, end;          /* unchunked data in buf */
+    double offset;              /* of buf[start] in the stream */
+    int eof;
+} LChunks;
+
+enum { CHUNKS_OFFSETS, CHUNKS_FINGERPRINTS, CHUNKS_STRINGS };
+static const char *chunk_modes[] = { "offsets", "fingerprints", "strings", NULL };
+
+/* Read size for the iterator (or twice the max chunk size, if larger). */
+#define CHUNKS_READ_SZ (1024 * 1024)
+
+static void close_chunks(LChunks *c) {
+    if (c->hc) hashchop_free(c->hc);
+    if (c->f && c->owns_f) fclose(c->f);
+    free(c->buf);
+    c->hc = NULL;
+    c->f = NULL;
+    c->buf = NULL;
+}
+
+static int lchunks_gc(lua_State *L) {
+    close_chunks(luaL_checkudata(L, 1, "HashchopChunks"));
+    return 0;
+}
+
+/* Get the next chunk: (offset, length), (offset, length, fingerprint)
+ * or (chunk, offset), depending on the mode, with offsets from 0 and
+ * the fingerprint as a hex string; or nil at the end. */
+static int lchunks_next(lua_State *L) {
+    LChunks *c = lua_touserdata(L, lua_upvalueindex(1));
+    if (c->hc == NULL) return 0;
+    size_t max = hashchop_max_chunk(c->hc);
+    if (c->end - c->start < max && !c->eof) {
+        size_t rem = c->end - c->start;
+        memmove(c->buf, c->buf + c->start, rem);
+        c->start = 0;
+        c->end = rem;
+        while (c->end < c->buf_sz && !c->eof) {
+            size_t rd = fread(c->buf + c->end, 1, c->buf_sz - c->end, c->f);
+            c->end += rd;
+            if (rd == 0) {
+                if (ferror(c->f)) {
+                    return luaL_error(L, "hashchop.chunks: %s", strerror(errno));
+                }
+                c->eof = 1;
+            }
+        }
+    }
+    if (c->start == c->end) {
+        close_chunks(c);
+        return 0;
+    }
+
+    const unsigned char *chunk = c->buf + c->start;
+    size_t sz = hashchop_seam(c->hc, chunk, c->end - c->start);
+    double offset = c->offset;
+    c->start += sz;
+    c->offset += sz;
+    switch (c->mode) {
+    case CHUNKS_STRINGS:
+        lua_pushlstring(L, (const char *)chunk, sz);
+        lua_pushnumber(L, offset);
+        return 2;
+    case CHUNKS_FINGERPRINTS: {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx",
+            (unsigned long long)hashchop_fingerprint(chunk, sz));
+        lua_pushnumber(L, offset);
+        lua_pushinteger(L, sz);
+        lua_pushstring(L, hex);
+        return 3;
+    }
+    default:
+        lua_pushnumber(L, offset);
+        lua_pushinteger(L, sz);
+        return 2;
+    }
+}
+
+/* Iterate over the chunks of a file, given as a path or an open file
+ * handle (which is left open), for a generic for loop. MODE is
+ * "offsets" (the default), "fingerprints" or "strings".
+ * Returns the iterator, or (nil, error message). */
+static int lhashchop_chunks(lua_State *L) {
+    FILE *f = NULL;
+    int owns_f = 0;
+    int bits = luaL_checkint(L, 2);
+    int mode = luaL_checkoption(L, 3, "offsets", chunk_modes);
+    if (bits < HASHCHOP_MIN_BITS || bits > HASHCHOP_MAX_BITS) {
+        lua_pushnil(L);
+        lua_pushstring(L, "Bad bits argument.");
+        return 2;
+    }
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        const char *path = lua_tostring(L, 1);
+        f = fopen(path, "rb");
+        if (f == NULL) {
+            lua_pushnil(L);
+            lua_pushfstring(L, "%s: %s", path, strerror(errno));
+            return 2;
+        }
+        owns_f = 1;
+    } else {
+        FILE **fp = luaL_checkudata(L, 1, LUA_FILEHANDLE);
+        if (*fp == NULL) return luaL_error(L, "attempt to use a closed file");
+        f = *fp;
+    }
+
+    LChunks *c = lua_newuserdata(L, sizeof(*c));
+    memset(c, 0, sizeof(*c));
+    c->f = f;
+    c->owns_f = owns_f;
+    c->mode = mode;
+    luaL_getmetatable(L, "HashchopChunks");
+    lua_setmetatable(L, -2);
+    c->hc = hashchop_new(bits);
+    if (c->hc == NULL) {
+        close_chunks(c);
+        lua_pushnil(L);
+        lua_pushstring(L, "Bad bits argument.");
+        return 2;
+    }
+    c->buf_sz = 2 * hashchop_max_chunk(c->hc);
+    if (c->buf_sz < CHUNKS_READ_SZ) c->buf_sz = CHUNKS_READ_SZ;
+    c->buf = malloc(c->buf_sz);
+    if (c->buf == NULL) {
+        close_chunks(c);
+        return luaL_error(L, "Hashchop alloc failure");
+    }
+    lua_pushcclosure(L, lchunks_next, 1);
+    return 1;
+}
+
+/* Library's table. */
 static const struct luaL_Reg lhashchop_lib[] = {
     { "new", lhashchop_new },
+    { "chunks", lhashchop_chunks },
     { NULL, NULL },
 };
 
@@ -130,6 +341,9 @@ static const struct luaL_Reg lhashchop_mt[] = {
     { "sink", lhashchop_sink },
     { "poll", lhashchop_poll },
     { "finish", lhashchop_finish },
+    { "poll_all", lhashchop_poll_all },
+    { "push", lhashchop_push },
+    { "seams", lhashchop_seams },
     { "reset", lhashchop_reset },
     { "__gc", lhashchop_gc },
     { "__tostring", lhashchop_tostring },
@@ -144,6 +358,12 @@ int luaopen_hashchop(lua_State *L) {
     luaL_register(L, NULL, lhashchop_mt);
     lua_pop(L, 1);
 
+    /* Iterator state, only for closing the file when collected. */
+    luaL_newmetatable(L, "HashchopChunks");
+    lua_pushcfunction(L, lchunks_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
     luaL_register(L, "hashchop", lhashchop_lib);
     return 1;
 }
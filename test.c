@@ -3,16 +3,36 @@
 #include <string.h>
 #include <strings.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "hashchop.h"
+#include "hashchop_internal.h"
 #include "greatest.h"
+#include "test.h"
 
 typedef unsigned char UC;
 
-/* Fill a buffer with reasonably random binary data. */
-static void mkrandom(unsigned int seed, unsigned char *buf, size_t len) {
-    srandom(seed);
-    for (size_t i = 0; i < len; i++) buf[i] = random() % 256;
+unsigned int next_random(unsigned int *seed) {
+    *seed = 1103515245 * *seed + 12345;
+    return (*seed >> 16) & 0xffff;
+}
+
+void mkrandom(unsigned int seed, unsigned char *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) buf[i] = next_random(&seed);
+}
+
+hashchop_fp fp_of(uint64_t i) {
+    unsigned char buf[8];
+    for (int j = 0; j < 8; j++) buf[j] = i >> (8 * j);
+    return hashchop_fingerprint(buf, sizeof(buf));
+}
+
+void tmp_path(char *buf, size_t size, const char *ext) {
+    snprintf(buf, size, "/tmp/hashchop_test_%d.%s", (int)getpid(), ext);
+}
+
+void remove_paths(void *udata) {
+    for (char **path = udata; *path; path++) unlink(*path);
 }
 
 TEST constructor_should_reject_chopper_with_invalid_bits_values() {
@@ -391,6 +411,496 @@ TEST make_data_with_deletion_and_check_reuse(size_t sz, size_t bytes_deleted,
     PASS();
 }
 
+TEST levels_should_not_change_chunks(int bits) {
+    size_t sz = 8 * 1024 * 1024;
+    UC *data = malloc(sz), *out = malloc(1 << (bits + 2));
+    mkrandom(bits, data, sz);
+    hashchop *plain = hashchop_new(bits), *hc = hashchop_new(bits);
+    ASSERT(plain); ASSERT(hc);
+    ASSERT_EQ(1, hashchop_levels(hc));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_set_levels(hc, HASHCHOP_MAX_LEVELS));
+    ASSERT_EQ(HASHCHOP_MAX_LEVELS, hashchop_levels(hc));
+
+    /* Seams with levels match seams without, and the levels match
+     * polling with levels. */
+    size_t pos = 0, sunk = 0, counts[HASHCHOP_MAX_LEVELS];
+    memset(counts, 0, sizeof(counts));
+    while (pos < sz) {
+        uint8_t level = 0, polled_level = 0;
+        size_t len = hashchop_seam_level(hc, data + pos, sz - pos, &level);
+        ASSERT_EQ(hashchop_seam(plain, data + pos, sz - pos), len);
+        ASSERT(level < HASHCHOP_MAX_LEVELS);
+        for (int l = 0; l <= level; l++) counts[l]++;
+
+        size_t rem = 1 << (bits + 2);
+        hashchop_res res = HASHCHOP_ERROR_UNDERFLOW;
+        while ((res = hashchop_poll_level(hc, out, &rem, &polled_level))
+            == HASHCHOP_ERROR_UNDERFLOW && sunk < sz) {
+            size_t n = (sz - sunk < 1000 ? sz - sunk : 1000);
+            ASSERT_EQ(HASHCHOP_OK, hashchop_sink(hc, data + sunk, n));
+            sunk += n;
+        }
+        if (res == HASHCHOP_OK) {
+            ASSERT_EQ(len, rem);
+            ASSERT_EQ(level, polled_level);
+        } else {                /* the last chunk */
+            ASSERT_EQ(HASHCHOP_MAX_LEVELS - 1, level);
+            rem = 1 << (bits + 2);
+            ASSERT_EQ(HASHCHOP_OK, hashchop_finish(hc, out, &rem));
+            ASSERT_EQ(len, rem);
+        }
+        ASSERT_EQ(0, memcmp(out, data + pos, len));
+        pos += len;
+    }
+
+    /* Each level has about half as many boundaries as the one below. */
+    for (int l = 1; l < 5; l++) {
+        if (GREATEST_IS_VERBOSE()) {
+            printf("level %d: %zu chunks\n", l, counts[l]);
+        }
+        ASSERT(counts[l] > 0.4 * counts[l - 1]);
+        ASSERT(counts[l] < 0.6 * counts[l - 1]);
+    }
+    free(data); free(out);
+    hashchop_free(plain); hashchop_free(hc);
+    PASS();
+}
+
+TEST set_levels_should_reject_invalid_counts() {
+    hashchop *hc = hashchop_new(12);
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_set_levels(hc, 0));
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW,
+        hashchop_set_levels(hc, HASHCHOP_MAX_LEVELS + 1));
+    ASSERT_EQ(1, hashchop_levels(hc));
+    hashchop_free(hc);
+    PASS();
+}
+
+/* Fill BUF with log-like lines, and return how many bytes were used. */
+static size_t mklog(unsigned int seed, char *buf, size_t sz) {
+    size_t used = 0;
+    while (used + 200 < sz) {
+        used += sprintf(buf + used, "%u host%u app[%u]: %.*s\n",
+            next_random(&seed) % 100000, next_random(&seed) % 10,
+            next_random(&seed) % 1000,
+            (int)(next_random(&seed) % 120), "lorem ipsum dolor sit amet, consectetur "
+            "adipiscing elit, sed do eiusmod tempor incididunt ut labore et "
+            "dolore magna aliqua. ut enim ad minim veniam quis nostrud");
+    }
+    return used;
+}
+
+/* Check that chopping LEN bytes of DATA with HC by seams and by polling
+ * agree, and count the chunks that end in a record end, according to
+ * IS_END, in (*ALIGNED). Returns the number of chunks, or 0 on error. */
+static size_t check_aligned(hashchop *hc, const UC *data, size_t len,
+        int (*is_end)(const UC *data, size_t offset), size_t *aligned) {
+    size_t max = hashchop_max_chunk(hc), pos = 0, sunk = 0, n = 0;
+    UC *out = malloc(max);
+    *aligned = 0;
+    while (pos < len) {
+        size_t cut = hashchop_seam(hc, data + pos, len - pos), rem = max;
+        hashchop_res res = HASHCHOP_ERROR_UNDERFLOW;
+        while ((res = hashchop_poll(hc, out, &rem)) == HASHCHOP_ERROR_UNDERFLOW
+            && sunk < len) {
+            size_t sz = (len - sunk < 1000 ? len - sunk : 1000);
+            if (HASHCHOP_OK != hashchop_sink(hc, data + sunk, sz)) return 0;
+            sunk += sz;
+        }
+        if (res != HASHCHOP_OK) {
+            rem = max;
+            if (HASHCHOP_OK != hashchop_finish(hc, out, &rem)) return 0;
+        }
+        if (rem != cut || memcmp(out, data + pos, cut) != 0) return 0;
+        pos += cut;
+        n++;
+        if (is_end(data, pos - 1)) (*aligned)++;
+    }
+    free(out);
+    return n;
+}
+
+static int newline_end(const UC *data, size_t offset) {
+    return data[offset] == '\n';
+}
+
+TEST delimiter_should_align_chunks_to_records() {
+    size_t sz = 4 * 1024 * 1024, aligned = 0;
+    char *log = malloc(sz);
+    size_t len = mklog(1, log, sz);
+    hashchop *hc = hashchop_new(12);
+    size_t n = check_aligned(hc, (UC *)log, len, newline_end, &aligned);
+    ASSERT(n > 0);
+    ASSERT(aligned < n / 10);   /* without record alignment */
+
+    hashchop_set_delimiter(hc, '\n');
+    n = check_aligned(hc, (UC *)log, len, newline_end, &aligned);
+    ASSERT(n > 0);
+    ASSERT_EQ(n, aligned);
+
+    /* Without any delimiters, seams don't move. */
+    UC *data = malloc(sz);
+    mkrandom(2, data, sz);
+    for (size_t i = 0; i < sz; i++) if (data[i] == '\n') data[i] = ' ';
+    hashchop *plain = hashchop_new(12);
+    for (size_t pos = 0; pos < sz; ) {
+        size_t cut = hashchop_seam(hc, data + pos, sz - pos);
+        ASSERT_EQ(hashchop_seam(plain, data + pos, sz - pos), cut);
+        pos += cut;
+    }
+    hashchop_set_delimiter(hc, HASHCHOP_NO_DELIMITER);
+    n = check_aligned(hc, (UC *)log, len, newline_end, &aligned);
+    ASSERT(aligned < n / 10);
+    free(log); free(data);
+    hashchop_free(hc); hashchop_free(plain);
+    PASS();
+}
+
+/* Records that end with "}\n", as in newline-delimited JSON where a
+ * record may span several lines. */
+static size_t json_end_cb(const UC *data, size_t length, void *udata) {
+    int *calls = udata;
+    (*calls)++;
+    for (size_t i = 1; i < length; i++) {
+        if (data[i] == '\n' && data[i - 1] == '}') return i;
+    }
+    return length;
+}
+
+static int json_end(const UC *data, size_t offset) {
+    return offset > 0 && data[offset] == '\n' && data[offset - 1] == '}';
+}
+
+TEST delimiter_callback_should_align_chunks_to_records() {
+    size_t sz = 4 * 1024 * 1024, used = 0, aligned = 0;
+    char *json = malloc(sz);
+    int calls = 0;
+    unsigned int seed = 3;
+    while (used + 100 < sz) {
+        used += sprintf(json + used, "{\"id\": %u,\n \"v\": \"%u\"}\n",
+            next_random(&seed), next_random(&seed) % 1000);
+    }
+    hashchop *hc = hashchop_new(10);
+    hashchop_set_delimiter_cb(hc, json_end_cb, &calls);
+    size_t n = check_aligned(hc, (UC *)json, used, json_end, &aligned);
+    ASSERT(n > 0);
+    ASSERT(calls > 0);
+    ASSERT_EQ(n, aligned);
+    free(json);
+    hashchop_free(hc);
+    PASS();
+}
+
+/* Chop LEN bytes of DATA with HC by sinking and polling, sinking until
+ * the buffer is FULL each time. Returns the number of chunks. */
+static size_t sink_and_poll(hashchop *hc, const UC *data, size_t len) {
+    size_t max = hashchop_max_chunk(hc), sunk = 0, n = 0;
+    UC *out = malloc(max + len);
+    for (;;) {
+        size_t rem = max;
+        hashchop_res res = hashchop_poll(hc, out, &rem);
+        if (res == HASHCHOP_OK) { n++; continue; }
+        if (sunk == len) break;
+        while (sunk < len) {
+            size_t sz = (len - sunk < 1000 ? len - sunk : 1000);
+            if (HASHCHOP_OK != hashchop_sink(hc, data + sunk, sz)) break;
+            sunk += sz;
+        }
+    }
+    size_t rem = max + len;
+    if (HASHCHOP_OK == hashchop_finish(hc, out, &rem) && rem > 0) n++;
+    free(out);
+    return n;
+}
+
+TEST stats_should_count_chunks_and_cuts() {
+    size_t sz = 4 * 1024 * 1024;
+    UC *data = malloc(sz);
+    hashchop_stats st;
+    mkrandom(4, data, sz);
+    hashchop *hc = hashchop_new(10);
+    sink_and_poll(hc, data, sz);
+    hashchop_get_stats(hc, &st);
+    ASSERT_EQ(0, st.bytes_in);  /* off by default */
+    ASSERT_EQ(0, st.chunks_out);
+
+    ASSERT_EQ(HASHCHOP_OK, hashchop_set_stats(hc, 1));
+    size_t n = sink_and_poll(hc, data, sz);
+    hashchop_get_stats(hc, &st);
+    ASSERT_EQ(sz, st.bytes_in);
+    ASSERT_EQ(n, st.chunks_out);
+    ASSERT_EQ(1, st.finish_cuts);
+    ASSERT(st.full > 0);
+    ASSERT(st.underflow > 0);
+    ASSERT(st.bytes_moved > 0);
+    ASSERT(st.forced_cuts < n / 10);
+    uint64_t total = 0;
+    for (int i = 0; i < HASHCHOP_STATS_BUCKETS; i++) {
+        total += st.sizes[i];
+        /* Between the min and max size, except the last chunk. */
+        if (i < 8 || i > 12) {
+            if (st.sizes[i] > 1) {
+                fprintf(stderr, "bucket %d: %llu chunks\n", i,
+                    (unsigned long long)st.sizes[i]);
+                FAIL();
+            }
+        }
+    }
+    ASSERT_EQ(n, total);
+
+    /* Constant data never matches the mask, so every cut is forced. */
+    memset(data, 0, sz);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_set_stats(hc, 1));
+    n = sink_and_poll(hc, data, sz);
+    hashchop_get_stats(hc, &st);
+    ASSERT_EQ(sz, st.bytes_in);
+    ASSERT_EQ(sz / 4096, n);
+    ASSERT_EQ(n, st.forced_cuts);
+    ASSERT_EQ(n, st.sizes[12]);
+    ASSERT_EQ(0, st.finish_cuts);
+
+    ASSERT_EQ(HASHCHOP_OK, hashchop_set_stats(hc, 0));
+    hashchop_get_stats(hc, &st);
+    ASSERT_EQ(0, st.chunks_out);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_set_stats(hc, 1));
+    free(data);
+    hashchop_free(hc);          /* with counting on */
+    PASS();
+}
+
+TEST poll_view_should_give_the_same_chunks_as_poll() {
+    size_t sz = 1024 * 1024, sunk = 0, pos = 0;
+    UC *data = malloc(sz);
+    mkrandom(7, data, sz);
+    hashchop *hc = hashchop_new(10), *view_hc = hashchop_new(10);
+    size_t max = hashchop_max_chunk(hc);
+    UC *out = malloc(max);
+    for (;;) {
+        const UC *view = NULL;
+        size_t len = 0, rem = max;
+        hashchop_res res = hashchop_poll_view(view_hc, &view, &len);
+        ASSERT_EQ(res, hashchop_poll(hc, out, &rem));
+        if (res == HASHCHOP_OK) {
+            ASSERT_EQ(rem, len);
+            ASSERT_EQ(0, memcmp(view, out, len));
+            ASSERT_EQ(0, memcmp(view, data + pos, len));
+            pos += len;
+            continue;
+        }
+        ASSERT_EQ(HASHCHOP_ERROR_UNDERFLOW, res);
+        if (sunk == sz) break;
+        size_t piece = (sz - sunk < 3000 ? sz - sunk : 3000);
+        ASSERT_EQ(HASHCHOP_OK, hashchop_sink(hc, data + sunk, piece));
+        ASSERT_EQ(HASHCHOP_OK, hashchop_sink(view_hc, data + sunk, piece));
+        sunk += piece;
+    }
+    const UC *view = NULL;
+    size_t len = 0;
+    hashchop_finish_view(view_hc, &view, &len);
+    ASSERT_EQ(sz - pos, len);
+    ASSERT_EQ(0, memcmp(view, data + pos, len));
+    hashchop_finish_view(view_hc, &view, &len);
+    ASSERT_EQ(0, len);
+    free(data); free(out);
+    hashchop_free(hc); hashchop_free(view_hc);
+    PASS();
+}
+
+TEST seams_should_match_repeated_seam_calls() {
+    size_t sz = 1024 * 1024, ends[64], n = 0, pos = 0, total = 0;
+    UC *data = malloc(sz);
+    mkrandom(8, data, sz);
+    hashchop *hc = hashchop_new(10);
+    do {
+        /* 64 at a time, with the last end as the next start. */
+        n = hashchop_seams(hc, data + pos, sz - pos, ends, 64);
+        for (size_t i = 0; i < n; i++) {
+            size_t start = (i == 0 ? 0 : ends[i - 1]);
+            ASSERT_EQ(hashchop_seam(hc, data + pos + start, sz - pos - start),
+                ends[i] - start);
+        }
+        total += n;
+        pos += ends[n - 1];
+    } while (n == 64 && pos < sz);
+    ASSERT_EQ(sz, pos);
+    ASSERT(total > 64);
+    ASSERT_EQ(0, hashchop_seams(hc, data, 0, ends, 64));
+    free(data);
+    hashchop_free(hc);
+    PASS();
+}
+
+TEST scan_kernels_should_match_the_generic_scan() {
+    size_t sz = (1 << 26) + (1 << 20);
+    UC *data = malloc(sz);
+    mkrandom(9, data, sz);
+    for (int bits = HASHCHOP_MIN_BITS; bits <= 25; bits++) {
+        hashchop *hc = hashchop_new(bits), *ghc = hashchop_new(bits);
+        hashchop_set_levels(hc, HASHCHOP_MAX_LEVELS);
+        hashchop_set_levels(ghc, HASHCHOP_MAX_LEVELS);
+        hashchop_set_generic_scan(ghc, 1);
+        size_t len = 16 * hashchop_max_chunk(hc);
+        if (len > sz) len = sz;
+        for (size_t pos = 0; pos < len; ) {
+            uint8_t level = 0, glevel = 0;
+            size_t cut = hashchop_seam_level(hc, data + pos, len - pos, &level);
+            size_t gcut = hashchop_seam_level(ghc, data + pos, len - pos,
+                &glevel);
+            if (cut != gcut || level != glevel) {
+                fprintf(stderr, "bits %d at %zu: %zu/%u vs. %zu/%u\n",
+                    bits, pos, cut, level, gcut, glevel);
+                FAIL();
+            }
+            pos += cut;
+        }
+        hashchop_free(hc);
+        hashchop_free(ghc);
+    }
+    free(data);
+    PASS();
+}
+
+/* Chop LEN bytes of DATA with HC, sinking 1000 bytes at a time, and
+ * write the end offset and level of each chunk in ENDS and LEVELS.
+ * After CHECKPOINT sinks (if non-zero), save HC's state, free it, and
+ * continue with a restored hashchopper. Returns the chunk count. */
+static size_t chop_with_checkpoint(hashchop *hc, const UC *data, size_t len,
+        size_t checkpoint, size_t *ends, uint8_t *levels) {
+    size_t n = 0, sinks = 0, pos = 0;
+    UC out[1 << 16];
+    while (pos < len) {
+        size_t sz = (len - pos < 1000 ? len - pos : 1000);
+        if (HASHCHOP_OK != hashchop_sink(hc, data + pos, sz)) return 0;
+        pos += sz;
+        size_t clen = sizeof(out);
+        uint8_t level = 0;
+        while (HASHCHOP_OK == hashchop_poll_level(hc, out, &clen, &level)) {
+            ends[n] = (n > 0 ? ends[n - 1] : 0) + clen;
+            levels[n++] = level;
+            clen = sizeof(out);
+        }
+        if (++sinks == checkpoint) {
+            size_t state_len = hashchop_state_size(hc);
+            UC *state = malloc(state_len);
+            if (HASHCHOP_OK != hashchop_save_state(hc, state, &state_len)) {
+                return 0;
+            }
+            uint64_t offset = hashchop_stream_offset(hc);
+            hashchop_free(hc);
+            hc = hashchop_restore_state(state, state_len, NULL);
+            free(state);
+            if (hc == NULL || hashchop_stream_offset(hc) != offset
+                || offset != pos) return 0;
+        }
+    }
+    size_t clen = sizeof(out);
+    if (HASHCHOP_OK != hashchop_finish(hc, out, &clen)) return 0;
+    ends[n] = (n > 0 ? ends[n - 1] : 0) + clen;
+    levels[n++] = 0;
+    hashchop_free(hc);
+    return n;
+}
+
+TEST restored_chopper_should_continue_the_stream(const hashchop_engine *engine,
+        int delimiter) {
+    size_t sz = 2 * 1024 * 1024;
+    UC *data = malloc(sz);
+    size_t *ends = malloc(sz * sizeof(size_t));
+    size_t *rends = malloc(sz * sizeof(size_t));
+    uint8_t *levels = malloc(sz), *rlevels = malloc(sz);
+    mkrandom(10, data, sz);
+    if (delimiter != HASHCHOP_NO_DELIMITER) {
+        for (size_t i = 0; i < sz; i++) data[i] = 'a' + data[i] % 32;
+        for (size_t i = 0; i < sz; i += 20 + data[i] % 60) data[i] = '\n';
+    }
+
+    size_t n = 0;
+    for (size_t cp = 0; cp < sz / 1000; cp += 157) {
+        hashchop *hc = hashchop_new_engine(10, engine);
+        hashchop_set_levels(hc, 3);
+        hashchop_set_delimiter(hc, delimiter);
+        size_t rn = chop_with_checkpoint(hc, data, sz, cp, rends, rlevels);
+        if (cp == 0) {
+            n = rn;
+            memcpy(ends, rends, n * sizeof(size_t));
+            memcpy(levels, rlevels, n);
+            ASSERT(n > 100);
+            continue;
+        }
+        if (rn != n || memcmp(ends, rends, n * sizeof(size_t)) != 0
+            || memcmp(levels, rlevels, n) != 0) {
+            fprintf(stderr, "%s: checkpoint after %zu sinks differs\n",
+                engine->name, cp);
+            FAIL();
+        }
+    }
+    free(data); free(ends); free(rends); free(levels); free(rlevels);
+    PASS();
+}
+
+TEST bad_states_should_be_rejected() {
+    UC data[4000], state[8192];
+    mkrandom(11, data, sizeof(data));
+    hashchop *hc = hashchop_new_engine(10, &hashchop_engine_rabin);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_sink(hc, data, sizeof(data)));
+    size_t len = 10;
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_save_state(hc, state, &len));
+    len = sizeof(state);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_save_state(hc, state, &len));
+    ASSERT_EQ(hashchop_state_size(hc), len);
+    hashchop_free(hc);
+
+    ASSERT_EQ(NULL, hashchop_restore_state(state, len - 1, NULL));
+    ASSERT_EQ(NULL, hashchop_restore_state(state, 10, NULL));
+    ASSERT_EQ(NULL, hashchop_restore_state(state, len,
+            &hashchop_engine_buzhash));
+    state[100] ^= 1;            /* corrupt */
+    ASSERT_EQ(NULL, hashchop_restore_state(state, len, NULL));
+    state[100] ^= 1;
+    state[4]++;                 /* newer version */
+    ASSERT_EQ(NULL, hashchop_restore_state(state, len, NULL));
+    state[4]--;
+    hc = hashchop_restore_state(state, len, &hashchop_engine_rabin);
+    ASSERT(hc);
+    ASSERT_EQ(&hashchop_engine_rabin, hashchop_get_engine(hc));
+    ASSERT_EQ(sizeof(data), hashchop_stream_offset(hc));
+    hashchop_free(hc);
+    PASS();
+}
+
+#ifdef HASHCHOP_TRACE
+TEST trace_should_time_each_phase() {
+    size_t sz = 1024 * 1024;
+    UC *data = malloc(sz);
+    hashchop_trace tr;
+    mkrandom(6, data, sz);
+    hashchop *hc = hashchop_new(10);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_trace_window(hc, 100));
+    size_t n = sink_and_poll(hc, data, sz);
+    hashchop_get_trace(hc, &tr);
+    ASSERT_EQ(sz, tr.bytes[HASHCHOP_PHASE_SINK]);
+    ASSERT_EQ(sz, tr.bytes[HASHCHOP_PHASE_COPY_OUT]);
+    ASSERT_EQ(n, tr.calls[HASHCHOP_PHASE_COPY_OUT]);
+    ASSERT(tr.calls[HASHCHOP_PHASE_SCAN] > 0);
+    ASSERT(tr.ns[HASHCHOP_PHASE_SCAN] > 0);
+
+    FILE *f = tmpfile();
+    char buf[256];
+    int events = 0;
+    ASSERT(f);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_trace_dump(hc, f));
+    rewind(f);
+    ASSERT(fgets(buf, sizeof(buf), f));
+    ASSERT_STR_EQ("{\"traceEvents\":[\n", buf);
+    while (fgets(buf, sizeof(buf), f)) events += (buf[0] == '{');
+    ASSERT_EQ(100, events);
+    fclose(f);
+    free(data);
+    hashchop_free(hc);
+    PASS();
+}
+#endif
+
 SUITE(suite) {
     RUN_TEST(constructor_should_reject_chopper_with_invalid_bits_values);
     RUN_TEST(a_chopper_given_one_chunk_and_closed_should_return_the_one_chunk);
@@ -401,6 +911,25 @@ SUITE(suite) {
     for (int bits = 10; bits < 16; bits++) {
         RUN_TESTp(average_chunk_size_should_be_close_to_2_expt_bits, bits);
     }
+    RUN_TESTp(levels_should_not_change_chunks, 10);
+    RUN_TESTp(levels_should_not_change_chunks, 13);
+    RUN_TEST(set_levels_should_reject_invalid_counts);
+    RUN_TEST(delimiter_should_align_chunks_to_records);
+    RUN_TEST(delimiter_callback_should_align_chunks_to_records);
+    RUN_TEST(stats_should_count_chunks_and_cuts);
+    RUN_TEST(poll_view_should_give_the_same_chunks_as_poll);
+    RUN_TEST(seams_should_match_repeated_seam_calls);
+    RUN_TEST(scan_kernels_should_match_the_generic_scan);
+    RUN_TESTp(restored_chopper_should_continue_the_stream,
+        &hashchop_engine_rsync, HASHCHOP_NO_DELIMITER);
+    RUN_TESTp(restored_chopper_should_continue_the_stream,
+        &hashchop_engine_buzhash, HASHCHOP_NO_DELIMITER);
+    RUN_TESTp(restored_chopper_should_continue_the_stream,
+        &hashchop_engine_rsync, '\n');
+    RUN_TEST(bad_states_should_be_rejected);
+#ifdef HASHCHOP_TRACE
+    RUN_TEST(trace_should_time_each_phase);
+#endif
 
     static const int MB = 1024 * 1024;
     
@@ -424,11 +953,37 @@ SUITE(suite) {
     }
 }
 
+/* Suites for the other modules, in test_*.c. */
+extern SUITE(store_suite);
+extern SUITE(pack_suite);
+extern SUITE(filter_suite);
+extern SUITE(rechunk_suite);
+extern SUITE(merkle_suite);
+extern SUITE(delta_suite);
+extern SUITE(similar_suite);
+extern SUITE(tune_suite);
+extern SUITE(engine_suite);
+extern SUITE(manifest_suite);
+extern SUITE(batch_suite);
+extern SUITE(router_suite);
+
 /* Add all the definitions that need to be in the test runner's main file. */
 GREATEST_MAIN_DEFS();
 
 int main(int argc, char **argv) {
     GREATEST_MAIN_BEGIN();      /* command-line arguments, initialization. */
     RUN_SUITE(suite);
+    RUN_SUITE(store_suite);
+    RUN_SUITE(pack_suite);
+    RUN_SUITE(filter_suite);
+    RUN_SUITE(rechunk_suite);
+    RUN_SUITE(merkle_suite);
+    RUN_SUITE(delta_suite);
+    RUN_SUITE(similar_suite);
+    RUN_SUITE(tune_suite);
+    RUN_SUITE(engine_suite);
+    RUN_SUITE(manifest_suite);
+    RUN_SUITE(batch_suite);
+    RUN_SUITE(router_suite);
     GREATEST_MAIN_END();        /* display results */
 }
@@ -0,0 +1,28 @@
+#ifndef TEST_H
+#define TEST_H
+
+/* Helpers shared by the test suites, defined in test.c. */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hashchop.h"
+
+/* Fill a buffer with reasonably random binary data. The same SEED
+ * always gives the same data. */
+void mkrandom(unsigned int seed, unsigned char *buf, size_t len);
+
+/* Step the generator mkrandom uses, and return the next 16 random bits. */
+unsigned int next_random(unsigned int *seed);
+
+/* Get the I'th test fingerprint. */
+hashchop_fp fp_of(uint64_t i);
+
+/* Write a temporary file path for this process, ending in EXT, into
+ * BUF. */
+void tmp_path(char *buf, size_t size, const char *ext);
+
+/* Unlink each of the NULL-terminated array of paths in UDATA. Used as
+ * a suite teardown, and to clear out files left by an earlier run. */
+void remove_paths(void *udata);
+
+#endif
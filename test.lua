@@ -15,6 +15,18 @@ function test_single_chunk_in_out()
     assert_nil(err)
 end
 
+function test_new_should_reject_bits_that_would_wrap()
+    -- hashchop_new takes a uint8_t, so 264 would be 8.
+    for _, bits in ipairs({ 7, 31, 264, -248 }) do
+        local h, err = hashchop.new(bits)
+        assert_nil(h)
+        assert_equal("Bad bits argument.", err)
+        local iter, err = hashchop.chunks("test.lua", bits)
+        assert_nil(iter)
+        assert_equal("Bad bits argument.", err)
+    end
+end
+
 function test_single_chunk_added_byte_by_byte()
     local h = hashchop.new(10)
     local mt = getmetatable(h)
@@ -27,4 +39,163 @@ function test_single_chunk_added_byte_by_byte()
     assert_equal(data, out)
 end
 
+function test_results_should_have_their_names()
+    local h = hashchop.new(10)
+    local out, err = h:poll()
+    assert_nil(out)
+    assert_equal("underflow", err)
+    -- The max chunk at 10 bits is 4096 bytes; the buffer holds 4 of them.
+    assert_equal("overflow", h:sink(string.rep("x", 4097)))
+    local piece, res = string.rep("x", 4096)
+    for i = 1, 5 do res = h:sink(piece) end
+    assert_equal("full", res)
+    out, err = h:poll()
+    assert_equal(4096, #out)
+    assert_nil(err)
+end
+
+function test_tostring_should_show_the_whole_address()
+    local h = hashchop.new(10)
+    local mt = getmetatable(h)
+    local f = mt.__tostring
+    mt.__tostring = nil
+    local raw = tostring(h)             -- "userdata: 0x..."
+    mt.__tostring = f
+    assert_equal((raw:gsub("^userdata", "hashchop")), tostring(h))
+end
+
+local function random_string(len)
+    math.randomseed(1)
+    local t = {}
+    for i = 1, len do t[i] = string.char(math.random(0, 255)) end
+    return table.concat(t)
+end
+
+function test_seams_should_cover_the_string()
+    local h = hashchop.new(10)
+    local data = random_string(100000)
+    local ends = h:seams(data)
+    assert_true(#ends > 1)
+    assert_equal(#data, ends[#ends])
+    local chunks, prev = {}, 0
+    for i, e in ipairs(ends) do
+        assert_true(e > prev)
+        chunks[i] = data:sub(prev + 1, e)
+        prev = e
+    end
+    assert_equal(data, table.concat(chunks))
+end
+
+function test_push_should_give_the_same_chunks_as_seams()
+    local h = hashchop.new(10)
+    local data = random_string(100000)
+    local ends = h:seams(data)
+    local chunks = h:push(data:sub(1, 50000))
+    for _, c in ipairs(h:push(data:sub(50001))) do chunks[#chunks + 1] = c end
+    assert_equal(0, #h:poll_all())
+    chunks[#chunks + 1] = h:finish()
+    local prev = 0
+    for i, e in ipairs(ends) do
+        assert_equal(data:sub(prev + 1, e), chunks[i])
+        prev = e
+    end
+    assert_equal(#ends, #chunks)
+end
+
+function test_chunks_should_iterate_over_a_file()
+    local data = random_string(3000000)
+    local path = os.tmpname()
+    local f = assert(io.open(path, "wb"))
+    f:write(data)
+    f:close()
+    local ends = hashchop.new(12):seams(data)
+
+    local i, prev = 0, 0
+    for off, len, fp in hashchop.chunks(path, 12, "fingerprints") do
+        i = i + 1
+        assert_equal(prev, off)
+        assert_equal(ends[i], off + len)
+        assert_equal(16, #fp)
+        prev = off + len
+    end
+    assert_equal(#ends, i)
+
+    f = assert(io.open(path, "rb"))
+    local chunks = {}
+    for chunk, off in hashchop.chunks(f, 12, "strings") do
+        chunks[#chunks + 1] = chunk
+    end
+    f:close()
+    assert_equal(#ends, #chunks)
+    assert_equal(data, table.concat(chunks))
+    os.remove(path)
+
+    local iter, err = hashchop.chunks(path, 12)
+    assert_nil(iter)
+    assert_string(err)
+end
+
+-- Count the files this process has open that can be opened again
+-- through /proc/self/fd, or nil if that isn't there.
+local function open_files()
+    local f = io.open("/proc/self/stat")
+    if f == nil then return nil end
+    f:close()
+    local n = 0
+    for fd = 0, 1023 do
+        f = io.open("/proc/self/fd/" .. fd)
+        if f then
+            n = n + 1
+            f:close()
+        end
+    end
+    return n
+end
+
+-- Start COUNT iterators over PATH, and abandon each after a few chunks.
+local function abandon_chunks(path, count)
+    for round = 1, count do
+        local n = 0
+        for off, len in hashchop.chunks(path, 12) do
+            n = n + 1
+            if n == 10 then break end
+        end
+        assert_equal(10, n)
+    end
+end
+
+function test_abandoned_chunks_iterator_should_close_its_file()
+    local path = os.tmpname()
+    local f = assert(io.open(path, "wb"))
+    f:write(random_string(3000000))
+    f:close()
+    collectgarbage()
+    local before = open_files()
+
+    abandon_chunks(path, 20)
+    if before then
+        -- They hold their files until they're collected. (LuaJIT's
+        -- compiled traces keep the closures they were recorded with, and
+        -- the last one may still be in a dead stack slot.)
+        assert_true(open_files() >= before + 20)
+        if jit then jit.flush() end
+        collectgarbage()
+        collectgarbage()
+        assert_true(open_files() <= before + 1)
+    end
+    os.remove(path)
+end
+
+function test_chunks_should_raise_read_errors()
+    -- A directory opens, but reading it fails.
+    local iter = hashchop.chunks("/", 12)
+    if iter == nil then return end      -- (if fopen refuses it)
+    local ok, err = pcall(iter)
+    assert_false(ok)
+    assert_true(err:match("^hashchop.chunks: ") ~= nil)
+    -- And again on the next call, rather than ending quietly.
+    ok, err = pcall(iter)
+    assert_false(ok)
+end
+
 lunatest.run()
@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hashchop.h"
+#include "hashchop_batch.h"
+#include "greatest.h"
+#include "test.h"
+
+typedef unsigned char UC;
+
+#define SZ (24 * 1024 * 1024)
+
+/* Split LEN bytes of DATA into objects, mostly a few KB, with an empty
+ * one and a few larger than the max chunk size mixed in. Returns how
+ * many, at most MAX. */
+static size_t split(const UC *data, size_t len, hashchop_object *objects,
+        size_t max) {
+    size_t n = 0, pos = 0;
+    unsigned int seed = 7;
+    while (pos < len && n < max) {
+        seed = 1103515245 * seed + 12345;
+        size_t sz = 512 + (seed >> 16) % 8192;
+        if (n % 100 == 50) sz = 0;
+        if (n % 100 == 99) sz = 200000 + (seed >> 16) % 100000;
+        if (sz > len - pos) sz = len - pos;
+        objects[n].data = data + pos;
+        objects[n].length = sz;
+        pos += sz;
+        n++;
+    }
+    return n;
+}
+
+/* Check RESULTS and ENDS against chopping each object with seams. */
+static int check_batch(hashchop *hc, const hashchop_object *objects,
+        size_t n, const hashchop_batch_result *results, const size_t *ends) {
+    size_t *exp = malloc(SZ * sizeof(size_t) / 1024);
+    size_t next = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t ct = hashchop_seams(hc, objects[i].data, objects[i].length,
+            exp, SZ / 1024);
+        if (results[i].first != next || results[i].count != ct
+            || memcmp(exp, ends + next, ct * sizeof(size_t)) != 0) {
+            fprintf(stderr, "object %zu differs\n", i);
+            free(exp);
+            FAIL();
+        }
+        next += ct;
+    }
+    free(exp);
+    PASS();
+}
+
+TEST a_batch_should_match_chopping_each_object(int threads) {
+    UC *data = malloc(SZ);
+    mkrandom(1, data, SZ);
+    size_t max_objs = SZ / 512;
+    hashchop_object *objects = malloc(max_objs * sizeof(*objects));
+    size_t n = split(data, SZ, objects, max_objs);
+    hashchop_batch_result *results = malloc(n * sizeof(*results));
+    hashchop *hc = hashchop_new(12);
+    size_t max_ends = hashchop_batch_max_ends(hc, objects, n);
+    size_t *ends = malloc(max_ends * sizeof(size_t));
+
+    ASSERT_EQ(HASHCHOP_OK, hashchop_chop_batch(hc, objects, n, results,
+            ends, max_ends, threads));
+    int res = check_batch(hc, objects, n, results, ends);
+    if (res != 0) return res;
+
+    /* With record alignment, too. */
+    hashchop_set_delimiter(hc, 'x');
+    ASSERT_EQ(HASHCHOP_OK, hashchop_chop_batch(hc, objects, n, results,
+            ends, max_ends, threads));
+    res = check_batch(hc, objects, n, results, ends);
+    if (res != 0) return res;
+
+    hashchop_free(hc);
+    free(data); free(objects); free(results); free(ends);
+    PASS();
+}
+
+TEST a_batch_should_overflow_when_out_of_room() {
+    UC *data = malloc(SZ);
+    mkrandom(2, data, SZ);
+    hashchop_object objects[3] = {
+        { data, 1000 }, { data + 1000, 1000000 }, { data + 1001000, 1000 },
+    };
+    hashchop_batch_result results[3];
+    size_t ends[400];
+    hashchop *hc = hashchop_new(12);
+
+    /* Exactly enough room. */
+    ASSERT_EQ(HASHCHOP_OK, hashchop_chop_batch(hc, objects, 3, results,
+            ends, 400, 4));
+    size_t used = results[2].first + results[2].count;
+    ASSERT_EQ(HASHCHOP_OK, hashchop_chop_batch(hc, objects, 3, results,
+            ends, used, 4));
+    ASSERT_EQ(1000, ends[used - 1]);
+
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_chop_batch(hc, objects, 3,
+            results, ends, used - 1, 4));
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_chop_batch(hc, objects, 3,
+            results, ends, 5, 1));
+    ASSERT_EQ(0, results[0].first);
+    ASSERT_EQ(1, results[0].count);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_chop_batch(hc, objects, 0, results,
+            ends, 0, 4));
+    hashchop_free(hc);
+    free(data);
+    PASS();
+}
+
+SUITE(batch_suite) {
+    RUN_TESTp(a_batch_should_match_chopping_each_object, 1);
+    RUN_TESTp(a_batch_should_match_chopping_each_object, 4);
+    RUN_TEST(a_batch_should_overflow_when_out_of_room);
+}
@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "hashchop.h"
+#include "hashchop_delta.h"
+#include "greatest.h"
+#include "test.h"
+
+typedef unsigned char UC;
+
+#define BITS 12
+#define SZ (4 * 1024 * 1024)
+
+/* Sync from OLD to NEW the way two ends would: send the signature of OLD
+ * encoded, then the delta, and check that applying it rebuilds NEW.
+ * Returns the delta's size, or 0 on failure. */
+static size_t sync(const UC *old, size_t old_len, const UC *new,
+                   size_t new_len, hashchop_delta_stats *stats) {
+    size_t res_sz = 0;
+    hashchop_sig *s = hashchop_sig_build(BITS, old, old_len);
+    assert(s);
+    size_t sig_len = hashchop_sig_size(s);
+    UC *sig_buf = malloc(sig_len);
+    assert(sig_buf);
+    if (HASHCHOP_OK != hashchop_sig_encode(s, sig_buf, &sig_len)) goto done;
+    hashchop_sig *r = hashchop_sig_decode(sig_buf, sig_len);
+    if (r == NULL || hashchop_sig_count(r) != hashchop_sig_count(s)) goto done;
+
+    size_t delta_len = hashchop_delta_bound(r, new_len);
+    UC *delta = malloc(delta_len);
+    UC *out = malloc(new_len + 1);
+    assert(delta && out);
+    size_t out_len = new_len, target = 0;
+    if (HASHCHOP_OK == hashchop_delta_encode(r, new, new_len, delta,
+            &delta_len, stats)
+        && HASHCHOP_OK == hashchop_delta_target_length(delta, delta_len, &target)
+        && target == new_len
+        && HASHCHOP_OK == hashchop_delta_apply(old, old_len, delta, delta_len,
+            out, &out_len)
+        && out_len == new_len && 0 == memcmp(out, new, new_len)) {
+        res_sz = delta_len;
+    }
+    free(delta); free(out);
+    hashchop_sig_free(r);
+done:
+    free(sig_buf);
+    hashchop_sig_free(s);
+    return res_sz;
+}
+
+TEST identical_data_should_be_one_copy() {
+    UC *data = malloc(SZ);
+    mkrandom(1, data, SZ);
+    hashchop_delta_stats st;
+    size_t sz = sync(data, SZ, data, SZ, &st);
+    ASSERT(sz > 0);
+    ASSERT_EQ(1, st.copy_ops);
+    ASSERT_EQ(SZ, st.copy_bytes);
+    ASSERT_EQ(0, st.literal_bytes);
+    ASSERT(sz < 64);
+    free(data);
+    PASS();
+}
+
+TEST unrelated_data_should_be_all_literal() {
+    UC *old = malloc(SZ), *new = malloc(SZ);
+    mkrandom(1, old, SZ);
+    mkrandom(2, new, SZ);
+    /* fill's sequences for different seeds overlap, so flip bits too. */
+    for (size_t i = 0; i < SZ; i++) new[i] ^= 0x5a;
+    hashchop_delta_stats st;
+    size_t sz = sync(old, SZ, new, SZ, &st);
+    ASSERT(sz > SZ);
+    ASSERT_EQ(0, st.copy_bytes);
+    ASSERT_EQ(1, st.literal_ops);
+    free(old); free(new);
+    PASS();
+}
+
+/* Replace OLD_LENGTH bytes at OFFSET with NEW_LENGTH new bytes. */
+TEST edits_should_only_send_changed_chunks(size_t offset, size_t old_length,
+        size_t new_length) {
+    UC *old = malloc(SZ), *new = malloc(SZ + new_length);
+    mkrandom(3, old, SZ);
+    memcpy(new, old, offset);
+    mkrandom(4, new + offset, new_length);
+    memcpy(new + offset + new_length, old + offset + old_length,
+        SZ - offset - old_length);
+    size_t new_len = SZ - old_length + new_length;
+
+    hashchop_delta_stats st;
+    size_t sz = sync(old, SZ, new, new_len, &st);
+    ASSERT(sz > 0);
+    ASSERT_EQ(new_len, st.copy_bytes + st.literal_bytes);
+    if (GREATEST_IS_VERBOSE()) {
+        printf("%zu copy ops, %zu literal bytes, %zu delta bytes\n",
+            st.copy_ops, st.literal_bytes, sz);
+    }
+    /* The chunks touching the edit, and about one on each side. */
+    ASSERT(st.literal_bytes <= new_length + 4 * (1 << (BITS + 2)));
+    ASSERT(st.copy_ops <= 2);
+    free(old); free(new);
+    PASS();
+}
+
+TEST empty_data_should_sync() {
+    UC data[10];
+    mkrandom(5, data, sizeof(data));
+    hashchop_delta_stats st;
+    ASSERT(sync(data, 0, data, sizeof(data), &st) > 0);
+    ASSERT(sync(data, sizeof(data), data, 0, &st) > 0);
+    ASSERT_EQ(0, st.copy_ops + st.literal_ops);
+    PASS();
+}
+
+TEST bad_deltas_should_be_rejected() {
+    UC *old = malloc(SZ), *other = malloc(SZ), *new = malloc(SZ);
+    UC *out = malloc(SZ);
+    mkrandom(6, old, SZ);
+    mkrandom(7, other, SZ);
+    memcpy(new, old, SZ);
+    mkrandom(8, new + 1000, 100);
+    hashchop_sig *s = hashchop_sig_build(BITS, old, SZ);
+    size_t delta_len = hashchop_delta_bound(s, SZ);
+    UC *delta = malloc(delta_len);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_delta_encode(s, new, SZ, delta,
+            &delta_len, NULL));
+
+    size_t out_len = SZ - 1;
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_delta_apply(old, SZ,
+            delta, delta_len, out, &out_len));
+    out_len = SZ;               /* wrong basis */
+    ASSERT_EQ(HASHCHOP_ERROR_FORMAT, hashchop_delta_apply(other, SZ,
+            delta, delta_len, out, &out_len));
+    out_len = SZ;               /* truncated */
+    ASSERT_EQ(HASHCHOP_ERROR_FORMAT, hashchop_delta_apply(old, SZ,
+            delta, delta_len - 1, out, &out_len));
+    out_len = SZ;               /* short basis */
+    ASSERT_EQ(HASHCHOP_ERROR_FORMAT, hashchop_delta_apply(old, SZ / 2,
+            delta, delta_len, out, &out_len));
+    delta[0] = 'x';
+    out_len = SZ;
+    ASSERT_EQ(HASHCHOP_ERROR_FORMAT, hashchop_delta_apply(old, SZ,
+            delta, delta_len, out, &out_len));
+
+    size_t small = 100;
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_delta_encode(s, other, SZ,
+            delta, &small, NULL));
+    UC sig_buf[30];
+    size_t sig_len = sizeof(sig_buf);
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_sig_encode(s, sig_buf,
+            &sig_len));
+    ASSERT_EQ(NULL, hashchop_sig_decode(sig_buf, 10));
+
+    hashchop_sig_free(s);
+    free(old); free(other); free(new); free(out); free(delta);
+    PASS();
+}
+
+SUITE(delta_suite) {
+    RUN_TEST(identical_data_should_be_one_copy);
+    RUN_TEST(unrelated_data_should_be_all_literal);
+    RUN_TESTp(edits_should_only_send_changed_chunks, SZ / 2, 4096, 4096);
+    RUN_TESTp(edits_should_only_send_changed_chunks, SZ / 3, 0, 100);
+    RUN_TESTp(edits_should_only_send_changed_chunks, SZ / 3, 10000, 0);
+    RUN_TESTp(edits_should_only_send_changed_chunks, 0, 0, 1);
+    RUN_TESTp(edits_should_only_send_changed_chunks, SZ, 0, 5000);
+    RUN_TEST(empty_data_should_sync);
+    RUN_TEST(bad_deltas_should_be_rejected);
+}
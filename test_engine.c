@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "hashchop.h"
+#include "hashchop_internal.h"
+#include "greatest.h"
+#include "test.h"
+
+typedef unsigned char UC;
+
+#define SZ (4 * 1024 * 1024)
+
+static const hashchop_engine *engines[] = {
+    &hashchop_engine_rsync, &hashchop_engine_rabin, &hashchop_engine_buzhash,
+};
+#define ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+/* Find the ends of all the chunks in LEN bytes of DATA, as offsets
+ * into ENDS (which has room for LEN), and return how many. */
+static size_t all_seams(hashchop *hc, const UC *data, size_t len,
+        size_t *ends) {
+    return hashchop_seams(hc, data, len, ends, len);
+}
+
+/* Not for rsync: its rolled sums also depend on where it started. */
+TEST rolling_should_match_hashing_the_window() {
+    UC buf[8192];
+    mkrandom(1, buf, sizeof(buf));
+    for (size_t e = 1; e < ENGINES; e++) {
+        const hashchop_engine *eng = engines[e];
+        size_t w = eng->window(1024);
+        uint64_t h = eng->init(buf, w);
+        for (size_t i = w; i < sizeof(buf); i++) {
+            h = eng->roll(h, w, buf[i - w], buf[i]);
+            if (h != eng->init(buf + i - w + 1, w)) {
+                fprintf(stderr, "%s: rolled hash differs at %zu\n",
+                    eng->name, i);
+                FAIL();
+            }
+        }
+    }
+    PASS();
+}
+
+TEST rabin_should_be_the_window_mod_the_polynomial() {
+    const uint64_t pol = 0x3DA3358B4DC173ULL;
+    UC buf[64];
+    for (unsigned int seed = 0; seed < 100; seed++) {
+        uint64_t h = 0;
+        mkrandom(seed, buf, sizeof(buf));
+        /* Long division, a bit at a time. */
+        for (size_t i = 0; i < sizeof(buf); i++) {
+            for (int bit = 7; bit >= 0; bit--) {
+                h = (h << 1) | ((buf[i] >> bit) & 1);
+                if (h & (1ULL << 53)) h ^= pol;
+            }
+        }
+        ASSERT_EQ(h, hashchop_engine_rabin.init(buf, sizeof(buf)));
+    }
+    PASS();
+}
+
+TEST batch_scans_should_match_rolling() {
+    UC *data = malloc(SZ);
+    mkrandom(2, data, SZ);
+    for (size_t e = 0; e < ENGINES; e++) {
+        for (int bits = HASHCHOP_MIN_BITS; bits <= 16; bits += 2) {
+            hashchop *hc = hashchop_new_engine(bits, engines[e]);
+            hashchop *lhc = hashchop_new_engine(bits, engines[e]);
+            ASSERT(hc && lhc);
+            hashchop_set_generic_scan(lhc, 1);
+            /* The rsync kernels' levels come from the checksum, not the
+             * rolling hash, so only compare the others' levels. */
+            int levels = (engines[e] == &hashchop_engine_rsync ? 1 : 4);
+            hashchop_set_levels(hc, levels);
+            hashchop_set_levels(lhc, levels);
+            for (size_t pos = 0; pos < SZ; ) {
+                uint8_t level = 0, llevel = 0;
+                size_t cut = hashchop_seam_level(hc, data + pos, SZ - pos,
+                    &level);
+                size_t lcut = hashchop_seam_level(lhc, data + pos, SZ - pos,
+                    &llevel);
+                if (cut != lcut || level != llevel) {
+                    fprintf(stderr, "%s, bits %d at %zu: %zu/%u vs. %zu/%u\n",
+                        engines[e]->name, bits, pos, cut, level, lcut, llevel);
+                    FAIL();
+                }
+                pos += cut;
+            }
+            hashchop_free(hc);
+            hashchop_free(lhc);
+        }
+    }
+    free(data);
+    PASS();
+}
+
+TEST engines_should_give_chunks_of_about_the_average_size() {
+    UC *data = malloc(SZ);
+    size_t *ends = malloc(SZ * sizeof(size_t));
+    mkrandom(3, data, SZ);
+    for (size_t e = 0; e < ENGINES; e++) {
+        hashchop *hc = hashchop_new_engine(12, engines[e]);
+        size_t n = all_seams(hc, data, SZ, ends);
+        if (GREATEST_IS_VERBOSE()) {
+            printf("%s: %zu chunks, %zu avg\n", engines[e]->name, n, SZ / n);
+        }
+        /* min + 2^bits, less the chunks cut at the max */
+        ASSERT(SZ / n > 4000 && SZ / n < 6000);
+        hashchop_free(hc);
+    }
+    free(data);
+    free(ends);
+    PASS();
+}
+
+TEST engine_chunks_should_resync_after_an_insert() {
+    size_t off = SZ / 4, ins = 100;
+    UC *old = malloc(SZ), *new = malloc(SZ + ins);
+    size_t *old_ends = malloc(SZ * sizeof(size_t));
+    size_t *new_ends = malloc((SZ + ins) * sizeof(size_t));
+    mkrandom(4, old, SZ);
+    memcpy(new, old, off);
+    mkrandom(5, new + off, ins);
+    memcpy(new + off + ins, old + off, SZ - off);
+    for (size_t e = 1; e < ENGINES; e++) {
+        hashchop *hc = hashchop_new_engine(12, engines[e]);
+        size_t on = all_seams(hc, old, SZ, old_ends);
+        size_t nn = all_seams(hc, new, SZ + ins, new_ends);
+        size_t shared = 0, j = 0;
+        for (size_t i = 0; i < on; i++) {
+            size_t end = old_ends[i] + (old_ends[i] > off ? ins : 0);
+            while (j < nn && new_ends[j] < end) j++;
+            shared += (j < nn && new_ends[j] == end);
+        }
+        /* All but the few around the insert. */
+        ASSERT(shared + 4 >= on);
+        hashchop_free(hc);
+    }
+    free(old); free(new); free(old_ends); free(new_ends);
+    PASS();
+}
+
+static size_t big_window(size_t min) { return min + 1; }
+
+TEST engines_should_be_chosen_at_construction() {
+    UC *data = malloc(SZ);
+    size_t *ends = malloc(SZ * sizeof(size_t));
+    size_t *rends = malloc(SZ * sizeof(size_t));
+    mkrandom(6, data, SZ);
+
+    hashchop *hc = hashchop_new(12);
+    hashchop *rhc = hashchop_new_engine(12, &hashchop_engine_rsync);
+    ASSERT_EQ(&hashchop_engine_rsync, hashchop_get_engine(hc));
+    size_t n = all_seams(hc, data, SZ, ends);
+    ASSERT_EQ(n, all_seams(rhc, data, SZ, rends));
+    ASSERT_EQ(0, memcmp(ends, rends, n * sizeof(size_t)));
+    hashchop_free(hc);
+    hashchop_free(rhc);
+
+    /* Sinking and polling gives the same chunks as seams. */
+    hc = hashchop_new_engine(12, &hashchop_engine_buzhash);
+    ASSERT_EQ(&hashchop_engine_buzhash, hashchop_get_engine(hc));
+    n = all_seams(hc, data, SZ, ends);
+    size_t max = hashchop_max_chunk(hc), pos = 0, i = 0;
+    for (size_t off = 0; off < SZ; off += max) {
+        const UC *chunk = NULL;
+        size_t len = 0;
+        ASSERT_EQ(HASHCHOP_OK, hashchop_sink(hc, data + off, max));
+        while (HASHCHOP_OK == hashchop_poll_view(hc, &chunk, &len)) {
+            pos += len;
+            ASSERT_EQ(ends[i++], pos);
+        }
+    }
+    const UC *chunk = NULL;
+    size_t len = 0;
+    hashchop_finish_view(hc, &chunk, &len);
+    ASSERT_EQ(SZ, pos + len);
+    ASSERT_EQ(n, i + (len > 0));
+    hashchop_free(hc);
+
+    hashchop_engine bad = hashchop_engine_rabin;
+    bad.window = big_window;
+    ASSERT_EQ(NULL, hashchop_new_engine(12, &bad));
+    free(data); free(ends); free(rends);
+    PASS();
+}
+
+SUITE(engine_suite) {
+    RUN_TEST(rolling_should_match_hashing_the_window);
+    RUN_TEST(rabin_should_be_the_window_mod_the_polynomial);
+    RUN_TEST(batch_scans_should_match_rolling);
+    RUN_TEST(engines_should_give_chunks_of_about_the_average_size);
+    RUN_TEST(engine_chunks_should_resync_after_an_insert);
+    RUN_TEST(engines_should_be_chosen_at_construction);
+}
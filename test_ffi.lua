@@ -0,0 +1,87 @@
+require "lunatest"
+require "hashchop"
+local ffi = require "ffi"
+local hffi = require "hashchop_ffi"
+
+-- Check the LuaJIT FFI module against the hashchop.so binding.
+
+local function random_string(len)
+    math.randomseed(1)
+    local t = {}
+    for i = 1, len do t[i] = string.char(math.random(0, 255)) end
+    return table.concat(t)
+end
+
+local data = random_string(1000000)
+local buf = ffi.new("uint8_t[?]", #data)
+ffi.copy(buf, data, #data)
+
+function test_ffi_seams_should_match_the_binding()
+    for _, bits in ipairs({ 8, 10, 12, 16 }) do
+        local expect = hashchop.new(bits):seams(data)
+        local h = hffi.new(bits)
+        -- A small ends array, so the loop has to resume.
+        local ends, max = hffi.ends(16), 16
+        local n, pos = 0, 0
+        repeat
+            local ct = h:seams(buf + pos, #data - pos, ends, max)
+            for i = 0, ct - 1 do
+                n = n + 1
+                assert_equal(expect[n], pos + tonumber(ends[i]))
+            end
+            pos = pos + tonumber(ends[ct - 1])
+        until ct < max or pos == #data
+        assert_equal(#expect, n)
+    end
+end
+
+function test_ffi_views_should_match_the_binding_chunks()
+    local h, ch = hffi.new(12), hashchop.new(12)
+    local chunks = ch:push(data)
+    chunks[#chunks + 1] = ch:finish()
+    local max, pos, n = h:max_chunk(), 0, 0
+    while pos < #data do
+        local piece = math.min(max, #data - pos)
+        assert_equal(hffi.OK, h:sink(buf + pos, piece))
+        pos = pos + piece
+        while true do
+            local p, len = h:poll_view()
+            if p == nil then
+                assert_equal(hffi.UNDERFLOW, len)
+                break
+            end
+            n = n + 1
+            assert_equal(chunks[n], ffi.string(p, len))
+        end
+    end
+    local p, len = h:finish_view()
+    n = n + 1
+    assert_equal(chunks[n], ffi.string(p, len))
+    assert_equal(#chunks, n)
+end
+
+function test_ffi_poll_should_copy_the_chunk()
+    local h = hffi.new(10)
+    local out = ffi.new("uint8_t[?]", h:max_chunk())
+    assert_equal(hffi.OVERFLOW, h:sink(buf, h:max_chunk() + 1))
+    assert_equal(hffi.OK, h:sink(buf, h:max_chunk()))
+    local len = h:poll(out, h:max_chunk())
+    assert_equal(hashchop.new(10):seams(data:sub(1, h:max_chunk()))[1], len)
+    assert_equal(data:sub(1, len), ffi.string(out, len))
+    assert_nil(hffi.new(99))
+    assert_true(hffi.fingerprint(buf, 100) ~= hffi.fingerprint(buf + 1, 100))
+end
+
+function test_ffi_new_should_reject_bits_that_would_wrap()
+    -- As a uint8_t, 264 would be 8, and -248 would be 8.
+    for _, bits in ipairs({ 7, 31, 99, 264, -248 }) do
+        local h, err = hffi.new(bits)
+        assert_nil(h)
+        assert_equal("Bad bits argument.", err)
+        assert_equal(err, select(2, hashchop.new(bits)))
+    end
+    assert_false(pcall(hffi.new, "twelve"))
+    assert_false(pcall(hashchop.new, "twelve"))
+end
+
+lunatest.run()
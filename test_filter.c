@@ -0,0 +1,94 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hashchop.h"
+#include "hashchop_filter.h"
+#include "greatest.h"
+#include "test.h"
+
+static char filter_path[64];
+static char *paths[] = { filter_path, NULL };
+
+TEST a_filter_should_never_report_an_added_fingerprint_as_new() {
+    hashchop_filter *f = hashchop_filter_new(10000, 0);
+    ASSERT(f);
+    for (int i = 0; i < 10000; i++) hashchop_filter_add(f, fp_of(i));
+    for (int i = 0; i < 10000; i++) ASSERT(hashchop_filter_check(f, fp_of(i)));
+    ASSERT_EQ(10000, hashchop_filter_count(f));
+    hashchop_filter_free(f);
+    PASS();
+}
+
+TEST a_filter_at_capacity_should_have_a_low_false_positive_rate(int bits) {
+    const int count = 100000;
+    hashchop_filter *f = hashchop_filter_new(count, bits);
+    ASSERT(f);
+    for (int i = 0; i < count; i++) hashchop_filter_add(f, fp_of(i));
+    int fp_ct = 0;
+    for (int i = count; i < 2 * count; i++) {
+        fp_ct += hashchop_filter_check(f, fp_of(i));
+    }
+    double rate = fp_ct / (double)count;
+    if (GREATEST_IS_VERBOSE()) {
+        printf("%d bits/entry: false positive rate %.4f\n", bits, rate);
+    }
+    /* A standard Bloom filter would get about 2^(-0.48 * bits) (0.717
+     * per bit); blocking costs a little on top of that. */
+    double expected = 1.0;
+    for (int i = 0; i < bits; i++) expected *= 0.717;
+    ASSERT(rate < 2.0 * expected);
+    hashchop_filter_free(f);
+    PASS();
+}
+
+TEST a_saved_filter_should_map_back_with_the_same_contents() {
+    hashchop_filter *f = hashchop_filter_new(5000, 0);
+    ASSERT(f);
+    for (int i = 0; i < 5000; i++) hashchop_filter_add(f, fp_of(i));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_filter_save(f, filter_path));
+
+    hashchop_filter *m = hashchop_filter_map(filter_path);
+    ASSERT(m);
+    ASSERT_EQ(5000, hashchop_filter_count(m));
+    ASSERT_EQ(5000, hashchop_filter_capacity(m));
+    for (int i = 0; i < 10000; i++) {
+        ASSERT_EQ(hashchop_filter_check(f, fp_of(i)),
+            hashchop_filter_check(m, fp_of(i)));
+    }
+
+    /* adding to a mapped filter doesn't change the file */
+    for (int i = 5000; i < 6000; i++) hashchop_filter_add(m, fp_of(i));
+    hashchop_filter *m2 = hashchop_filter_map(filter_path);
+    ASSERT(m2);
+    ASSERT_EQ(5000, hashchop_filter_count(m2));
+    hashchop_filter_free(m2);
+    hashchop_filter_free(m);
+    hashchop_filter_free(f);
+    PASS();
+}
+
+TEST mapping_a_missing_or_invalid_filter_should_fail() {
+    ASSERT_EQ(NULL, hashchop_filter_map(filter_path));
+    FILE *out = fopen(filter_path, "wb");
+    ASSERT(out);
+    fprintf(out, "not a filter");
+    fclose(out);
+    ASSERT_EQ(NULL, hashchop_filter_map(filter_path));
+    PASS();
+}
+
+SUITE(filter_suite) {
+    tmp_path(filter_path, sizeof(filter_path), "filter");
+    remove_paths(paths);
+    SET_SUITE_TEARDOWN(remove_paths, paths);
+
+    RUN_TEST(a_filter_should_never_report_an_added_fingerprint_as_new);
+    for (int bits = 8; bits <= 16; bits += 4) {
+        RUN_TESTp(a_filter_at_capacity_should_have_a_low_false_positive_rate, bits);
+    }
+    RUN_TEST(a_saved_filter_should_map_back_with_the_same_contents);
+    RUN_TEST(mapping_a_missing_or_invalid_filter_should_fail);
+}
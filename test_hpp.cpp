@@ -0,0 +1,174 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ranges>
+#include <vector>
+
+#include "hashchop.hpp"
+#include "greatest.h"
+
+typedef unsigned char UC;
+
+#define SZ (4 * 1024 * 1024)
+
+static void fill(unsigned int seed, UC *buf, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        seed = 1103515245 * seed + 12345;
+        buf[i] = seed >> 16;
+    }
+}
+
+/* Random data, zeros (every cut forced), and log-like text. */
+static void make_data(int profile, UC *buf, size_t len) {
+    switch (profile) {
+    case 0: fill(1, buf, len); break;
+    case 1: memset(buf, 0, len); break;
+    default:
+        for (size_t i = 0; i < len; ) {
+            i += snprintf((char *)buf + i, len - i,
+                "%zu GET /item/%zu HTTP/1.1 200\n", i, (i * 7919) % 1000);
+        }
+        break;
+    }
+}
+
+static hashchop_cpp::bytes as_bytes(const UC *buf, size_t len) {
+    return hashchop_cpp::bytes(reinterpret_cast<const std::byte *>(buf), len);
+}
+
+static_assert(std::ranges::forward_range<hashchop_cpp::chunk_range<
+    hashchop_cpp::rsync, hashchop_cpp::config<12>>>);
+
+/* Check that ENGINE and BITS give the same chunks as the C core for
+ * PROFILE's data, both in place and streamed through sink/poll. */
+template <class Engine, uint8_t BITS>
+static int same_chunks_for(int profile) {
+    using chopper = hashchop_cpp::chopper<Engine, hashchop_cpp::config<BITS>>;
+    UC *buf = (UC *)malloc(SZ);
+    make_data(profile, buf, SZ);
+    hashchop *hc = hashchop_new_engine(BITS, Engine::c_engine());
+    std::vector<size_t> ends(SZ);
+    size_t n = hashchop_seams(hc, buf, SZ, ends.data(), ends.size());
+    hashchop_free(hc);
+
+    size_t i = 0, pos = 0;
+    for (hashchop_cpp::bytes c : chopper::chunks(as_bytes(buf, SZ))) {
+        if (i >= n || c.data() != as_bytes(buf, SZ).data() + pos
+            || pos + c.size() != ends[i]) {
+            fprintf(stderr, "chunk %zu at %zu differs\n", i, pos);
+            FAIL();
+        }
+        pos += c.size();
+        i++;
+    }
+    ASSERT_EQ(n, i);
+    ASSERT_EQ((size_t)SZ, pos);
+
+    chopper ch;
+    ASSERT_EQ(Engine::c_engine(), hashchop_get_engine(ch.get()));
+    hashchop_cpp::bytes c;
+    size_t step = chopper::max_chunk() / 3;
+    i = 0;
+    pos = 0;
+    for (size_t off = 0; off < SZ; off += step) {
+        size_t len = (SZ - off < step ? SZ - off : step);
+        ASSERT_EQ(HASHCHOP_OK, ch.sink(as_bytes(buf + off, len)));
+        while (ch.poll(c)) {
+            ASSERT(i < n);
+            ASSERT_EQ(ends[i] - pos, c.size());
+            ASSERT_EQ(0, memcmp(c.data(), buf + pos, c.size()));
+            pos = ends[i++];
+        }
+    }
+    c = ch.finish();
+    ASSERT_EQ((size_t)SZ - pos, c.size());
+    ASSERT_EQ(0, memcmp(c.data(), buf + pos, c.size()));
+    free(buf);
+    PASS();
+}
+
+/* (greatest's RUN_TESTp needs C99 varargs macros, so loop here.) */
+template <class Engine, uint8_t BITS>
+TEST same_chunks() {
+    for (int profile = 0; profile < 3; profile++) {
+        int res = same_chunks_for<Engine, BITS>(profile);
+        if (res != 0) return res;
+    }
+    PASS();
+}
+
+TEST empty_input_should_have_no_chunks() {
+    hashchop_cpp::chopper<> ch;
+    UC *b = (UC *)calloc(1, ch.max_chunk());
+    ASSERT(ch.chunks(as_bytes(b, 0)).begin() == std::default_sentinel);
+    ASSERT_EQ(0u, ch.finish().size());
+
+    size_t ct = 0;
+    for (hashchop_cpp::bytes c : ch.chunks(as_bytes(b, 1))) ct += c.size();
+    ASSERT_EQ(1u, ct);
+    free(b);
+    PASS();
+}
+
+TEST moved_chopper_should_own_the_handle() {
+    hashchop_cpp::chopper<> a;
+    hashchop *h = a.get();
+    hashchop_cpp::chopper<> b(std::move(a));
+    ASSERT_EQ(h, b.get());
+    ASSERT_EQ(nullptr, a.get());
+    a = std::move(b);
+    ASSERT_EQ(h, a.get());
+    PASS();
+}
+
+static size_t wide_window(size_t min) { return min + 1; }
+static const hashchop_engine wide_engine = {
+    "wide", wide_window, hashchop_engine_rabin.init,
+    hashchop_engine_rabin.roll, hashchop_engine_rabin.is_boundary, nullptr,
+};
+struct wide : hashchop_cpp::c_engine_tag<&wide_engine> {};
+
+/* Rabin without its batch scan, so seams are found by rolling. */
+static const hashchop_engine rolled_engine = {
+    "rolled", hashchop_engine_rabin.window, hashchop_engine_rabin.init,
+    hashchop_engine_rabin.roll, hashchop_engine_rabin.is_boundary, nullptr,
+};
+struct rolled : hashchop_cpp::c_engine_tag<&rolled_engine> {};
+
+TEST engines_should_fit_the_min_chunk() {
+    bool thrown = false;
+    try {
+        hashchop_cpp::chopper<wide> ch;
+    } catch (const std::invalid_argument &) {
+        thrown = true;
+    }
+    ASSERT(thrown);
+    PASS();
+}
+
+SUITE(hpp_suite) {
+    using namespace hashchop_cpp;
+    RUN_TEST((same_chunks<rsync, 8>));
+    RUN_TEST((same_chunks<rsync, 10>));
+    RUN_TEST((same_chunks<rsync, 12>));
+    RUN_TEST((same_chunks<rsync, 16>));
+    RUN_TEST((same_chunks<rsync, 20>));
+    RUN_TEST((same_chunks<rabin, 8>));
+    RUN_TEST((same_chunks<rabin, 12>));
+    RUN_TEST((same_chunks<rabin, 16>));
+    RUN_TEST((same_chunks<buzhash, 8>));
+    RUN_TEST((same_chunks<buzhash, 12>));
+    RUN_TEST((same_chunks<buzhash, 16>));
+    RUN_TEST((same_chunks<rolled, 12>));
+    RUN_TEST(engines_should_fit_the_min_chunk);
+    RUN_TEST(empty_input_should_have_no_chunks);
+    RUN_TEST(moved_chopper_should_own_the_handle);
+}
+
+GREATEST_MAIN_DEFS();
+
+int main(int argc, char **argv) {
+    GREATEST_MAIN_BEGIN();
+    RUN_SUITE(hpp_suite);
+    GREATEST_MAIN_END();
+}
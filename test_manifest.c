@@ -0,0 +1,252 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hashchop.h"
+#include "hashchop_manifest.h"
+#include "greatest.h"
+#include "test.h"
+
+typedef unsigned char UC;
+
+#define SZ (4 * 1024 * 1024)
+
+static char manifest_path[64];
+static char *paths[] = { manifest_path, NULL };
+
+/* Chop LEN bytes of DATA, and return a writer with its chunks. Writes
+ * the chunk count in (*COUNT) and their ends in ENDS, if non-NULL. */
+static hashchop_manifest_writer *chop_into_manifest(const UC *data,
+        size_t len, size_t *ends, size_t *count) {
+    hashchop *hc = hashchop_new(12);
+    size_t *e = ends ? ends : malloc(len * sizeof(size_t));
+    size_t n = hashchop_seams(hc, data, len, e, len);
+    hashchop_manifest_writer *w = hashchop_manifest_writer_new(12);
+    for (size_t i = 0, pos = 0; i < n; i++) {
+        hashchop_manifest_add(w, e[i] - pos,
+            hashchop_fingerprint(data + pos, e[i] - pos));
+        pos = e[i];
+    }
+    if (ends == NULL) free(e);
+    hashchop_free(hc);
+    if (count) *count = n;
+    return w;
+}
+
+/* Encode W into a new buffer, and write its size in (*LEN). */
+static UC *encode(hashchop_manifest_writer *w, size_t *len) {
+    *len = hashchop_manifest_size(w);
+    UC *buf = malloc(*len);
+    if (hashchop_manifest_encode(w, buf, len) != HASHCHOP_OK) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+TEST a_manifest_should_list_the_chunks_in_order() {
+    UC *data = malloc(SZ);
+    size_t *ends = malloc(SZ * sizeof(size_t));
+    size_t n = 0, len = 0;
+    mkrandom(1, data, SZ);
+    hashchop_manifest_writer *w = chop_into_manifest(data, SZ, ends, &n);
+    UC *buf = encode(w, &len);
+    ASSERT(buf);
+    ASSERT_EQ(24 + 12 * n + 8 * ((n + 63) / 64), len);
+
+    hashchop_manifest *m = hashchop_manifest_open(buf, len);
+    ASSERT(m);
+    ASSERT_EQ(n, hashchop_manifest_count(m));
+    ASSERT_EQ(SZ, hashchop_manifest_length(m));
+    ASSERT_EQ(12, hashchop_manifest_bits(m));
+    hashchop_manifest_entry e;
+    for (size_t i = 0, pos = 0; i < n; i++) {
+        ASSERT_EQ(HASHCHOP_OK, hashchop_manifest_get(m, i, &e));
+        if (e.offset != pos || e.length != ends[i] - pos
+            || e.fp != hashchop_fingerprint(data + pos, e.length)) {
+            fprintf(stderr, "chunk %zu differs\n", i);
+            FAIL();
+        }
+        pos = ends[i];
+    }
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_manifest_get(m, n, &e));
+
+    hashchop_manifest_free(m);
+    hashchop_manifest_writer_free(w);
+    free(buf); free(data); free(ends);
+    PASS();
+}
+
+TEST find_should_get_the_chunk_holding_an_offset() {
+    UC *data = malloc(SZ);
+    size_t *ends = malloc(SZ * sizeof(size_t));
+    size_t n = 0, len = 0, i = 0;
+    mkrandom(2, data, SZ);
+    hashchop_manifest_writer *w = chop_into_manifest(data, SZ, ends, &n);
+    UC *buf = encode(w, &len);
+    hashchop_manifest *m = hashchop_manifest_open(buf, len);
+    ASSERT(m);
+    hashchop_manifest_entry e;
+
+    /* Both sides of every boundary. */
+    for (size_t c = 0, pos = 0; c < n; c++) {
+        ASSERT_EQ(HASHCHOP_OK, hashchop_manifest_find(m, pos, &i, &e));
+        ASSERT_EQ(c, i);
+        ASSERT_EQ(pos, e.offset);
+        ASSERT_EQ(HASHCHOP_OK, hashchop_manifest_find(m, ends[c] - 1, &i, NULL));
+        ASSERT_EQ(c, i);
+        pos = ends[c];
+    }
+
+    unsigned int seed = 3;
+    for (int t = 0; t < 10000; t++) {
+        seed = 1103515245 * seed + 12345;
+        uint64_t off = seed % SZ;
+        ASSERT_EQ(HASHCHOP_OK, hashchop_manifest_find(m, off, &i, &e));
+        ASSERT(e.offset <= off && off < e.offset + e.length);
+        ASSERT_EQ(ends[i], e.offset + e.length);
+    }
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_manifest_find(m, SZ, &i, &e));
+
+    hashchop_manifest_free(m);
+    hashchop_manifest_writer_free(w);
+    free(buf); free(data); free(ends);
+    PASS();
+}
+
+TEST empty_chunks_should_be_skipped_by_find() {
+    hashchop_manifest_writer *w = hashchop_manifest_writer_new(12);
+    /* 200 chunks, every third one empty, so some index runs start with
+     * an empty chunk. */
+    for (int i = 0; i < 200; i++) {
+        ASSERT_EQ(HASHCHOP_OK,
+            hashchop_manifest_add(w, (i % 3 == 0 ? 0 : 10), i));
+    }
+    size_t len = 0, i = 0;
+    UC *buf = encode(w, &len);
+    hashchop_manifest *m = hashchop_manifest_open(buf, len);
+    ASSERT(m);
+    hashchop_manifest_entry e;
+    for (uint64_t off = 0; off < hashchop_manifest_length(m); off++) {
+        ASSERT_EQ(HASHCHOP_OK, hashchop_manifest_find(m, off, &i, &e));
+        ASSERT_EQ(10, e.length);
+        ASSERT(e.offset <= off && off < e.offset + 10);
+    }
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_manifest_add(w,
+            (size_t)UINT32_MAX + 1, 0));
+    hashchop_manifest_free(m);
+    hashchop_manifest_writer_free(w);
+    free(buf);
+    PASS();
+}
+
+TEST a_saved_manifest_should_map_back_with_the_same_contents() {
+    UC *data = malloc(SZ);
+    size_t n = 0, len = 0;
+    mkrandom(4, data, SZ);
+    hashchop_manifest_writer *w = chop_into_manifest(data, SZ, NULL, &n);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_manifest_save(w, manifest_path));
+    UC *buf = encode(w, &len);
+    hashchop_manifest *m = hashchop_manifest_open(buf, len);
+    hashchop_manifest *mm = hashchop_manifest_map(manifest_path);
+    ASSERT(m && mm);
+    ASSERT_EQ(n, hashchop_manifest_count(mm));
+    ASSERT_EQ(SZ, hashchop_manifest_length(mm));
+    for (size_t i = 0; i < n; i++) {
+        hashchop_manifest_entry a, b;
+        ASSERT_EQ(HASHCHOP_OK, hashchop_manifest_get(m, i, &a));
+        ASSERT_EQ(HASHCHOP_OK, hashchop_manifest_get(mm, i, &b));
+        ASSERT(a.offset == b.offset && a.length == b.length && a.fp == b.fp);
+    }
+    hashchop_manifest_free(m);
+    hashchop_manifest_free(mm);
+    hashchop_manifest_writer_free(w);
+    free(buf); free(data);
+    PASS();
+}
+
+static void count_new(size_t i, const hashchop_manifest_entry *e,
+        void *udata) {
+    (void)i;
+    *(uint64_t *)udata += e->length;
+}
+
+TEST a_diff_should_only_have_the_edited_chunks() {
+    size_t off = SZ / 2, ins = 100, olen = 0, nlen = 0;
+    UC *old = malloc(SZ), *new = malloc(SZ + ins);
+    mkrandom(5, old, SZ);
+    memcpy(new, old, off);
+    mkrandom(6, new + off, ins);
+    memcpy(new + off + ins, old + off, SZ - off);
+    hashchop_manifest_writer *ow = chop_into_manifest(old, SZ, NULL, NULL);
+    hashchop_manifest_writer *nw = chop_into_manifest(new, SZ + ins, NULL,
+        NULL);
+    UC *obuf = encode(ow, &olen), *nbuf = encode(nw, &nlen);
+    hashchop_manifest *om = hashchop_manifest_open(obuf, olen);
+    hashchop_manifest *nm = hashchop_manifest_open(nbuf, nlen);
+    ASSERT(om && nm);
+
+    hashchop_manifest_diff_stats st;
+    uint64_t cb_bytes = 0;
+    ASSERT_EQ(HASHCHOP_OK, hashchop_manifest_diff(om, nm, count_new,
+            &cb_bytes, &st));
+    ASSERT_EQ(hashchop_manifest_count(nm), st.shared_chunks + st.new_chunks);
+    ASSERT_EQ(SZ + ins, st.shared_bytes + st.new_bytes);
+    ASSERT_EQ(cb_bytes, st.new_bytes);
+    ASSERT(st.new_chunks >= 1 && st.new_chunks <= 3);
+
+    /* Against itself, nothing is new. */
+    ASSERT_EQ(HASHCHOP_OK, hashchop_manifest_diff(om, om, NULL, NULL, &st));
+    ASSERT_EQ(0, st.new_chunks);
+    ASSERT_EQ(SZ, st.shared_bytes);
+
+    hashchop_manifest_free(om); hashchop_manifest_free(nm);
+    hashchop_manifest_writer_free(ow); hashchop_manifest_writer_free(nw);
+    free(obuf); free(nbuf); free(old); free(new);
+    PASS();
+}
+
+TEST malformed_manifests_should_be_rejected() {
+    hashchop_manifest_writer *w = hashchop_manifest_writer_new(12);
+    for (int i = 0; i < 100; i++) hashchop_manifest_add(w, 1000 + i, i);
+    size_t len = hashchop_manifest_size(w), small = len - 1;
+    UC *buf = malloc(len);
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW,
+        hashchop_manifest_encode(w, buf, &small));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_manifest_encode(w, buf, &len));
+
+    hashchop_manifest *m = hashchop_manifest_open(buf, len);
+    ASSERT(m);
+    hashchop_manifest_free(m);
+    ASSERT_EQ(NULL, hashchop_manifest_open(buf, len - 1));
+    ASSERT_EQ(NULL, hashchop_manifest_open(buf, 10));
+    buf[0] ^= 1;                /* magic */
+    ASSERT_EQ(NULL, hashchop_manifest_open(buf, len));
+    buf[0] ^= 1;
+    buf[4]++;                   /* version */
+    ASSERT_EQ(NULL, hashchop_manifest_open(buf, len));
+    buf[4]--;
+    buf[15] = 0xff;             /* count */
+    ASSERT_EQ(NULL, hashchop_manifest_open(buf, len));
+
+    remove_paths(paths);
+    ASSERT_EQ(NULL, hashchop_manifest_map(manifest_path));
+    hashchop_manifest_writer_free(w);
+    free(buf);
+    PASS();
+}
+
+SUITE(manifest_suite) {
+    tmp_path(manifest_path, sizeof(manifest_path), "manifest");
+    remove_paths(paths);
+    SET_SUITE_TEARDOWN(remove_paths, paths);
+
+    RUN_TEST(a_manifest_should_list_the_chunks_in_order);
+    RUN_TEST(find_should_get_the_chunk_holding_an_offset);
+    RUN_TEST(empty_chunks_should_be_skipped_by_find);
+    RUN_TEST(a_saved_manifest_should_map_back_with_the_same_contents);
+    RUN_TEST(a_diff_should_only_have_the_edited_chunks);
+    RUN_TEST(malformed_manifests_should_be_rejected);
+}
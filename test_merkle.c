@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "hashchop.h"
+#include "hashchop_merkle.h"
+#include "hashchop_rechunk.h"
+#include "greatest.h"
+#include "test.h"
+
+typedef unsigned char UC;
+
+static hashchop_fp next_fp(unsigned long long *state) {
+    /* xorshift64* */
+    unsigned long long x = *state;
+    x ^= x >> 12; x ^= x << 25; x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+/* Build the tree for N LEAVES the slow way, straight from the definition,
+ * and return the root. */
+static hashchop_fp reference_root(uint8_t bits, const hashchop_fp *leaves,
+                                  size_t n) {
+    size_t max_fanout = 4 << bits, mask = (1 << bits) - 1;
+    hashchop_fp *cur = malloc(n * sizeof(*cur));
+    UC *buf = malloc(1 + 8 * max_fanout);
+    assert(cur && buf);
+    memcpy(cur, leaves, n * sizeof(*cur));
+    for (int level = 1; n > 1; level++) {
+        size_t out = 0, start = 0;
+        for (size_t i = 0; i < n; i++) {
+            size_t ct = i + 1 - start;
+            if (((cur[i] >> 40) & mask) == 0 || ct == max_fanout || i == n - 1) {
+                buf[0] = level;
+                for (size_t c = 0; c < ct; c++) {
+                    hashchop_fp fp = cur[start + c];
+                    for (int b = 0; b < 8; b++) buf[1 + 8*c + b] = fp >> (8*b);
+                }
+                cur[out++] = hashchop_fingerprint(buf, 1 + 8 * ct);
+                start = i + 1;
+            }
+        }
+        n = out;
+    }
+    hashchop_fp root = cur[0];
+    free(cur); free(buf);
+    return root;
+}
+
+static hashchop_merkle *build(uint8_t bits, const hashchop_fp *leaves,
+                              size_t n, hashchop_fp *root) {
+    hashchop_merkle *m = hashchop_merkle_new(bits);
+    assert(m);
+    for (size_t i = 0; i < n; i++) {
+        assert(HASHCHOP_OK == hashchop_merkle_add(m, leaves[i]));
+    }
+    assert(HASHCHOP_OK == hashchop_merkle_finish(m, root));
+    return m;
+}
+
+TEST streamed_tree_should_match_definition(uint8_t bits) {
+    static const size_t sizes[] = { 1, 2, 3, 17, 100, 1000, 54321 };
+    unsigned long long st = 88172645463325252ULL;
+    hashchop_fp *leaves = malloc(54321 * sizeof(*leaves));
+    for (size_t i = 0; i < 54321; i++) leaves[i] = next_fp(&st);
+
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+        hashchop_fp root = 0;
+        hashchop_merkle *m = build(bits, leaves, sizes[s], &root);
+        ASSERT_EQ(reference_root(bits, leaves, sizes[s]), root);
+        ASSERT_EQ(sizes[s], hashchop_merkle_count(m, 0));
+        ASSERT_EQ(1, hashchop_merkle_count(m, hashchop_merkle_levels(m) - 1));
+        if (sizes[s] == 1) ASSERT_EQ(leaves[0], root);
+        hashchop_merkle_free(m);
+    }
+    free(leaves);
+    PASS();
+}
+
+TEST updates_should_match_rebuilding(uint8_t bits) {
+    size_t n = 20000, cap = 40000;
+    unsigned long long st = 1234567;
+    hashchop_fp *leaves = malloc(cap * sizeof(*leaves));
+    hashchop_fp ins[64];
+    for (size_t i = 0; i < n; i++) leaves[i] = next_fp(&st);
+    hashchop_fp root = 0;
+    hashchop_merkle *m = build(bits, leaves, n, &root);
+    size_t total = 0;
+    for (size_t l = 0; l < hashchop_merkle_levels(m); l++) {
+        total += hashchop_merkle_count(m, l);
+    }
+
+    for (int round = 0; round < 200; round++) {
+        size_t first, removed, added;
+        switch (round % 5) {
+        case 0: first = 0; break;       /* at the start */
+        case 1: first = n; break;       /* append */
+        default: first = next_fp(&st) % n; break;
+        }
+        removed = next_fp(&st) % 8;
+        if (first + removed > n) removed = n - first;
+        added = next_fp(&st) % 8;
+        for (size_t i = 0; i < added; i++) ins[i] = next_fp(&st);
+
+        memmove(leaves + first + added, leaves + first + removed,
+            (n - first - removed) * sizeof(*leaves));
+        memcpy(leaves + first, ins, added * sizeof(*leaves));
+        n = n - removed + added;
+
+        size_t rehashed = 0;
+        ASSERT_EQ(HASHCHOP_OK, hashchop_merkle_update(m, first, removed,
+                ins, added, &root, &rehashed));
+        ASSERT_EQ(n, hashchop_merkle_count(m, 0));
+        if (root != reference_root(bits, leaves, n)) {
+            fprintf(stderr, "round %d: mismatch after update at %zu\n",
+                round, first);
+            FAIL();
+        }
+        /* Only the changed paths, with some slack for re-syncing. */
+        ASSERT(rehashed < total / 20);
+    }
+    hashchop_merkle_free(m);
+    free(leaves);
+    PASS();
+}
+
+TEST growing_and_shrinking_should_match_rebuilding() {
+    unsigned long long st = 99;
+    hashchop_fp leaves[3000];
+    for (size_t i = 0; i < 3000; i++) leaves[i] = next_fp(&st);
+    hashchop_fp root = 0;
+    hashchop_merkle *m = build(2, leaves, 1, &root);
+
+    /* Grow from a single leaf, then shrink back down. */
+    ASSERT_EQ(HASHCHOP_OK, hashchop_merkle_update(m, 1, 0, leaves + 1,
+            2999, &root, NULL));
+    ASSERT_EQ(reference_root(2, leaves, 3000), root);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_merkle_update(m, 10, 2990, NULL, 0,
+            &root, NULL));
+    ASSERT_EQ(reference_root(2, leaves, 10), root);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_merkle_update(m, 0, 9, NULL, 0,
+            &root, NULL));
+    ASSERT_EQ(leaves[9], root);
+    ASSERT_EQ(1, hashchop_merkle_levels(m));
+    ASSERT_EQ(HASHCHOP_ERROR_UNDERFLOW, hashchop_merkle_update(m, 0, 1,
+            NULL, 0, &root, NULL));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_merkle_update(m, 0, 0, leaves, 5,
+            &root, NULL));
+    ASSERT_EQ(reference_root(2, leaves, 5), root);
+    hashchop_merkle_free(m);
+    PASS();
+}
+
+#define SZ (4 * 1024 * 1024)
+#define BITS 12
+
+static size_t seams(hashchop *hc, const UC *data, size_t sz, size_t *cuts) {
+    size_t pos = 0, n = 0;
+    while (pos < sz) {
+        pos += hashchop_seam(hc, data + pos, sz - pos);
+        cuts[n++] = pos;
+    }
+    return n;
+}
+
+static void leaves_of(const UC *data, const size_t *cuts, size_t n,
+                      hashchop_fp *leaves) {
+    for (size_t i = 0; i < n; i++) {
+        size_t start = (i == 0 ? 0 : cuts[i - 1]);
+        leaves[i] = hashchop_fingerprint(data + start, cuts[i] - start);
+    }
+}
+
+TEST rechunked_edit_should_update_few_nodes() {
+    hashchop *hc = hashchop_new(BITS);
+    UC *data = malloc(SZ);
+    size_t *old_cuts = malloc(SZ / 256 * sizeof(size_t));
+    size_t *new_cuts = malloc(SZ / 256 * sizeof(size_t));
+    hashchop_fp *old_leaves = malloc(SZ / 256 * sizeof(hashchop_fp));
+    hashchop_fp *new_leaves = malloc(SZ / 256 * sizeof(hashchop_fp));
+    assert(hc && data && old_cuts && new_cuts && old_leaves && new_leaves);
+    mkrandom(3, data, SZ);
+
+    size_t old_count = seams(hc, data, SZ, old_cuts);
+    leaves_of(data, old_cuts, old_count, old_leaves);
+    hashchop_fp root = 0, old_root = 0;
+    hashchop_merkle *m = build(4, old_leaves, old_count, &old_root);
+
+    hashchop_edit e = { SZ / 2, 4096, 4096 };
+    mkrandom(4, data + e.offset, e.new_length);
+    size_t new_count = SZ / 256;
+    ASSERT_EQ(HASHCHOP_OK, hashchop_rechunk(hc, data, SZ, old_cuts,
+            old_count, &e, 1, new_cuts, &new_count, NULL));
+    leaves_of(data, new_cuts, new_count, new_leaves);
+
+    /* Find the changed run of leaves. */
+    size_t first = 0, old_end = old_count, new_end = new_count;
+    while (first < old_count && first < new_count
+        && old_cuts[first] == new_cuts[first]
+        && old_leaves[first] == new_leaves[first]) first++;
+    while (old_end > first && new_end > first
+        && old_cuts[old_end - 1] == new_cuts[new_end - 1]
+        && old_leaves[old_end - 1] == new_leaves[new_end - 1]) {
+        old_end--; new_end--;
+    }
+
+    size_t rehashed = 0;
+    ASSERT_EQ(HASHCHOP_OK, hashchop_merkle_update(m, first, old_end - first,
+            new_leaves + first, new_end - first, &root, &rehashed));
+    ASSERT(root != old_root);
+    ASSERT_EQ(reference_root(4, new_leaves, new_count), root);
+    if (GREATEST_IS_VERBOSE()) {
+        printf("%zu leaves changed, %zu nodes re-hashed, %zu levels\n",
+            new_end - first, rehashed, hashchop_merkle_levels(m));
+    }
+    ASSERT(rehashed <= 4 * hashchop_merkle_levels(m));
+
+    hashchop_merkle_free(m);
+    free(data); free(old_cuts); free(new_cuts);
+    free(old_leaves); free(new_leaves);
+    hashchop_free(hc);
+    PASS();
+}
+
+TEST bad_arguments_should_fail() {
+    ASSERT_EQ(NULL, hashchop_merkle_new(0));
+    ASSERT_EQ(NULL, hashchop_merkle_new(HASHCHOP_MERKLE_MAX_BITS + 1));
+
+    hashchop_merkle *m = hashchop_merkle_new(4);
+    hashchop_fp root = 0;
+    ASSERT_EQ(HASHCHOP_ERROR_UNDERFLOW, hashchop_merkle_finish(m, &root));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_merkle_add_chunk(m, (const UC *)"abc", 3));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_merkle_finish(m, &root));
+    ASSERT_EQ(hashchop_fingerprint((const UC *)"abc", 3), root);
+    ASSERT_EQ(HASHCHOP_ERROR_FULL, hashchop_merkle_add(m, 1));
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_merkle_update(m, 1, 1,
+            NULL, 0, &root, NULL));
+    ASSERT_EQ(0, hashchop_merkle_node(m, 5, 0, NULL));
+    hashchop_merkle_free(m);
+    PASS();
+}
+
+SUITE(merkle_suite) {
+    for (uint8_t bits = 1; bits <= 6; bits++) {
+        RUN_TESTp(streamed_tree_should_match_definition, bits);
+    }
+    RUN_TESTp(updates_should_match_rebuilding, 1);
+    RUN_TESTp(updates_should_match_rebuilding, 2);
+    RUN_TESTp(updates_should_match_rebuilding, 4);
+    RUN_TEST(growing_and_shrinking_should_match_rebuilding);
+    RUN_TEST(rechunked_edit_should_update_few_nodes);
+    RUN_TEST(bad_arguments_should_fail);
+}
@@ -0,0 +1,236 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hashchop.h"
+#include "hashchop_pack.h"
+#include "greatest.h"
+#include "test.h"
+
+typedef unsigned char UC;
+
+static char pack_path[64];
+static char idx_path[80];
+static char filter_path[80];
+static char *paths[] = { pack_path, idx_path, filter_path, NULL };
+
+/* Copy the file at FROM to TO. */
+static int copy_file(const char *from, const char *to) {
+    UC buf[4096];
+    size_t rd = 0;
+    FILE *in = fopen(from, "rb"), *out = fopen(to, "wb");
+    if (in == NULL || out == NULL) return 0;
+    while ((rd = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, rd, out) != rd) return 0;
+    }
+    fclose(in);
+    return 0 == fclose(out);
+}
+
+/* Put COUNT generated chunks in P, writing their IDs into IDS. */
+static int put_chunks(hashchop_pack *p, int first, int count, uint64_t *ids) {
+    UC buf[100];
+    for (int i = first; i < first + count; i++) {
+        mkrandom(i, buf, sizeof(buf));
+        if (HASHCHOP_OK != hashchop_pack_put(p, buf, 20 + i % 80, &ids[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Check that chunks [FIRST, FIRST+COUNT) can be found and read back. */
+static int check_chunks(hashchop_pack *p, int first, int count,
+                        const uint64_t *ids) {
+    UC buf[100], out[100];
+    for (int i = first; i < first + count; i++) {
+        uint64_t id = 0;
+        size_t len = sizeof(out);
+        mkrandom(i, buf, sizeof(buf));
+        if (!hashchop_pack_lookup(p, hashchop_fingerprint(buf, 20 + i % 80),
+                &id)) return 0;
+        if (ids && id != ids[i]) return 0;
+        if (HASHCHOP_OK != hashchop_pack_read(p, id, out, &len)) return 0;
+        if (len != 20 + i % 80 || 0 != memcmp(buf, out, len)) return 0;
+    }
+    return 1;
+}
+
+TEST chunks_put_in_a_pack_should_be_found_after_reopening() {
+    static uint64_t ids[2000];
+    hashchop_pack *p = hashchop_pack_open(pack_path, 0);
+    ASSERT(p);
+    ASSERT(put_chunks(p, 0, 1000, ids));
+    ASSERT(check_chunks(p, 0, 1000, ids));
+
+    /* duplicates are not appended again */
+    uint64_t dup_ids[1000];
+    ASSERT(put_chunks(p, 0, 1000, dup_ids));
+    ASSERT_EQ(0, memcmp(ids, dup_ids, sizeof(dup_ids)));
+    ASSERT_EQ(1000, hashchop_pack_count(p));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_close(p));
+
+    p = hashchop_pack_open(pack_path, 0);
+    ASSERT(p);
+    ASSERT_EQ(1000, hashchop_pack_count(p));
+    ASSERT(check_chunks(p, 0, 1000, ids));
+    ASSERT(put_chunks(p, 1000, 1000, ids));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_close(p));
+
+    p = hashchop_pack_open(pack_path, 0);
+    ASSERT(p);
+    ASSERT_EQ(2000, hashchop_pack_count(p));
+    ASSERT(check_chunks(p, 0, 2000, ids));
+
+    UC buf[100];
+    uint64_t id = 0;
+    mkrandom(2000, buf, sizeof(buf));
+    ASSERT_FALSE(hashchop_pack_lookup(p, hashchop_fingerprint(buf, 20), &id));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_close(p));
+    PASS();
+}
+
+TEST a_pack_should_recover_unindexed_chunks_and_drop_a_torn_tail() {
+    static uint64_t ids[600];
+    hashchop_pack *p = hashchop_pack_open(pack_path, 0);
+    ASSERT(p);
+    char saved_idx[96];
+    snprintf(saved_idx, sizeof(saved_idx), "%s.saved", idx_path);
+    ASSERT(put_chunks(p, 0, 500, ids));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_sync(p));
+    ASSERT(copy_file(idx_path, saved_idx));
+    ASSERT(put_chunks(p, 500, 100, ids));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_close(p));
+
+    /* Simulate a crash: put back the index from before the last 100
+     * chunks, then tear the last record. */
+    ASSERT_EQ(0, rename(saved_idx, idx_path));
+    struct stat st;
+    ASSERT_EQ(0, stat(pack_path, &st));
+    ASSERT_EQ(0, truncate(pack_path, st.st_size - 10));
+
+    p = hashchop_pack_open(pack_path, 0);
+    ASSERT(p);
+    ASSERT_EQ(599, hashchop_pack_count(p));
+    ASSERT(check_chunks(p, 0, 599, ids));
+
+    /* the torn chunk can be appended again */
+    ASSERT(put_chunks(p, 599, 1, ids));
+    ASSERT(check_chunks(p, 0, 600, ids));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_close(p));
+    PASS();
+}
+
+TEST a_pack_should_rebuild_a_missing_index() {
+    static uint64_t ids[300];
+    hashchop_pack *p = hashchop_pack_open(pack_path, 0);
+    ASSERT(p);
+    ASSERT(put_chunks(p, 0, 300, ids));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_close(p));
+    ASSERT_EQ(0, unlink(idx_path));
+
+    p = hashchop_pack_open(pack_path, 0);
+    ASSERT(p);
+    ASSERT_EQ(300, hashchop_pack_count(p));
+    ASSERT(check_chunks(p, 0, 300, ids));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_close(p));
+    PASS();
+}
+
+TEST chunks_should_survive_many_syncs_as_the_index_grows() {
+    static uint64_t ids[150000];
+    remove_paths(paths);
+    hashchop_pack *p = hashchop_pack_open(pack_path, 0);
+    ASSERT(p);
+    /* Past the 64K pending entries, and several doublings of the index. */
+    for (int i = 0; i < 150000; i += 10000) {
+        ASSERT(put_chunks(p, i, 10000, ids));
+        ASSERT_EQ(HASHCHOP_OK, hashchop_pack_sync(p));
+    }
+    ASSERT(check_chunks(p, 0, 150000, ids));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_close(p));
+
+    p = hashchop_pack_open(pack_path, 0);
+    ASSERT(p);
+    ASSERT_EQ(150000, hashchop_pack_count(p));
+    ASSERT(check_chunks(p, 0, 150000, ids));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_close(p));
+    PASS();
+}
+
+TEST a_pack_should_rebuild_an_index_left_mid_update() {
+    static uint64_t ids[100000];
+    remove_paths(paths);
+    hashchop_pack *p = hashchop_pack_open(pack_path, 0);
+    ASSERT(p);
+    char saved_idx[96];
+    snprintf(saved_idx, sizeof(saved_idx), "%s.saved", idx_path);
+    ASSERT(put_chunks(p, 0, 20000, ids));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_sync(p));
+    /* Enough new chunks to move some into the index before a sync. */
+    ASSERT(put_chunks(p, 20000, 80000, ids));
+    ASSERT(copy_file(idx_path, saved_idx));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_close(p));
+
+    /* Simulate a crash before the sync: put back the index as it was. */
+    ASSERT_EQ(0, rename(saved_idx, idx_path));
+    p = hashchop_pack_open(pack_path, 0);
+    ASSERT(p);
+    ASSERT_EQ(100000, hashchop_pack_count(p));
+    ASSERT(check_chunks(p, 0, 100000, ids));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_close(p));
+    PASS();
+}
+
+TEST chunks_polled_into_a_pack_should_read_back_as_the_stream() {
+    hashchop *hc = hashchop_new(10);
+    hashchop_pack *p = hashchop_pack_open(pack_path, 0);
+    ASSERT(hc); ASSERT(p);
+    size_t sz = 512 * 100;
+    UC *data = malloc(sz), *out = malloc(sz);
+    uint64_t ids[sz / 256];
+    size_t n = 0;
+    mkrandom(3, data, sz);
+
+    for (size_t i = 0; i < sz; i += 512) {
+        while (HASHCHOP_OK == hashchop_pack_poll(p, hc, &ids[n])) n++;
+        ASSERT_EQ(HASHCHOP_OK, hashchop_sink(hc, data + i, 512));
+    }
+    while (HASHCHOP_OK == hashchop_pack_poll(p, hc, &ids[n])) n++;
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_finish(p, hc, &ids[n]));
+    n++;
+
+    size_t used = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t len = sz - used;
+        ASSERT_EQ(HASHCHOP_OK, hashchop_pack_read(p, ids[i], out + used, &len));
+        used += len;
+    }
+    ASSERT_EQ(sz, used);
+    ASSERT_EQ(0, memcmp(data, out, sz));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_pack_close(p));
+    free(data); free(out);
+    hashchop_free(hc);
+    PASS();
+}
+
+SUITE(pack_suite) {
+    tmp_path(pack_path, sizeof(pack_path), "pack");
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", pack_path);
+    snprintf(filter_path, sizeof(filter_path), "%s.filter", pack_path);
+    remove_paths(paths);
+    SET_SUITE_TEARDOWN(remove_paths, paths);
+
+    RUN_TEST(chunks_put_in_a_pack_should_be_found_after_reopening);
+    RUN_TEST(a_pack_should_recover_unindexed_chunks_and_drop_a_torn_tail);
+    RUN_TEST(a_pack_should_rebuild_a_missing_index);
+    RUN_TEST(chunks_should_survive_many_syncs_as_the_index_grows);
+    RUN_TEST(a_pack_should_rebuild_an_index_left_mid_update);
+    RUN_TEST(chunks_polled_into_a_pack_should_read_back_as_the_stream);
+}
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "hashchop.h"
+#include "hashchop_rechunk.h"
+#include "greatest.h"
+#include "test.h"
+
+typedef unsigned char UC;
+
+#define BITS 12
+#define SZ (4 * 1024 * 1024)
+#define MAX_CUTS (SZ / 256)
+
+/* Fill BUF with JSON-like lines. The checksum's low bits vary little over
+ * such regular text, so nearly all seams are forced by the max size. */
+static void fill_text(unsigned int seed, UC *buf, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        char line[64];
+        seed = 1103515245 * seed + 12345;
+        int n = snprintf(line, sizeof(line), "{\"id\": %u, \"v\": %u}\n",
+            seed >> 8, (seed >> 4) % 1000);
+        for (int j = 0; j < n && i < len; j++) buf[i++] = line[j];
+    }
+}
+
+/* Chop DATA by sinking and polling, and write the chunk end offsets
+ * into CUTS. Returns the number of chunks. */
+static size_t chop(hashchop *hc, const UC *data, size_t sz, size_t *cuts) {
+    static UC out[1 << (BITS + 3)];
+    size_t n = 0, pos = 0, rem = 0;
+    for (size_t i = 0; i < sz; i += 1000) {
+        size_t len = (sz - i < 1000 ? sz - i : 1000);
+        rem = sizeof(out);
+        while (hashchop_poll(hc, out, &rem) == HASHCHOP_OK) {
+            pos += rem;
+            cuts[n++] = pos;
+            rem = sizeof(out);
+        }
+        assert(HASHCHOP_OK == hashchop_sink(hc, data + i, len));
+    }
+    rem = sizeof(out);
+    while (hashchop_poll(hc, out, &rem) == HASHCHOP_OK) {
+        pos += rem;
+        cuts[n++] = pos;
+        rem = sizeof(out);
+    }
+    rem = sizeof(out);
+    assert(HASHCHOP_OK == hashchop_finish(hc, out, &rem));
+    if (rem > 0) { pos += rem; cuts[n++] = pos; }
+    return n;
+}
+
+TEST seams_found_in_place_should_match_polled_chunks() {
+    hashchop *hc = hashchop_new(BITS);
+    ASSERT(hc);
+    UC *data = malloc(SZ);
+    size_t *cuts = malloc(MAX_CUTS * sizeof(size_t));
+    mkrandom(11, data, SZ);
+    size_t n = chop(hc, data, SZ, cuts);
+    size_t pos = 0, i = 0;
+    while (pos < SZ) {
+        pos += hashchop_seam(hc, data + pos, SZ - pos);
+        ASSERT(i < n);
+        ASSERT_EQ(cuts[i], pos);
+        i++;
+    }
+    ASSERT_EQ(n, i);
+    free(data); free(cuts);
+    hashchop_free(hc);
+    PASS();
+}
+
+/* Apply EDITS to OLD, re-chunk the result, and check that it matches
+ * chopping the new data from scratch, and that only about
+ * MAX_SCANNED_PER_EDIT bytes per edit needed re-scanning. If DELIM isn't
+ * HASHCHOP_NO_DELIMITER, the data is lines of text, and seams are
+ * aligned to DELIM. */
+static int check_edits(const hashchop_edit *edits, size_t edit_count,
+                       unsigned int seed, int delim) {
+    hashchop *hc = hashchop_new(BITS);
+    hashchop_set_delimiter(hc, delim);
+    UC *old = malloc(SZ), *new = malloc(2 * SZ);
+    size_t *old_cuts = malloc(MAX_CUTS * sizeof(size_t));
+    size_t *ref_cuts = malloc(2 * MAX_CUTS * sizeof(size_t));
+    size_t *new_cuts = malloc(2 * MAX_CUTS * sizeof(size_t));
+    assert(hc && old && new && old_cuts && ref_cuts && new_cuts);
+    if (delim == HASHCHOP_NO_DELIMITER) {
+        mkrandom(seed, old, SZ);
+    } else {
+        fill_text(seed, old, SZ);
+    }
+
+    size_t old_count = chop(hc, old, SZ, old_cuts);
+    size_t o = 0, n = 0;
+    for (size_t i = 0; i < edit_count; i++) {
+        const hashchop_edit *e = &edits[i];
+        memcpy(new + n, old + o, e->offset - o);
+        n += e->offset - o;
+        mkrandom(seed + i + 1, new + n, e->new_length);
+        n += e->new_length;
+        o = e->offset + e->old_length;
+    }
+    memcpy(new + n, old + o, SZ - o);
+    n += SZ - o;
+
+    size_t ref_count = chop(hc, new, n, ref_cuts);
+    size_t new_count = 2 * MAX_CUTS, scanned = 0;
+    hashchop_res res = hashchop_rechunk(hc, new, n, old_cuts, old_count,
+        edits, edit_count, new_cuts, &new_count, &scanned);
+    int ok = (res == HASHCHOP_OK && new_count == ref_count
+        && 0 == memcmp(ref_cuts, new_cuts, ref_count * sizeof(size_t)));
+    if (GREATEST_IS_VERBOSE()) {
+        printf("%zu edits: %zu chunks, %zu bytes re-scanned\n",
+            edit_count, new_count, scanned);
+    }
+    /* A couple of chunks before and after each edit, plus the edit. */
+    size_t allowed = 0;
+    for (size_t i = 0; i < edit_count; i++) {
+        allowed += 8 * hashchop_max_chunk(hc) + edits[i].new_length;
+    }
+    /* Seams forced by the max size depend on where the chunk started, so
+     * over text (where nearly all are forced) they only fall back in sync
+     * after a while; only check the scanned length for binary data. */
+    if (delim == HASHCHOP_NO_DELIMITER) ok = ok && scanned <= allowed;
+
+    free(old); free(new);
+    free(old_cuts); free(ref_cuts); free(new_cuts);
+    hashchop_free(hc);
+    return ok;
+}
+
+TEST rechunking_should_match_chopping_from_scratch(const char *name,
+        const hashchop_edit *edits, size_t edit_count) {
+    for (unsigned int seed = 0; seed < 3; seed++) {
+        if (!check_edits(edits, edit_count, seed, HASHCHOP_NO_DELIMITER)) {
+            fprintf(stderr, "%s edits, seed %u: mismatch\n", name, seed);
+            FAIL();
+        }
+    }
+    PASS();
+}
+
+TEST rechunking_record_aligned_data_should_match_chopping_from_scratch(
+        const char *name, const hashchop_edit *edits, size_t edit_count) {
+    for (unsigned int seed = 0; seed < 3; seed++) {
+        if (!check_edits(edits, edit_count, seed, '\n')) {
+            fprintf(stderr, "%s edits, seed %u: mismatch\n", name, seed);
+            FAIL();
+        }
+    }
+    PASS();
+}
+
+TEST rechunking_after_an_edit_past_a_moved_seam_should_match() {
+    /* A seam forced by the max size and moved back to a delimiter still
+     * depends on the bytes after it, up to the max: deleting a line just
+     * past it pulls the next delimiter in range. */
+    hashchop *hc = hashchop_new(BITS);
+    UC *data = malloc(SZ);
+    size_t *cuts = malloc(MAX_CUTS * sizeof(size_t));
+    hashchop_set_delimiter(hc, '\n');
+    fill_text(0, data, SZ);
+    size_t n = chop(hc, data, SZ, cuts);
+    ASSERT(n > 20);
+    for (size_t i = 10; i < 20; i++) {
+        hashchop_edit e = { cuts[i] + 2, 30, 0 };
+        if (!check_edits(&e, 1, 0, '\n')) {
+            fprintf(stderr, "edit after seam %zu: mismatch\n", i);
+            FAIL();
+        }
+    }
+    free(data); free(cuts);
+    hashchop_free(hc);
+    PASS();
+}
+
+TEST rechunking_with_too_little_room_should_overflow() {
+    hashchop *hc = hashchop_new(BITS);
+    UC *data = malloc(SZ);
+    size_t *cuts = malloc(MAX_CUTS * sizeof(size_t));
+    size_t new_cuts[10];
+    mkrandom(5, data, SZ);
+    size_t n = chop(hc, data, SZ, cuts);
+    hashchop_edit e = { SZ / 2, 10, 10 };
+    size_t count = 10;
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_rechunk(hc, data, SZ,
+            cuts, n, &e, 1, new_cuts, &count, NULL));
+    free(data); free(cuts);
+    hashchop_free(hc);
+    PASS();
+}
+
+static const hashchop_edit write_4k[] = { { SZ / 2, 4096, 4096 } };
+static const hashchop_edit insertion[] = { { SZ / 3, 0, 100000 } };
+static const hashchop_edit deletion[] = { { SZ / 3, 100000, 0 } };
+static const hashchop_edit shift[] = { { 1000, 0, 1 } };
+static const hashchop_edit at_start[] = { { 0, 10, 3 } };
+static const hashchop_edit append[] = { { SZ, 0, 5000 } };
+static const hashchop_edit truncation[] = { { SZ - 20000, 20000, 0 } };
+static const hashchop_edit several[] = {
+    { 1000, 1, 1 }, { 2000, 0, 7 }, { 500000, 300, 0 },
+    { 2000000, 4096, 4096 }, { SZ - 10, 10, 100 },
+};
+
+SUITE(rechunk_suite) {
+#define RUN_EDITS(E) RUN_TESTp(rechunking_should_match_chopping_from_scratch, \
+        #E, E, sizeof(E) / sizeof(E[0]))
+    RUN_TEST(seams_found_in_place_should_match_polled_chunks);
+    RUN_EDITS(write_4k);
+    RUN_EDITS(insertion);
+    RUN_EDITS(deletion);
+    RUN_EDITS(shift);
+    RUN_EDITS(at_start);
+    RUN_EDITS(append);
+    RUN_EDITS(truncation);
+    RUN_EDITS(several);
+    RUN_TESTp(rechunking_record_aligned_data_should_match_chopping_from_scratch,
+        "several", several, sizeof(several) / sizeof(several[0]));
+    RUN_TESTp(rechunking_record_aligned_data_should_match_chopping_from_scratch,
+        "insertion", insertion, 1);
+    RUN_TEST(rechunking_after_an_edit_past_a_moved_seam_should_match);
+    RUN_TEST(rechunking_with_too_little_room_should_overflow);
+#undef RUN_EDITS
+}
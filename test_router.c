@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hashchop.h"
+#include "hashchop_router.h"
+#include "greatest.h"
+#include "test.h"
+
+#define COUNT 100000
+
+TEST jump_hash_should_only_move_keys_to_a_new_shard() {
+    for (uint32_t shards = 1; shards < 40; shards++) {
+        size_t moved = 0;
+        for (uint64_t i = 0; i < COUNT; i++) {
+            uint32_t a = hashchop_jump_hash(fp_of(i), shards);
+            uint32_t b = hashchop_jump_hash(fp_of(i), shards + 1);
+            ASSERT(a < shards);
+            if (a != b) {
+                ASSERT_EQ(shards, b);
+                moved++;
+            }
+        }
+        /* About 1 / (shards + 1) of them. */
+        double expect = COUNT / (double)(shards + 1);
+        if (moved < 0.9 * expect || moved > 1.1 * expect) {
+            fprintf(stderr, "%u -> %u shards: moved %zu, expected %.0f\n",
+                shards, shards + 1, moved, expect);
+            FAIL();
+        }
+    }
+    PASS();
+}
+
+TEST a_batch_should_be_grouped_by_shard_in_order() {
+    hashchop_fp *fps = malloc(COUNT * sizeof(*fps));
+    size_t *lens = malloc(COUNT * sizeof(size_t));
+    char *seen = calloc(COUNT, 1);
+    for (size_t i = 0; i < COUNT; i++) {
+        fps[i] = fp_of(i);
+        lens[i] = 1000 + i % 7;
+    }
+    hashchop_router *r = hashchop_router_new(7);
+    ASSERT(r);
+    ASSERT_EQ(7, hashchop_router_shards(r));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_router_route(r, fps, lens, COUNT));
+
+    size_t total = 0;
+    for (uint32_t s = 0; s < 7; s++) {
+        const size_t *idx = NULL;
+        size_t n = hashchop_router_batch(r, s, &idx);
+        for (size_t j = 0; j < n; j++) {
+            ASSERT(idx[j] < COUNT && !seen[idx[j]]);
+            ASSERT(j == 0 || idx[j - 1] < idx[j]);
+            ASSERT_EQ(s, hashchop_jump_hash(fps[idx[j]], 7));
+            seen[idx[j]] = 1;
+        }
+        hashchop_router_stats st;
+        hashchop_router_get_stats(r, s, &st);
+        ASSERT_EQ(n, st.chunks);
+        total += n;
+    }
+    ASSERT_EQ(COUNT, total);
+    ASSERT(hashchop_router_imbalance(r) < 1.03);
+
+    /* A smaller batch replaces it; the totals keep adding up. */
+    ASSERT_EQ(HASHCHOP_OK, hashchop_router_route(r, fps, NULL, 10));
+    total = 0;
+    for (uint32_t s = 0; s < 7; s++) {
+        const size_t *idx = NULL;
+        total += hashchop_router_batch(r, s, &idx);
+    }
+    ASSERT_EQ(10, total);
+    uint64_t chunks = 0;
+    for (uint32_t s = 0; s < 7; s++) {
+        hashchop_router_stats st;
+        hashchop_router_get_stats(r, s, &st);
+        chunks += st.chunks;
+    }
+    ASSERT_EQ(COUNT + 10, chunks);
+
+    hashchop_router_free(r);
+    free(fps); free(lens); free(seen);
+    PASS();
+}
+
+TEST routers_should_start_empty() {
+    ASSERT_EQ(NULL, hashchop_router_new(0));
+    hashchop_router *r = hashchop_router_new(1);
+    ASSERT_EQ(0, hashchop_router_imbalance(r));
+    const size_t *idx = NULL;
+    ASSERT_EQ(0, hashchop_router_batch(r, 0, &idx));
+    hashchop_fp fp = fp_of(1);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_router_route(r, &fp, NULL, 1));
+    ASSERT_EQ(1, hashchop_router_batch(r, 0, &idx));
+    ASSERT_EQ(0, idx[0]);
+    ASSERT_EQ(1.0, hashchop_router_imbalance(r));
+    hashchop_router_free(r);
+    PASS();
+}
+
+SUITE(router_suite) {
+    RUN_TEST(jump_hash_should_only_move_keys_to_a_new_shard);
+    RUN_TEST(a_batch_should_be_grouped_by_shard_in_order);
+    RUN_TEST(routers_should_start_empty);
+}
@@ -0,0 +1,190 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "hashchop.h"
+#include "hashchop_similar.h"
+#include "greatest.h"
+#include "test.h"
+
+typedef unsigned char UC;
+
+#define CHUNK_SZ 8192
+
+/* Change COUNT bytes of BUF at pseudo-random offsets. */
+static void scribble(unsigned int seed, UC *buf, size_t len, int count) {
+    for (int i = 0; i < count; i++) {
+        seed = 1103515245 * seed + 12345;
+        buf[(seed >> 8) % len] ^= 0xff;
+    }
+}
+
+static int shared_sf(const hashchop_sketch *a, const hashchop_sketch *b) {
+    int ct = 0;
+    for (int s = 0; s < HASHCHOP_SKETCH_SF; s++) {
+        ct += (a->sf[s] != 0 && a->sf[s] == b->sf[s]);
+    }
+    return ct;
+}
+
+TEST similar_chunks_should_share_super_features() {
+    UC a[CHUNK_SZ], b[CHUNK_SZ];
+    int similar = 0, unrelated = 0;
+    for (unsigned int seed = 1; seed <= 100; seed++) {
+        hashchop_sketch sa, sb;
+        mkrandom(seed, a, sizeof(a));
+        memcpy(b, a, sizeof(a));
+        scribble(seed, b, sizeof(b), 4);
+        hashchop_sketch_chunk(a, sizeof(a), &sa);
+        hashchop_sketch_chunk(b, sizeof(b), &sb);
+        similar += (shared_sf(&sa, &sb) > 0);
+
+        for (size_t i = 0; i < sizeof(b); i++) b[i] = a[i] ^ 0x5a;
+        hashchop_sketch_chunk(b, sizeof(b), &sb);
+        unrelated += (shared_sf(&sa, &sb) > 0);
+    }
+    if (GREATEST_IS_VERBOSE()) {
+        printf("similar: %d/100 share a super-feature, unrelated: %d/100\n",
+            similar, unrelated);
+    }
+    ASSERT(similar >= 90);
+    ASSERT_EQ(0, unrelated);
+    PASS();
+}
+
+TEST tiny_chunks_should_have_empty_sketches() {
+    UC buf[2] = { 0, 0 };
+    hashchop_sketch sk;
+    hashchop_sketch_chunk(buf, 0, &sk);
+    for (int s = 0; s < HASHCHOP_SKETCH_SF; s++) ASSERT_EQ(0, sk.sf[s]);
+
+    hashchop_simindex *x = hashchop_simindex_new(0);
+    uint32_t id = 0;
+    ASSERT_EQ(HASHCHOP_OK, hashchop_simindex_add(x, &sk, 0));
+    ASSERT_EQ(0, hashchop_simindex_find(x, &sk, &id));
+    hashchop_simindex_free(x);
+    PASS();
+}
+
+TEST index_should_find_most_similar_chunk() {
+    hashchop_simindex *x = hashchop_simindex_new(0);
+    UC buf[CHUNK_SZ];
+    /* Enough chunks to grow the tables a few times. */
+    for (unsigned int i = 0; i < 3000; i++) {
+        hashchop_sketch sk;
+        mkrandom(i, buf, 1024);
+        buf[0] = i; buf[1] = i >> 8;
+        hashchop_sketch_chunk(buf, 1024, &sk);
+        ASSERT_EQ(HASHCHOP_OK, hashchop_simindex_add(x, &sk, i));
+    }
+    ASSERT_EQ(3000, hashchop_simindex_count(x));
+
+    int found = 0;
+    for (unsigned int i = 0; i < 3000; i += 7) {
+        hashchop_sketch sk;
+        uint32_t id = 0;
+        mkrandom(i, buf, 1024);
+        buf[0] = i; buf[1] = i >> 8;
+        scribble(i, buf + 64, 1024 - 64, 1);
+        hashchop_sketch_chunk(buf, 1024, &sk);
+        if (hashchop_simindex_find(x, &sk, &id) > 0 && id == i) found++;
+    }
+    ASSERT(found >= 9 * (3000 / 7) / 10);
+    hashchop_simindex_free(x);
+    PASS();
+}
+
+/* Encode TARGET against BASE, check that it decodes, and return the
+ * delta size (or 0 on failure). */
+static size_t round_trip(const UC *base, size_t base_len,
+                         const UC *target, size_t target_len) {
+    size_t bound = hashchop_xdelta_bound(target_len), len = bound;
+    UC *delta = malloc(bound), *out = malloc(target_len + 1);
+    size_t out_len = target_len, res = 0;
+    if (HASHCHOP_OK == hashchop_xdelta_encode(base, base_len, target,
+            target_len, delta, &len)
+        && len <= bound
+        && HASHCHOP_OK == hashchop_xdelta_decode(base, base_len, delta, len,
+            out, &out_len)
+        && out_len == target_len && 0 == memcmp(out, target, target_len)) {
+        res = len;
+    }
+    free(delta); free(out);
+    return res;
+}
+
+TEST xdelta_of_small_edits_should_be_small() {
+    UC base[CHUNK_SZ], target[CHUNK_SZ + 100];
+    mkrandom(9, base, sizeof(base));
+
+    memcpy(target, base, sizeof(base));
+    scribble(9, target, CHUNK_SZ, 4);
+    size_t sz = round_trip(base, sizeof(base), target, CHUNK_SZ);
+    ASSERT(sz > 0 && sz < 100);
+
+    /* Insert 100 bytes in the middle. */
+    memcpy(target, base, 4000);
+    mkrandom(10, target + 4000, 100);
+    memcpy(target + 4100, base + 4000, CHUNK_SZ - 4000);
+    sz = round_trip(base, sizeof(base), target, sizeof(target));
+    ASSERT(sz > 100 && sz < 130);
+
+    /* Delete 1000 bytes. */
+    memcpy(target, base, 3000);
+    memcpy(target + 3000, base + 4000, CHUNK_SZ - 4000);
+    sz = round_trip(base, sizeof(base), target, CHUNK_SZ - 1000);
+    ASSERT(sz > 0 && sz < 20);
+    PASS();
+}
+
+TEST xdelta_should_handle_unrelated_and_empty_data() {
+    UC base[CHUNK_SZ], target[CHUNK_SZ];
+    mkrandom(11, base, sizeof(base));
+    for (size_t i = 0; i < sizeof(base); i++) target[i] = base[i] ^ 0x5a;
+    size_t sz = round_trip(base, sizeof(base), target, sizeof(target));
+    ASSERT(sz > CHUNK_SZ);
+    ASSERT(sz <= hashchop_xdelta_bound(CHUNK_SZ));
+    ASSERT(round_trip(base, 0, target, sizeof(target)) > 0);
+    ASSERT(round_trip(base, sizeof(base), target, 0) > 0);
+    ASSERT(round_trip(base, sizeof(base), target, 5) > 0);
+    PASS();
+}
+
+TEST bad_xdeltas_should_be_rejected() {
+    UC base[CHUNK_SZ], target[CHUNK_SZ], delta[CHUNK_SZ + 100];
+    UC out[CHUNK_SZ];
+    mkrandom(12, base, sizeof(base));
+    memcpy(target, base, sizeof(base));
+    scribble(12, target, CHUNK_SZ, 3);
+
+    size_t len = 10;
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_xdelta_encode(base,
+            sizeof(base), target, sizeof(target), delta, &len));
+    len = sizeof(delta);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_xdelta_encode(base, sizeof(base),
+            target, sizeof(target), delta, &len));
+
+    size_t out_len = CHUNK_SZ - 1;
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_xdelta_decode(base,
+            sizeof(base), delta, len, out, &out_len));
+    out_len = CHUNK_SZ;         /* truncated */
+    ASSERT_EQ(HASHCHOP_ERROR_FORMAT, hashchop_xdelta_decode(base,
+            sizeof(base), delta, len - 1, out, &out_len));
+    out_len = CHUNK_SZ;         /* short base */
+    ASSERT_EQ(HASHCHOP_ERROR_FORMAT, hashchop_xdelta_decode(base,
+            100, delta, len, out, &out_len));
+    out_len = CHUNK_SZ;
+    ASSERT_EQ(HASHCHOP_ERROR_FORMAT, hashchop_xdelta_decode(base,
+            sizeof(base), delta, 0, out, &out_len));
+    PASS();
+}
+
+SUITE(similar_suite) {
+    RUN_TEST(similar_chunks_should_share_super_features);
+    RUN_TEST(tiny_chunks_should_have_empty_sketches);
+    RUN_TEST(index_should_find_most_similar_chunk);
+    RUN_TEST(xdelta_of_small_edits_should_be_small);
+    RUN_TEST(xdelta_should_handle_unrelated_and_empty_data);
+    RUN_TEST(bad_xdeltas_should_be_rejected);
+}
@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "hashchop.h"
+#include "hashchop_store.h"
+#include "greatest.h"
+#include "test.h"
+
+typedef unsigned char UC;
+
+TEST putting_the_same_chunk_twice_should_return_the_same_id() {
+    hashchop_store *s = hashchop_store_new(0);
+    ASSERT(s);
+    UC a[100], b[100];
+    mkrandom(1, a, sizeof(a));
+    mkrandom(2, b, sizeof(b));
+    hashchop_id ida = 0, idb = 0, ida2 = 0;
+    ASSERT_EQ(HASHCHOP_OK, hashchop_store_put(s, a, sizeof(a), &ida));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_store_put(s, b, sizeof(b), &idb));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_store_put(s, a, sizeof(a), &ida2));
+    ASSERT_EQ(ida, ida2);
+    ASSERT(ida != idb);
+    ASSERT_EQ(2, hashchop_store_count(s));
+
+    size_t len = 0;
+    const UC *got = hashchop_store_get(s, idb, &len);
+    ASSERT(got);
+    ASSERT_EQ(sizeof(b), len);
+    ASSERT_EQ(0, memcmp(got, b, len));
+    ASSERT_EQ(NULL, hashchop_store_get(s, 2, &len));
+
+    hashchop_store_stats st;
+    hashchop_store_get_stats(s, &st);
+    ASSERT_EQ(3, st.chunks_in);
+    ASSERT_EQ(300, st.bytes_in);
+    ASSERT_EQ(2, st.chunks_stored);
+    ASSERT_EQ(200, st.bytes_stored);
+    hashchop_store_free(s);
+    PASS();
+}
+
+TEST chunks_too_long_for_32_bits_should_be_rejected() {
+    if (SIZE_MAX <= UINT32_MAX) SKIP();
+    hashchop_store *s = hashchop_store_new(0);
+    ASSERT(s);
+    UC a[100];
+    mkrandom(1, a, sizeof(a));
+    hashchop_id id = 0;
+    size_t huge = (size_t)UINT32_MAX + sizeof(a);
+    /* The length is checked before any data is read. */
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_store_put(s, a, huge, &id));
+    ASSERT_EQ(0, hashchop_store_find(s, a, huge, &id));
+    ASSERT_EQ(0, hashchop_store_count(s));
+
+    hashchop_store_stats st;
+    hashchop_store_get_stats(s, &st);
+    ASSERT_EQ(0, st.chunks_in);
+    ASSERT_EQ(0, st.bytes_in);
+    hashchop_store_free(s);
+    PASS();
+}
+
+TEST the_store_should_grow_and_keep_every_chunk() {
+    hashchop_store *s = hashchop_store_new(0);
+    ASSERT(s);
+    const int count = 20000;
+    UC buf[64];
+    for (int i = 0; i < count; i++) {
+        hashchop_id id = 0;
+        mkrandom(i, buf, sizeof(buf));
+        ASSERT_EQ(HASHCHOP_OK, hashchop_store_put(s, buf, 16 + i % 48, &id));
+        ASSERT_EQ(i, id);
+    }
+    for (int i = 0; i < count; i++) {
+        hashchop_id id = 0;
+        size_t len = 0;
+        mkrandom(i, buf, sizeof(buf));
+        ASSERT(hashchop_store_find(s, buf, 16 + i % 48, &id));
+        ASSERT_EQ(i, id);
+        const UC *got = hashchop_store_get(s, id, &len);
+        ASSERT_EQ(16 + i % 48, len);
+        ASSERT_EQ(0, memcmp(got, buf, len));
+    }
+    mkrandom(count, buf, sizeof(buf));
+    hashchop_id id = 0;
+    ASSERT_FALSE(hashchop_store_find(s, buf, sizeof(buf), &id));
+    hashchop_store_free(s);
+    PASS();
+}
+
+/* Chop DATA through HC into S, and return the number of chunks. */
+static size_t chop_into_store(hashchop_store *s, hashchop *hc,
+                              const UC *data, size_t sz, hashchop_id *ids) {
+    size_t n = 0;
+    for (size_t i = 0; i < sz; i += 512) {
+        while (hashchop_store_poll(s, hc, &ids[n]) == HASHCHOP_OK) n++;
+        assert(HASHCHOP_OK == hashchop_sink(hc, data + i, 512));
+    }
+    while (hashchop_store_poll(s, hc, &ids[n]) == HASHCHOP_OK) n++;
+    if (hashchop_store_finish(s, hc, &ids[n]) == HASHCHOP_OK) n++;
+    return n;
+}
+
+TEST storing_the_same_stream_twice_should_dedup_it() {
+    hashchop *hc = hashchop_new(10);
+    hashchop_store *s = hashchop_store_new(0);
+    ASSERT(hc); ASSERT(s);
+    size_t sz = 512 * 200;
+    UC *data = malloc(sz);
+    hashchop_id ids1[sz / 256], ids2[sz / 256];
+    mkrandom(7, data, sz);
+
+    size_t n1 = chop_into_store(s, hc, data, sz, ids1);
+    size_t n2 = chop_into_store(s, hc, data, sz, ids2);
+    ASSERT(n1 > 1);
+    ASSERT_EQ(n1, n2);
+    for (size_t i = 0; i < n1; i++) ASSERT_EQ(ids1[i], ids2[i]);
+
+    /* the chunks should reassemble to the original data */
+    size_t used = 0;
+    for (size_t i = 0; i < n1; i++) {
+        size_t len = 0;
+        const UC *c = hashchop_store_get(s, ids1[i], &len);
+        ASSERT_EQ(0, memcmp(data + used, c, len));
+        used += len;
+    }
+    ASSERT_EQ(sz, used);
+
+    hashchop_store_stats st;
+    hashchop_store_get_stats(s, &st);
+    ASSERT_EQ(2 * sz, st.bytes_in);
+    ASSERT_EQ(sz, st.bytes_stored);
+    free(data);
+    hashchop_store_free(s);
+    hashchop_free(hc);
+    PASS();
+}
+
+SUITE(store_suite) {
+    RUN_TEST(putting_the_same_chunk_twice_should_return_the_same_id);
+    RUN_TEST(chunks_too_long_for_32_bits_should_be_rejected);
+    RUN_TEST(the_store_should_grow_and_keep_every_chunk);
+    RUN_TEST(storing_the_same_stream_twice_should_dedup_it);
+}
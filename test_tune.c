@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "hashchop.h"
+#include "hashchop_tune.h"
+#include "greatest.h"
+#include "test.h"
+
+typedef unsigned char UC;
+
+#define SZ (4 * 1024 * 1024)
+
+/* Write VERSIONS copies of SZ bytes of data into BUF, each changing 16
+ * bytes at a few hundred pseudo-random offsets. */
+static void versions(UC *buf, int versions) {
+    mkrandom(1, buf, SZ);
+    unsigned int seed = 2;
+    for (int v = 1; v < versions; v++) {
+        UC *cur = buf + v * SZ;
+        memcpy(cur, cur - SZ, SZ);
+        for (int i = 0; i < 300; i++) {
+            seed = 1103515245 * seed + 12345;
+            memset(cur + (seed >> 4) % (SZ - 16), v, 16);
+        }
+    }
+}
+
+TEST counts_should_add_up() {
+    UC *buf = malloc(2 * SZ);
+    versions(buf, 2);
+    hashchop_tuner *t = hashchop_tuner_new(10, 4);
+    ASSERT(t);
+    ASSERT_EQ(4, hashchop_tuner_levels(t));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_tuner_add(t, buf, SZ));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_tuner_add(t, buf + SZ, SZ));
+
+    hashchop_tune_level prev;
+    memset(&prev, 0, sizeof(prev));
+    for (uint8_t i = 0; i < 4; i++) {
+        hashchop_tune_level s;
+        ASSERT_EQ(HASHCHOP_OK, hashchop_tuner_level(t, i, &s));
+        if (GREATEST_IS_VERBOSE()) {
+            printf("%u bits: %zu chunks, %zu unique, %.1f%% dup\n",
+                s.bits, s.chunks, s.unique_chunks,
+                100.0 * s.dup_bytes / s.bytes);
+        }
+        ASSERT_EQ(10 + i, s.bits);
+        ASSERT_EQ(2 * SZ, s.bytes);
+        ASSERT(s.unique_chunks <= s.chunks);
+        ASSERT(s.dup_bytes < SZ);
+        if (i > 0) {
+            /* Bigger chunks: fewer of them, and fewer duplicates. */
+            ASSERT(s.chunks < prev.chunks);
+            ASSERT(s.dup_bytes <= prev.dup_bytes);
+        }
+        prev = s;
+    }
+    hashchop_tune_level s;
+    ASSERT_EQ(HASHCHOP_ERROR_OVERFLOW, hashchop_tuner_level(t, 4, &s));
+    hashchop_tuner_free(t);
+    free(buf);
+    PASS();
+}
+
+TEST repeated_samples_should_be_all_duplicates() {
+    UC *buf = malloc(SZ);
+    mkrandom(3, buf, SZ);
+    hashchop_tuner *t = hashchop_tuner_new(12, 3);
+    ASSERT(t);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_tuner_add(t, buf, SZ));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_tuner_add(t, buf, SZ));
+    ASSERT_EQ(HASHCHOP_OK, hashchop_tuner_add(t, buf, 0));
+    for (uint8_t i = 0; i < 3; i++) {
+        hashchop_tune_level s;
+        ASSERT_EQ(HASHCHOP_OK, hashchop_tuner_level(t, i, &s));
+        ASSERT_EQ(SZ, s.dup_bytes);
+        ASSERT_EQ(2 * s.unique_chunks, s.chunks);
+    }
+    hashchop_tuner_free(t);
+    free(buf);
+    PASS();
+}
+
+TEST recommendation_should_follow_index_entry_cost() {
+    UC *buf = malloc(4 * SZ);
+    versions(buf, 4);
+    hashchop_tuner *t = hashchop_tuner_new(8, 8);
+    ASSERT(t);
+    ASSERT_EQ(HASHCHOP_OK, hashchop_tuner_add(t, buf, 4 * SZ));
+
+    /* Free index entries: the most dedup. Costly ones: the fewest. */
+    ASSERT_EQ(8, hashchop_tuner_recommend(t, 0));
+    ASSERT_EQ(15, hashchop_tuner_recommend(t, 1e9));
+    uint8_t bits = hashchop_tuner_recommend(t, 1024);
+    if (GREATEST_IS_VERBOSE()) printf("recommended bits: %u\n", bits);
+    ASSERT(bits > 8 && bits < 15);
+    double best = hashchop_tuner_cost(t, bits - 8, 1024);
+    for (uint8_t i = 0; i < 8; i++) {
+        ASSERT(best <= hashchop_tuner_cost(t, i, 1024));
+    }
+    hashchop_tuner_free(t);
+    free(buf);
+    PASS();
+}
+
+TEST bad_tuner_arguments_should_be_rejected() {
+    ASSERT_EQ(NULL, hashchop_tuner_new(HASHCHOP_MIN_BITS - 1, 2));
+    ASSERT_EQ(NULL, hashchop_tuner_new(HASHCHOP_MAX_BITS - 1, 3));
+    ASSERT_EQ(NULL, hashchop_tuner_new(12, 0));
+    ASSERT_EQ(NULL, hashchop_tuner_new(12, HASHCHOP_MAX_LEVELS + 1));
+    PASS();
+}
+
+SUITE(tune_suite) {
+    RUN_TEST(counts_should_add_up);
+    RUN_TEST(repeated_samples_should_be_all_duplicates);
+    RUN_TEST(recommendation_should_follow_index_entry_cost);
+    RUN_TEST(bad_tuner_arguments_should_be_rejected);
+}